@@ -1,6 +1,10 @@
 #ifndef BUFFERS_INCLUDE_GLSL
 #define BUFFERS_INCLUDE_GLSL
 
+#if !defined( __cplusplus ) && defined( NEKO_DRAW_BUFFER )
+#extension GL_ARB_shader_draw_parameters : require
+#endif
+
 #ifdef __cplusplus
 
 #include "neko_types.h"
@@ -37,6 +41,14 @@ namespace neko::uniforms {
     float d0;
   };
 
+  //! Per-draw values for pipelines built with NEKO_DRAW_BUFFER, replacing the uniforms of the same purpose.
+  struct DrawData {
+    mat4 model;
+    vec2 texDimensions;
+    float posScale;
+    int texLayer;
+  };
+
   NEKO_DECLARE_UNIFORMBLOCK( 0, World )
   {
     float time;
@@ -56,6 +68,18 @@ namespace neko::uniforms {
     mat4 textproj;
   } NEKO_UNIFORM_INSTANCE( processing );
 
+#if !defined( __cplusplus ) && defined( NEKO_DRAW_BUFFER )
+
+  NEKO_DECLARE_UNIFORMBLOCK( 2, Draws )
+  {
+    DrawData items[];
+  } NEKO_UNIFORM_INSTANCE( draws );
+
+  // Each command is issued as a single instance whose base instance is its index into the buffer
+  #define NEKO_DRAW draws.items[gl_BaseInstanceARB]
+
+#endif
+
 #ifdef __cplusplus
 
 #pragma pack( pop )
@@ -11,7 +11,11 @@ layout ( location = 1 ) in vec3 vbo_normal;
 layout ( location = 2 ) in vec2 vbo_texcoord;
 layout ( location = 3 ) in vec4 vbo_color;
 
+#ifdef NEKO_DRAW_BUFFER
+#define model NEKO_DRAW.model
+#else
 uniform mat4 model;
+#endif
 
 out VertexData {
   vec3 normal;
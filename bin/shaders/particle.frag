@@ -14,5 +14,5 @@ uniform sampler2D tex;
 void main()
 {
   vec4 diffuse = texture( tex, interpolateAtSample( vs_out.texcoord, gl_SampleID ) );
-  out_color = diffuse;
+  out_color = vs_out.color * diffuse;
 }
\ No newline at end of file
@@ -9,14 +9,14 @@ out gl_PerVertex {
 
 out VertexData {
   vec4 orientation;
-  vec2 size;
+  vec3 size;
   vec4 color;
   float id;
 } vs_out;
 
 layout ( location = 0 ) in vec3 vbo_position;
 layout ( location = 1 ) in vec4 vbo_orientation;
-layout ( location = 2 ) in vec2 vbo_size;
+layout ( location = 2 ) in vec3 vbo_size;
 layout ( location = 3 ) in vec4 vbo_color;
 
 uniform mat4 model;
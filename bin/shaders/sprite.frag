@@ -7,13 +7,22 @@ in VertexData {
   vec2 texcoord;
   vec3 fragpos;
   vec4 color;
+#ifdef NEKO_DRAW_BUFFER
+  flat int layer;
+  flat vec2 dimensions;
+#endif
 } vs_out;
 
 layout ( location = 0 ) out vec4 out_color;
 
 uniform sampler2DArray tex;
+#ifdef NEKO_DRAW_BUFFER
+#define tex_layer vs_out.layer
+#define tex_dimensions vs_out.dimensions
+#else
 uniform int tex_layer;
 uniform vec2 tex_dimensions;
+#endif
 
 #include "inc.colorutils.glsl"
 
@@ -13,14 +13,23 @@ layout ( location = 3 ) in vec4 vbo_color;
 layout ( location = 4 ) in vec4 vbo_tangent;
 layout ( location = 5 ) in vec3 vbo_bitangent;
 
+#ifdef NEKO_DRAW_BUFFER
+#define model NEKO_DRAW.model
+#define tex_dimensions NEKO_DRAW.texDimensions
+#else
 uniform mat4 model;
 uniform vec2 tex_dimensions;
+#endif
 
 out VertexData {
   vec3 normal;
   vec2 texcoord;
   vec3 fragpos;
   vec4 color;
+#ifdef NEKO_DRAW_BUFFER
+  flat int layer;
+  flat vec2 dimensions;
+#endif
 } vs_out;
 
 void main()
@@ -33,4 +42,8 @@ void main()
   vs_out.texcoord = vbo_texcoord * tex_dimensions;
   vs_out.fragpos = vec3( model * vec4( vbo_position, 1.0 ) );
   vs_out.color = vbo_color;
+#ifdef NEKO_DRAW_BUFFER
+  vs_out.layer = NEKO_DRAW.texLayer;
+  vs_out.dimensions = NEKO_DRAW.texDimensions;
+#endif
 }
\ No newline at end of file
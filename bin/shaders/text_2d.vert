@@ -6,11 +6,12 @@ out gl_PerVertex {
   vec4 gl_Position;
 };
 
-layout ( location = 0 ) in vec3 vbo_position;
+layout ( location = 0 ) in vec2 vbo_position; // Fixed point, scaled by posscale
 layout ( location = 1 ) in vec2 vbo_texcoord;
 layout ( location = 2 ) in vec4 vbo_color;
 
 uniform mat4 model;
+uniform float posscale;
 
 out VertexData {
   vec2 texcoord;
@@ -20,11 +21,12 @@ out VertexData {
 
 void main()
 {
+  vec3 position = vec3( vbo_position * posscale, 0.0 );
   mat4 modelProjection = processing.textproj * model;
 
-  gl_Position = modelProjection * vec4( vbo_position, 1.0 );
+  gl_Position = modelProjection * vec4( position, 1.0 );
 
   vs_out.texcoord = vbo_texcoord;
-  vs_out.fragpos = vec3( model * vec4( vbo_position, 1.0 ) );
+  vs_out.fragpos = vec3( model * vec4( position, 1.0 ) );
   vs_out.color = vbo_color;
 }
\ No newline at end of file
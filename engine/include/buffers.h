@@ -8,6 +8,8 @@
 #include "materials.h"
 #include "shaders.h"
 #include "math_aabb.h"
+#include "rendercommands.h"
+#include "streambuffer.h"
 
 namespace neko {
 
@@ -76,36 +78,28 @@ namespace neko {
     {
       setFrom( verts.size(), verts.data(), idxs.size(), idxs.data() );
     }
-    void begin()
+    void begin( GLStateCache& state )
     {
-      gl::glBindVertexArray( vao_ );
+      state.bindVertexArray( vao_ );
     }
     void draw()
     {
       gl::glDrawElements( gl::GL_TRIANGLES, static_cast<gl::GLsizei>( indices_->size() ), gl::GL_UNSIGNED_INT, nullptr );
-      gl::glBindVertexArray( 0 );
     }
-    void draw( Shaders& shaders, const Material& mat, const mat4& model )
+    void record( RenderCommandList& list, const Material& mat, const mat4& model, Real depth )
     {
-      gl::glBindVertexArray( vao_ );
-      auto ppl = &shaders.usePipeline( "mat_unlit" );
-      const auto hndl = mat.layers_[0].texture_->handle();
-      gl::glBindTextures( 0, 1, &hndl );
-      ppl->setUniform( "tex", 0 );
-      ppl->setUniform( "model", model );
-      gl::glDrawElements( gl::GL_TRIANGLES, static_cast<gl::GLsizei>( indices_->size() ), gl::GL_UNSIGNED_INT, nullptr );
-      gl::glBindVertexArray( 0 );
+      auto& params = list.draw( RenderPass_Opaque, "mat_unlit_batch", vao_, mat.layers_[0].texture_->handle(),
+        static_cast<GLsizei>( indices_->size() ), depth );
+      params.model = model;
     }
     void draw( Shaders& shaders, GLuint texture, const mat4& model )
     {
-      gl::glBindVertexArray( vao_ );
+      shaders.state().bindVertexArray( vao_ );
       auto ppl = &shaders.usePipeline( "mat_unlit" );
-      const auto hndl = texture;
-      gl::glBindTextures( 0, 1, &hndl );
-      ppl->setUniform( "tex", 0 );
-      ppl->setUniform( "model", model );
+      shaders.state().bindTextureUnit( 0, texture );
+      ppl->setUniform( Uniform_Tex, 0 );
+      ppl->setUniform( Uniform_Model, model );
       gl::glDrawElements( gl::GL_TRIANGLES, static_cast<gl::GLsizei>( indices_->size() ), gl::GL_UNSIGNED_INT, nullptr );
-      gl::glBindVertexArray( 0 );
     }
     ~IndexedVertexBufferBase()
     {
@@ -157,27 +151,20 @@ namespace neko {
     {
       setFrom( verts.size(), verts.data(), idxs.size(), idxs.data() );
     }
-    void draw( Shaders& shaders, const Material& mat, const mat4& model )
+    void record( RenderCommandList& list, const Material& mat, const mat4& model, Real depth )
     {
-      gl::glBindVertexArray( vao_ );
-      auto ppl = &shaders.usePipeline( "mat_unlit" );
-      const auto hndl = mat.layers_[0].texture_->handle();
-      gl::glBindTextures( 0, 1, &hndl );
-      ppl->setUniform( "tex", 0 );
-      ppl->setUniform( "model", model );
-      gl::glDrawElements( gl::GL_TRIANGLES, static_cast<gl::GLsizei>( indices_->size() ), gl::GL_UNSIGNED_INT, nullptr );
-      gl::glBindVertexArray( 0 );
+      auto& params = list.draw( RenderPass_Opaque, "mat_unlit_batch", vao_, mat.layers_[0].texture_->handle(),
+        static_cast<GLsizei>( indices_->size() ), depth );
+      params.model = model;
     }
     void draw( Shaders& shaders, GLuint texture, const mat4& model )
     {
-      gl::glBindVertexArray( vao_ );
+      shaders.state().bindVertexArray( vao_ );
       auto ppl = &shaders.usePipeline( "mat_unlit" );
-      const auto hndl = texture;
-      gl::glBindTextures( 0, 1, &hndl );
-      ppl->setUniform( "tex", 0 );
-      ppl->setUniform( "model", model );
+      shaders.state().bindTextureUnit( 0, texture );
+      ppl->setUniform( Uniform_Tex, 0 );
+      ppl->setUniform( Uniform_Model, model );
       gl::glDrawElements( gl::GL_TRIANGLES, static_cast<gl::GLsizei>( indices_->size() ), gl::GL_UNSIGNED_INT, nullptr );
-      gl::glBindVertexArray( 0 );
     }
     ~BasicIndexedVertexbuffer()
     {
@@ -187,63 +174,58 @@ namespace neko {
     }
   };
 
-  class SpriteVertexbuffer {
+  //! Immutable quads of a sprite: one per frame of its atlas animation, or just the one, all sharing the indices of
+  //! the first. A frame is drawn by its base vertex, and nothing is written after creation, so nothing races the GPU.
+  class SpriteVertexbuffer: public nocopy {
   protected:
-    using BufferType = MappedGLBuffer<Vertex3D>;
-    using IndicesType = MappedGLBuffer<gl::GLuint>;
-    unique_ptr<BufferType> buffer_;
-    unique_ptr<IndicesType> indices_;
-    AttribWriter attribs_;
+    GLuint vertices_ = 0;
+    GLuint indices_ = 0;
     GLuint vao_ = 0;
+    GLsizei indexCount_ = 0;
+    GLint frameVertices_ = 0; //!< Vertices per frame
+    int frames_ = 0;
   public:
-    SpriteVertexbuffer( size_t maxVertices, size_t maxIndices )
+    SpriteVertexbuffer( const vector<Vertex3D>& vertices, const vector<GLuint>& frameIndices, size_t frames ):
+      indexCount_( static_cast<GLsizei>( frameIndices.size() ) ),
+      frameVertices_( static_cast<GLint>( vertices.size() / frames ) ), frames_( static_cast<int>( frames ) )
     {
-      buffer_ = make_unique<BufferType>( maxVertices );
-      indices_ = make_unique<IndicesType>( maxIndices );
+      assert( frames > 0 && vertices.size() % frames == 0 );
+      gl::glCreateBuffers( 1, &vertices_ );
+      gl::glNamedBufferStorage( vertices_, vertices.size() * sizeof( Vertex3D ), vertices.data(), gl::GL_NONE_BIT );
+      gl::glCreateBuffers( 1, &indices_ );
+      gl::glNamedBufferStorage( indices_, frameIndices.size() * sizeof( GLuint ), frameIndices.data(), gl::GL_NONE_BIT );
       gl::glCreateVertexArrays( 1, &vao_ );
-      gl::glVertexArrayElementBuffer( vao_, indices_->id() );
-      attribs_.add( Attrib_Pos3D ); // vec3 position
-      attribs_.add( Attrib_Normal3D ); // vec3 normal
-      attribs_.add( Attrib_Texcoord2D ); // vec2 texcoord
-      attribs_.add( Attrib_Color4D ); // vec4 color
-      attribs_.add( Attrib_Tangent4D ); // vec4 tangent
-      attribs_.add( Attrib_Bitangent3D ); // vec3 bitangent
-      attribs_.write( vao_ );
-      gl::glVertexArrayVertexBuffer( vao_, 0, buffer_->id(), 0, attribs_.stride() );
+      gl::glVertexArrayElementBuffer( vao_, indices_ );
+      KnownVertexAttributes<Vertex3D> attribs;
+      attribs.write( vao_ );
+      gl::glVertexArrayVertexBuffer( vao_, 0, vertices_, 0, attribs.stride() );
     }
-    inline BufferType& buffer() { return *buffer_; }
-    inline IndicesType& indices() { return *indices_; }
-    void draw( Shaders& shaders, const Material& mat, int frame, const mat4& model )
-    {
-      gl::glBindVertexArray( vao_ );
-      auto ppl = &shaders.usePipeline( "sprite" );
-      const auto hndl = mat.layers_[0].texture_->handle();
-      gl::glBindTextures( 0, 1, &hndl );
-      ppl->setUniform( "tex", 0 );
-      ppl->setUniform( "tex_layer", frame < mat.arrayDepth_ ? frame : mat.arrayDepth_ - 1 );
-      ppl->setUniform( "tex_dimensions", vec2( mat.width(), mat.height() ) );
-      ppl->setUniform( "model", model );
-      gl::glDrawElements( gl::GL_TRIANGLES, static_cast<gl::GLsizei>( indices_->size() ), gl::GL_UNSIGNED_INT, nullptr );
-      gl::glBindVertexArray( 0 );
+    inline int frames() const noexcept { return frames_; }
+    void record( RenderCommandList& list, const Material& mat, int layer, int frame, const mat4& model, Real depth )
+    {
+      auto& params = list.draw( RenderPass_Transparent, "sprite_batch", vao_, mat.layers_[0].texture_->handle(),
+        indexCount_, depth, false, math::clamp( frame, 0, frames_ - 1 ) * frameVertices_ );
+      params.model = model;
+      params.textureLayer = ( layer < mat.arrayDepth_ ? layer : mat.arrayDepth_ - 1 );
+      params.textureDimensions = vec2( mat.width(), mat.height() );
+      params.flags = DrawParam_TextureLayer | DrawParam_TextureDimensions;
     }
     ~SpriteVertexbuffer()
     {
       gl::glDeleteVertexArrays( 1, &vao_ );
-      indices_.reset();
-      buffer_.reset();
+      gl::glDeleteBuffers( 1, &indices_ );
+      gl::glDeleteBuffers( 1, &vertices_ );
     }
   };
 
-  template <size_t Count>
+  //! Points rewritten every frame, as many as each frame needs. Only the vertex array is owned; the vertices are streamed.
   class PointRenderBuffer {
   protected:
-    static constexpr GLuint c_maxVertices = Count;
-    unique_ptr<MappedGLBuffer<VertexPointParticle>> buffer_;
     GLuint vao_ = 0;
+    GLsizei stride_ = 0;
   public:
     PointRenderBuffer()
     {
-      buffer_ = make_unique<MappedGLBuffer<VertexPointParticle>>( c_maxVertices );
       gl::glCreateVertexArrays( 1, &vao_ );
       neko::AttribWriter attribs;
       attribs.add( Attrib_Pos3D ); // vec3 position
@@ -251,61 +233,70 @@ namespace neko {
       attribs.add( Attrib_Scale3D ); // vec3 size
       attribs.add( Attrib_Color4D ); // vec4 color
       attribs.write( vao_ );
-      gl::glVertexArrayVertexBuffer( vao_, 0, buffer_->id(), 0, attribs.stride() );
+      stride_ = attribs.stride();
+    }
+    //! Allocate this frame's vertices and attach them to the vertex array. Valid until the end of the frame.
+    span<VertexPointParticle> lock( StreamBuffer& stream, size_t count )
+    {
+      StreamBuffer::Allocation alloc;
+      auto verts = stream.allocate<VertexPointParticle>( count, alloc );
+      gl::glVertexArrayVertexBuffer( vao_, 0, alloc.buffer, alloc.offset, stride_ );
+      return verts;
     }
-    inline MappedGLBuffer<VertexPointParticle>& buffer() { return *buffer_; }
-    void draw( Pipeline& pipeline, GLsizei count, GLint base = 0, gl::GLenum mode = gl::GL_POINTS )
+    void draw( GLStateCache& state, Pipeline& pipeline, GLsizei count, GLint base = 0, gl::GLenum mode = gl::GL_POINTS )
     {
-      gl::glBindVertexArray( vao_ );
+      state.bindVertexArray( vao_ );
       mat4 mdl( 1.0f );
-      pipeline.setUniform( "model", mdl );
+      pipeline.setUniform( Uniform_Model, mdl );
       gl::glDrawArrays( mode, base, count );
-      gl::glBindVertexArray( 0 );
     }
     ~PointRenderBuffer()
     {
       gl::glDeleteVertexArrays( 1, &vao_ );
-      buffer_.reset();
     }
   };
 
+  //! Lines rewritten every frame. Only the vertex array is owned; the vertices are streamed.
   template <size_t Count>
   class LineRenderBuffer {
   protected:
-    const GLuint c_maxVertices = Count;
-    unique_ptr<MappedGLBuffer<VertexLine>> buffer_;
+    static constexpr GLuint c_maxVertices = Count;
     GLuint vao_ = 0;
+    GLsizei stride_ = 0;
   public:
     LineRenderBuffer()
     {
-      buffer_ = make_unique<MappedGLBuffer<VertexLine>>( c_maxVertices );
       gl::glCreateVertexArrays( 1, &vao_ );
       neko::AttribWriter attribs;
       attribs.add( Attrib_Pos3D ); // vec3 position
       attribs.add( Attrib_Color4D ); // vec4 color
       attribs.write( vao_ );
-      gl::glVertexArrayVertexBuffer( vao_, 0, buffer_->id(), 0, attribs.stride() );
+      stride_ = attribs.stride();
+    }
+    //! Allocate this frame's vertices and attach them to the vertex array. Valid until the end of the frame.
+    span<VertexLine> lock( StreamBuffer& stream )
+    {
+      StreamBuffer::Allocation alloc;
+      auto verts = stream.allocate<VertexLine>( c_maxVertices, alloc );
+      gl::glVertexArrayVertexBuffer( vao_, 0, alloc.buffer, alloc.offset, stride_ );
+      return verts;
     }
-    inline MappedGLBuffer<VertexLine>& buffer() { return *buffer_; }
-    void draw( Pipeline& pipeline, GLsizei count, GLint base = 0, gl::GLenum mode = gl::GL_POINTS )
+    void draw( GLStateCache& state, Pipeline& pipeline, GLsizei count, GLint base = 0, gl::GLenum mode = gl::GL_POINTS )
     {
-      gl::glBindVertexArray( vao_ );
+      state.bindVertexArray( vao_ );
       mat4 mdl( 1.0f );
-      pipeline.setUniform( "model", mdl );
+      pipeline.setUniform( Uniform_Model, mdl );
       gl::glDrawArrays( mode, base, count );
-      gl::glBindVertexArray( 0 );
     }
-    void draw( Pipeline& pipeline, const mat4& mdl, GLsizei count, GLint base, gl::GLenum mode )
+    void draw( GLStateCache& state, Pipeline& pipeline, const mat4& mdl, GLsizei count, GLint base, gl::GLenum mode )
     {
-      gl::glBindVertexArray( vao_ );
-      pipeline.setUniform( "model", mdl );
+      state.bindVertexArray( vao_ );
+      pipeline.setUniform( Uniform_Model, mdl );
       gl::glDrawArrays( mode, base, count );
-      gl::glBindVertexArray( 0 );
     }
     ~LineRenderBuffer()
     {
       gl::glDeleteVertexArrays( 1, &vao_ );
-      buffer_.reset();
     }
   };
 
@@ -314,44 +305,123 @@ namespace neko {
   //using Vertices = vector<Vertex>;
   using Indices = vector<VertexIndex>;
 
+  //! Immutable index buffer for a batch of quads laid out as four consecutive vertices each.
+  //! 16-bit indices, so larger meshes draw in several batches using a base vertex.
+  class QuadIndexBuffer {
+  public:
+    static constexpr GLsizei c_quadsPerBatch = 16384;
+    static constexpr GLint c_verticesPerBatch = c_quadsPerBatch * 4;
+  protected:
+    GLuint id_ = 0;
+  public:
+    QuadIndexBuffer()
+    {
+      vector<uint16_t> indices( static_cast<size_t>( c_quadsPerBatch ) * 6 );
+      for ( size_t i = 0; i < static_cast<size_t>( c_quadsPerBatch ); ++i )
+      {
+        auto base = static_cast<uint16_t>( i * 4 );
+        uint16_t quad[6] = { base, static_cast<uint16_t>( base + 1 ), static_cast<uint16_t>( base + 2 ),
+          base, static_cast<uint16_t>( base + 2 ), static_cast<uint16_t>( base + 3 ) };
+        memcpy( &indices[i * 6], quad, sizeof( quad ) );
+      }
+      gl::glCreateBuffers( 1, &id_ );
+      gl::glNamedBufferStorage( id_, indices.size() * sizeof( uint16_t ), indices.data(), gl::GL_NONE_BIT );
+    }
+    inline GLuint id() const { return id_; }
+    //! Record quadCount quads from the given vertex array, one command per batch of 16-bit indices.
+    //! Every command gets the same params.
+    void record( RenderCommandList& list, RenderPass pass, const utf8String& pipeline, GLuint vao, GLuint texture,
+      GLsizei quadCount, Real depth, const DrawParams& params ) const
+    {
+      const auto ppl = list.pipeline( pipeline );
+      for ( GLint base = 0; quadCount > 0; base += c_verticesPerBatch, quadCount -= c_quadsPerBatch )
+      {
+        auto count = math::min( quadCount, c_quadsPerBatch );
+        list.draw( pass, ppl, vao, texture, count * 6, depth, true, base ) = params;
+      }
+    }
+    ~QuadIndexBuffer()
+    {
+      gl::glDeleteBuffers( 1, &id_ );
+    }
+  };
+
+  using QuadIndexBufferPtr = unique_ptr<QuadIndexBuffer>;
+
+  //! Glyph quads of a text, in one persistently mapped copy per StreamBuffer frame region.
+  //! A frame only writes and draws the copy of its own region, so the stream buffer's fence on that region doubles as
+  //! the guarantee that the GPU has finished the last frame to draw from it. Each copy tracks how many of its leading
+  //! quads are still current, so that an edit only rewrites what changed, once in every copy.
   class TextRenderBuffer {
   protected:
     using BufferType = MappedGLBuffer<VertexText>;
-    using IndicesType = MappedGLBuffer<gl::GLuint>;
-    unique_ptr<BufferType> buffer_;
-    unique_ptr<IndicesType> indices_;
-    GLuint vao_ = 0;
+    struct Copy
+    {
+      unique_ptr<BufferType> buffer;
+      GLuint vao = 0;
+      size_t validQuads = 0; //!< Leading quads that match the text's current vertices
+    };
+    Copy copies_[StreamBuffer::c_frames];
+    const QuadIndexBuffer& indices_;
+    size_t capacity_ = 0;
+    size_t current_ = 0; //!< Copy written and drawn this frame
   public:
-    TextRenderBuffer( GLuint maxVertices, GLuint maxIndices )
+    TextRenderBuffer( GLuint maxQuads, const QuadIndexBuffer& indices ): indices_( indices ), capacity_( maxQuads )
     {
-      buffer_ = make_unique<BufferType>( maxVertices );
-      indices_ = make_unique<IndicesType>( maxIndices );
-      gl::glCreateVertexArrays( 1, &vao_ );
-      gl::glVertexArrayElementBuffer( vao_, indices_->id() );
-      neko::AttribWriter attribs;
-      attribs.add( Attrib_Pos3D ); // vec3 position
-      attribs.add( Attrib_Texcoord2D ); // vec2 texcoord
-      attribs.add( Attrib_Color4D ); // vec4 color
-      attribs.write( vao_ );
-      gl::glVertexArrayVertexBuffer( vao_, 0, buffer_->id(), 0, attribs.stride() );
+      KnownVertexAttributes<VertexText> attribs;
+      for ( auto& copy : copies_ )
+      {
+        copy.buffer = make_unique<BufferType>( static_cast<size_t>( maxQuads ) * 4 );
+        gl::glCreateVertexArrays( 1, &copy.vao );
+        gl::glVertexArrayElementBuffer( copy.vao, indices_.id() );
+        attribs.write( copy.vao );
+        gl::glVertexArrayVertexBuffer( copy.vao, 0, copy.buffer->id(), 0, attribs.stride() );
+      }
     }
-    inline BufferType& buffer() { return *buffer_; }
-    inline IndicesType& indices() { return *indices_; }
-    void draw( Shaders& shaders, const mat4& model, gl::GLuint texture )
+    inline size_t quadCapacity() const noexcept { return capacity_; }
+    //! Mark every quad from firstQuad onwards as changed.
+    void invalidate( size_t firstQuad )
     {
-      gl::glBindVertexArray( vao_ );
-      auto& pipeline = shaders.usePipeline( "text3d" );
-      pipeline.setUniform( "model", model );
-      pipeline.setUniform( "tex", 0 );
-      gl::glBindTextureUnit( 0, texture );
-      gl::glDrawElements( gl::GL_TRIANGLES, static_cast<gl::GLsizei>( indices_->size() ), gl::GL_UNSIGNED_INT, nullptr );
-      gl::glBindVertexArray( 0 );
+      for ( auto& copy : copies_ )
+        copy.validQuads = math::min( copy.validQuads, firstQuad );
+    }
+    //! Bring the copy for the given stream buffer frame up to date with vertices, and draw from it this frame.
+    void upload( uint64_t frame, span<const VertexText> vertices )
+    {
+      current_ = static_cast<size_t>( frame % StreamBuffer::c_frames );
+      auto& copy = copies_[current_];
+      const auto quads = vertices.size() / 4;
+      assert( quads <= capacity_ );
+      if ( copy.validQuads < quads )
+      {
+        const auto count = quads - copy.validQuads;
+        const auto verts = copy.buffer->lock( static_cast<gl::GLintptr>( copy.validQuads * 4 * sizeof( VertexText ) ),
+          static_cast<gl::GLint>( count * 4 ) );
+        memcpy( verts.data(), &vertices[copy.validQuads * 4], count * 4 * sizeof( VertexText ) );
+        copy.buffer->unlock();
+      }
+      copy.validQuads = quads;
+    }
+    //! Record drawing the first quadCount glyph quads.
+    //! Buffers are allocated with headroom, so the used portion is usually smaller than the capacity.
+    //! positionScale converts the fixed point vertex positions back to text units.
+    void record( RenderCommandList& list, const mat4& model, gl::GLuint texture, GLsizei quadCount, Real positionScale,
+      Real depth )
+    {
+      DrawParams params;
+      params.model = model;
+      params.positionScale = positionScale;
+      params.flags = DrawParam_PositionScale;
+      indices_.record( list, RenderPass_Transparent, "text3d_batch", copies_[current_].vao, texture, quadCount, depth,
+        params );
     }
     ~TextRenderBuffer()
     {
-      gl::glDeleteVertexArrays( 1, &vao_ );
-      indices_.reset();
-      buffer_.reset();
+      for ( auto& copy : copies_ )
+      {
+        gl::glDeleteVertexArrays( 1, &copy.vao );
+        copy.buffer.reset();
+      }
     }
   };
 
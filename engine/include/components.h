@@ -142,11 +142,20 @@ namespace neko {
     {
     };
 
+    //! Transform changed by the last logic tick, so it's derived anew every frame while the renderer blends it.
+    struct interpolated_transform
+    {
+    };
+
     struct transform
     {
       vec3 scale { numbers::one, numbers::one, numbers::one };
       quat rotate = quat::identity();
       vec3 translate { numbers::zero, numbers::zero, numbers::zero };
+      vec3 previous_scale { numbers::one, numbers::one, numbers::one }; //!< Local values as the latest logic tick began
+      quat previous_rotate = quat::identity();
+      vec3 previous_translate { numbers::zero, numbers::zero, numbers::zero };
+      bool snapshotted = false; //!< Previous values are valid. Nodes created mid-tick have none, and show as they are
       vec3 derived_scale { numbers::one, numbers::one, numbers::one };
       quat derived_rotate = quat::identity();
       vec3 derived_translate { numbers::zero, numbers::zero, numbers::zero };
@@ -271,7 +280,7 @@ namespace neko {
     public:
       primitive_system( manager* m );
       void update();
-      void draw( Shaders& shaders, const Material& mat );
+      void record( RenderCommandList& list, const Camera& cam, const Material& mat );
       ~primitive_system();
       void imguiPrimitiveEditor( entity e );
     };
@@ -291,6 +300,7 @@ namespace neko {
       vec2 offset = { 0.0f, 0.0f };
       int alignHorizontal = 0;
       int alignVertical = 0;
+      Real wrapWidth = 0.0f; //!< Width to wrap lines at, or zero for no wrapping
       TextInputUserData int_ud_;
     };
 
@@ -315,7 +325,7 @@ namespace neko {
     public:
       text_system( manager* m );
       void update( FontManager& fntmgr );
-      void draw( Renderer& renderer );
+      void record( RenderCommandList& list, const Camera& cam );
       ~text_system();
       inline const TextDataMap& texts() const { return texts_; }
       void imguiTextEditor( entity e );
@@ -331,6 +341,7 @@ namespace neko {
       bool billboard = true;
       int frame = 0;
       MaterialPtr material;
+      SpriteAnimationSetDefinitionEntryPtr animation; //!< When matName names a sprite atlas entry
       vec2 dimensions { 0.0f, 0.0f };
       utf8String matName;
       TextInputUserData int_ud_;
@@ -348,8 +359,8 @@ namespace neko {
       void removeSprite( registry& r, entity e );
     public:
       sprite_system( manager* m );
-      void update( MaterialManager& mats );
-      void draw( Renderer& renderer, const Camera& cam );
+      void update( MaterialManager& mats, const SpriteManager& sprites );
+      void record( RenderCommandList& list, const Camera& cam );
       ~sprite_system();
       void imguiSpriteEditor( entity e );
     };
@@ -420,6 +431,7 @@ namespace neko {
       bool paintBrushNoiseEdgesOnly = true;
       PaintBrushType paintBrushType = Brush_Classic;
       vector<GLuint> textures;
+      MaterialPtr layerMaterials[4]; //!< Layer texture handles are refreshed from these each draw, as streaming replaces them
       void applyPaint( Renderer& renderer, const vec2& pos );
       void mouseClickTest( manager* m, entity e, Renderer& renderer, const Ray& ray, const vec2i& mousepos, int button );
     };
@@ -512,7 +524,11 @@ namespace neko {
       entity createSprite( string_view name );
       entity createPaintable( string_view name );
       inline entity& root() { return root_; }
-      void update();
+      //! Derive world transforms for the changed nodes. Those the last logic tick moved are placed interpolation
+      //! of the way from their previous local values to the current ones.
+      void update( Real interpolation = 1.0f );
+      //! Keep the current local transforms as the previous ones. Logic calls this as each tick begins.
+      void snapshotTransforms();
       void markDirty( entity e );
       void imguiSceneGraph();
       void imguiSelectedNodes();
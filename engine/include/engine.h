@@ -31,6 +31,7 @@ namespace neko {
     uint32_t steamAppID = 0;
     bool useDiscord = false;
     uint64_t discordAppID = 0;
+    GameTime logicRate = 60.0; //!< Logic ticks per second, the renderer interpolates in between
   };
 
   //! \class Engine
@@ -78,11 +79,13 @@ namespace neko {
     {
       atomic<GameTime> gameTime = 0.0;
       atomic<GameTime> realTime = 0.0;
+      atomic<Real> interpolation = 1.0f; //!< Fraction of a logic step passed since the latest tick
     } sync_;
     Stats stats_;
     platform::PerformanceClock clock_;
     GameTime time_ = 0.0;
     GameTime realTime_ = 0.0;
+    Real pendingInterpolation_ = 1.0f; //!< Fraction of a step left once the current frame's ticks are done
     volatile Signal signal_ = Signal_None;
     EngineSettings settings_;
     bool paused();
@@ -104,6 +107,13 @@ namespace neko {
     inline MessagingPtr msgs() noexcept { return messaging_; }
     inline DirectorPtr director() noexcept { return director_; }
     inline Sync& sync() noexcept { return sync_; }
+    //! Publish the game time after a tick, and the fraction the renderer blends its snapshots by.
+    //! Called within the same scene lock that the tick moved the snapshots under.
+    inline void publishTick( GameTime time ) noexcept
+    {
+      sync_.gameTime.store( time );
+      sync_.interpolation.store( pendingInterpolation_ );
+    }
     inline const utf8String& listFlags();
     inline const Stats& stats() const noexcept { return stats_; }
     inline const bool devmode() const noexcept { return state_.devMode; }
@@ -1,6 +1,7 @@
 #pragma once
 #include "neko_types.h"
 #include "neko_exception.h"
+#include "neko_platform.h"
 #include <windows.h>
 #include <shlobj.h>
 
@@ -35,6 +36,27 @@ namespace neko {
 
   using FileReaderPtr = shared_ptr<FileReader>;
 
+  //! \class FileMapping
+  //! Read-only memory mapping of a whole file.
+  //! Shared between users of the same file; unmapped when the last reference goes away.
+  class FileMapping {
+  protected:
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+    uint8_t* view_ = nullptr;
+    uint64_t size_ = 0;
+  public:
+    FileMapping( const wstring& filename );
+    FileMapping( const FileMapping& ) = delete;
+    FileMapping& operator=( const FileMapping& ) = delete;
+    inline const uint64_t size() const noexcept { return size_; }
+    inline const uint8_t* data() const noexcept { return view_; }
+    inline span<const uint8_t> view() const noexcept { return span<const uint8_t>( view_, static_cast<size_t>( size_ ) ); }
+    ~FileMapping();
+  };
+
+  using FileMappingPtr = shared_ptr<FileMapping>;
+
   enum FileDir
   {
     Dir_User = 0,
@@ -45,12 +67,17 @@ namespace neko {
     Dir_Animations,
     Dir_GUI,
     Dir_Shaders,
-    Dir_Scripts
+    Dir_Scripts,
+    Dir_Cache
   };
 
+  using FileWriterPtr = shared_ptr<platform::FileWriter>;
+
   class FileSystem {
   private:
     map<FileDir, wstring> rootDirs_;
+    map<wstring, weak_ptr<FileMapping>> mappings_;
+    platform::RWLock mappingsLock_;
     wstring fixPath( FileDir dir, const wstring& path );
   public:
     FileSystem();
@@ -59,6 +86,11 @@ namespace neko {
     FileReaderPtr openFile( FileDir dir, const utf8String& path );
     FileReaderPtr openFileAbsolute( const wstring& path );
     FileReaderPtr openFileAbsolute( const utf8String& path );
+    //! Map a file into memory read-only. Mapping the same file again while a previous
+    //! mapping is still alive returns the existing one instead of creating another.
+    FileMappingPtr mapFile( FileDir dir, const utf8String& path );
+    //! Create or overwrite a file for writing, creating the root directory if necessary.
+    FileWriterPtr createFile( FileDir dir, const utf8String& path );
   };
 
 }
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include "shaders.h"
 #include "resources.h"
 #include "textureatlas.h"
+#include "filesystem.h"
 #include "pch.h"
 #include "buffers.h"
 
@@ -87,6 +88,12 @@ namespace neko {
       return spn;
     }
     void setFrom( hb_font_t* font, const vector<hb_feature_t>& feats, const unicodeString& str )
+    {
+      setFrom( font, feats, str, 0, str.length() );
+    }
+    //! Shape only the given range of the string, while still passing the full string
+    //! as context. Glyph clusters will index into the full string.
+    void setFrom( hb_font_t* font, const vector<hb_feature_t>& feats, const unicodeString& str, int32_t offset, int32_t length )
     {
       hb_buffer_reset( hbbuf_ );
 
@@ -99,7 +106,7 @@ namespace neko {
       flags |= HB_BUFFER_FLAG_EOT;
       hb_buffer_set_flags( hbbuf_, static_cast<hb_buffer_flags_t>( flags ) );
 
-      hb_buffer_add_utf16( hbbuf_, reinterpret_cast<const uint16_t*>( str.getBuffer() ), str.length(), 0, str.length() );
+      hb_buffer_add_utf16( hbbuf_, reinterpret_cast<const uint16_t*>( str.getBuffer() ), str.length(), offset, length );
 
       hb_shape( font, hbbuf_, feats.empty() ? nullptr : feats.data(), static_cast<int>( feats.size() ) );
 
@@ -199,8 +206,15 @@ namespace neko {
     Real size_ = 0.0f;
     Real ascender_ = 0.0f;
     Real descender_ = 0.0f;
+    Real lineHeight_ = 0.0f;
+    uint64_t cacheKey_ = 0;
+    size_t cachedGlyphs_ = 0; //!< Number of glyphs in the cache file as last read or written
   protected:
     void initEmptyGlyph();
+    uint64_t makeCacheKey( FT_Library ft ) const;
+    utf8String cacheFilename() const;
+    bool loadCache();
+    void saveCache();
     void postLoad();
     void loadGlyph( FT_Library ft, FT_Face face, GlyphIndex index, bool hinting );
   public:
@@ -211,6 +225,8 @@ namespace neko {
     inline Real size() const noexcept { return size_; }
     inline Real ascender() const noexcept { return ascender_; }
     inline Real descender() const noexcept { return descender_; }
+    //! Baseline-to-baseline distance, including the font's line gap.
+    inline Real lineHeight() const noexcept { return lineHeight_; }
     Glyph* getGlyph( FT_Library ft, FT_Face face, GlyphIndex index );
     inline bool dirty() const { return dirty_; }
     inline void markClean() { dirty_ = false; }
@@ -230,11 +246,16 @@ namespace neko {
     FontPtr font_;
     FT_Library ft_ = nullptr;
     FT_Face face_ = nullptr;
+    hb_face_t* hbface_ = nullptr; //!< Shared by all styles; its blob references the font's file mapping
+    FileMappingPtr data_; //!< Kept alive for as long as FreeType may read from it
+    uint64_t dataHash_ = 0;
     FontStyleMap styles_;
   protected:
     void forceUCS2Charmap();
   public:
-    FontFace( FontPtr font, FT_Library ft, FT_Open_Args* args, FaceID faceIndex );
+    //! Hash of the font file contents, computed on first use.
+    uint64_t dataHash();
+    FontFace( FontPtr font, FT_Library ft, FileMappingPtr data, FaceID faceIndex );
     FontStylePtr style( StyleID id );
     StyleID loadStyle( FontRendering rendering, Real size, Real thickness, const unicodeString& prerenderGlyphs );
     inline FontPtr font() { return font_; }
@@ -255,9 +276,9 @@ namespace neko {
   private:
     FontManagerPtr manager_;
     FontFaceMap faces_;
-    unique_ptr<Buffer> data_;
+    FileMappingPtr data_;
     IDType id_;
-    FontFacePtr loadFace( span<uint8_t> source, FaceID faceIndex );
+    FontFacePtr loadFace( FileMappingPtr source, FaceID faceIndex );
   public:
     Font( FontManagerPtr manager, IDType i, const utf8String& name );
     inline FontManagerPtr manager() { return manager_; }
@@ -305,12 +326,49 @@ namespace neko {
   };
 
   class Text {
+    friend class FontManager;
   public:
     struct Features
     {
       bool ligatures : 1;
       bool kerning   : 1;
     };
+    //! A single shaped glyph, cached so that re-layout doesn't require reshaping.
+    struct ShapedGlyph
+    {
+      GlyphIndex index = 0;
+      int32_t cluster = 0; //!< Source UTF-16 unit this glyph originates from
+      vec2 advance { 0.0f };
+      vec2 offset { 0.0f };
+      bool control : 1 = false; //!< Control character without a glyph; advances but emits no quad
+      bool space : 1 = false; //!< Whitespace; not counted towards the width of a row it ends
+    };
+    //! A visual row of a paragraph after wrapping, as a range of its shaped run.
+    struct Row
+    {
+      size_t first = 0;
+      size_t last = 0; //!< One past the last glyph of the row
+      Real width = 0.0f; //!< Width excluding trailing whitespace
+    };
+    //! A paragraph of text, terminated by a hard break or the end of the text.
+    //! Holds its shaped run and line break opportunities, which are only recomputed
+    //! when the paragraph's text changes.
+    struct Paragraph
+    {
+      int32_t start = 0; //!< First UTF-16 unit of the paragraph in the source text
+      int32_t length = 0; //!< Length in UTF-16 units, excluding the terminating break
+      int32_t breakLength = 0; //!< Length of the terminating break sequence (0, 1 or 2)
+      bool rtl = false; //!< Base direction, used to resolve start/end alignment
+      vector<ShapedGlyph> run;
+      vector<size_t> breaks; //!< Indices into run where a row may begin
+      vector<Row> rows;
+      size_t firstRow = 0;
+      size_t firstGlyph = 0; //!< Index of the first glyph quad of this paragraph
+      size_t glyphCount = 0; //!< Number of glyph quads in this paragraph
+      vec2 min { 0.0f };
+      vec2 max { 0.0f };
+      inline int32_t end() const noexcept { return start + length + breakLength; }
+    };
   private:
     FontManagerPtr manager_;
     //hb_language_t language_;
@@ -318,16 +376,31 @@ namespace neko {
     // hb_direction_t direction_;
     // hb_buffer_t* hbbuf_ = nullptr;
     bool dirty_ = false;
+    bool relayout_ = false; //!< Width or alignment changed; lay out all paragraphs again without reshaping
     FontStylePtr style_;
     vector<hb_feature_t> features_;
     unique_ptr<HBBuffer> hbbuf_;
+    unique_ptr<icu::BreakIterator> breaker_;
     unicodeString text_;
     IDType id_;
     TextMeshPtr mesh_;
     vector<VertexText> vertices_;
-    Indices indices_;
+    int quantShift_ = 6; //!< Fractional bits in the fixed point vertex positions
+    vector<Paragraph> paragraphs_;
+    int32_t dirtyFrom_ = 0; //!< First changed UTF-16 unit since last regenerate
+    size_t uploadFrom_ = 0; //!< First changed glyph quad since last upload
+    Real maxWidth_ = 0.0f; //!< Wrapping width, or zero for no wrapping
+    Real layoutWidth_ = 0.0f; //!< Width the current rows were aligned against
+    TextAlignment alignment_ = TextAlign_Start;
     vec2 meshDimensions_ = { 0.0f, 0.0f };
     bool dead_ = false;
+    void markRelayout();
+    void shapeParagraph( Paragraph& paragraph );
+    void wrapParagraph( Paragraph& paragraph );
+    void emitParagraph( Paragraph& paragraph, Real alignWidth );
+    void emitFrom( size_t first, Real alignWidth );
+    int requiredQuantShift() const;
+    void updateDimensions();
   public:
     Text() = delete;
     Text( FontManagerPtr manager, IDType id, FontStylePtr style, const Text::Features& features );
@@ -342,10 +415,18 @@ namespace neko {
     StyleID styleid() const noexcept { return style_->id(); }
     void regenerate();
     inline IDType id() const noexcept { return id_; }
-    void draw( Renderer& renderer, const mat4& modelMatrix );
+    void record( RenderCommandList& list, const mat4& modelMatrix, Real depth );
     inline void markDead() { dead_ = true; }
     inline const bool dead() const noexcept { return dead_; }
     inline const vec2& dimensions() const noexcept { return meshDimensions_; }
+    //! Width of the box rows are aligned in: the wrap width if set, otherwise the widest row.
+    inline Real layoutWidth() const noexcept { return layoutWidth_; }
+    inline const vector<Paragraph>& paragraphs() const noexcept { return paragraphs_; }
+    //! Set the width to wrap lines at, or zero to disable wrapping.
+    void width( Real maxWidth );
+    inline Real width() const noexcept { return maxWidth_; }
+    void alignment( TextAlignment align );
+    inline TextAlignment alignment() const noexcept { return alignment_; }
   };
 
   class FontManager: public LoadedResourceManagerBase<Font>, public ShareableBase<FontManager> {
@@ -360,6 +441,8 @@ namespace neko {
   protected:
     Renderer* renderer_ = nullptr;
     map<IDType, TextPtr> texts_;
+    QuadIndexBufferPtr quadIndices_; //!< Shared by all text meshes
+    vector<pair<uint64_t, TextMeshPtr>> retiredMeshes_; //!< Replaced or orphaned text meshes, with the frame they went on
   private:
     FT_MemoryRec_ ftMemAllocator_;
     FT_Library freeType_ = nullptr;
@@ -380,6 +463,9 @@ namespace neko {
     IDType textIndex_ = 0;
   protected:
     inline FT_Library ft() { return freeType_; }
+    inline const QuadIndexBuffer& quadIndices() const { assert( quadIndices_ ); return *quadIndices_; }
+    //! Keep a mesh alive until no frame in flight can still be drawing from it.
+    void retireMesh( TextMeshPtr mesh );
   public:
     inline FontManagerPtr ptr() noexcept { return this->shared_from_this(); }
     FontManager( ThreadedLoaderPtr loader );
@@ -395,7 +481,7 @@ namespace neko {
     void loadFile( const utf8String& filename );
     // Font overrides
     FontPtr createFont( const utf8String& name );
-    FontFacePtr loadFace( FontPtr font, span<uint8_t> buffer, FaceID faceIndex );
+    FontFacePtr loadFace( FontPtr font, FileMappingPtr source, FaceID faceIndex );
     StyleID loadStyle(
       FontFacePtr face, Real size, FontRendering rendering, Real thickness, const unicodeString& prerenderGlyphs );
     void unloadFont( FontPtr font );
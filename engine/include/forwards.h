@@ -106,4 +106,7 @@ namespace neko {
   class SpriteManager;
   using SpriteManagerPtr = shared_ptr<SpriteManager>;
 
+  class ModelManager;
+  using ModelManagerPtr = shared_ptr<ModelManager>;
+
 }
\ No newline at end of file
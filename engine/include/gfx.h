@@ -213,7 +213,9 @@ namespace neko {
     GUIPtr gui_;
   protected:
     Info info_;
+    bool headless_ = false; //!< Offscreen only, no window, input or ImGui backends
     unique_ptr<sf::Window> window_;
+    unique_ptr<sf::Context> context_; //!< Windowless context used in headless mode
     RendererPtr renderer_;
     Viewport windowViewport_;
     GameViewport gameViewport_;
@@ -221,8 +223,11 @@ namespace neko {
     EditorPtr editor_;
     std::queue<uint64_t> updateAccounts_;
     platform::RWLock logicLock_;
+    GameTime lastTime_ = 0.0; //!< Game time of the previous update
     void preInitialize();
+    void createWindow( const sf::Vector2u& size, const sf::ContextSettings& settings );
     void printInfo();
+    vec2i surfaceSize() const; //!< Window client size, or the configured screen size when headless
     void resize( Engine& engine, size_t width, size_t height );
     struct Flags {
       bool editorResized = false;
@@ -242,8 +247,10 @@ namespace neko {
     void processEvents( Engine& engine, bool discardMouse, bool discardKeyboard ); //!< Process vital window events and such.
     void updateRealTime( GameTime realTime, GameTime delta, Engine& engine );
     void preUpdate();
-    void update( GameTime gameTime, GameTime delta, Engine& engine );
+    //! Update and draw a frame at the game time the logic thread last published.
+    void update( Engine& engine );
     inline Renderer& renderer() noexcept { return *( renderer_.get() ); }
+    inline bool headless() const noexcept { return headless_; }
     void shutdown( Engine& engine );
     void restart( Engine& engine );
     void jsRestart( Engine& engine );
@@ -263,7 +270,6 @@ namespace neko {
     MessagingPtr messaging_;
     ConsolePtr console_;
     DirectorPtr director_;
-    GameTime lastTime_ = 0.0;
     GameTime lastRealTime_ = 0.0;
   protected:
     static bool threadProc( platform::Event& running, platform::Event& wantStop, void* argument );
@@ -45,25 +45,21 @@ namespace neko {
       position( position_ ), normal( normal_ ), texcoord( texcoord_ ), color( color_ ), tangent{ 0.0f }, bitangent{ 0.0f } {}
   };
 
+  //! Compact glyph quad vertex, 12 bytes.
+  //! Positions are fixed point relative to the text origin, scaled back by a per-mesh factor in the shader.
   struct VertexText
   {
-    static constexpr size_t ElementCount = 9;
-    vec3 position; //!< 0: Vertex coordinates
-    vec2 texcoord; //!< 1: UV coordinates
-    vec4 color; //!< 2: Vertex color
-    VertexText(): position { 0.0f }, texcoord { 0.0f }, color { 0.0f }
-    {
-    }
-    VertexText( float x_, float y_, float z_, float s_, float t_, float r_, float g_, float b_, float a_ ):
-      position( x_, y_, z_ ), texcoord( s_, t_ ), color( r_, g_, b_, a_ )
-    {
-    }
-    VertexText( vec3 position_, vec2 texcoord_, vec4 color_ ):
-      position( position_ ), texcoord( texcoord_ ), color( color_ )
-    {
-    }
+    static constexpr size_t ElementCount = 5;
+    int16_t x, y; //!< 0: Fixed point vertex coordinates
+    uint16_t s, t; //!< 1: Normalized UV coordinates
+    uint32_t color; //!< 2: Packed RGBA8 vertex color
+    VertexText(): x( 0 ), y( 0 ), s( 0 ), t( 0 ), color( 0 ) {}
+    VertexText( int16_t x_, int16_t y_, uint16_t s_, uint16_t t_, uint32_t color_ ):
+      x( x_ ), y( y_ ), s( s_ ), t( t_ ), color( color_ ) {}
   };
 
+  static_assert( sizeof( VertexText ) == 12 );
+
   struct VertexPointParticle
   {
     static constexpr size_t ElementCount = 14;
@@ -101,7 +97,12 @@ namespace neko {
     PixFmtDepth24Stencil8,
     PixFmtColorR8,
     PixFmtColorRG8,
-    PixFmtColorR16f
+    PixFmtColorR16f,
+    PixFmtBC1, //!< Block compressed RGB, 8 bytes per 4x4 block
+    PixFmtBC3, //!< Block compressed RGBA, 16 bytes per 4x4 block
+    PixFmtBC4, //!< Block compressed R, 8 bytes per 4x4 block
+    PixFmtBC5, //!< Block compressed RG, 16 bytes per 4x4 block
+    PixFmtBC7 //!< Block compressed RGBA, 16 bytes per 4x4 block
   };
 
   struct PixelFormatValues
@@ -115,6 +116,15 @@ namespace neko {
 
   extern const map<PixelFormat, PixelFormatValues> c_pixelFormatData;
 
+  //! Size and format of an encoded image from its header, for allocating the storage to decode it into.
+  struct ImageInfo
+  {
+    int width = 0;
+    int height = 0;
+    PixelFormat format = PixFmtColorRGBA8;
+    size_t bytes() const;
+  };
+
   class Pixmap : public nocopy {
   private:
     int width_ = 0;
@@ -124,6 +134,8 @@ namespace neko {
   public:
     Pixmap( PixelFormat fmt );
     Pixmap( int width, int height, PixelFormat fmt, const uint8_t* data );
+    //! Take over existing pixel data without copying it.
+    Pixmap( int width, int height, PixelFormat fmt, vector<uint8_t>&& data );
     Pixmap( const Pixmap& from, int x, int y, int width, int height );
     Pixmap( Pixmap&& rhs ) noexcept
     {
@@ -133,26 +145,63 @@ namespace neko {
       data_.swap( rhs.data_ );
     }
     static Pixmap from( const Pixmap& rhs );
-    static Pixmap fromPNG( const vector<uint8_t>& input );
-    static Pixmap fromEXR( const vector<uint8_t>& input );
-    static Pixmap fromTIFF( const utf8String& filename );
+    static ImageInfo inspectPNG( const vector<uint8_t>& input );
+    static ImageInfo inspectEXR( const vector<uint8_t>& input );
+    //! Decode straight into out, which must hold info.bytes(), such as a mapped upload buffer.
+    //! Flip stores the rows bottom up, GL style, as they're decoded.
+    static void decodePNG( const vector<uint8_t>& input, const ImageInfo& info, uint8_t* out, bool flip );
+    static void decodeEXR( const vector<uint8_t>& input, const ImageInfo& info, uint8_t* out, bool flip );
+    static Pixmap fromPNG( const vector<uint8_t>& input, bool flip = false );
+    static Pixmap fromEXR( const vector<uint8_t>& input, bool flip = false );
+    static Pixmap fromTIFF( const utf8String& filename, bool flip = false );
     inline bool empty() const noexcept { return data_.empty(); }
     inline int width() const noexcept { return width_; }
     inline int height() const noexcept { return height_; }
     inline PixelFormat format() const noexcept { return format_; }
     inline const vector<uint8_t>& data() const noexcept { return data_; }
     inline vector<uint8_t>& writableData() noexcept { return data_; }
-    void convert( PixelFormat newfmt );
+    //! Convert to any other supported format. With srgb, 8-bit color channels are treated as sRGB encoded:
+    //! decoded to linear going to float formats and encoded coming back. Alpha is always linear.
+    void convert( PixelFormat newfmt, bool srgb = false );
+    //! Converted copy, leaving this one as it is.
+    Pixmap converted( PixelFormat newfmt, bool srgb = false ) const;
+    //! Encode 8-bit R, RGB or RGBA as PNG. False for any other format.
+    bool encodePNG( vector<uint8_t>& out ) const;
     void writePNG( const utf8String& filename ) const;
     void reset();
     void flipVertical();
     void flipRectHorizontal( int x, int y, int width, int height );
     void flipRectVertical( int x, int y, int width, int height );
     void blitRectFrom( const Pixmap& rhs, int dst_x, int dst_y, int src_x, int src_y, int width, int height );
+    //! Half resolution copy, 2x2 box filtered. Odd edges fold into the last texel. 8-bit formats only.
+    Pixmap downsample() const;
   };
 
   using PixmapPtr = shared_ptr<Pixmap>;
 
+  struct CompressedLevel
+  {
+    int width = 0;
+    int height = 0;
+    vector<uint8_t> data;
+  };
+
+  //! A block compressed mip chain, see TextureCompressor.
+  struct CompressedImage
+  {
+    PixelFormat format = PixFmtBC1;
+    vector<CompressedLevel> levels;
+    inline bool empty() const noexcept { return levels.empty(); }
+    inline size_t size() const noexcept
+    {
+      size_t total = 0;
+      for ( const auto& level : levels )
+        total += level.data.size();
+      return total;
+    }
+    inline void reset() { levels.clear(); }
+  };
+
   enum GLFormatSizeFlagBits
   {
     GL_FORMAT_SIZE_PACKED_BIT = 0x00000001,
@@ -0,0 +1,114 @@
+#pragma once
+#include "neko_types.h"
+#include "gfx_types.h"
+
+namespace neko {
+
+  //! Shadow copy of the OpenGL state the renderer touches, so that redundant binds and toggles can be skipped.
+  //! Everything starts out unknown and is issued on first use. Code that changes the same state behind
+  //! the cache's back (ImGui, MyGUI) must be followed by invalidate().
+  class GLStateCache {
+  public:
+    static constexpr GLuint c_textureUnits = 16;
+    static constexpr GLuint c_imageUnits = 8;
+    static constexpr GLuint c_bufferSlots = 8;
+    enum Capability: int
+    {
+      Cap_DepthTest = 0,
+      Cap_Blend,
+      Cap_CullFace,
+      Cap_ScissorTest,
+      Cap_StencilTest,
+      Cap_Multisample,
+      Cap_LineSmooth,
+      Cap_PolygonSmooth,
+      MAX_Capability
+    };
+    struct Stats
+    {
+      uint64_t issued = 0; //!< Calls that reached the driver
+      uint64_t skipped = 0; //!< Calls dropped as redundant
+    };
+  protected:
+    static constexpr GLuint c_unknown = 0xFFFFFFFF;
+    struct ImageBinding
+    {
+      GLuint texture;
+      GLint level;
+      GLboolean layered;
+      GLint layer;
+      GLenum access;
+      GLenum format;
+      inline bool operator==( const ImageBinding& rhs ) const noexcept = default;
+    };
+    //! Size 0 stands for the whole buffer, as bound by bindBufferBase.
+    struct BufferBinding
+    {
+      GLuint buffer;
+      GLintptr offset;
+      GLsizeiptr size;
+      inline bool operator==( const BufferBinding& rhs ) const noexcept = default;
+    };
+    GLuint vao_;
+    GLuint pipeline_;
+    GLuint framebuffer_;
+    GLuint textures_[c_textureUnits];
+    ImageBinding images_[c_imageUnits];
+    BufferBinding storageBuffers_[c_bufferSlots];
+    BufferBinding uniformBuffers_[c_bufferSlots];
+    int8_t caps_[MAX_Capability]; //!< -1 = unknown
+    int8_t depthMask_;
+    GLenum depthFunc_;
+    GLenum blendSrc_;
+    GLenum blendDst_;
+    GLenum polygonMode_;
+    GLenum cullFace_;
+    GLenum frontFace_;
+    Stats frame_;
+    Stats lastFrame_;
+    BufferBinding* bufferSlots( GLenum target );
+    //! Returns whether the call should go through, updating cached and counting.
+    template <typename T>
+    inline bool change( T& cached, const T& value )
+    {
+      if ( cached == value )
+      {
+        frame_.skipped++;
+        return false;
+      }
+      cached = value;
+      frame_.issued++;
+      return true;
+    }
+  public:
+    GLStateCache();
+    //! Forget everything, forcing the next call of each kind to be issued.
+    void invalidate();
+    //! Latch this frame's counters as the last frame's, and invalidate since the frame's end
+    //! (UI rendering, buffer swap) is outside our control.
+    void endFrame();
+    inline const Stats& lastFrame() const noexcept { return lastFrame_; }
+    void bindVertexArray( GLuint vao );
+    void bindProgramPipeline( GLuint pipeline );
+    void bindFramebuffer( GLuint framebuffer );
+    void bindTextureUnit( GLuint unit, GLuint texture );
+    //! Binds a contiguous range of units with one call, if any of them differ.
+    void bindTextures( GLuint first, GLsizei count, const GLuint* textures );
+    void bindImageTexture( GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access,
+      GLenum format );
+    //! Indexed binding for GL_SHADER_STORAGE_BUFFER or GL_UNIFORM_BUFFER.
+    void bindBufferBase( GLenum target, GLuint index, GLuint buffer );
+    //! Indexed binding of a buffer range for GL_SHADER_STORAGE_BUFFER or GL_UNIFORM_BUFFER.
+    void bindBufferRange( GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size );
+    void enable( Capability cap, bool enable );
+    //! Query a capability, asking the driver only if unknown.
+    bool enabled( Capability cap );
+    void depthMask( bool write );
+    void depthFunc( GLenum func );
+    void blendFunc( GLenum src, GLenum dst );
+    void polygonMode( GLenum mode );
+    void cullFace( GLenum face );
+    void frontFace( GLenum winding );
+  };
+
+}
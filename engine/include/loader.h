@@ -4,6 +4,7 @@
 #include "font.h"
 #include "gfx_types.h"
 #include "spriteanim.h"
+#include "model.h"
 
 namespace neko {
 
@@ -19,7 +20,9 @@ namespace neko {
     enum LoadType {
       Load_Texture,
       Load_Fontface,
-      Load_Spritesheet
+      Load_Spritesheet,
+      Load_SpriteAtlas,
+      Load_Model
     } type_;
     struct TextureLoad {
       MaterialPtr material_;
@@ -34,6 +37,14 @@ namespace neko {
     {
       SpriteAnimationSetDefinitionPtr def_;
     } spriteLoad;
+    struct SpriteAtlasLoad
+    {
+      SpriteAtlasPtr atlas_;
+    } atlasLoad;
+    struct ModelLoad
+    {
+      ModelPtr model_;
+    } modelLoad;
     LoadTask( MaterialPtr material, vector<utf8String> paths ): type_( Load_Texture )
     {
       textureLoad.material_ = move( material );
@@ -49,6 +60,14 @@ namespace neko {
     {
       spriteLoad.def_ = move( ptr );
     }
+    LoadTask( SpriteAtlasPtr ptr ): type_( Load_SpriteAtlas )
+    {
+      atlasLoad.atlas_ = move( ptr );
+    }
+    LoadTask( ModelPtr ptr ): type_( Load_Model )
+    {
+      modelLoad.model_ = move( ptr );
+    }
   };
 
   using LoadTaskVector = vector<LoadTask>;
@@ -68,10 +87,15 @@ namespace neko {
     MaterialVector finishedMaterials_;
     FontVector finishedFonts_;
     SpriteAnimationSetDefinitionVector finishedSpritesheets_;
+    ModelVector finishedModels_;
     void loadFontFace( LoadTask::FontfaceLoad& task );
     Pixmap loadTexture( const utf8String& path );
+    //! Compress the layer or build its mip chain, whichever the material's texture will want.
+    void prepareLayer( const Material& material, MaterialLayer& layer );
     void loadMaterial( LoadTask::TextureLoad& task );
     void loadSpritesheet( LoadTask::SpritesheetLoad& task );
+    void loadSpriteAtlas( LoadTask::SpriteAtlasLoad& task );
+    void loadModel( LoadTask::ModelLoad& task ); // loader_gltf.cpp
     void handleNewTasks();
   private:
     static bool threadProc( platform::Event& running, platform::Event& wantStop, void* argument );
@@ -82,6 +106,7 @@ namespace neko {
     void getFinishedMaterials( MaterialVector& materials );
     void getFinishedFonts( FontVector& fonts );
     void getFinishedSpritesheets( SpriteAnimationSetDefinitionVector& sheets );
+    void getFinishedModels( ModelVector& models );
     void addLoadTask( const LoadTaskVector& resources );
     void clear();
     ~ThreadedLoader();
@@ -10,23 +10,32 @@ namespace neko {
   struct MaterialLayer: public nocopy {
   public:
     Pixmap image_;
+    vector<Pixmap> mips_; //!< Host copies of levels 1...n, kept for texture streaming
+    CompressedImage compressed_; //!< Replaces the pixmaps when the material asks for block compression
     TexturePtr texture_;
   public:
-    inline const bool hasHostCopy() const noexcept { return !image_.empty(); }
+    inline const bool hasHostCopy() const noexcept { return ( !image_.empty() || !compressed_.empty() ); }
     inline void deleteHostCopy()
     {
       image_.reset();
+      mips_.clear();
+      compressed_.reset();
     }
+    //! Build the full host mip chain from the image. Worker thread.
+    void buildMipChain();
+    inline int levels() const noexcept { return static_cast<int>( mips_.size() ) + 1; }
+    inline const Pixmap& level( int index ) const noexcept { return ( index == 0 ? image_ : mips_[index - 1] ); }
     inline const bool uploaded() const noexcept { return ( texture_.get() != nullptr ); }
     MaterialLayer(): image_( PixFmtColorRGBA8 ) {}
     MaterialLayer( Pixmap&& from ): image_( move( from ) ) {}
     // move constructor
     MaterialLayer( MaterialLayer&& rhs ) noexcept:
-    image_( move( rhs.image_ ) ), texture_( rhs.texture_ )
+    image_( move( rhs.image_ ) ), mips_( move( rhs.mips_ ) ), compressed_( move( rhs.compressed_ ) ),
+      texture_( rhs.texture_ )
     {
     }
-    inline int width() const noexcept { return image_.width(); }
-    inline int height() const noexcept { return image_.height(); }
+    inline int width() const noexcept { return ( compressed_.empty() ? image_.width() : compressed_.levels.front().width ); }
+    inline int height() const noexcept { return ( compressed_.empty() ? image_.height() : compressed_.levels.front().height ); }
     inline const Pixmap& image() const noexcept { return image_; }
   };
 
@@ -50,10 +59,14 @@ namespace neko {
     } type_ = UnlitSimple;
     Texture::Wrapping wantWrapping_ = Texture::Repeat;
     Texture::Filtering wantFiltering_ = Texture::Mipmapped;
+    optional<PixelFormat> wantCompression_; //!< Block compressed format to encode the layers to, if any
     int width_ = 0;
     int height_ = 0;
     int arrayDepth_ = 1;
+    bool arrayTexture_ = false; //!< Upload as an array texture even with a depth of one, for array samplers
     MaterialLayers layers_;
+    mutable uint64_t lastUseFrame_ = 0; //!< Residency feedback from drawing, see TextureStreamer
+    mutable Real finestDensity_ = 0.0f; //!< Smallest texels per screen pixel drawn at during lastUseFrame_
     inline const bool uploaded() const noexcept
     {
       if ( !loaded_ )
@@ -19,12 +19,20 @@ namespace neko {
 
   namespace util {
 
+    //! Fill in tangents & bitangents of an indexed triangle list from its positions, normals and texture coordinates,
+    //! in the manner of MikkTSpace. Triangles and then vertices are processed in parallel chunks.
     void generateTangentsAndBitangents( vector<Vertex3D>& verts, const vector<GLuint>& indices );
+    //! Collapse bitwise identical vertices into their first occurrence and remap the indices to match.
+    //! Returns how many vertices were removed.
+    size_t weldVertices( vector<Vertex3D>& verts, vector<GLuint>& indices );
 
   }
 
   struct Pipeline;
 
+  //! A fixed size buffer, mapped persistently for its whole lifetime.
+  //! lock() and unlock() only hand out & take back a view of the mapping, so writes are not synchronized with
+  //! the GPU: only rewrite data no frame in flight is still reading. Transient per-frame data belongs in a StreamBuffer.
   template <typename T>
   class MappedGLBuffer {
     static constexpr glbinding::SharedBitfield<gl::BufferStorageMask, gl::MapBufferAccessMask> c_glMapFlags = ( gl::GL_MAP_WRITE_BIT | gl::GL_MAP_READ_BIT | gl::GL_MAP_PERSISTENT_BIT | gl::GL_MAP_COHERENT_BIT );
@@ -32,6 +40,7 @@ namespace neko {
   protected:
     GLuint id_ = 0;
     size_t count_;
+    uint8_t* data_ = nullptr;
     bool mapped_ = false;
   public:
     MappedGLBuffer( size_t count = 1 ): count_( count )
@@ -39,6 +48,7 @@ namespace neko {
       assert( count > 0 );
       gl::glCreateBuffers( 1, &id_ );
       gl::glNamedBufferStorage( id_, count_ * sizeof( T ), nullptr, c_glStoreFlags );
+      data_ = reinterpret_cast<uint8_t*>( gl::glMapNamedBufferRange( id_, 0, count_ * sizeof( T ), c_glMapFlags ) );
     }
     inline GLuint id() const { return id_; }
     inline size_t size() const noexcept { return count_; }
@@ -47,19 +57,18 @@ namespace neko {
     {
       if ( count < 1 )
         count = static_cast<GLint>( count_ );
-      auto buf = reinterpret_cast<T*>( gl::glMapNamedBufferRange( id_, offset, count * sizeof( T ), c_glMapFlags ) );
+      assert( offset + count * sizeof( T ) <= bytesize() );
       mapped_ = true;
-      return span<T>( buf, count );
+      return span<T>( reinterpret_cast<T*>( data_ + offset ), count );
     }
     inline void unlock()
     {
-      auto ret = gl::glUnmapNamedBuffer( id_ );
-      assert( ret == gl::GL_TRUE );
       mapped_ = false;
     }
     ~MappedGLBuffer()
     {
       assert( !mapped_ );
+      gl::glUnmapNamedBuffer( id_ );
       gl::glDeleteBuffers( 1, &id_ );
     }
   };
@@ -79,7 +88,7 @@ namespace neko {
   };
 
   class AttribWriter: public nocopy {
-  private:
+  public:
     struct Record {
       AttributeType type_;
       GLenum stype_;
@@ -91,11 +100,13 @@ namespace neko {
       {
       }
     };
+  private:
     vector<Record> recs_;
     GLsizei stride_;
   public:
     AttribWriter(): stride_( 0 ) {}
     inline GLsizei stride() const { return stride_; }
+    inline const vector<Record>& records() const { return recs_; }
     void add( AttributeType type, GLenum datatype = gl::GL_FLOAT, bool normalize = false )
     {
       GLsizei count = 0;
@@ -146,6 +157,8 @@ namespace neko {
         size = ( count * sizeof( float ) );
       else if ( datatype == gl::GL_UNSIGNED_BYTE )
         size = ( count * sizeof( uint8_t ) );
+      else if ( datatype == gl::GL_SHORT || datatype == gl::GL_UNSIGNED_SHORT )
+        size = ( count * sizeof( uint16_t ) );
       else
         NEKO_EXCEPT( "Unsupported vertex attribute type in writer" );
       recs_.emplace_back( type, datatype, count, size, normalize );
@@ -185,9 +198,9 @@ namespace neko {
       }
       else if constexpr ( std::is_same_v<VertexType, VertexText> )
       {
-        add( Attrib_Pos3D ); // vec3 position
-        add( Attrib_Texcoord2D ); // vec2 texcoord
-        add( Attrib_Color4D ); // vec4 color
+        add( Attrib_Pos2D, gl::GL_SHORT ); // vec2 fixed point position
+        add( Attrib_Texcoord2D, gl::GL_UNSIGNED_SHORT, true ); // vec2 texcoord
+        add( Attrib_Color4D, gl::GL_UNSIGNED_BYTE, true ); // vec4 color
       }
       else
       {
@@ -0,0 +1,49 @@
+#pragma once
+#include "neko_types.h"
+#include "gfx_types.h"
+#include "texture.h"
+
+namespace neko {
+
+  class Model;
+
+  //! Binary cache of imported models, so that a model is only parsed and processed once per version of its sources.
+  //! The file opens with a header of the model's nodes, meshes, parts and bounds, the textures its materials use, and
+  //! descriptors of the vertex attributes, in the order an AttribWriter lists them for Vertex3D. The vertex, index and
+  //! encoded image blocks follow from the next aligned offset, each aligned from the start of the file, so that they can
+  //! be read and uploaded in place from a file mapping.
+  //! Files are named after a hash of the model's main source file. Any further files it read, such as .bin buffers and
+  //! images, are listed in the header with a hash of their contents, and a change to them also means a fresh import.
+  class MeshCache {
+  public:
+    static constexpr uint32_t c_cacheMagic = 0x48534D4E; //!< 'NMSH'
+    static constexpr uint32_t c_cacheVersion = 1; //!< Bump when the layout or the importer's output changes
+    static constexpr size_t c_alignment = 64; //!< Of every data block
+    //! A texture to decode for the model, still encoded as PNG, JPEG or anything else stb_image can read.
+    struct Image
+    {
+      utf8String name; //!< Without the model's name in front
+      Texture::Wrapping wrapping = Texture::Repeat;
+      span<const uint8_t> encoded;
+    };
+    //! Textures of a model, and which one each of its materials uses.
+    struct Images
+    {
+      vector<Image> images;
+      vector<int> materials; //!< Index into images per material, -1 for none
+      shared_ptr<void> owner; //!< Keeps the encoded bytes of a fresh import alive; cached ones live in the model's mapping
+    };
+    static uint64_t key( span<const uint8_t> source );
+    //! Hash of the files besides the main source that an import read.
+    static uint64_t hashDependencies( const vector<utf8String>& paths );
+    //! Fill the model's nodes and meshes from the cache, with its vertices and indices left in the mapped file.
+    //! False if there's no cache for this key, or it's out of date.
+    static bool load( Model& model, uint64_t key, Images& images );
+    //! Dependencies are relative to the meshes directory.
+    static void save( const Model& model, uint64_t key, const vector<utf8String>& dependencies, const Images& images );
+    //! Load the model from the cache, or import it from its glTF source and cache the result. True if it was cached.
+    //! Implemented in loader_gltf.cpp, next to the importer.
+    static bool fetch( Model& model, Images& images );
+  };
+
+}
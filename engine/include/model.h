@@ -0,0 +1,93 @@
+#pragma once
+#include "neko_types.h"
+#include "gfx_types.h"
+#include "resources.h"
+#include "materials.h"
+#include "filesystem.h"
+
+namespace neko {
+
+  //! One draw's worth of a mesh: an indexed triangle list with a single material.
+  //! Parts loaded from the mesh cache leave their vertices and indices in the mapped cache file instead of the vectors,
+  //! so read them through vertexData() and indexData().
+  struct ModelPart
+  {
+    vector<Vertex3D> vertices;
+    vector<GLuint> indices;
+    span<const Vertex3D> mappedVertices;
+    span<const GLuint> mappedIndices;
+    int material = -1; //!< Index into the model's materials, -1 for none
+    vec3 boundsMin { 0.0f };
+    vec3 boundsMax { 0.0f };
+    inline span<const Vertex3D> vertexData() const noexcept
+    {
+      return ( mappedVertices.empty() ? span<const Vertex3D>( vertices ) : mappedVertices );
+    }
+    inline span<const GLuint> indexData() const noexcept
+    {
+      return ( mappedIndices.empty() ? span<const GLuint>( indices ) : mappedIndices );
+    }
+  };
+
+  struct ModelMesh
+  {
+    utf8String name;
+    vector<ModelPart> parts;
+    vec3 boundsMin { 0.0f };
+    vec3 boundsMax { 0.0f };
+  };
+
+  struct ModelNode
+  {
+    utf8String name;
+    vec3 translate { 0.0f };
+    quaternion rotate { 1.0f, 0.0f, 0.0f, 0.0f };
+    vec3 scale { 1.0f };
+    int parent = -1; //!< Parents are always listed before their children
+    int mesh = -1;
+  };
+
+  //! A scene hierarchy of meshes imported from a glTF 2.0 file, loaded by ThreadedLoader.
+  //! Vertices and indices stay on the host; the textures come back through the loader like any other materials'.
+  class Model: public LoadedResourceBase<Model> {
+  public:
+    using Base = LoadedResourceBase<Model>;
+    using Base::Ptr;
+    friend class ThreadedLoader;
+    friend class ModelManager;
+    friend class MeshCache;
+  protected:
+    utf8String path_; //!< Relative to the meshes directory
+    vector<ModelNode> nodes_;
+    vector<ModelMesh> meshes_;
+    //! One per glTF material, holding its base color texture, or null if it has none.
+    //! Materials sharing an image share the pointer.
+    MaterialVector materials_;
+    FileMappingPtr cache_; //!< Holds the mapped vertices and indices of a model loaded from the mesh cache
+  public:
+    Model() = delete;
+    Model( const utf8String& name, const utf8String& path ): Base( name ), path_( path ) {}
+    inline const utf8String& path() const noexcept { return path_; }
+    inline const vector<ModelNode>& nodes() const noexcept { return nodes_; }
+    inline const vector<ModelMesh>& meshes() const noexcept { return meshes_; }
+    inline const MaterialVector& materials() const noexcept { return materials_; }
+  };
+
+  using ModelPtr = Model::Ptr;
+  using ModelVector = vector<ModelPtr>;
+
+  class ModelManager: public LoadedResourceManagerBase<Model> {
+  public:
+    using Base = LoadedResourceManagerBase<Model>;
+    using ResourcePtr = Base::ResourcePtr;
+    using MapType = Base::MapType;
+  public:
+    ModelManager( ThreadedLoaderPtr loader );
+    //! Queue a .gltf or .glb file from the meshes directory for loading.
+    ModelPtr loadModel( const utf8String& name, const utf8String& path );
+    //! Pick up the models the loader has finished. Render thread.
+    void update();
+    ~ModelManager();
+  };
+
+}
@@ -10,15 +10,126 @@
 #include "shaders.h"
 #include "math_aabb.h"
 #include "buffers.h"
+#include "radixsort.h"
 
 namespace neko {
 
+  //! A change applied to every live particle on each update, in the order the system lists them.
+  struct ParticleAffector
+  {
+    enum Type
+    {
+      Gravity, //!< Constant acceleration a.xyz
+      Drag, //!< Fraction a.x of velocity lost per second
+      ColorOverLife, //!< Color from a to b over the lifetime, replacing the emitted color
+      SizeOverLife //!< Size from a.xy to b.xy over the lifetime, replacing the emitted size
+    } type = Gravity;
+    vec4 a { 0.0f };
+    vec4 b { 0.0f };
+    static ParticleAffector gravity( const vec3& acceleration );
+    static ParticleAffector drag( Real coefficient );
+    static ParticleAffector colorOverLife( const vec4& from, const vec4& to );
+    static ParticleAffector sizeOverLife( const vec2& from, const vec2& to );
+  };
+
+  //! Spawns particles at a steady rate within a box. Initial values are picked uniformly within their spreads.
+  struct ParticleEmitter
+  {
+    vec3 position { 0.0f };
+    vec3 extents { 0.0f }; //!< Half size of the spawn box
+    vec3 velocity { 0.0f };
+    vec3 velocitySpread { 0.0f }; //!< Up to this much more or less, per axis
+    vec4 color { 1.0f };
+    vec2 size { 1.0f };
+    Real rate = 0.0f; //!< Particles per second
+    Real lifetime = 1.0f; //!< Seconds
+    Real lifetimeSpread = 0.0f;
+    bool enabled = true;
+    double pending = 0.0; //!< Fractional spawns carried over between updates
+  };
+
+  //! Particles drawn with one material, stored as a structure of arrays in fixed size chunks.
+  //! Each chunk keeps its live particles packed at its front, so chunks simulate, retire and write their vertices
+  //! independently on worker threads, without particles ever moving between chunks. Simulation runs four
+  //! particles at a time; retiring swaps the chunk's last particle into each hole, so it costs only the deaths.
+  //! Updates come once per logic tick, so positions before and after the latest one are both kept, and drawing
+  //! places the particles between them by how far the renderer is into the next tick.
+  class ParticleSystem {
+  public:
+    static constexpr size_t c_chunkSize = 16384; //!< Particles per chunk, a multiple of the SIMD width
+    enum Stream
+    {
+      Stream_PositionX = 0,
+      Stream_PositionY,
+      Stream_PositionZ,
+      Stream_VelocityX,
+      Stream_VelocityY,
+      Stream_VelocityZ,
+      Stream_Age,
+      Stream_InverseLifetime,
+      Stream_ColorR,
+      Stream_ColorG,
+      Stream_ColorB,
+      Stream_ColorA,
+      Stream_SizeX,
+      Stream_SizeY,
+      Stream_PreviousX, //!< Position before the latest update, drawing blends from it
+      Stream_PreviousY,
+      Stream_PreviousZ,
+      MAX_Stream
+    };
+  protected:
+    utf8String material_;
+    size_t maxParticles_;
+    vector<float> streams_[MAX_Stream];
+    vector<uint32_t> counts_; //!< Live particles per chunk
+    size_t alive_ = 0;
+    vector<ParticleEmitter> emitters_;
+    vector<ParticleAffector> affectors_;
+    std::mt19937 random_;
+    bool sorted_ = true;
+    vector<radix::DepthEntry> order_;
+    vector<radix::DepthEntry> scratch_;
+    vector<VertexPointParticle> vertices_; //!< Unsorted vertices, when sorting
+    void spawn( ParticleEmitter& emitter, size_t count );
+  public:
+    ParticleSystem( const utf8String& material, size_t maxParticles );
+    inline const utf8String& material() const noexcept { return material_; }
+    inline size_t alive() const noexcept { return alive_; }
+    inline size_t maxParticles() const noexcept { return maxParticles_; }
+    inline vector<ParticleEmitter>& emitters() noexcept { return emitters_; }
+    inline vector<ParticleAffector>& affectors() noexcept { return affectors_; }
+    //! Whether drawing sorts the particles back to front. Order independent blending, such as additive, can skip it.
+    inline bool sorted() const noexcept { return sorted_; }
+    inline void sorted( bool sort ) noexcept { sorted_ = sort; }
+    //! Advance the live particles, retire the expired and spawn new ones. Runs on worker threads, returns when done.
+    //! Positions from before are kept for interpolation, so this should be called once per logic tick.
+    void update( Real delta );
+    //! Write every live particle as a vertex, interpolation of the way from its previous to its current position.
+    //! Out must hold alive().
+    void write( span<VertexPointParticle> out, Real interpolation = 1.0f ) const;
+    //! As above, back to front by depth along the view unless the system isn't sorted.
+    void write( span<VertexPointParticle> out, const mat4& view, Real interpolation = 1.0f );
+    void clear();
+  };
+
+  using ParticleSystemPtr = shared_ptr<ParticleSystem>;
+
   class ParticleSystemManager {
+  protected:
+    vector<ParticleSystemPtr> systems_;
+    unique_ptr<PointRenderBuffer> points_;
+    Real interpolation_ = 1.0f;
   public:
     ParticleSystemManager();
-    void update( GameTime delta, GameTime time );
-    void draw( Shaders& shaders, MaterialManager& materials );
+    ParticleSystemPtr createSystem( const utf8String& material, size_t maxParticles );
+    void destroySystem( const ParticleSystemPtr& system );
+    //! Advance every system by delta, if any game time has passed. Interpolation is the fraction of a logic step
+    //! since the latest tick, and places the particles when drawn.
+    void update( GameTime delta, GameTime time, Real interpolation );
+    //! Stream every system's particles and draw them as billboards with their material.
+    void draw( Renderer& renderer, const Camera& camera );
     ~ParticleSystemManager();
   };
 
-}
\ No newline at end of file
+}
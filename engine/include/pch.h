@@ -67,6 +67,7 @@
 #include <stack>
 #include <cstdint>
 #include <algorithm>
+#include <functional>
 #include <random>
 #include <filesystem>
 #include <queue>
@@ -77,6 +78,7 @@
 #include <optional>
 #include <chrono>
 #include <span>
+#include <execution>
 
 #include <fcntl.h>
 #include <io.h>
@@ -134,6 +136,8 @@
 # include <unicode/utf16.h>
 # include <unicode/uchriter.h>
 # include <unicode/schriter.h>
+# include <unicode/brkiter.h>
+# include <unicode/ubidi.h>
 #endif // !NEKO_NO_ICU
 
 #pragma warning( pop )
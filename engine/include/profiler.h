@@ -0,0 +1,106 @@
+#pragma once
+#include "neko_types.h"
+#include "gfx_types.h"
+#include "forwards.h"
+
+namespace neko {
+
+  //! A completed scope on some thread's timeline.
+  struct ProfileEvent
+  {
+    const char* name; //!< Must outlive the profiler; markers pass string literals
+    uint64_t start; //!< Nanoseconds on the profiler clock
+    uint64_t end;
+  };
+
+  //! Fixed size ring of the most recent events of one thread.
+  //! Single producer (the owning thread), any number of readers. Readers copy the ring and drop whatever
+  //! got overwritten while they were copying, along with the oldest one whose slot may be mid-write,
+  //! so the producer never waits.
+  class ProfileThreadBuffer {
+  public:
+    static constexpr size_t c_capacity = 16384;
+    static_assert( ( c_capacity & ( c_capacity - 1 ) ) == 0, "Capacity must be a power of two" );
+  protected:
+    ProfileEvent events_[c_capacity];
+    atomic<uint64_t> written_ { 0 };
+  public:
+    utf8String name_;
+    uint32_t id_;
+    ProfileThreadBuffer( uint32_t id ): id_( id ) {}
+    inline void push( const ProfileEvent& event )
+    {
+      const auto index = written_.load( std::memory_order_relaxed );
+      events_[index & ( c_capacity - 1 )] = event;
+      written_.store( index + 1, std::memory_order_release );
+    }
+    //! Append the events still in the ring to out, oldest first.
+    void snapshot( vector<ProfileEvent>& out ) const;
+  };
+
+  //! Collects scoped CPU markers from every thread and GPU timestamp queries from the render thread,
+  //! for the editor overlay and Chrome trace export (chrome://tracing, Perfetto).
+  //! Use through the NEKO_PROFILE_* macros, which compile to nothing unless NEKO_PROFILER is defined.
+  class Profiler {
+  public:
+    static constexpr size_t c_gpuFrames = 4; //!< Frames of GPU queries in flight before reading results back
+    static constexpr size_t c_gpuScopesPerFrame = 128;
+    static inline uint64_t now()
+    {
+      return static_cast<uint64_t>(
+        chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now().time_since_epoch() ).count() );
+    }
+    //! This thread's buffer, registered on first use.
+    static ProfileThreadBuffer& thread();
+    static void nameThread( const char* name );
+    static inline void record( const char* name, uint64_t start, uint64_t end ) { thread().push( { name, start, end } ); }
+    //! Render thread only. Returns the scope's index for gpuEnd, or -1 if this frame's queries ran out.
+    static int gpuBegin( const char* name );
+    static void gpuEnd( int index );
+    //! Render thread only. Read back the oldest frame's queries and start a new frame. Call once per frame.
+    static void gpuFrame();
+    //! Render thread only. Release the queries while the context still exists.
+    static void gpuShutdown();
+    //! Write everything still in the rings as Chrome trace event JSON.
+    static void exportTrace( const utf8String& filename );
+    //! Per thread summary of the last second's markers.
+    static void imguiWindow();
+  };
+
+  class ProfileScope {
+  protected:
+    const char* name_;
+    uint64_t start_;
+  public:
+    inline ProfileScope( const char* name ): name_( name ), start_( Profiler::now() ) {}
+    inline ~ProfileScope() { Profiler::record( name_, start_, Profiler::now() ); }
+  };
+
+  class GpuProfileScope {
+  protected:
+    int index_;
+  public:
+    inline GpuProfileScope( const char* name ): index_( Profiler::gpuBegin( name ) ) {}
+    inline ~GpuProfileScope() { Profiler::gpuEnd( index_ ); }
+  };
+
+}
+
+#define NEKO_PROFILE_CONCAT_INNER( a, b ) a##b
+#define NEKO_PROFILE_CONCAT( a, b ) NEKO_PROFILE_CONCAT_INNER( a, b )
+
+#ifdef NEKO_PROFILER
+//! Time the rest of the enclosing scope. The name must be a string literal.
+# define NEKO_PROFILE_SCOPE( name ) ::neko::ProfileScope NEKO_PROFILE_CONCAT( neko_profile_, __LINE__ )( name )
+# define NEKO_PROFILE_FUNCTION() NEKO_PROFILE_SCOPE( __FUNCTION__ )
+//! Time the GPU work issued in the rest of the enclosing scope. Render thread only.
+# define NEKO_PROFILE_GPU( name ) ::neko::GpuProfileScope NEKO_PROFILE_CONCAT( neko_profile_gpu_, __LINE__ )( name )
+# define NEKO_PROFILE_GPU_FRAME() ::neko::Profiler::gpuFrame()
+# define NEKO_PROFILE_THREAD( name ) ::neko::Profiler::nameThread( name )
+#else
+# define NEKO_PROFILE_SCOPE( name )
+# define NEKO_PROFILE_FUNCTION()
+# define NEKO_PROFILE_GPU( name )
+# define NEKO_PROFILE_GPU_FRAME() ( (void)0 )
+# define NEKO_PROFILE_THREAD( name ) ( (void)0 )
+#endif
@@ -0,0 +1,44 @@
+#pragma once
+#include "neko_types.h"
+
+namespace neko {
+
+  //! Radix sorting of key & index pairs, so that only the pairs move and the sorted items stay where they are.
+  //! Large inputs are split into blocks that are counted and scattered on worker threads.
+  namespace radix {
+
+    template <typename Key>
+    struct Entry
+    {
+      Key key;
+      uint32_t index;
+    };
+
+    using DepthEntry = Entry<uint32_t>;
+
+    //! Inputs smaller than this are sorted on the calling thread, as splitting them costs more than it saves.
+    constexpr size_t c_parallelThreshold = 65536;
+    constexpr size_t c_blockSize = 32768; //!< Entries per worker block
+
+    //! Map a float to an unsigned integer with the same ordering.
+    inline uint32_t floatBits( float value )
+    {
+      uint32_t bits;
+      memcpy( &bits, &value, sizeof( bits ) );
+      // Negative floats sort in reverse when treated as integers, so flip all their bits;
+      // positive ones just need the sign bit set to land above the negatives.
+      return bits ^ ( ( bits & 0x80000000u ) ? 0xFFFFFFFFu : 0x80000000u );
+    }
+
+    //! LSD radix sort by key, eight bits at a time. Digits that are equal across all entries are skipped,
+    //! so keys that vary in only a few bits cost fewer passes. Stable, so equal keys keep their input order.
+    void sort( vector<Entry<uint32_t>>& entries, vector<Entry<uint32_t>>& scratch );
+    void sort( vector<Entry<uint64_t>>& entries, vector<Entry<uint64_t>>& scratch );
+
+    //! MSD radix sort by key in place, without the scratch copy. Equal keys end up in no particular order.
+    void sortInPlace( vector<Entry<uint32_t>>& entries );
+    void sortInPlace( vector<Entry<uint64_t>>& entries );
+
+  }
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "neko_types.h"
+#include "forwards.h"
+#include "components.h"
+
+namespace neko {
+
+  class ViewportDrawParameters;
+
+  //! Synthetic render load for tracking renderer performance over time.
+  //! Fills the scene with a grid of one kind of renderable, draws a fixed number of frames into the game
+  //! framebuffers, finishing each one, and reports frame time percentiles. Every frame is drawn at the same
+  //! game time, so dumped frames are comparable between runs for image diff regression tests.
+  //! Requested from the console with bench_render, run by the render thread between frames.
+  class RenderBenchmark {
+  public:
+    enum Scene
+    {
+      Scene_Sprites,
+      Scene_Texts,
+      Scene_Primitives,
+      Scene_Paintables,
+      MAX_Scene
+    };
+    struct Settings
+    {
+      Scene scene = Scene_Sprites;
+      int count = 1000;
+      int frames = 300;
+      int warmup = 30; //!< Frames drawn first and not measured, giving the loader time to deliver materials & fonts
+      bool dump = false; //!< Write the last frame as a PNG
+    };
+    struct Results
+    {
+      double average = 0.0;
+      double p50 = 0.0;
+      double p90 = 0.0;
+      double p99 = 0.0;
+      double worst = 0.0;
+    };
+  protected:
+    Settings settings_;
+    vector<c::entity> entities_;
+    void populate( SManager& scene );
+    void clear( SManager& scene );
+    void dumpFrame( Renderer& renderer, const utf8String& filename );
+  public:
+    static const char* c_sceneNames[MAX_Scene];
+    //! Queue a run for the render thread. Any thread.
+    static void request( const Settings& settings );
+    //! Take the queued run, if any. Render thread.
+    static bool takeRequest( Settings& out );
+    explicit RenderBenchmark( const Settings& settings ): settings_( settings ) {}
+    //! Render thread, with the scene locked for writing.
+    Results run( Renderer& renderer, SManager& scene, const ViewportDrawParameters& params );
+  };
+
+}
@@ -0,0 +1,186 @@
+#pragma once
+#include "neko_types.h"
+#include "gfx_types.h"
+#include "forwards.h"
+#include "streambuffer.h"
+#include "radixsort.h"
+
+namespace neko {
+
+  struct Pipeline;
+
+  //! Render passes, in execution order.
+  //! The pass occupies the topmost bits of a sort key, so a sorted list is grouped by pass.
+  enum RenderPass: uint8_t
+  {
+    RenderPass_Opaque = 0, //!< Depth tested & written, sorted by state then front to back
+    RenderPass_Transparent, //!< Depth tested but not written, sorted back to front then by state
+    MAX_RenderPass
+  };
+
+  //! Which optional per-draw uniforms a command carries.
+  //! Only consulted for pipelines without a draw buffer, which always receive every value.
+  enum DrawParamFlags: uint8_t
+  {
+    DrawParam_None = 0,
+    DrawParam_TextureLayer = 1, //!< int tex_layer
+    DrawParam_TextureDimensions = 2, //!< vec2 tex_dimensions
+    DrawParam_PositionScale = 4 //!< float posscale
+  };
+
+  //! Per-draw uniform values.
+  //! Kept out of line from DrawCommand so that the commands themselves stay small to sort.
+  struct DrawParams
+  {
+    mat4 model { 1.0f };
+    vec2 textureDimensions { 0.0f, 0.0f };
+    Real positionScale = 1.0f;
+    int32_t textureLayer = 0;
+    uint8_t flags = DrawParam_None;
+  };
+
+  //! A single recorded indexed draw.
+  struct DrawCommand
+  {
+    uint64_t key; //!< Sort key, see RenderCommandList::makeKey
+    GLuint vao; //!< Vertex array, with its element buffer attached
+    GLuint texture; //!< Texture bound to unit 0
+    uint16_t pipeline; //!< Index into the owning list's pipeline table
+    uint16_t shortIndices; //!< Whether the element buffer holds 16-bit instead of 32-bit indices
+    GLsizei count; //!< Index count
+    GLint baseVertex; //!< Added to every index
+    uint32_t params; //!< Index into the owning list's DrawParams
+  };
+
+  //! A list of draw commands recorded by the scene systems, sorted before execution.
+  //! Sort keys are laid out so that a plain integer sort yields the desired order:
+  //! - Opaque:      pass:4 | pipeline:12 | material:16 | depth:32
+  //! - Transparent: pass:4 | inverted depth:32 | pipeline:12 | material:16
+  //! Opaque draws are thus grouped to minimize state changes, while transparent ones are
+  //! drawn back to front and only batched where their depths coincide.
+  class RenderCommandList {
+  public:
+    static constexpr int c_passBits = 4;
+    static constexpr int c_pipelineBits = 12;
+    static constexpr int c_materialBits = 16;
+    static constexpr int c_depthBits = 32;
+    static constexpr size_t c_maxPipelines = ( 1 << c_pipelineBits );
+    //! Key entry for sorting, so that the commands themselves need not be moved.
+    using SortEntry = radix::Entry<uint64_t>;
+  protected:
+    vector<DrawCommand> commands_;
+    vector<DrawParams> params_;
+    vector<utf8String> pipelines_;
+    vector<SortEntry> order_;
+    vector<SortEntry> scratch_;
+    bool sorted_ = true;
+  public:
+    //! Map a float depth to an unsigned integer with the same ordering.
+    static inline uint32_t depthBits( Real depth ) { return radix::floatBits( depth ); }
+    static uint64_t makeKey( RenderPass pass, uint16_t pipeline, uint16_t material, Real depth );
+    //! Distance along the view direction to a model's origin, for use as the sort depth.
+    static inline Real viewDepth( const mat4& view, const mat4& model ) { return -( view * model[3] ).z; }
+    static inline RenderPass keyPass( uint64_t key ) { return static_cast<RenderPass>( key >> ( 64 - c_passBits ) ); }
+    //! Find or register a pipeline by name, returning its index.
+    uint16_t pipeline( const utf8String& name );
+    inline const utf8String& pipelineName( uint16_t index ) const { return pipelines_[index]; }
+    inline size_t pipelineCount() const noexcept { return pipelines_.size(); }
+    //! Record an indexed draw. The returned params may be filled in by the caller until the next record.
+    DrawParams& draw( RenderPass pass, uint16_t pipeline, GLuint vao, GLuint texture, GLsizei count, Real depth,
+      bool shortIndices = false, GLint baseVertex = 0 );
+    inline DrawParams& draw( RenderPass pass, const utf8String& pipeline, GLuint vao, GLuint texture, GLsizei count,
+      Real depth, bool shortIndices = false, GLint baseVertex = 0 )
+    {
+      return draw( pass, this->pipeline( pipeline ), vao, texture, count, depth, shortIndices, baseVertex );
+    }
+    //! Stable radix sort by key, see radix::sort. Only a few pipelines & materials cost fewer passes.
+    void sort();
+    //! Forget recorded commands. The pipeline table is kept, so indices stay stable across frames.
+    void clear();
+    inline bool sorted() const noexcept { return sorted_; }
+    inline size_t size() const noexcept { return commands_.size(); }
+    inline bool empty() const noexcept { return commands_.empty(); }
+    //! Access commands in sorted order. Only valid after sort().
+    inline const DrawCommand& sortedCommand( size_t i ) const { return commands_[order_[i].index]; }
+    inline const DrawParams& params( const DrawCommand& cmd ) const { return params_[cmd.params]; }
+    inline const DrawParams& params( size_t index ) const { return params_[index]; }
+    inline size_t paramsCount() const noexcept { return params_.size(); }
+    //! Range of sorted indices belonging to the given pass.
+    pair<size_t, size_t> passRange( RenderPass pass ) const;
+  };
+
+  struct RenderBackendStats
+  {
+    size_t draws = 0;
+    size_t batches = 0; //!< Runs of draws sharing pipeline, vertex array & texture
+    size_t pipelineChanges = 0;
+    size_t vaoChanges = 0;
+    size_t textureChanges = 0;
+    size_t errors = 0;
+    inline void reset() { *this = RenderBackendStats(); }
+  };
+
+  //! Executes sorted command lists.
+  //! Redundant binds are filtered here rather than in the implementations, so that the
+  //! state change counts of the null backend match what the GL backend would issue.
+  class RenderBackend {
+  protected:
+    RenderBackendStats stats_;
+    virtual void beginPass( RenderPass pass ) = 0;
+    virtual void bindPipeline( const RenderCommandList& list, uint16_t pipeline ) = 0;
+    virtual void bindVao( GLuint vao ) = 0;
+    virtual void bindTexture( GLuint texture ) = 0;
+    virtual void submit( const RenderCommandList& list, const DrawCommand& cmd, const DrawParams& params ) = 0;
+    virtual void endPass( RenderPass pass ) {}
+  public:
+    //! Execute all commands of one pass. The list must be sorted.
+    void execute( const RenderCommandList& list, RenderPass pass );
+    inline const RenderBackendStats& stats() const noexcept { return stats_; }
+    inline void resetStats() { stats_.reset(); }
+    virtual ~RenderBackend() {}
+  };
+
+  //! Backend that issues the commands to OpenGL.
+  //! Pipelines built with a draw buffer read their per-draw values from a storage buffer range, streamed once
+  //! per list, instead of having them set as uniforms on every draw.
+  class GLRenderBackend: public RenderBackend {
+  public:
+    using PassStateCallback = std::function<void( RenderPass pass )>;
+    //! Storage buffer binding of the draw buffer, matching inc.buffers.glsl.
+    static constexpr gl::GLuint c_drawBufferBinding = 2;
+  protected:
+    Shaders& shaders_;
+    PassStateCallback passState_;
+    Pipeline* pipeline_ = nullptr;
+    StreamBuffer::Allocation draws_;
+    void beginPass( RenderPass pass ) override;
+    void bindPipeline( const RenderCommandList& list, uint16_t pipeline ) override;
+    void bindVao( GLuint vao ) override;
+    void bindTexture( GLuint texture ) override;
+    void submit( const RenderCommandList& list, const DrawCommand& cmd, const DrawParams& params ) override;
+    void endPass( RenderPass pass ) override;
+  public:
+    //! passState is invoked at the start of each pass to set up depth, blend & raster state.
+    GLRenderBackend( Shaders& shaders, PassStateCallback passState = {} );
+    inline void passState( PassStateCallback passState ) { passState_ = move( passState ); }
+    //! Stream the list's params into a draw buffer. Call once after recording, before executing any pass.
+    void upload( const RenderCommandList& list );
+  };
+
+  //! Backend that touches no GPU state, only validating the commands and counting what would have been done.
+  //! Usable without a context, for benchmarking recording, sorting and batching.
+  class NullRenderBackend: public RenderBackend {
+  protected:
+    uint64_t lastKey_ = 0;
+    bool validate_ = true;
+    void error( const char* what, const DrawCommand& cmd );
+    void beginPass( RenderPass pass ) override;
+    void bindPipeline( const RenderCommandList& list, uint16_t pipeline ) override;
+    void bindVao( GLuint vao ) override;
+    void bindTexture( GLuint texture ) override;
+    void submit( const RenderCommandList& list, const DrawCommand& cmd, const DrawParams& params ) override;
+  public:
+    NullRenderBackend( bool validate = true ): validate_( validate ) {}
+  };
+
+}
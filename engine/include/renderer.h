@@ -8,6 +8,11 @@
 #include "materials.h"
 #include "scripting.h"
 #include "shaders.h"
+#include "rendercommands.h"
+#include "glstate.h"
+#include "streambuffer.h"
+#include "texturestreaming.h"
+#include "buffers.h"
 #include "viewport.h"
 #include "gfx.h"
 #include "console.h"
@@ -68,7 +73,7 @@ namespace neko {
       GLGraphicsFormat internalType, const void* data,
       GLWrapMode wrap = GLenum::GL_REPEAT,
       Texture::Filtering filtering = Texture::Linear,
-      int samples = 1 );
+      int samples = 1, int levels = 1 );
     GLuint implCreateTexture2DArray( int width, int height, int depth,
       GLGraphicsFormat format, GLGraphicsFormat internalFormat,
       GLGraphicsFormat internalType, const void* data,
@@ -86,16 +91,23 @@ namespace neko {
     ConsolePtr console_;
     ThreadedLoaderPtr loader_;
     FontManagerPtr fonts_;
+    GLStateCache state_;
+    unique_ptr<StreamBuffer> stream_;
     ShadersPtr shaders_;
 #ifndef NEKO_NO_SCRIPTING
     TextManagerPtr texts_;
 #endif
     platform::RWLock loadLock_;
     MaterialManagerPtr materials_;
+    unique_ptr<TextureStreamer> streamer_;
     ParticleSystemManagerPtr particles_;
     SpriteManagerPtr sprites_;
+    ModelManagerPtr models_;
     DirectorPtr director_;
     vec2 resolution_;
+    RenderCommandList commands_;
+    unique_ptr<GLRenderBackend> backend_;
+    unique_ptr<LineRenderBuffer<24>> frustumViz_;
     struct DrawCtx
     {
       FramebufferPtr fboMainMultisampled_;
@@ -132,6 +144,9 @@ namespace neko {
       PixelFormat format, const void* data, const Texture::Wrapping wrapping = Texture::Repeat,
       const Texture::Filtering filtering = Texture::Linear );
     inline MaterialManager& materials() noexcept { return *( materials_.get() ); }
+    inline TextureStreamer& streamer() noexcept { return *streamer_; }
+    inline ModelManager& models() noexcept { return *models_; }
+    inline const vec2& resolution() const noexcept { return resolution_; }
     inline ThreadedLoaderPtr loader() noexcept { return loader_; }
     Pipeline& useMaterial( const utf8String& name );
     void bindVao( GLuint id );
@@ -146,10 +161,13 @@ namespace neko {
         return ctx_.mergedMain_->texture( 0 );
       return {};
     }
-    void update( SManager& scene, GameTime delta, GameTime time );
+    //! Interpolation is the fraction of a logic step since the latest tick, see SManager::update.
+    void update( SManager& scene, GameTime delta, GameTime time, Real interpolation = 1.0f );
     void uploadTextures();
     void jsRestart();
     inline Shaders& shaders() noexcept { return *( shaders_.get() ); }
+    inline GLStateCache& state() noexcept { return state_; }
+    inline StreamBuffer& stream() noexcept { return *stream_; }
     void drawGame( GameTime time, SManager& scene, Camera& camera, const Viewport* viewport,
       const ViewportDrawParameters& params, const RenderVisualizations& vis, bool showVis );
     void draw( GameTime time, SManager& scene, Camera& camera, const ViewportDrawParameters& drawparams,
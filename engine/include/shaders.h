@@ -4,6 +4,8 @@
 #include "forwards.h"
 #include "neko_exception.h"
 #include "mesh_primitives.h"
+#include "glstate.h"
+#include "streambuffer.h"
 #include "inc.buffers.glsl"
 
 namespace neko {
@@ -23,6 +25,25 @@ namespace neko {
 
   class Shaders;
 
+  //! Uniforms set on hot paths, with their locations resolved once at link time.
+  //! Anything else can still be set by name, at the cost of a map lookup per stage.
+  enum Uniform: int
+  {
+    Uniform_Model = 0, //!< mat4 model
+    Uniform_Tex, //!< sampler tex
+    Uniform_TexLayer, //!< int tex_layer
+    Uniform_TexDimensions, //!< vec2 tex_dimensions
+    Uniform_PositionScale, //!< float posscale
+    MAX_Uniform
+  };
+
+  //! GLSL names of the Uniform enum values.
+  extern const char* c_uniformNames[MAX_Uniform];
+
+  //! Pipelines built with this define source per-draw values from the draw buffer, indexed by
+  //! the base instance, instead of from uniforms. See DrawData in inc.buffers.glsl.
+  constexpr const char* c_drawBufferDefine = "NEKO_DRAW_BUFFER";
+
   struct Shader: public nocopy
   {
     friend class Shaders;
@@ -48,7 +69,8 @@ namespace neko {
   protected:
     GLuint id_;
     bool linked_;
-    map<string, GLint> uniforms_;
+    map<string, GLint, std::less<>> uniforms_;
+    GLint locations_[MAX_Uniform];
   public:
     Program();
     inline GLuint id() const { return id_; }
@@ -185,15 +207,23 @@ namespace neko {
     inline GLint getUniformLocation( const char* name )
     {
       auto ret = gl::glGetUniformLocation( id_, name );
-      uniforms_[name] = ret;
+      uniforms_.emplace( name, ret );
       return ret;
     }
+    inline GLint location( Uniform uniform ) const { return locations_[uniform]; }
+    template <typename T>
+    inline void setUniform( Uniform uniform, T const & value )
+    {
+      setUniform<T>( locations_[uniform], value );
+    }
     template <typename T>
     inline void setUniform( const char* name, T const & value )
     {
-      if ( uniforms_.find( name ) == uniforms_.end() )
+      // Transparent lookup, so no std::string is built for names already known
+      auto it = uniforms_.find( string_view( name ) );
+      if ( it == uniforms_.end() )
         return setUniform<T>( getUniformLocation( name ), value );
-      return setUniform<T>( uniforms_[name], value );
+      return setUniform<T>( it->second, value );
     }
     ~Program();
   };
@@ -210,6 +240,8 @@ namespace neko {
     GLuint id_;
     utf8String name_;
     map<ShaderType, ProgramPtr> stages_;
+    vector<Program*> programs_; //!< Flat copy of stages_ for setting uniforms
+    bool drawBuffer_ = false;
   public:
     Pipeline( const utf8String& name );
     inline GLuint id() const { return id_; }
@@ -226,11 +258,20 @@ namespace neko {
       return stages_[stage];
     }
     inline bool ready() { return ( gl::glIsProgramPipeline( id_ ) && !stages_.empty() ); }
+    //! Whether the pipeline was built with c_drawBufferDefine.
+    inline bool drawBuffer() const noexcept { return drawBuffer_; }
+    template <typename T>
+    inline Pipeline& setUniform( Uniform uniform, T const & value )
+    {
+      for ( auto program : programs_ )
+        program->setUniform( uniform, value );
+      return ( *this );
+    }
     template <typename T>
     inline Pipeline& setUniform( const char* name, T const & value )
     {
-      for ( auto& stage : stages_ )
-        stage.second->setUniform( name, value );
+      for ( auto program : programs_ )
+        program->setUniform( name, value );
       return ( *this );
     }
     inline Pipeline& setUniformInt( GLint index, int value )
@@ -342,32 +383,85 @@ namespace neko {
   using PipelineVector = vector<PipelinePtr>;
   using PipelineMap = map<utf8String, PipelinePtr>;
 
+  //! A shader source file split into runs of verbatim text and include directives,
+  //! with the #ifdef __cplusplus sections of shared headers already dropped.
+  struct ShaderSource
+  {
+    static constexpr size_t c_text = static_cast<size_t>( -1 );
+    struct Chunk
+    {
+      size_t offset;
+      size_t length;
+      size_t include; //!< Index into includes, or c_text for a run of text
+    };
+    utf8String text;
+    uint64_t hash = 0; //!< Of the file contents
+    vector<utf8String> includes; //!< Direct dependencies, in order of appearance
+    vector<Chunk> chunks;
+    //! Tokenize directives line by line; only #include and the __cplusplus conditionals are acted on.
+    void parse( utf8String contents );
+  };
+
+  struct PipelineDefinition
+  {
+    utf8String name;
+    map<ShaderType, utf8String> files;
+    vector<utf8String> uniforms;
+    vector<utf8String> defines;
+  };
+
   class Shaders: public nocopy {
   protected:
     ConsolePtr console_;
+    GLStateCache& state_;
+    StreamBuffer& stream_;
     ShaderVector shaders_;
     ProgramVector programs_;
     PipelineMap pipelines_;
-    map<utf8String, utf8String> includes_;
-    unique_ptr<MappedGLBuffer<neko::uniforms::World>> world_;
-    unique_ptr<MappedGLBuffer<neko::uniforms::Processing>> processing_;
+    set<utf8String> includes_; //!< The files #include may name, as listed in includes.json
+    map<utf8String, ShaderSource> sources_; //!< Files parsed during the current load
+    map<uint64_t, utf8String> expanded_; //!< Expanded sources by the hash of their whole include tree, kept across reloads
+    uint64_t driverKey_ = 0; //!< Hash of the GL vendor, renderer and version strings, or 0 if binaries can't be saved
+    struct ProgramCacheStats
+    {
+      size_t hits = 0;
+      size_t misses = 0;
+      size_t rejected = 0; //!< Binaries the driver refused to load, e.g. after an update with the same version string
+    } cacheStats_;
+    StreamBuffer::Allocation world_;
+    StreamBuffer::Allocation processing_;
+    uint64_t worldFrame_ = ~0ull; //!< Stream frame world_ was written on; its range is only valid until that frame ends
+    uint64_t processingFrame_ = ~0ull;
     void dumpLog( const GLuint& target, const bool isProgram );
-    void readIncludeFile( utf8String filename );
     void compileShader( Shader& shader, const string_view source );
     void linkSingleProgram( Program& program, Shader& shader, const vector<utf8String>& uniforms );
-    utf8String readSource( const utf8String& filename, int includeDepth = 0 );
-    void buildSeparableProgram( const utf8String& name, const utf8String& filename, ShaderType type, ShaderPtr& shader,
-      ProgramPtr& program, const vector<utf8String>& uniforms );
+    void resolveUniforms( Program& program, const vector<utf8String>& uniforms );
+    //! Restore a linked program from the binary cache. On any failure the program is left for linking from source.
+    bool loadProgramBinary( Program& program, uint64_t key );
+    void saveProgramBinary( const Program& program, uint64_t key );
+    uint64_t sourceKey( const utf8String& filename, int includeDepth = 0 ) const;
+    //! Append the file with its includes substituted; sourceKey must have validated its tree.
+    void expandSource( const utf8String& filename, utf8String& out ) const;
+    //! Read and parse every file the definitions use in parallel, then expand the ones whose include tree changed.
+    void preprocess( const vector<PipelineDefinition>& definitions );
+    void buildSeparableProgram( const utf8String& name, ShaderType type, const utf8String& source, ShaderPtr& shader,
+      ProgramPtr& program, const vector<utf8String>& uniforms, const vector<utf8String>& defines );
+    void buildPipeline( const PipelineDefinition& definition );
   public:
-    Shaders( ConsolePtr console );
-    inline unique_ptr<MappedGLBuffer<neko::uniforms::World>>& world() { return world_; }
-    inline unique_ptr<MappedGLBuffer<neko::uniforms::Processing>>& processing() { return processing_; }
+    Shaders( ConsolePtr console, GLStateCache& state, StreamBuffer& stream );
+    inline GLStateCache& state() noexcept { return state_; }
+    inline StreamBuffer& stream() noexcept { return stream_; }
+    //! Stream a fresh, zeroed world block for the draws that follow and return it for filling in.
+    //! The previous block stays intact for the draws already issued.
+    uniforms::World& writeWorld();
+    //! Stream a fresh, zeroed processing block for the draws that follow and return it for filling in.
+    uniforms::Processing& writeProcessing();
     void initialize();
     Pipeline& usePipeline( const utf8String& name );
     void loadIncludeJSONRaw( const nlohmann::json& arr );
     void loadIncludeJSON( const utf8String& input );
     void loadIncludeFile( const utf8String& filename );
-    void loadPipelineJSONRaw( const nlohmann::json& arr );
+    void loadPipelineJSONRaw( const nlohmann::json& arr, vector<PipelineDefinition>& out );
     void loadPipelineJSON( const utf8String& input );
     void loadPipelineFile( const utf8String& filename );
     void shutdown();
@@ -22,7 +22,7 @@ namespace neko {
   public:
     EditorGridRenderer();
     ~EditorGridRenderer();
-    void update( const EditorViewport& viewport, EditorOrthoCamera& camera );
+    void update( Shaders& shaders, const EditorViewport& viewport, EditorOrthoCamera& camera );
     void draw( Shaders& shaders );
   };
 
@@ -35,6 +35,16 @@ namespace neko {
   using SpriteAnimationDefinitionPtr = shared_ptr<SpriteAnimationDefinition>;
   using SpriteAnimationDefinitionMap = map<utf8String, SpriteAnimationDefinitionPtr>;
 
+  //! Where one animation frame lies in the sprite atlas, in pixels. Transparent borders are trimmed away,
+  //! so size and offset describe the opaque part within the frame's full definition size.
+  struct SpriteAtlasFrame
+  {
+    int page = 0; //!< Array layer
+    vec2i position { 0, 0 }; //!< Top left corner on the page
+    vec2i size { 0, 0 }; //!< Zero for frames with nothing visible
+    vec2i offset { 0, 0 }; //!< Top left corner within the untrimmed frame
+  };
+
   struct SpriteAnimationSetDefinitionEntry
   {
     const utf8String name_;
@@ -44,6 +54,7 @@ namespace neko {
     const vector<int> flipFramesX_ {};
     SpriteAnimationDefinitionPtr definition_;
     MaterialPtr material_;
+    vector<SpriteAtlasFrame> atlasFrames_; //!< When loaded from an atlas, which material_ is then shared by all
   public:
     SpriteAnimationSetDefinitionEntry( const utf8String& name, const utf8String& sheetname, const utf8String& defname,
       const vec2i& sheetpos, const vector<int>& flipframesx );
@@ -62,12 +73,27 @@ namespace neko {
   using SpriteAnimationSetDefinitionVector = vector<SpriteAnimationSetDefinitionPtr>;
   using SpriteAnimationSetDefinitionMap = map<utf8String, SpriteAnimationSetDefinitionPtr>;
 
+  //! Pages of a packed sprite atlas, loaded as the layers of one array material. See SpriteAtlasPacker.
+  struct SpriteAtlas
+  {
+    utf8String name_;
+    vec2i pageSize_ { 0, 0 };
+    vector<utf8String> pages_; //!< Page image filenames
+    MaterialPtr material_;
+  };
+
+  using SpriteAtlasPtr = shared_ptr<SpriteAtlas>;
+
   class SpriteManager {
   private:
     Renderer* renderer_ = nullptr;
     SpriteAnimationDefinitionMap animdefs_;
     SpriteAnimationSetDefinitionMap sets_;
+    map<utf8String, SpriteAnimationSetDefinitionEntryPtr> atlasEntries_; //!< By set_entry, like their materials
   public:
+    static constexpr uint32_t c_atlasMagic = 0x4153474E; //!< 'NGSA'
+    static constexpr uint32_t c_atlasVersion = 1;
+    //! Renderer may be null when only parsing definitions, as the atlas packer does.
     SpriteManager( Renderer* renderer );
     void initialize();
     void prepareRender( ThreadedLoader& loader );
@@ -75,9 +101,17 @@ namespace neko {
     void loadAnimdefJSONRaw( const nlohmann::json& arr );
     void loadAnimdefJSON( const utf8String& input );
     void loadAnimdefFile( const utf8String& filename );
+    //! Build set definitions without creating materials or loading anything.
+    void parseAnimsetJSON( const nlohmann::json& arr, SpriteAnimationSetDefinitionVector& out ) const;
     void loadAnimsetJSONRaw( const nlohmann::json& arr );
     void loadAnimsetJSON( const utf8String& input );
     void loadAnimsetFile( const utf8String& filename );
+    //! Hash of the definition files an atlas was packed from, to tell when it's out of date.
+    static uint64_t hashSources( const vector<utf8String>& filenames );
+    //! Load a packed atlas manifest in place of the sets' sheets. False if it's missing or not packed from sources.
+    bool loadAtlasFile( const utf8String& filename, uint64_t sources );
+    //! Atlas entry for a set_entry name, or null if sets aren't atlased.
+    SpriteAnimationSetDefinitionEntryPtr atlasEntry( const utf8String& name ) const;
     ~SpriteManager();
   };
 
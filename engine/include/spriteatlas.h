@@ -0,0 +1,64 @@
+#pragma once
+#include "neko_types.h"
+#include "gfx_types.h"
+#include "spriteanim.h"
+#include "textureatlas.h"
+
+namespace neko {
+
+  //! Build time packer for sprite animation frames, run through the sprite_pack command.
+  //! Every frame the sets reference is cut from its sheet (flip-frames-x applied), trimmed of fully transparent
+  //! borders and deduplicated, then packed tallest first into skyline pages. The page size is the smallest power of
+  //! two that holds everything on one page, up to the maximum, past which pages are added instead.
+  //! Writes the pages as PNGs to the textures directory and a binary manifest of frame rectangles, which
+  //! SpriteManager::loadAtlasFile reads instead of cutting up the sheets at load time.
+  class SpriteAtlasPacker {
+  public:
+    static constexpr int c_minPageSize = 64;
+    static constexpr int c_padding = 1; //!< Transparent texels between frames, against bleeding
+    struct Result
+    {
+      size_t frames = 0;
+      size_t unique = 0;
+      size_t pages = 0;
+      int pageSize = 0;
+      Real coverage = 0.0f; //!< Fraction of page area holding frames
+    };
+  protected:
+    struct Image
+    {
+      Pixmap pixels { PixFmtColorRGBA8 }; //!< Trimmed, empty if nothing was visible
+      int page = 0;
+      vec2i position { 0, 0 };
+    };
+    struct Frame
+    {
+      size_t image = 0;
+      vec2i offset { 0, 0 };
+    };
+    struct Entry
+    {
+      utf8String name;
+      utf8String definition;
+      vector<Frame> frames;
+    };
+    struct Set
+    {
+      utf8String name;
+      vector<Entry> entries;
+    };
+    vector<Image> images_;
+    vector<Set> sets_;
+    map<uint64_t, vector<size_t>> known_; //!< Images by content hash, for deduplication
+    uint64_t sources_ = 0;
+    size_t frames_ = 0;
+    Frame addFrame( const Pixmap& frame );
+    bool pack( int pageSize, const vector<size_t>& order, vector<TextureAtlasPtr>& pages );
+  public:
+    //! Cut and trim every frame of the sets in setsFile, with animation definitions from defsFile (both in data).
+    void load( const utf8String& defsFile, const utf8String& setsFile );
+    //! Pack, then write the pages and the manifest to data under filename. The pages take its name as a prefix.
+    Result write( const utf8String& filename, int maxPageSize );
+  };
+
+}
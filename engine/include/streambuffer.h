@@ -0,0 +1,68 @@
+#pragma once
+#include "neko_types.h"
+#include "gfx_types.h"
+#include "forwards.h"
+
+namespace neko {
+
+  //! One large persistently mapped buffer for transient per-frame data, split into c_frames regions used round robin.
+  //! Each frame's data is bump allocated from its region, and a fence placed at the end of the frame keeps the
+  //! region from being rewritten before the GPU is done reading it. Nothing is mapped or unmapped after creation.
+  //! A frame that outgrows its region replaces the buffer with a larger one, sized from that frame's usage;
+  //! the old buffer is kept alive until every frame that might reference it has retired.
+  class StreamBuffer: public nocopy {
+  public:
+    static constexpr size_t c_frames = 3;
+    static constexpr size_t c_defaultFrameSize = 1024 * 1024;
+    //! A slice of the current frame's region. Valid until the end of the frame.
+    struct Allocation
+    {
+      uint8_t* data = nullptr;
+      GLuint buffer = 0;
+      GLintptr offset = 0;
+      GLsizeiptr size = 0;
+      template <typename T>
+      inline span<T> as() const { return span<T>( reinterpret_cast<T*>( data ), size / sizeof( T ) ); }
+    };
+    struct Stats
+    {
+      size_t used = 0; //!< Bytes allocated during the last frame
+      size_t peak = 0; //!< Most bytes allocated during any frame
+      size_t capacity = 0; //!< Bytes per frame region
+      uint64_t waits = 0; //!< Frames that had to wait for the GPU to release their region
+      uint64_t grows = 0; //!< Times the buffer was replaced by a larger one
+    };
+  protected:
+    GLuint id_ = 0;
+    uint8_t* base_ = nullptr;
+    size_t frameSize_ = 0;
+    size_t alignment_ = 16;
+    uint64_t frame_ = 0; //!< Monotonic frame number, the region being c_frames modulo
+    size_t offset_ = 0; //!< Bump pointer within the current region
+    gl::GLsync fences_[c_frames] = {};
+    vector<pair<uint64_t, GLuint>> retired_; //!< Replaced buffers, with the frame they were replaced on
+    Stats stats_;
+    void create( size_t frameSize );
+    void grow( size_t required );
+    void waitFence( size_t region );
+  public:
+    explicit StreamBuffer( size_t frameSize = c_defaultFrameSize );
+    //! Allocate bytes from the current frame's region, aligned for use as a storage buffer range,
+    //! vertex buffer or element buffer.
+    Allocation allocate( size_t bytes );
+    template <typename T>
+    inline span<T> allocate( size_t count, Allocation& out )
+    {
+      out = allocate( count * sizeof( T ) );
+      return out.as<T>();
+    }
+    //! Fence the frame's commands, move on to the next region and wait until the GPU has released it.
+    //! Call once per frame, after all of its commands have been issued.
+    void endFrame();
+    inline GLuint id() const noexcept { return id_; }
+    inline uint64_t frame() const noexcept { return frame_; }
+    inline const Stats& stats() const noexcept { return stats_; }
+    ~StreamBuffer();
+  };
+
+}
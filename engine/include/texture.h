@@ -42,15 +42,23 @@ namespace neko {
   protected:
     Type type_; //!< Texture type.
     int multisamples_;
+    int levels_ = 1; //!< Mip levels in storage.
   public:
     Texture() = delete;
     Texture( Renderer* renderer, int width, int height, PixelFormat format, const void* data,
       const Wrapping wrapping, const Filtering filtering, int multisamples = 1 );
     Texture( Renderer* renderer, int width, int height, int depth, PixelFormat format,
       const void* data, const Wrapping wrapping, const Filtering filtering, int multisamples = 1 );
+    //! Storage for a mip chain, with every level left for writeLevel.
+    Texture( Renderer* renderer, int width, int height, PixelFormat format, int levels,
+      const Wrapping wrapping, const Filtering filtering );
+    //! Block compressed, with every level the image has.
+    Texture( Renderer* renderer, const CompressedImage& image, const Wrapping wrapping, const Filtering filtering );
+    inline int levels() const noexcept { return levels_; }
     PixmapPtr readBack();
     void writeData( const void* data );
     void writeRect( const vec2i& offset, int width, int height, const void* data );
+    void writeLevel( int level, const void* data );
     ~Texture();
   };
 
@@ -21,8 +21,12 @@ namespace neko {
     void merge();
     vec4i getRegion( int width, int height );
     void clear();
+    //! Replace the packing state and pixels wholesale, e.g. from a cache.
+    void restore( const vector<vec3i>& nodes, size_t used, const uint8_t* data, size_t length );
   public:
     inline int depth() const noexcept { return depth_; }
+    inline const vector<vec3i>& nodes() const noexcept { return nodes_; }
+    inline size_t used() const noexcept { return used_; }
     inline uint8_t* data() { return data_.data(); }
     inline vec2 fdimensions() const { return { static_cast<Real>( size_.x ), static_cast<Real>( size_.y ) }; }
     PixelFormat format() const;
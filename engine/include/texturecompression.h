@@ -0,0 +1,30 @@
+#pragma once
+#include "neko_types.h"
+#include "gfx_types.h"
+
+namespace neko {
+
+  struct MaterialLayer;
+  class Material;
+
+  //! CPU encoder for the block compressed formats (BC1, BC3, BC4, BC5 and BC7 mode 6).
+  //! Endpoints come from the block's principal axis refined by a least squares pass, indices from an SSE projection
+  //! onto the endpoint line. Block rows are encoded in parallel. Results are cached on disk by a hash of the
+  //! source pixels, so each image is only encoded once; the cache files double as build output to ship.
+  class TextureCompressor {
+  public:
+    static constexpr uint32_t c_cacheMagic = 0x5443474E; //!< 'NGCT'
+    static constexpr uint32_t c_cacheVersion = 1; //!< Bump when the encoder's output changes
+    static bool isCompressed( PixelFormat format );
+    //! Whether the loader should compress this material's layer: the material asks for it and the image is 2D 8-bit.
+    static bool compressible( const Material& mat, const Pixmap& image );
+    //! Bytes per 4x4 block.
+    static size_t blockBytes( PixelFormat format );
+    //! Encode one 8-bit image into a level of blocks. Edge blocks are padded by clamping.
+    static void encode( const Pixmap& image, PixelFormat format, CompressedLevel& out );
+    //! Replace the layer's host pixels with their compressed levels, encoded or loaded from the cache.
+    //! Mipmapped builds the full chain first. Worker thread.
+    static void encodeLayer( MaterialLayer& layer, PixelFormat format, bool mipmapped );
+  };
+
+}
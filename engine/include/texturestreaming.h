@@ -0,0 +1,68 @@
+#pragma once
+#include "neko_types.h"
+#include "forwards.h"
+#include "gfx_types.h"
+#include "materials.h"
+
+namespace neko {
+
+  //! Uploads finished materials and keeps streamed textures resident at the detail they're drawn at.
+  //! Streamed materials (single 2D mipmapped 8-bit layers, mip chain built by the loader) first get only their mip
+  //! tail, which is small enough to upload at once, so they're drawable the frame they arrive. Finer levels are then
+  //! added by what the draws report wanting, most recently used first, within a per frame upload cap and a memory
+  //! budget. Under budget pressure the least recently used textures give up their finest levels.
+  //! A residency change reallocates the texture at its new size and copies the levels both share on the GPU,
+  //! so only new levels cost upload bandwidth. Everything else, block compressed textures included, is uploaded whole,
+  //! still under the upload cap.
+  //! Render thread only.
+  class TextureStreamer {
+  public:
+    static constexpr int c_tailSize = 64; //!< Levels no larger than this are always resident
+    static constexpr uint64_t c_idleFrames = 120; //!< Undrawn for this long and a texture only wants its tail
+    struct Stats
+    {
+      size_t resident = 0; //!< Bytes in streamed textures
+      size_t budget = 0;
+      size_t uploaded = 0; //!< Bytes uploaded last frame
+      size_t streamed = 0; //!< Streamed texture count
+      size_t queued = 0; //!< Whole uploads waiting for their turn
+      uint64_t evictions = 0;
+    };
+  protected:
+    struct Entry
+    {
+      MaterialPtr material;
+      size_t layer = 0;
+      int levels = 0; //!< Host mip chain length
+      int tail = 0; //!< Coarsest level that is always resident
+      int resident = 0; //!< Finest level in the texture
+      int wanted = 0; //!< Finest level the draws asked for
+      size_t bytes = 0; //!< Resident size
+    };
+    Renderer* renderer_;
+    vector<Entry> entries_;
+    std::deque<MaterialPtr> queue_;
+    uint64_t frame_ = 1;
+    size_t primed_ = 0; //!< Bytes uploaded by add since the last update
+    Stats stats_;
+    static size_t levelBytes( const Pixmap& image );
+    size_t uploadWhole( Material& mat );
+    size_t prime( const MaterialPtr& mat, size_t layer );
+    size_t resize( Entry& entry, int level );
+  public:
+    explicit TextureStreamer( Renderer* renderer );
+    //! Whether the loader should build a host mip chain for this material's layer.
+    static bool streamable( const Material& mat, const Pixmap& image );
+    //! Screen pixels per world unit at a position, for the density passed to noteUsage.
+    static Real pixelsPerUnit( const Camera& camera, const vec3& position, Real viewportHeight );
+    //! Take over newly loaded materials. Streamed ones are drawable right away, at their tail resolution.
+    void add( const MaterialVector& materials );
+    //! Report a draw of mat at density texels (of its full resolution) per screen pixel. Zero wants full detail.
+    void noteUsage( const Material& mat, Real density );
+    //! Do queued uploads, then adjust residency to last frame's usage. Once per frame, before drawing.
+    void update();
+    inline const Stats& stats() const noexcept { return stats_; }
+    ~TextureStreamer();
+  };
+
+}
@@ -90,6 +90,26 @@ namespace neko {
       return ( ( offset + alignment - 1 ) / alignment ) * alignment;
     }
 
+    //! Fast non-cryptographic 64-bit hash for cache keys and change detection.
+    //! FNV-1a over 64-bit words, tail bytes folded in one at a time.
+    inline uint64_t hash64( const void* data, size_t length, uint64_t seed = 0xCBF29CE484222325ULL )
+    {
+      constexpr uint64_t prime = 0x100000001B3ULL;
+      auto bytes = static_cast<const uint8_t*>( data );
+      auto hash = seed;
+      size_t i = 0;
+      for ( ; i + sizeof( uint64_t ) <= length; i += sizeof( uint64_t ) )
+      {
+        uint64_t word;
+        memcpy( &word, bytes + i, sizeof( uint64_t ) );
+        hash = ( hash ^ word ) * prime;
+        hash ^= ( hash >> 32 );
+      }
+      for ( ; i < length; ++i )
+        hash = ( hash ^ bytes[i] ) * prime;
+      return hash;
+    }
+
     inline unicodeString uniFrom( const utf8String& u8str )
     {
       auto unistr = unicodeString::fromUTF8( icu::StringPiece( u8str.c_str(), static_cast<int32_t>( u8str.length() ) ) );
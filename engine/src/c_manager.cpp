@@ -76,6 +76,25 @@ namespace neko {
 
     void manager::destroyNode( entity e )
     {
+      // Destroying a child moves other entities' nodes around in storage, so look ours up again each time
+      while ( registry_.get<node>( e ).first != null )
+        destroyNode( registry_.get<node>( e ).first );
+
+      // Unlink from the parent and siblings so the hierarchy stays walkable
+      const auto& en = registry_.get<node>( e );
+      if ( en.parent != null )
+      {
+        auto& pn = registry_.get<node>( en.parent );
+        if ( pn.first == e )
+          pn.first = en.next;
+        pn.children--;
+      }
+      if ( en.prev != null )
+        registry_.get<node>( en.prev ).next = en.next;
+      if ( en.next != null )
+        registry_.get<node>( en.next ).prev = en.prev;
+
+      imguiSelectedNodes_.erase( e );
       registry_.destroy( e );
     }
 
@@ -297,7 +316,7 @@ namespace neko {
       }
     }
 
-    void manager::update()
+    void manager::update( Real interpolation )
     {
       // if strange transform bugs start appearing when our hierarchy gets more complicated,
       // it's probably an issue in this sort logic
@@ -309,22 +328,39 @@ namespace neko {
           || ( !( ln.parent == rhs || rn.next == lhs ) && ( ln.parent < rn.parent || ( ln.parent == rn.parent && &ln < &rn ) ) ) );
       } );
 
-      registry_.view<dirty_transform>().each( [this]( const auto entity )
+      // Blended transforms move every frame, not just when touched
+      registry_.view<interpolated_transform>().each( [this]( const auto entity )
+      {
+        registry_.emplace_or_replace<dirty_transform>( entity );
+      } );
+
+      registry_.view<dirty_transform>().each( [this, interpolation]( const auto entity )
       {
         const auto& n = nd( entity );
         auto& t = tn( entity );
+        auto rotate = t.rotate;
+        auto scale = t.scale;
+        auto translate = t.translate;
+        if ( t.snapshotted &&
+          ( t.previous_rotate != t.rotate || t.previous_scale != t.scale || t.previous_translate != t.translate ) )
+        {
+          registry_.emplace_or_replace<interpolated_transform>( entity );
+          rotate = glm::slerp( t.previous_rotate, t.rotate, interpolation );
+          scale = glm::mix( t.previous_scale, t.scale, interpolation );
+          translate = glm::mix( t.previous_translate, t.translate, interpolation );
+        }
         if ( n.parent != null )
         {
           const auto& pt = tn( n.parent );
-          t.derived_rotate = ( pt.derived_rotate * t.rotate );
-          t.derived_scale = ( pt.derived_scale * t.scale );
-          t.derived_translate = ( pt.derived_rotate * ( pt.derived_scale * t.translate ) ) + pt.derived_translate;
+          t.derived_rotate = ( pt.derived_rotate * rotate );
+          t.derived_scale = ( pt.derived_scale * scale );
+          t.derived_translate = ( pt.derived_rotate * ( pt.derived_scale * translate ) ) + pt.derived_translate;
         }
         else
         {
-          t.derived_rotate = t.rotate;
-          t.derived_scale = t.scale;
-          t.derived_translate = t.translate;
+          t.derived_rotate = rotate;
+          t.derived_scale = scale;
+          t.derived_translate = translate;
         }
         auto tmp = mat4( numbers::one );
         tmp = glm::translate( tmp, t.derived_translate );
@@ -336,6 +372,24 @@ namespace neko {
       registry_.clear<dirty_transform>();
     }
 
+    void manager::snapshotTransforms()
+    {
+      // Whatever was still blending gets derived once more at its final values
+      registry_.view<interpolated_transform>().each( [this]( const auto entity )
+      {
+        registry_.emplace_or_replace<dirty_transform>( entity );
+      } );
+      registry_.clear<interpolated_transform>();
+
+      registry_.view<transform>().each( []( auto& t )
+      {
+        t.previous_rotate = t.rotate;
+        t.previous_scale = t.scale;
+        t.previous_translate = t.translate;
+        t.snapshotted = true;
+      } );
+    }
+
     void manager::markDirty( entity e )
     {
       registry_.emplace_or_replace<dirty_transform>( e );
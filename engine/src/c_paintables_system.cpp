@@ -39,7 +39,7 @@ namespace neko {
 
     void paintables_system::removeSurface( registry& r, entity e )
     {
-      mgr_->reg().emplace_or_replace<dirty_paintable>( e );
+      mgr_->reg().remove<dirty_paintable>( e );
     }
 
     void paintable::mouseClickTest(
@@ -133,9 +133,9 @@ namespace neko {
       Renderer& renderer, const span<GLuint> textures, const mat4& model, const vec2& pxdimensions, float pxscale )
     {
       assert( textures.size() == 5 );
-      gl::glBindVertexArray( vao_ );
+      renderer.bindVao( vao_ );
       auto& pipeline = renderer.shaders().usePipeline( c_drawPipelineName );
-      gl::glBindTextures( 0, static_cast<GLsizei>( textures.size() ), textures.data() );
+      renderer.state().bindTextures( 0, static_cast<GLsizei>( textures.size() ), textures.data() );
       pipeline.setUniform( "texture_layer0_diffuse", 0 );
       glActiveTexture( GL_TEXTURE0 );
       glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
@@ -146,9 +146,8 @@ namespace neko {
       pipeline.setUniform( "texture_blendmap", 4 );
       pipeline.setUniform( "texture_dimensions", pxdimensions );
       pipeline.setUniform( "pixelscale", pxscale );
-      pipeline.setUniform( "model", model );
+      pipeline.setUniform( Uniform_Model, model );
       gl::glDrawElements( gl::GL_TRIANGLES, static_cast<gl::GLsizei>( indices_->size() ), gl::GL_UNSIGNED_INT, nullptr );
-      gl::glBindVertexArray( 0 );
     }
 
     void paintables_system::update( Renderer& renderer )
@@ -169,6 +168,7 @@ namespace neko {
             okay = false;
             break;
           }
+          pt.layerMaterials[i] = mat;
           pt.textures[i] = mat->textureHandle( 0 );
           glTextureParameteri( pt.textures[i], GL_TEXTURE_WRAP_S, GL_REPEAT );
           glTextureParameteri( pt.textures[i], GL_TEXTURE_WRAP_T, GL_REPEAT );
@@ -212,6 +212,15 @@ namespace neko {
         if ( !pt.mesh || !pt.blendMap || pt.textures.size() < 5 )
           continue;
         auto& t = mgr_->tn( e );
+        // One layer texel covers one pixel scale unit
+        const auto texelsPerUnit = 1.0f / c_pixelScaleValues[pt.pixelScaleBase];
+        const auto density = texelsPerUnit /
+          TextureStreamer::pixelsPerUnit( cam, vec3( t.model()[3] ), renderer.resolution().y );
+        for ( int i = 0; i < 4; ++i )
+        {
+          renderer.streamer().noteUsage( *pt.layerMaterials[i], density );
+          pt.textures[i] = pt.layerMaterials[i]->textureHandle( 0 );
+        }
         pt.mesh->draw( renderer, pt.textures, t.model(),
           vec2( pt.blendMap->width(), pt.blendMap->height() ),
           c_pixelScaleValues[pt.pixelScaleBase] );
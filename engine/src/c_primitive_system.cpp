@@ -34,7 +34,7 @@ namespace neko {
 
     void primitive_system::removePrimitive( registry& r, entity e )
     {
-      mgr_->reg().emplace_or_replace<dirty_primitive>( e );
+      mgr_->reg().remove<dirty_primitive>( e );
     }
 
     void primitive_system::update()
@@ -70,7 +70,7 @@ namespace neko {
       mgr_->reg().clear<dirty_primitive>();
     }
 
-    void primitive_system::draw( Shaders& shaders, const Material& mat )
+    void primitive_system::record( RenderCommandList& list, const Camera& cam, const Material& mat )
     {
       auto view = mgr_->reg().view<primitive>();
       for ( auto entity : view )
@@ -80,7 +80,8 @@ namespace neko {
           continue;
         auto& t = mgr_->tn( entity );
         
-        p.mesh->draw( shaders, mat, t.model() );
+        const auto model = t.model();
+        p.mesh->record( list, mat, model, RenderCommandList::viewDepth( cam.view(), model ) );
       }
     }
 
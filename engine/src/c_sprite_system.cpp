@@ -37,10 +37,54 @@ namespace neko {
 
     void sprite_system::removeSprite( registry& r, entity e )
     {
-      mgr_->reg().emplace_or_replace<dirty_sprite>( e );
+      mgr_->reg().remove<dirty_sprite>( e );
     }
 
-    void sprite_system::update( MaterialManager& mats )
+    namespace {
+
+      //! Shrink a full frame quad to the frame's trimmed rectangle, and its texcoords to where that lies on the page.
+      void fitToAtlasFrame( vector<Vertex3D>& verts, const SpriteAtlasFrame& frame, const vec2& full, const vec2& page )
+      {
+        // Positions are linear in texcoords, so the quad's axes follow from three of its corners
+        const auto texAxes = mat2( verts[1].texcoord - verts[0].texcoord, verts[2].texcoord - verts[0].texcoord );
+        const auto posAxes = glm::mat<2, 3, Real>( verts[1].position - verts[0].position, verts[2].position - verts[0].position );
+        const auto texToPos = posAxes * math::inverse( texAxes );
+        const auto offset = vec2( frame.offset );
+        const auto size = vec2( frame.size );
+        for ( auto& v : verts )
+        {
+          const auto trimmed = ( offset + v.texcoord * size ) / full;
+          v.position += texToPos * ( trimmed - v.texcoord );
+          v.texcoord = ( vec2( frame.position ) + v.texcoord * size ) / page;
+        }
+      }
+
+      //! Build the sprite's quads once: a frame step only picks another base vertex when drawing.
+      void buildMesh( sprite& s )
+      {
+        auto parts = Locator::meshGenerator().makePlane(
+          s.dimensions * c_pixelScaleValues[s.pixelScaleBase], { 1, 1 }, { 0.0f, 0.0f, 1.0f } );
+        if ( !s.animation )
+        {
+          s.mesh = make_unique<SpriteVertexbuffer>( parts.first, parts.second, 1 );
+          return;
+        }
+        const auto& frames = s.animation->atlasFrames_;
+        const auto page = vec2( static_cast<Real>( s.material->width() ), static_cast<Real>( s.material->height() ) );
+        vector<Vertex3D> verts;
+        verts.reserve( parts.first.size() * frames.size() );
+        for ( const auto& frame : frames )
+        {
+          auto quad = parts.first;
+          fitToAtlasFrame( quad, frame, s.dimensions, page );
+          verts.insert( verts.end(), quad.begin(), quad.end() );
+        }
+        s.mesh = make_unique<SpriteVertexbuffer>( verts, parts.second, frames.size() );
+      }
+
+    }
+
+    void sprite_system::update( MaterialManager& mats, const SpriteManager& sprites )
     {
       set<entity> bad;
 
@@ -50,7 +94,10 @@ namespace neko {
         auto& s = mgr_->s( e );
         if ( !s.material )
         {
-          s.material = mats.getPtr( s.matName );
+          s.animation = sprites.atlasEntry( s.matName );
+          if ( s.animation && s.animation->atlasFrames_.empty() )
+            s.animation.reset();
+          s.material = ( s.animation ? s.animation->material_ : mats.getPtr( s.matName ) );
         }
         if ( s.size < 0.00001f || !s.material || !s.material->uploaded() )
         {
@@ -59,21 +106,12 @@ namespace neko {
         }
         else
         {
-          s.dimensions = { static_cast<Real>( s.material->width() ), static_cast<Real>( s.material->height() ) };
-          auto parts =
-            Locator::meshGenerator().makePlane(
-              s.dimensions * c_pixelScaleValues[s.pixelScaleBase],
-              { 1, 1 },
-              { 0.0f, 0.0f, 1.0f } );
-          if ( !s.mesh || s.mesh->buffer().size() != parts.first.size() ||
-                s.mesh->indices().size() != parts.second.size() )
-            s.mesh = make_unique<SpriteVertexbuffer>( parts.first.size(), parts.second.size() );
-          const auto& verts = s.mesh->buffer().lock();
-          const auto& indces = s.mesh->indices().lock();
-          memcpy( verts.data(), parts.first.data(), parts.first.size() * sizeof( Vertex3D ) );
-          memcpy( indces.data(), parts.second.data(), parts.second.size() * sizeof( GLuint ) );
-          s.mesh->buffer().unlock();
-          s.mesh->indices().unlock();
+          if ( s.animation )
+            s.dimensions = { static_cast<Real>( s.animation->definition_->width() ),
+              static_cast<Real>( s.animation->definition_->height() ) };
+          else
+            s.dimensions = { static_cast<Real>( s.material->width() ), static_cast<Real>( s.material->height() ) };
+          buildMesh( s );
         }
       }
 
@@ -82,7 +120,7 @@ namespace neko {
         mgr_->reg().emplace_or_replace<dirty_sprite>( e );
     }
 
-    void sprite_system::draw( Renderer& renderer, const Camera& cam )
+    void sprite_system::record( RenderCommandList& list, const Camera& cam )
     {
       auto view = mgr_->reg().view<sprite>();
       for ( auto e : view )
@@ -94,8 +132,17 @@ namespace neko {
 
         auto& t = mgr_->tn( e );
 
+        // Atlas frames differ in trimmed size and place, so each has its own quad; otherwise it's the array layer
+        auto layer = s.frame;
+        auto quad = 0;
+        if ( s.animation )
+        {
+          quad = math::clamp( s.frame, 0, s.mesh->frames() - 1 );
+          layer = s.animation->atlasFrames_[quad].page;
+        }
+
         auto model = s.billboard ? t.model() * mat4( mat3( math::transpose( math::inverse( cam.view() ) ) ) ) : t.model();
-        s.mesh->draw( renderer.shaders(), *s.material, s.frame, model );
+        s.mesh->record( list, *s.material, layer, quad, model, RenderCommandList::viewDepth( cam.view(), model ) );
       }
     }
 
@@ -112,7 +159,10 @@ namespace neko {
       changed |= ImGui::SliderInt( "frame", &s.frame, 0, 32 );
       ImGui::Checkbox( "billboard", &s.billboard );
       if ( matchanged )
+      {
         s.material.reset();
+        s.animation.reset();
+      }
       if ( changed || matchanged )
         mgr_->reg().emplace_or_replace<dirty_sprite>( e );
     }
@@ -44,7 +44,7 @@ namespace neko {
       }
     }
 
-    void text_system::draw( Renderer& renderer )
+    void text_system::record( RenderCommandList& list, const Camera& cam )
     {
       for ( auto& [eid, data] : texts_ )
       {
@@ -55,18 +55,19 @@ namespace neko {
 
         auto scalemat =
           glm::scale( vec3( c_pixelScaleValues[tn.pixelScaleBase] * ( tn.size / data.instance->style()->size() ) ) );
+        // Rows are already aligned within the layout box, so it's the box that gets anchored, not the inked extent
         auto offset = tn.offset;
         if ( tn.alignHorizontal == 1 )
-          offset.x -= ( data.instance->dimensions().x * 0.5f );
+          offset.x -= ( data.instance->layoutWidth() * 0.5f );
         else if ( tn.alignHorizontal == 2 )
-          offset.x -= ( data.instance->dimensions().x );
+          offset.x -= ( data.instance->layoutWidth() );
         if ( tn.alignVertical == 1 )
           offset.y += ( data.instance->dimensions().y * 0.5f );
         else if ( tn.alignVertical == 2 )
           offset.y += ( data.instance->dimensions().y );
         auto transmat = glm::translate( scalemat, vec3( offset, 0.0f ) );
         auto model = ( tf.model() * transmat );
-        data.instance->draw( renderer, model );
+        data.instance->record( list, model, RenderCommandList::viewDepth( cam.view(), model ) );
       }
     }
 
@@ -122,6 +123,10 @@ namespace neko {
         else
           data.instance->style( bestStyle );
 
+        // Wrap width is given at the component's size, but layout happens at the style's size
+        const TextAlignment alignments[3] = { TextAlign_Left, TextAlign_Center, TextAlign_Right };
+        data.instance->alignment( alignments[math::clamp( t.alignHorizontal, 0, 2 )] );
+        data.instance->width( t.size > 0.0f ? t.wrapWidth * ( bestStyle->size() / t.size ) : 0.0f );
         data.instance->content( utils::uniFrom( t.content ) );
 
         data.dirty = false;
@@ -137,12 +142,13 @@ namespace neko {
       bool changed = false;
       changed |= ig::imguiPixelScaleSelector( tn.pixelScaleBase );
       changed |= ig::dragVector( "offset", tn.offset, 0.1f, 0.0f, 0.0f, "%.4f", ImGuiSliderFlags_None );
-      ImGui::SliderInt(
+      changed |= ImGui::SliderInt(
         "horz align", &tn.alignHorizontal, 0, 2, "%d", ImGuiSliderFlags_NoInput | ImGuiSliderFlags_AlwaysClamp );
       ImGui::SliderInt(
         "vert align", &tn.alignVertical, 0, 2, "%d", ImGuiSliderFlags_NoInput | ImGuiSliderFlags_AlwaysClamp );
       changed |= ig::imguiInputText( "fontname", &tn.fontName, false, nullptr, &tn.int_ud_ );
       changed |= ImGui::SliderFloat( "size", &tn.size, 0.0f, 100.0f, "%.1f", ImGuiSliderFlags_AlwaysClamp );
+      changed |= ImGui::DragFloat( "wrap width", &tn.wrapWidth, 1.0f, 0.0f, 4096.0f, "%.1f", ImGuiSliderFlags_AlwaysClamp );
       changed |= ig::imguiInputText( "content", &tn.content, true, nullptr, &tn.int_ud_ );
 
       if ( changed )
@@ -32,7 +32,7 @@ namespace neko {
   void AxesPointerRenderer::draw( Shaders& shaders, vec3 origin, vec3 up, vec3 right )
   {
     origin = vec3( -origin.z, -origin.y, -origin.x );
-    auto verts = viz_->buffer().lock();
+    auto verts = viz_->lock( shaders.stream() );
     Real length = 0.5f;
     verts[0].color = vec4( 1.0f, 0.0f, 0.0f, 1.0f );
     verts[0].pos = origin;
@@ -46,13 +46,12 @@ namespace neko {
     verts[4].pos = origin;
     verts[5].color = vec4( 0.0f, 0.0f, 1.0f, 1.0f );
     verts[5].pos = origin + ( math::cross( right, up ) * length );
-    viz_->buffer().unlock();
     glLineWidth( 3.0f );
-    glDisable( GL_DEPTH_TEST );
-    glDepthMask( GL_FALSE );
-    glDisable( GL_LINE_SMOOTH );
+    shaders.state().enable( GLStateCache::Cap_DepthTest, false );
+    shaders.state().depthMask( false );
+    shaders.state().enable( GLStateCache::Cap_LineSmooth, false );
     auto pl = &shaders.usePipeline( "dbg_line" );
-    viz_->draw( *pl, 6, 0, gl::GL_LINES );
+    viz_->draw( shaders.state(), *pl, 6, 0, gl::GL_LINES );
   }
 
   EditorGridRenderer::EditorGridRenderer()
@@ -65,10 +64,14 @@ namespace neko {
     viz_.reset();
   }
 
-  void EditorGridRenderer::update( const EditorViewport& viewport, EditorOrthoCamera& camera )
+  void EditorGridRenderer::update( Shaders& shaders, const EditorViewport& viewport, EditorOrthoCamera& camera )
   {
+    // The vertices only live for this frame, so there's nothing to draw unless they're written anew
     if ( camera.frustum().type() != Projection_Orthographic )
+    {
+      drawCount_ = 0;
       return;
+    }
 
     if ( camera.frustum().radius() < 1.0f )
     {
@@ -83,7 +86,7 @@ namespace neko {
     auto color = viewport.drawopGridColor();
 
     int count = math::iround( area ) + 1;
-    auto verts = viz_->buffer().lock();
+    auto verts = viz_->lock( shaders.stream() );
 
     drawCount_ = math::min( count * 4 + 4, 1024 );
 
@@ -120,8 +123,6 @@ namespace neko {
       if ( i >= drawCount_ )
         break;
     }
-
-    viz_->buffer().unlock();
   }
 
   void EditorGridRenderer::draw( Shaders& shaders )
@@ -130,12 +131,12 @@ namespace neko {
       return;
 
     glLineWidth( 1.0f );
-    glDisable( GL_DEPTH_TEST );
-    glDepthMask( GL_FALSE );
-    glDisable( GL_LINE_SMOOTH );
+    shaders.state().enable( GLStateCache::Cap_DepthTest, false );
+    shaders.state().depthMask( false );
+    shaders.state().enable( GLStateCache::Cap_LineSmooth, false );
     auto pl = &shaders.usePipeline( "editor_bgline" );
     // pl->setUniform( "model", mat4(1.0f) );
-    viz_->draw( *pl, drawCount_, 0, gl::GL_LINES );
+    viz_->draw( shaders.state(), *pl, drawCount_, 0, gl::GL_LINES );
   }
 
 }
\ No newline at end of file
@@ -114,7 +114,7 @@ namespace neko {
 
   void EditorViewport::drawopPreSceneDraw( Shaders& shaders ) const
   {
-    grid_->update( *this, *camera_ );
+    grid_->update( shaders, *this, *camera_ );
     grid_->draw( shaders );
   }
 
@@ -10,6 +10,7 @@
 #include "input.h"
 #include "director.h"
 #include "steam.h"
+#include "profiler.h"
 
 namespace neko {
 
@@ -60,6 +61,9 @@ namespace neko {
 #endif
 #ifdef NEKO_NO_SCRIPTING
       "noscripting "
+#endif
+#ifdef NEKO_PROFILER
+      "profiler "
 #endif
       "windows";
     return flags;
@@ -83,10 +87,17 @@ namespace neko {
       if ( out.discordAppID )
         out.useDiscord = true;
     }
+    if ( settings.find( "logic" ) != settings.end() )
+    {
+      auto& logic = settings["logic"];
+      if ( logic.find( "rate" ) != logic.end() )
+        out.logicRate = math::max( 1.0, logic["rate"].get<GameTime>() );
+    }
   }
 
   void Engine::initialize( const Options& options )
   {
+    NEKO_PROFILE_FUNCTION();
     console_->setEngine( shared_from_this() );
 
     console_->printf( srcEngine, "Build flags: %s", listFlags().c_str() );
@@ -94,6 +105,10 @@ namespace neko {
     auto settingstext = Locator::fileSystem().openFile( Dir_User, c_engineSettingsFilename )->readFullString();
     parseSettingsJSON( json::parse( settingstext ), settings_ );
 
+    c_logicFPS = settings_.logicRate;
+    c_logicStep = ( 1.0 / c_logicFPS );
+    c_logicMaxFrameMicroseconds = static_cast<uint64_t>( ( c_logicStep * 1000.0 ) * 1000.0 );
+
     steam_ = make_shared<Steam>( ptr(), settings_.steamAppID );
 
     platform::PerformanceTimer timer;
@@ -238,6 +253,8 @@ namespace neko {
 
   void Engine::run()
   {
+    NEKO_PROFILE_THREAD( "Logic" );
+
     clock_.init();
     time_ = 0.0;
     realTime_ = 0.0;
@@ -268,6 +285,7 @@ namespace neko {
         restart();
         time_ = 0.0;
         accumulator = 0.0;
+        sync_.gameTime.store( time_ );
         clock_.update();
         continue;
       }
@@ -280,26 +298,45 @@ namespace neko {
       if ( !paused() )
       {
         accumulator += delta;
+
+        // Each tick moves on the snapshots the renderer blends between, and publishes its time along with the
+        // fraction before releasing the scene, so the fraction has to be known before ticking
+        auto remainder = accumulator;
+        while ( remainder >= c_logicStep )
+          remainder -= c_logicStep;
+        pendingInterpolation_ = static_cast<Real>( remainder / c_logicStep );
+
         while ( accumulator >= c_logicStep )
         {
+          NEKO_PROFILE_SCOPE( "Logic step" );
 #ifndef NEKO_NO_SCRIPTING
           scripting_->tick( c_logicStep, time_ );
 #endif
           messaging_->tick( c_logicStep, time_ );
           time_ += c_logicStep;
           accumulator -= c_logicStep;
+#ifdef NEKO_NO_SCRIPTING
+          publishTick( time_ );
+#endif
         }
+
+        // Without a tick the snapshots stay put, and only the fraction moves on
+        sync_.interpolation.store( pendingInterpolation_ );
       }
+      else
+        sync_.interpolation.store( 1.0f );
 
       realTime_ += delta;
 
-      sync_.gameTime.store( time_ );
       sync_.realTime.store( realTime_ );
 
       steam_->tick( delta, time_ );
 
 #ifndef NEKO_NO_SCRIPTING
-      scripting_->postUpdate( delta, time_ );
+      {
+        NEKO_PROFILE_SCOPE( "Script post update" );
+        scripting_->postUpdate( delta, time_ );
+      }
 #endif
 
       auto us = clock_.peekMicroseconds();
@@ -7,6 +7,7 @@
 #include "locator.h"
 #include "console.h"
 #include "filesystem.h"
+#include "utilities.h"
 
 namespace neko {
 
@@ -123,6 +124,48 @@ namespace neko {
     }
   };
 
+  FileMapping::FileMapping( const wstring& filename )
+  {
+    file_ = CreateFileW( filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, 0 );
+
+    if ( file_ == INVALID_HANDLE_VALUE )
+      NEKO_WINAPI_EXCEPT( "File open failed" );
+
+    LARGE_INTEGER size;
+    if ( !GetFileSizeEx( file_, &size ) || size.QuadPart == 0 )
+    {
+      CloseHandle( file_ );
+      NEKO_EXCEPT( "Cannot map an empty file" );
+    }
+    size_ = static_cast<uint64_t>( size.QuadPart );
+
+    mapping_ = CreateFileMappingW( file_, nullptr, PAGE_READONLY, 0, 0, nullptr );
+    if ( !mapping_ )
+    {
+      CloseHandle( file_ );
+      NEKO_WINAPI_EXCEPT( "CreateFileMapping failed" );
+    }
+
+    view_ = static_cast<uint8_t*>( MapViewOfFile( mapping_, FILE_MAP_READ, 0, 0, 0 ) );
+    if ( !view_ )
+    {
+      CloseHandle( mapping_ );
+      CloseHandle( file_ );
+      NEKO_WINAPI_EXCEPT( "MapViewOfFile failed" );
+    }
+  }
+
+  FileMapping::~FileMapping()
+  {
+    if ( view_ )
+      UnmapViewOfFile( view_ );
+    if ( mapping_ )
+      CloseHandle( mapping_ );
+    if ( file_ != INVALID_HANDLE_VALUE )
+      CloseHandle( file_ );
+  }
+
   FileSystem::FileSystem()
   {
     rootDirs_[Dir_User] = LR"()";
@@ -134,6 +177,7 @@ namespace neko {
     rootDirs_[Dir_GUI] = LR"(assets\gui\)";
     rootDirs_[Dir_Shaders] = LR"(shaders\)";
     rootDirs_[Dir_Scripts] = LR"(scripts\)";
+    rootDirs_[Dir_Cache] = LR"(cache\)";
   }
 
   wstring FileSystem::fixPath( FileDir dir, const wstring& path )
@@ -176,4 +220,40 @@ namespace neko {
     return openFileAbsolute( platform::utf8ToWide( path ) );
   }
 
+  FileMappingPtr FileSystem::mapFile( FileDir dir, const utf8String& path )
+  {
+    auto fixed = fixPath( dir, platform::utf8ToWide( path ) );
+
+    // Key by the full, case-folded path so that different spellings of the same file share a mapping
+    wchar_t full[MAX_PATH];
+    auto length = GetFullPathNameW( fixed.c_str(), MAX_PATH, full, nullptr );
+    wstring key = ( length > 0 && length < MAX_PATH ? wstring( full, length ) : fixed );
+    CharLowerBuffW( key.data(), static_cast<DWORD>( key.size() ) );
+
+    ScopedRWLock lock( &mappingsLock_ );
+
+    auto it = mappings_.find( key );
+    if ( it != mappings_.end() )
+    {
+      if ( auto existing = it->second.lock() )
+        return existing;
+    }
+
+    auto mapping = make_shared<FileMapping>( fixed );
+    mappings_[key] = mapping;
+
+    // Drop entries whose mappings have already been released
+    for ( auto entry = mappings_.begin(); entry != mappings_.end(); )
+      entry = ( entry->second.expired() ? mappings_.erase( entry ) : std::next( entry ) );
+
+    return mapping;
+  }
+
+  FileWriterPtr FileSystem::createFile( FileDir dir, const utf8String& path )
+  {
+    if ( dir != Dir_User )
+      platform::ensureDirectory( platform::getCurrentDirectory() + rootDirs_[dir] );
+    return make_shared<platform::FileWriter>( fixPath( dir, platform::utf8ToWide( path ) ) );
+  }
+
 }
\ No newline at end of file
@@ -14,27 +14,19 @@ namespace neko {
   {
   }
 
-  FontFacePtr Font::loadFace( span<uint8_t> source, FaceID faceIndex )
+  FontFacePtr Font::loadFace( FileMappingPtr source, FaceID faceIndex )
   {
     if ( !manager_ )
       NEKO_EXCEPT( "Font::loadFace called after manager has been reset" );
 
-    // Make a safety copy in our own memory
-    // Loading new styles on the fly later could still access this memory
-    // and we won't rely on the host keeping that available and alive
-    // Of course, if multiple faces are actually loaded from different blobs
-    // despite belonging to the same font, this copy will only contain the
-    // last loaded one - but that's pretty suspect behavior anyway, don't do it
-    data_ = make_unique<Buffer>( source );
+    // Hold on to the mapping; loading new styles on the fly later will still access it.
+    // Faces reference it too, so it stays alive for as long as any of them do.
+    // Of course, if multiple faces are actually loaded from different files
+    // despite belonging to the same font, this will only keep the last one -
+    // but that's pretty suspect behavior anyway, don't do it
+    data_ = source;
 
-    auto ftlib = manager_->ft();
-
-    FT_Open_Args args = { 0 };
-    args.flags = FT_OPEN_MEMORY;
-    args.memory_base = data_->data();
-    args.memory_size = (FT_Long)data_->length();
-
-    auto fc = make_shared<FontFace>( ptr(), ftlib, &args, faceIndex );
+    auto fc = make_shared<FontFace>( ptr(), manager_->ft(), source, faceIndex );
     faces_[faceIndex] = fc;
 
     return move( fc );
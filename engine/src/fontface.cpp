@@ -9,13 +9,25 @@
 
 namespace neko {
 
-  FontFace::FontFace( FontPtr font, FT_Library ft, FT_Open_Args* args, FaceID faceIndex ):
-    ft_( ft ), font_( font )
+  FontFace::FontFace( FontPtr font, FT_Library ft, FileMappingPtr data, FaceID faceIndex ):
+    ft_( ft ), font_( font ), data_( data )
   {
-    auto fterr = FT_Open_Face( ft, args, faceIndex, &face_ );
+    // Both FreeType and HarfBuzz read straight from the mapping, no copies
+    FT_Open_Args args = { 0 };
+    args.flags = FT_OPEN_MEMORY;
+    args.memory_base = data->data();
+    args.memory_size = static_cast<FT_Long>( data->size() );
+
+    auto fterr = FT_Open_Face( ft, &args, faceIndex, &face_ );
     if ( fterr || !face_ )
       NEKO_FREETYPE_EXCEPT( "FreeType font face load failed", fterr );
 
+    // The blob keeps its own reference to the mapping, released when HarfBuzz is done with it
+    auto blob = hb_blob_create( reinterpret_cast<const char*>( data->data() ), static_cast<unsigned int>( data->size() ),
+      HB_MEMORY_MODE_READONLY, new FileMappingPtr( data ), []( void* user ) { delete static_cast<FileMappingPtr*>( user ); } );
+    hbface_ = hb_face_create( blob, static_cast<unsigned int>( faceIndex ) );
+    hb_blob_destroy( blob );
+
     // For some reason this export is perpetually broken in release build of FT
     // auto fmt = FT_Get_Font_Format( face_ );
 
@@ -36,6 +48,13 @@ namespace neko {
       NEKO_EXCEPT( "Font is not scalable; bitmap fonts unsupported" );
   }
 
+  uint64_t FontFace::dataHash()
+  {
+    if ( !dataHash_ && data_ )
+      dataHash_ = utils::hash64( data_->data(), static_cast<size_t>( data_->size() ) );
+    return dataHash_;
+  }
+
   StyleID FontFace::loadStyle( FontRendering rendering, Real sz, Real thickness, const unicodeString& prerenderGlyphs )
   {
     auto id = makeStyleID( face_->face_index, sz, rendering, thickness );
@@ -78,6 +97,12 @@ namespace neko {
       style->unload();
     font_.reset();
     styles_.clear();
+    if ( hbface_ )
+    {
+      hb_face_destroy( hbface_ );
+      hbface_ = nullptr;
+    }
+    data_.reset();
   }
 
   FontFace::~FontFace()
@@ -5,6 +5,7 @@
 #include "console.h"
 #include "engine.h"
 #include "loader.h"
+#include "renderer.h"
 
 namespace neko {
 
@@ -57,6 +58,7 @@ namespace neko {
   void FontManager::initializeRender( Renderer* renderer )
   {
     renderer_ = renderer;
+    quadIndices_ = make_unique<QuadIndexBuffer>();
   }
 
   FontPtr FontManager::createFont( const utf8String& name )
@@ -67,9 +69,9 @@ namespace neko {
     return move( font );
   }
 
-  FontFacePtr FontManager::loadFace( FontPtr font, span<uint8_t> buffer, FaceID faceIndex )
+  FontFacePtr FontManager::loadFace( FontPtr font, FileMappingPtr source, FaceID faceIndex )
   {
-    return font->loadFace( buffer, faceIndex );
+    return font->loadFace( source, faceIndex );
   }
 
   StyleID FontManager::loadStyle(
@@ -177,11 +179,25 @@ namespace neko {
     }*/
   }
 
+  void FontManager::retireMesh( TextMeshPtr mesh )
+  {
+    retiredMeshes_.emplace_back( renderer_->stream().frame(), move( mesh ) );
+  }
+
   void FontManager::update()
   {
+    const auto frame = renderer_->stream().frame();
+    std::erase_if( retiredMeshes_, [frame]( const auto& retired ) {
+      return ( retired.first + StreamBuffer::c_frames <= frame );
+    } );
+
     for ( auto it = texts_.begin(); it != texts_.end(); )
       if ( ( *it ).second->dead() )
+      {
+        if ( it->second->mesh_ )
+          retireMesh( move( it->second->mesh_ ) );
         it = texts_.erase( it );
+      }
       else
       {
         it->second->update( *renderer_ );
@@ -201,9 +217,11 @@ namespace neko {
   void FontManager::shutdownRender()
   {
     texts_.clear();
+    retiredMeshes_.clear();
     for ( auto& [key, font] : map_ )
       font->unload();
     map_.clear();
+    quadIndices_.reset();
     renderer_ = nullptr;
   }
 
@@ -9,6 +9,15 @@
 
 namespace neko {
 
+  NEKO_DECLARE_CONVAR( fnt_glyphcache, "Whether to persist rasterized glyph atlases to disk and reuse them on startup.", true );
+
+  namespace {
+
+    constexpr uint32_t c_glyphCacheMagic = 0x4843474E; // 'NGCH'
+    constexpr uint32_t c_glyphCacheVersion = 1;
+
+  }
+
   FontStyle::FontStyle( FontFacePtr face, FT_Library ft, FT_Face ftface, Real size, vec2i atlasSize,
   FontRendering rendering, Real thickness, const unicodeString& prerenderGlyphs ): size_( size ),
   face_( face ), storedFaceIndex_( ftface->face_index ),
@@ -29,11 +38,24 @@ namespace neko {
 
     FT_Set_Transform( face_->face_, &matrix, nullptr );
 
-    hbfnt_ = hb_ft_font_create_referenced( face_->face_ );
-    hb_ft_font_set_funcs( hbfnt_ ); // Doesn't create_referenced already call this?
+    // Shape from the shared face with HarfBuzz's own OpenType functions, at this style's scale.
+    // Unlike hb_ft fonts this doesn't depend on whichever size was last set on the shared FT_Face.
+    hbfnt_ = hb_font_create( face_->hbface_ );
+    const auto& metrics = face_->face_->size->metrics;
+    const auto upem = static_cast<uint64_t>( face_->face_->units_per_EM );
+    hb_font_set_scale( hbfnt_,
+      static_cast<int>( ( static_cast<uint64_t>( metrics.x_scale ) * upem + ( 1u << 15 ) ) >> 16 ),
+      static_cast<int>( ( static_cast<uint64_t>( metrics.y_scale ) * upem + ( 1u << 15 ) ) >> 16 ) );
+    hb_font_set_ppem( hbfnt_, metrics.x_ppem, metrics.y_ppem );
 
     atlas_ = make_shared<TextureAtlas>( atlasSize, 1 );
-    initEmptyGlyph();
+
+    // A cache hit restores the atlas and every glyph seen in previous sessions,
+    // leaving nothing for FreeType to rasterize below
+    if ( g_CVar_fnt_glyphcache.as_b() )
+      cacheKey_ = makeCacheKey( ft );
+    if ( !cacheKey_ || !loadCache() )
+      initEmptyGlyph();
 
     if ( !prerenderGlyphs.isEmpty() )
     {
@@ -43,6 +65,9 @@ namespace neko {
         getGlyph( ft, ftface, prerenderBuf.glyphInfo()[i].codepoint );
     }
 
+    if ( cacheKey_ && glyphs_.size() != cachedGlyphs_ )
+      saveCache();
+
     postLoad();
   }
 
@@ -194,6 +219,117 @@ namespace neko {
       ascender_ = static_cast<Real>( metrics.ascender >> 6 );
       descender_ = static_cast<Real>( metrics.descender >> 6 );
     //}
+    lineHeight_ = static_cast<Real>( metrics.height >> 6 );
+  }
+
+  uint64_t FontStyle::makeCacheKey( FT_Library ft ) const
+  {
+    // Anything that changes the rasterized output has to be part of the key
+    struct
+    {
+      uint64_t dataHash;
+      int64_t faceIndex;
+      uint32_t faceSize;
+      uint32_t rendering;
+      Real thickness;
+      int32_t atlasWidth;
+      int32_t atlasHeight;
+      int32_t atlasDepth;
+      FT_Int ftVersion[3];
+      uint32_t version;
+    } key;
+    memset( &key, 0, sizeof( key ) );
+    key.dataHash = face_->dataHash();
+    key.faceIndex = storedFaceIndex_;
+    key.faceSize = storedFaceSize_;
+    key.rendering = static_cast<uint32_t>( rendering_ );
+    key.thickness = outlineThickness_;
+    key.atlasWidth = atlas_->dimensions().x;
+    key.atlasHeight = atlas_->dimensions().y;
+    key.atlasDepth = atlas_->depth();
+    FT_Library_Version( ft, &key.ftVersion[0], &key.ftVersion[1], &key.ftVersion[2] );
+    key.version = c_glyphCacheVersion;
+    return utils::hash64( &key, sizeof( key ) );
+  }
+
+  utf8String FontStyle::cacheFilename() const
+  {
+    char name[64];
+    sprintf_s( name, 64, "glyphs_%016llx.bin", static_cast<unsigned long long>( cacheKey_ ) );
+    return name;
+  }
+
+  bool FontStyle::loadCache()
+  {
+    auto filename = cacheFilename();
+    if ( !Locator::fileSystem().fileStat( Dir_Cache, platform::utf8ToWide( filename ) ) )
+      return false;
+
+    try
+    {
+      auto reader = Locator::fileSystem().openFile( Dir_Cache, filename );
+      if ( reader->readUint32() != c_glyphCacheMagic || reader->readUint32() != c_glyphCacheVersion ||
+        reader->readUint64() != cacheKey_ )
+        return false;
+
+      vector<vec3i> nodes( reader->readUint32() );
+      const auto used = static_cast<size_t>( reader->readUint64() );
+      if ( !nodes.empty() )
+        reader->read( nodes.data(), static_cast<uint32_t>( nodes.size() * sizeof( vec3i ) ) );
+      vector<uint8_t> pixels( reader->readUint32() );
+      if ( !pixels.empty() )
+        reader->read( pixels.data(), static_cast<uint32_t>( pixels.size() ) );
+
+      GlyphMap glyphs;
+      const auto count = reader->readUint32();
+      for ( uint32_t i = 0; i < count; ++i )
+      {
+        Glyph glyph;
+        reader->read( &glyph, sizeof( Glyph ) );
+        glyphs[glyph.index] = glyph;
+      }
+
+      atlas_->restore( nodes, used, pixels.data(), pixels.size() );
+      glyphs_.swap( glyphs );
+      cachedGlyphs_ = glyphs_.size();
+      dirty_ = true;
+    }
+    catch ( std::exception& e )
+    {
+      Locator::console().printf( srcGfx, "Discarding glyph cache %s: %s", filename.c_str(), e.what() );
+      return false;
+    }
+
+    return true;
+  }
+
+  void FontStyle::saveCache()
+  {
+    auto filename = cacheFilename();
+    try
+    {
+      auto writer = Locator::fileSystem().createFile( Dir_Cache, filename );
+      writer->writeUint32( c_glyphCacheMagic );
+      writer->writeUint32( c_glyphCacheVersion );
+      writer->writeUint64( cacheKey_ );
+
+      const auto& nodes = atlas_->nodes();
+      writer->writeUint32( static_cast<uint32_t>( nodes.size() ) );
+      writer->writeUint64( static_cast<uint64_t>( atlas_->used() ) );
+      writer->writeBlob( nodes.data(), static_cast<uint32_t>( nodes.size() * sizeof( vec3i ) ) );
+      writer->writeUint32( static_cast<uint32_t>( atlas_->bytesize() ) );
+      writer->writeBlob( atlas_->data(), static_cast<uint32_t>( atlas_->bytesize() ) );
+
+      writer->writeUint32( static_cast<uint32_t>( glyphs_.size() ) );
+      for ( const auto& [index, glyph] : glyphs_ )
+        writer->writeBlob( &glyph, sizeof( Glyph ) );
+
+      cachedGlyphs_ = glyphs_.size();
+    }
+    catch ( std::exception& e )
+    {
+      Locator::console().printf( srcGfx, "Failed to write glyph cache %s: %s", filename.c_str(), e.what() );
+    }
   }
 
   const TextureAtlas& FontStyle::atlas() const
@@ -204,6 +340,10 @@ namespace neko {
 
   void FontStyle::unload()
   {
+    // Glyphs rasterized during this session get appended, so the next startup is prewarmed
+    if ( cacheKey_ && atlas_ && glyphs_.size() != cachedGlyphs_ )
+      saveCache();
+
     if ( hbfnt_ )
     {
       hb_font_destroy( hbfnt_ );
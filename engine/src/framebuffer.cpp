@@ -174,8 +174,8 @@ namespace neko {
   {
     if ( multisamples_ > 1 )
     {
-      storedMultisampleEnable_ = glIsEnabled( GL_MULTISAMPLE ) ? true : false;
-      glEnable( GL_MULTISAMPLE );
+      storedMultisampleEnable_ = renderer_->state().enabled( GLStateCache::Cap_Multisample );
+      renderer_->state().enable( GLStateCache::Cap_Multisample, true );
     }
 
     glClipControl( GL_LOWER_LEFT, GL_NEGATIVE_ONE_TO_ONE );
@@ -190,16 +190,16 @@ namespace neko {
     if ( depth_ )
       glClearNamedFramebufferfv( handle_, GL_DEPTH, 0, &clearDepth );
 
-    glBindFramebuffer( GL_FRAMEBUFFER, handle_ );
+    renderer_->state().bindFramebuffer( handle_ );
     glBindSamplers( 0, 1, &sampler_ );
   }
 
   void Framebuffer::end()
   {
-    glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+    renderer_->state().bindFramebuffer( 0 );
 
     if ( multisamples_ > 1 && !storedMultisampleEnable_ )
-      glDisable( GL_MULTISAMPLE );
+      renderer_->state().enable( GLStateCache::Cap_Multisample, false );
 
     glViewportIndexedf( 0, static_cast<GLfloat>( savedViewport_[0] ), static_cast<GLfloat>( savedViewport_[1] ),
       static_cast<GLfloat>( savedViewport_[2] ), static_cast<GLfloat>( savedViewport_[3] ) );
@@ -11,6 +11,8 @@
 #include "gui.h"
 #include "neko_types.h"
 #include "gfx_imguistyle.h"
+#include "profiler.h"
+#include "renderbenchmark.h"
 
 #pragma comment( lib, "opengl32.lib" )
 
@@ -53,6 +55,8 @@ namespace neko {
   NEKO_DECLARE_CONVAR( vid_vsync, "Whether to print OpenGL debug log output.", true );
   NEKO_DECLARE_CONVAR( gl_debuglog, "OpenGL debug log output level. 0 = none, 1 = some, 2 = debug context", 2 );
 
+  NEKO_DECLARE_CONVAR( vid_headless, "Render offscreen without a window, for benchmarks and image tests. Changes are applied when the renderer is restarted.", false );
+
   Gfx::Gfx( ThreadedLoaderPtr loader, FontManagerPtr fonts, MessagingPtr messaging, DirectorPtr director, ConsolePtr console ):
   loader_( move( loader ) ), fonts_( move( fonts ) ), console_( move( console ) ),
   messaging_( move( messaging ) ), director_( move( director ) )
@@ -138,12 +142,19 @@ namespace neko {
     }
   }
 
+  vec2i Gfx::surfaceSize() const
+  {
+    if ( headless_ )
+      return vec2i( g_CVar_vid_screenwidth.as_i(), g_CVar_vid_screenheight.as_i() );
+    return vec2i( window_->getSize().x, window_->getSize().y );
+  }
+
   void Gfx::preInitialize()
   {
     info_.clear();
+    headless_ = g_CVar_vid_headless.as_b();
 
-    sf::VideoMode desktop = sf::VideoMode::getDesktopMode();
-    sf::VideoMode videoMode( sf::Vector2u( g_CVar_vid_screenwidth.as_i(), g_CVar_vid_screenheight.as_i() ), desktop.bitsPerPixel );
+    const auto screenSize = sf::Vector2u( g_CVar_vid_screenwidth.as_i(), g_CVar_vid_screenheight.as_i() );
 
     sf::ContextSettings settings;
     settings.depthBits = 24;
@@ -157,20 +168,16 @@ namespace neko {
     if ( g_CVar_gl_debuglog.as_i() > 1 )
       settings.attributeFlags |= sf::ContextSettings::Attribute::Debug;
 
-    window_ = make_unique<sf::Window>( videoMode, c_windowTitle, sf::Style::Default, settings );
-
-    platform::setWindowIcon( window_->getSystemHandle(), platform::KnownIcon::MainIcon );
-
-    window_->setVerticalSyncEnabled( g_CVar_vid_vsync.as_b() ); // vsync
-    window_->setFramerateLimit( 0 ); // no sleep till Brooklyn
-
-    if ( !window_->setActive( true ) )
-      window_->requestFocus();
-
-    const auto targetResolution = size2i( 1920, 1080 );
-
-    platform::RenderWindowHandler::get().setWindow( this, window_->getSystemHandle() );
-    platform::RenderWindowHandler::get().changeTargetResolution( targetResolution );
+    if ( headless_ )
+    {
+      // Everything renders into the renderer's own framebuffers, so the default one is never presented
+      context_ = make_unique<sf::Context>( settings, screenSize );
+      if ( !context_->setActive( true ) )
+        NEKO_EXCEPT( "Failed to activate headless OpenGL context" );
+      console_->print( srcGfx, "Running headless" );
+    }
+    else
+      createWindow( screenSize, settings );
 
     glbinding::initialize( nullptr );
 
@@ -188,6 +195,27 @@ namespace neko {
     printInfo();
   }
 
+  void Gfx::createWindow( const sf::Vector2u& size, const sf::ContextSettings& settings )
+  {
+    sf::VideoMode desktop = sf::VideoMode::getDesktopMode();
+    sf::VideoMode videoMode( size, desktop.bitsPerPixel );
+
+    window_ = make_unique<sf::Window>( videoMode, c_windowTitle, sf::Style::Default, settings );
+
+    platform::setWindowIcon( window_->getSystemHandle(), platform::KnownIcon::MainIcon );
+
+    window_->setVerticalSyncEnabled( g_CVar_vid_vsync.as_b() ); // vsync
+    window_->setFramerateLimit( 0 ); // no sleep till Brooklyn
+
+    if ( !window_->setActive( true ) )
+      window_->requestFocus();
+
+    const auto targetResolution = size2i( 1920, 1080 );
+
+    platform::RenderWindowHandler::get().setWindow( this, window_->getSystemHandle() );
+    platform::RenderWindowHandler::get().changeTargetResolution( targetResolution );
+  }
+
   // clang-format off
 
   static const vector<EditorViewportDefinition> g_editorViewportDefs =
@@ -221,7 +249,8 @@ namespace neko {
 
     setOpenGLDebugLogging( g_CVar_gl_debuglog.as_i() > 0 );
 
-    auto realResolution = vec2( (Real)window_->getSize().x, (Real)window_->getSize().y );
+    const auto surface = surfaceSize();
+    auto realResolution = vec2( (Real)surface.x, (Real)surface.y );
 
     engine.director()->renderSync().createScene( realResolution );
     auto scene = engine.director()->renderSync().lockSceneWrite();
@@ -247,8 +276,11 @@ namespace neko {
       igStyle.Colors[ImGuiCol_WindowBg].w = 1.0f;
     }
 
-    ImGui_ImplWin32_InitForOpenGL( window_->getSystemHandle() );
-    ImGui_ImplOpenGL3_Init( c_imguiGlslVersion );
+    if ( !headless_ )
+    {
+      ImGui_ImplWin32_InitForOpenGL( window_->getSystemHandle() );
+      ImGui_ImplOpenGL3_Init( c_imguiGlslVersion );
+    }
 
     gameViewport_.setCameraData( scene->cams().getActiveData() );
     engine.director()->renderSync().unlockSceneWrite();
@@ -256,7 +288,7 @@ namespace neko {
     editor_ = make_shared<Editor>();
     editor_->initialize( renderer_, realResolution );
 
-    resize( engine, window_->getSize().x, window_->getSize().y );
+    resize( engine, surface.x, surface.y );
 
     renderer_->initialize( gameViewport_.size().x, gameViewport_.size().y );
 
@@ -265,7 +297,8 @@ namespace neko {
     gui_->setInstallationInfo( engine.installationInfo() );
     #endif
 
-    input_->initialize( window_->getSystemHandle() );
+    if ( !headless_ )
+      input_->initialize( window_->getSystemHandle() );
 
     messaging_->listen( this );
   }
@@ -308,6 +341,9 @@ namespace neko {
 
   void Gfx::processEvents( Engine& engine, bool discardMouse, bool discardKeyboard )
   {
+    if ( headless_ )
+      return;
+
     input_->update();
 
     sf::Event evt {};
@@ -363,7 +399,7 @@ namespace neko {
     scene->cams().update();
     gameViewport_.setCameraData( scene->cams().getActiveData() );
 
-    if ( editor_->enabled() )
+    if ( editor_->enabled() && !headless_ )
     {
       bool ignoreInput = ( !window_->hasFocus() || platform::windowUnderCursor() != window_->getSystemHandle() );
       editor_->updateRealtime( *renderer_, realTime, delta, input_, *scene, windowViewport_, gameViewport_, ignoreInput );
@@ -375,8 +411,8 @@ namespace neko {
   void Gfx::clear( const vec4& color )
   {
     glClearColor( color.x, color.y, color.z, color.w );
-    glDepthMask( TRUE ); // enable depth writes or there is no depth clearing
-    glDepthFunc( GL_LESS ); // reset depth func
+    renderer_->state().depthMask( true ); // enable depth writes or there is no depth clearing
+    renderer_->state().depthFunc( GL_LESS ); // reset depth func
     glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT ); // clear the buffers
   }
 
@@ -392,8 +428,10 @@ namespace neko {
     .nodes = false
   };
 
-  void Gfx::update( GameTime time, GameTime delta, Engine& engine )
+  void Gfx::update( Engine& engine )
   {
+    NEKO_PROFILE_FUNCTION();
+
     if ( flags_.reloadShaders )
     {
       renderer_->shaders().shutdown();
@@ -403,9 +441,36 @@ namespace neko {
 
     auto scene = engine.director()->renderSync().lockSceneWrite();
 
-    scene->update();
+    RenderBenchmark::Settings benchmark;
+    if ( RenderBenchmark::takeRequest( benchmark ) )
+      RenderBenchmark( benchmark ).run( *renderer_, *scene, gameViewport_ );
+
+    // Read under the scene lock, so that they match the snapshots the latest tick left in the scene
+    const auto time = engine.sync().gameTime.load();
+    const auto delta = ( time - lastTime_ );
+    lastTime_ = time;
+    const auto interpolation = engine.sync().interpolation.load();
+
+    scene->update( interpolation );
 
-    renderer_->update( *scene, delta, time );
+    renderer_->update( *scene, delta, time, interpolation );
+
+    if ( headless_ )
+    {
+      if ( flags_.mainbufResized )
+      {
+        renderer_->reset( gameViewport_.width(), gameViewport_.height() );
+        flags_.mainbufResized = false;
+      }
+      auto camera = scene->cams().getActive();
+      if ( camera )
+        renderer_->drawGame( time, *scene, *camera, nullptr, gameViewport_, c_emptyVisualizations, false );
+      engine.director()->renderSync().unlockSceneWrite();
+      renderer_->state().endFrame();
+      renderer_->stream().endFrame();
+      NEKO_PROFILE_GPU_FRAME();
+      return;
+    }
     
     {
       char stats[256];
@@ -512,6 +577,15 @@ namespace neko {
     scene->cams().imguiCameraSelector();
     ImGui::DragFloat( "gamma", &gamma, 0.0025f, 0.0f, 10.0f );
     g_CVar_vid_gamma.set( gamma );
+    const auto& glstats = renderer_->state().lastFrame();
+    ImGui::Text( "GL state calls: %llu issued, %llu skipped", glstats.issued, glstats.skipped );
+    const auto& streamstats = renderer_->stream().stats();
+    ImGui::Text( "Stream buffer: %zu/%zu KiB, peak %zu KiB, %llu waits", streamstats.used / 1024,
+      streamstats.capacity / 1024, streamstats.peak / 1024, streamstats.waits );
+    const auto& texstats = renderer_->streamer().stats();
+    ImGui::Text( "Textures: %zu/%zu MiB in %zu streamed, %zu KiB uploaded, %zu queued, %llu evictions",
+      texstats.resident / ( 1024 * 1024 ), texstats.budget / ( 1024 * 1024 ), texstats.streamed, texstats.uploaded / 1024,
+      texstats.queued, texstats.evictions );
     //ImGui::RadioButton()
     ImGui::End();
 
@@ -547,6 +621,10 @@ namespace neko {
       ImGui::PopStyleVar( 2 );
     }
 
+#ifdef NEKO_PROFILER
+    Profiler::imguiWindow();
+#endif
+
     ImGui::EndFrame();
 
 #endif
@@ -554,7 +632,13 @@ namespace neko {
     engine.director()->renderSync().unlockSceneWrite();
 
     ImGui::Render();
-    ImGui_ImplOpenGL3_RenderDrawData( ImGui::GetDrawData() );
+    {
+      NEKO_PROFILE_GPU( "ImGui" );
+      ImGui_ImplOpenGL3_RenderDrawData( ImGui::GetDrawData() );
+    }
+    renderer_->state().endFrame();
+    renderer_->stream().endFrame();
+    NEKO_PROFILE_GPU_FRAME();
 
     if ( ImGui::GetIO().ConfigFlags & ImGuiConfigFlags_ViewportsEnable )
     {
@@ -567,7 +651,7 @@ namespace neko {
 
   const Image& Gfx::renderWindowReadPixels()
   {
-    glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+    renderer_->state().bindFramebuffer( 0 );
     lastCapture_.size_ = windowViewport_.size();
     lastCapture_.buffer_.resize( lastCapture_.size_.w * lastCapture_.size_.h * 4 * sizeof( uint8_t ) );
     glReadnPixels( 0, 0,
@@ -579,7 +663,8 @@ namespace neko {
 
   void Gfx::shutdown( Engine& engine )
   {
-    input_->shutdown();
+    if ( !headless_ )
+      input_->shutdown();
  
     messaging_->remove( this );
 
@@ -590,6 +675,13 @@ namespace neko {
     editor_->shutdown();
     editor_.reset();
 
+    if ( headless_ )
+    {
+      ImGui::DestroyContext();
+      context_.reset();
+      return;
+    }
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplWin32_Shutdown();
     ImGui::DestroyContext();
@@ -0,0 +1,202 @@
+#include "pch.h"
+#include "glstate.h"
+
+namespace neko {
+
+  using namespace gl;
+
+  namespace {
+
+    const GLenum c_capabilityEnums[GLStateCache::MAX_Capability] = {
+      GL_DEPTH_TEST,
+      GL_BLEND,
+      GL_CULL_FACE,
+      GL_SCISSOR_TEST,
+      GL_STENCIL_TEST,
+      GL_MULTISAMPLE,
+      GL_LINE_SMOOTH,
+      GL_POLYGON_SMOOTH
+    };
+
+  }
+
+  GLStateCache::GLStateCache()
+  {
+    invalidate();
+  }
+
+  void GLStateCache::invalidate()
+  {
+    vao_ = c_unknown;
+    pipeline_ = c_unknown;
+    framebuffer_ = c_unknown;
+    for ( auto& texture : textures_ )
+      texture = c_unknown;
+    for ( auto& image : images_ )
+      image = { c_unknown, 0, GL_FALSE, 0, GL_NONE, GL_NONE };
+    for ( auto& buffer : storageBuffers_ )
+      buffer = { c_unknown, 0, 0 };
+    for ( auto& buffer : uniformBuffers_ )
+      buffer = { c_unknown, 0, 0 };
+    for ( auto& cap : caps_ )
+      cap = -1;
+    depthMask_ = -1;
+    depthFunc_ = GL_NONE;
+    blendSrc_ = GL_NONE;
+    blendDst_ = GL_NONE;
+    polygonMode_ = GL_NONE;
+    cullFace_ = GL_NONE;
+    frontFace_ = GL_NONE;
+  }
+
+  void GLStateCache::endFrame()
+  {
+    lastFrame_ = frame_;
+    frame_ = Stats();
+    invalidate();
+  }
+
+  void GLStateCache::bindVertexArray( GLuint vao )
+  {
+    if ( change( vao_, vao ) )
+      glBindVertexArray( vao );
+  }
+
+  void GLStateCache::bindProgramPipeline( GLuint pipeline )
+  {
+    if ( change( pipeline_, pipeline ) )
+      glBindProgramPipeline( pipeline );
+  }
+
+  void GLStateCache::bindFramebuffer( GLuint framebuffer )
+  {
+    if ( change( framebuffer_, framebuffer ) )
+      glBindFramebuffer( GL_FRAMEBUFFER, framebuffer );
+  }
+
+  void GLStateCache::bindTextureUnit( GLuint unit, GLuint texture )
+  {
+    if ( unit >= c_textureUnits )
+    {
+      frame_.issued++;
+      glBindTextureUnit( unit, texture );
+      return;
+    }
+    if ( change( textures_[unit], texture ) )
+      glBindTextureUnit( unit, texture );
+  }
+
+  void GLStateCache::bindTextures( GLuint first, GLsizei count, const GLuint* textures )
+  {
+    bool dirty = ( first + count > c_textureUnits );
+    for ( GLsizei i = 0; !dirty && i < count; ++i )
+      dirty = ( textures_[first + i] != ( textures ? textures[i] : 0 ) );
+    if ( !dirty )
+    {
+      frame_.skipped++;
+      return;
+    }
+    for ( GLsizei i = 0; i < count && first + i < c_textureUnits; ++i )
+      textures_[first + i] = ( textures ? textures[i] : 0 );
+    frame_.issued++;
+    glBindTextures( first, count, textures );
+  }
+
+  void GLStateCache::bindImageTexture( GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer,
+    GLenum access, GLenum format )
+  {
+    const ImageBinding binding { texture, level, layered, layer, access, format };
+    if ( unit >= c_imageUnits )
+      frame_.issued++;
+    else if ( !change( images_[unit], binding ) )
+      return;
+    glBindImageTexture( unit, texture, level, layered, layer, access, format );
+  }
+
+  GLStateCache::BufferBinding* GLStateCache::bufferSlots( GLenum target )
+  {
+    return ( target == GL_SHADER_STORAGE_BUFFER ? storageBuffers_ :
+      target == GL_UNIFORM_BUFFER ? uniformBuffers_ : nullptr );
+  }
+
+  void GLStateCache::bindBufferBase( GLenum target, GLuint index, GLuint buffer )
+  {
+    auto slots = bufferSlots( target );
+    if ( !slots || index >= c_bufferSlots )
+      frame_.issued++;
+    else if ( !change( slots[index], BufferBinding { buffer, 0, 0 } ) )
+      return;
+    glBindBufferBase( target, index, buffer );
+  }
+
+  void GLStateCache::bindBufferRange( GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size )
+  {
+    auto slots = bufferSlots( target );
+    if ( !slots || index >= c_bufferSlots )
+      frame_.issued++;
+    else if ( !change( slots[index], BufferBinding { buffer, offset, size } ) )
+      return;
+    glBindBufferRange( target, index, buffer, offset, size );
+  }
+
+  void GLStateCache::enable( Capability cap, bool enable )
+  {
+    if ( !change( caps_[cap], static_cast<int8_t>( enable ? 1 : 0 ) ) )
+      return;
+    if ( enable )
+      glEnable( c_capabilityEnums[cap] );
+    else
+      glDisable( c_capabilityEnums[cap] );
+  }
+
+  bool GLStateCache::enabled( Capability cap )
+  {
+    if ( caps_[cap] < 0 )
+      caps_[cap] = ( glIsEnabled( c_capabilityEnums[cap] ) == GL_TRUE ? 1 : 0 );
+    return ( caps_[cap] > 0 );
+  }
+
+  void GLStateCache::depthMask( bool write )
+  {
+    if ( change( depthMask_, static_cast<int8_t>( write ? 1 : 0 ) ) )
+      glDepthMask( write ? GL_TRUE : GL_FALSE );
+  }
+
+  void GLStateCache::depthFunc( GLenum func )
+  {
+    if ( change( depthFunc_, func ) )
+      glDepthFunc( func );
+  }
+
+  void GLStateCache::blendFunc( GLenum src, GLenum dst )
+  {
+    if ( blendSrc_ == src && blendDst_ == dst )
+    {
+      frame_.skipped++;
+      return;
+    }
+    blendSrc_ = src;
+    blendDst_ = dst;
+    frame_.issued++;
+    glBlendFunc( src, dst );
+  }
+
+  void GLStateCache::polygonMode( GLenum mode )
+  {
+    if ( change( polygonMode_, mode ) )
+      glPolygonMode( GL_FRONT_AND_BACK, mode );
+  }
+
+  void GLStateCache::cullFace( GLenum face )
+  {
+    if ( change( cullFace_, face ) )
+      glCullFace( face );
+  }
+
+  void GLStateCache::frontFace( GLenum winding )
+  {
+    if ( change( frontFace_, winding ) )
+      glFrontFace( winding );
+  }
+
+}
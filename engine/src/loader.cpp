@@ -6,6 +6,8 @@
 #include "console.h"
 #include "filesystem.h"
 #include "spriteanim.h"
+#include "profiler.h"
+#include "texturecompression.h"
 
 #include "lodepng.h"
 #include "tinytiffreader.hxx"
@@ -24,6 +26,7 @@ namespace neko {
   bool ThreadedLoader::threadProc( platform::Event& running, platform::Event& wantStop, void* argument )
   {
     platform::performanceInitializeLoaderThread();
+    NEKO_PROFILE_THREAD( "Loader" );
 
     auto loader = ( (ThreadedLoader*)argument )->shared_from_this();
     running.set();
@@ -107,13 +110,26 @@ namespace neko {
     finishedSpritesheetsEvent_.reset();
   }
 
+  void ThreadedLoader::getFinishedModels( ModelVector& models )
+  {
+    if ( !finishedModelsEvent_.check() )
+      return;
+
+    finishedTasksLock_.lock();
+    models.swap( finishedModels_ );
+    finishedTasksLock_.unlock();
+
+    finishedModels_.clear();
+    finishedModelsEvent_.reset();
+  }
+
   using namespace gl;
 
   void ThreadedLoader::loadFontFace( LoadTask::FontfaceLoad& task )
   {
-    vector<uint8_t> input;
-    Locator::fileSystem().openFile( Dir_Fonts, task.path_ )->readFullVector( input );
-    auto face = task.font_->loadFace( input, 0 );
+    NEKO_PROFILE_FUNCTION();
+    auto mapping = Locator::fileSystem().mapFile( Dir_Fonts, task.path_ );
+    auto face = task.font_->loadFace( mapping, 0 );
     for ( const auto& spec : task.specs_ )
     {
       face->loadStyle( spec.rendering, spec.size, spec.thickness, g_prerenderGlyphs );
@@ -161,15 +177,24 @@ namespace neko {
     return { PixFmtColorRGBA8 };
   }
 
+  void ThreadedLoader::prepareLayer( const Material& material, MaterialLayer& layer )
+  {
+    if ( TextureCompressor::compressible( material, layer.image_ ) )
+      TextureCompressor::encodeLayer( layer, *material.wantCompression_, material.wantFiltering_ == Texture::Mipmapped );
+    else if ( TextureStreamer::streamable( material, layer.image_ ) )
+      layer.buildMipChain();
+  }
+
   void ThreadedLoader::loadMaterial( LoadTask::TextureLoad& task )
   {
+    NEKO_PROFILE_FUNCTION();
     for ( const auto& target : task.paths_ )
     {
       MaterialLayer layer( loadTexture( target ) );
-      layer.image_.flipVertical();
       task.material_->wantWrapping_ = Texture::Repeat;
       task.material_->width_ = layer.width();
       task.material_->height_ = layer.height();
+      prepareLayer( *task.material_, layer );
       task.material_->layers_.push_back( move( layer ) );
     }
 
@@ -182,13 +207,13 @@ namespace neko {
 
   void ThreadedLoader::loadSpritesheet( LoadTask::SpritesheetLoad& task )
   {
+    NEKO_PROFILE_FUNCTION();
     map<utf8String, PixmapPtr> textures;
     for ( const auto& [key, it] : task.def_->entries_ )
     {
       if ( !textures.contains( it->sheetName_ ) )
       {
         textures[it->sheetName_] = make_shared<Pixmap>( loadTexture( it->sheetName_ ) );
-        textures[it->sheetName_]->flipVertical();
       }
 
       auto w = it->definition_->width();
@@ -228,6 +253,7 @@ namespace neko {
       it->material_->width_ = it->definition_->width();
       it->material_->height_ = it->definition_->height();
       it->material_->arrayDepth_ = it->definition_->frameCount();
+      it->material_->arrayTexture_ = true;
       it->material_->loaded_ = true;
 
       finishedTasksLock_.lock();
@@ -240,9 +266,47 @@ namespace neko {
     finishedTasksLock_.unlock();
   }
 
+  void ThreadedLoader::loadSpriteAtlas( LoadTask::SpriteAtlasLoad& task )
+  {
+    NEKO_PROFILE_FUNCTION();
+    auto& atlas = *task.atlas_;
+    const ImageInfo pageInfo { atlas.pageSize_.x, atlas.pageSize_.y, PixFmtColorRGBA8 };
+    const auto pageBytes = pageInfo.bytes();
+
+    // Pages are decoded straight into their layers of the one array image
+    vector<uint8_t> pixels( pageBytes * atlas.pages_.size() );
+    vector<uint8_t> input;
+    for ( size_t i = 0; i < atlas.pages_.size(); ++i )
+    {
+      Locator::fileSystem().openFile( Dir_Textures, atlas.pages_[i] )->readFullVector( input );
+      const auto info = Pixmap::inspectPNG( input );
+      if ( info.width != pageInfo.width || info.height != pageInfo.height || info.format != pageInfo.format )
+        NEKO_EXCEPT( "Sprite atlas page doesn't match its manifest: " + atlas.pages_[i] );
+      Pixmap::decodePNG( input, info, pixels.data() + i * pageBytes, false );
+    }
+
+    auto& mat = *atlas.material_;
+    mat.layers_.emplace_back( Pixmap( pageInfo.width, pageInfo.height * static_cast<int>( atlas.pages_.size() ),
+      PixFmtColorRGBA8, move( pixels ) ) );
+    mat.wantWrapping_ = Texture::Wrapping::ClampBorder;
+    mat.wantFiltering_ = Texture::Filtering::Nearest;
+    mat.width_ = pageInfo.width;
+    mat.height_ = pageInfo.height;
+    mat.arrayDepth_ = static_cast<int>( atlas.pages_.size() );
+    mat.arrayTexture_ = true;
+    mat.loaded_ = true;
+
+    Locator::console().printf( srcLoader, "Loaded sprite atlas %s, %zu pages", atlas.name_.c_str(), atlas.pages_.size() );
+
+    finishedTasksLock_.lock();
+    finishedMaterials_.push_back( atlas.material_ );
+    finishedTasksLock_.unlock();
+  }
+
   // Context: Worker thread
   void ThreadedLoader::handleNewTasks()
   {
+    NEKO_PROFILE_FUNCTION();
     LoadTaskVector newTasks;
 
     addTaskLock_.lock();
@@ -264,6 +328,14 @@ namespace neko {
       {
         loadSpritesheet( task.spriteLoad );
       }
+      else if ( task.type_ == LoadTask::Load_SpriteAtlas )
+      {
+        loadSpriteAtlas( task.atlasLoad );
+      }
+      else if ( task.type_ == LoadTask::Load_Model )
+      {
+        loadModel( task.modelLoad );
+      }
     }
 
     if ( !finishedMaterials_.empty() )
@@ -274,6 +346,9 @@ namespace neko {
 
     if ( !finishedSpritesheets_.empty() )
       finishedSpritesheetsEvent_.set();
+
+    if ( !finishedModels_.empty() )
+      finishedModelsEvent_.set();
   }
 
   void ThreadedLoader::clear()
@@ -284,6 +359,7 @@ namespace neko {
     finishedMaterials_.clear();
     finishedFonts_.clear();
     finishedSpritesheets_.clear();
+    finishedModels_.clear();
     finishedTasksLock_.unlock();
     addTaskLock_.unlock();
   }
@@ -1,290 +1,764 @@
 #include "pch.h"
 #include "loader.h"
 #include "utilities.h"
-#include "lodepng.h"
 #include "gfx_types.h"
 #include "renderer.h"
 #include "console.h"
+#include "filesystem.h"
+#include "mesh_primitives.h"
+#include "meshcache.h"
+#include "model.h"
+#include "profiler.h"
 #include "tiny_gltf.h"
+#include "stb_image.h"
 
-#if 0
+namespace neko {
 
-namespace neko::loaders {
+  namespace {
 
-  static size_t ComponentTypeByteSize( int type )
-  {
-    switch ( type )
+    constexpr uint32_t c_glbMagic = 0x46546C67; // "glTF"
+    constexpr uint32_t c_glbChunkJSON = 0x4E4F534A; // "JSON"
+    constexpr uint32_t c_glbChunkBIN = 0x004E4942; // "BIN\0"
+    constexpr size_t c_decodeBlock = 65536; //!< Accessor elements per decode task
+
+    //! One byte stand-ins for the buffers and images the loader maps itself, see parseDocument.
+    const char* c_stubBufferUri = "data:application/octet-stream;base64,AA==";
+    const char* c_stubImageUri = "data:image/png;base64,AA==";
+
+    //! A parsed glTF file, and the bytes of its buffers and encoded images.
+    struct Document
     {
-      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-      case TINYGLTF_COMPONENT_TYPE_BYTE:
-        return sizeof( char );
-      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-      case TINYGLTF_COMPONENT_TYPE_SHORT:
-        return sizeof( short );
-      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-      case TINYGLTF_COMPONENT_TYPE_INT:
-        return sizeof( int );
-      case TINYGLTF_COMPONENT_TYPE_FLOAT:
-        return sizeof( float );
-      case TINYGLTF_COMPONENT_TYPE_DOUBLE:
-        return sizeof( double );
-      default:
-        return 0;
+      tinygltf::Model model;
+      vector<FileMappingPtr> mappings;
+      vector<utf8String> sources; //!< Files read besides the main one, relative to the meshes directory
+      vector<span<const uint8_t>> buffers;
+      vector<span<const uint8_t>> images;
+    };
+
+    //! Decode of one range of an accessor's elements, into floats or indices.
+    struct DecodeTask
+    {
+      const tinygltf::Accessor* accessor = nullptr;
+      int components = 0; //!< Floats written per element, zero when decoding indices
+      uint8_t* out = nullptr; //!< Where element 0 goes
+      size_t stride = 0; //!< Between elements in out
+      size_t first = 0;
+      size_t last = 0;
+    };
+
+    struct PendingPart
+    {
+      ModelPart* part = nullptr;
+      const tinygltf::Primitive* primitive = nullptr;
+      vector<DecodeTask> sparse; //!< Whole accessors with sparse values to patch in after decoding
+      bool indexed = false;
+      bool normals = false;
+      bool tangents = false;
+      vec4 baseColor { 1.0f };
+    };
+
+    inline uint32_t readUint32( const uint8_t* data )
+    {
+      uint32_t value;
+      memcpy( &value, data, sizeof( value ) );
+      return value;
     }
-  }
 
-  struct DumbBufferStructure {
-    vector<uint8_t> data_;
-    utf8String viewName_;
-    utf8String bufferName_;
-    GLenum componentType_ = GLenum::GL_FAILURE_NV; // as in what's fed to glVertexAttribPointer as [type]; GL_BYTE, GL_INT and so on
-  };
+    utf8String decodeUri( const utf8String& uri )
+    {
+      utf8String out;
+      for ( size_t i = 0; i < uri.size(); ++i )
+        if ( uri[i] == '%' && i + 2 < uri.size() && isxdigit( static_cast<unsigned char>( uri[i + 1] ) ) &&
+          isxdigit( static_cast<unsigned char>( uri[i + 2] ) ) )
+        {
+          out += static_cast<char>( strtol( uri.substr( i + 1, 2 ).c_str(), nullptr, 16 ) );
+          i += 2;
+        }
+        else
+          out += uri[i];
+      return out;
+    }
 
-  static void gltf_extractBuffers( tinygltf::Model& model, vector<DumbBufferStructure>& out )
-  {
-    for ( size_t i = 0; i < model.bufferViews.size(); i++ )
+    bool keepEncodedImage( tinygltf::Image* image, const int index, std::string* error, std::string* warning,
+      int width, int height, const unsigned char* bytes, int size, void* user )
     {
-      DumbBufferStructure out_buf;
+      image->image.assign( bytes, bytes + size );
+      image->as_is = true;
+      return true;
+    }
 
-      const tinygltf::BufferView& bufferView = model.bufferViews[i];
-      if ( bufferView.target == 0 )
-        NEKO_EXCEPT( "GLTF buffer view target is zero" );
+    //! Parse a .gltf or .glb from the meshes directory.
+    //! tinygltf would copy a .glb's binary chunk, and read every external buffer and image file, into vectors of its
+    //! own. Instead those sources are swapped for one byte stubs in the JSON it gets, and read from memory mappings.
+    //! Only data URIs are left for it to decode. Images are kept encoded, to be decoded in parallel later.
+    void parseDocument( const utf8String& path, Document& doc )
+    {
+      auto file = Locator::fileSystem().mapFile( Dir_Meshes, path );
+      doc.mappings.push_back( file );
+      const auto bytes = file->view();
+      const auto basedir = path.substr( 0, path.find_last_of( "/\\" ) + 1 );
 
-      int sparse_accessor = -1;
-      for ( size_t a_i = 0; a_i < model.accessors.size(); ++a_i )
+      span<const uint8_t> text = bytes;
+      span<const uint8_t> binary;
+      if ( bytes.size() >= 12 && readUint32( bytes.data() ) == c_glbMagic )
       {
-        const auto& accessor = model.accessors[a_i];
-        if ( accessor.bufferView == i )
+        if ( readUint32( bytes.data() + 4 ) != 2 )
+          NEKO_EXCEPT( "GLB container version is not 2: " + path );
+        const auto length = math::min( static_cast<size_t>( readUint32( bytes.data() + 8 ) ), bytes.size() );
+        text = {};
+        size_t offset = 12;
+        while ( offset + 8 <= length )
+        {
+          const size_t chunkLength = readUint32( bytes.data() + offset );
+          const auto chunkType = readUint32( bytes.data() + offset + 4 );
+          offset += 8;
+          if ( chunkLength > length - offset )
+            NEKO_EXCEPT( "GLB chunk runs past the end of the file: " + path );
+          if ( chunkType == c_glbChunkJSON && text.empty() )
+            text = bytes.subspan( offset, chunkLength );
+          else if ( chunkType == c_glbChunkBIN && binary.empty() )
+            binary = bytes.subspan( offset, chunkLength );
+          offset += ( chunkLength + 3 ) & ~size_t( 3 );
+        }
+        if ( text.empty() )
+          NEKO_EXCEPT( "GLB has no JSON chunk: " + path );
+      }
+
+      auto json = nlohmann::json::parse( text.begin(), text.end() );
+      if ( json.contains( "extensionsRequired" ) && !json["extensionsRequired"].empty() )
+        NEKO_EXCEPT( "GLTF requires extensions that aren't supported: " + json["extensionsRequired"].dump() );
+
+      const auto mapSource = [&doc, &basedir]( const utf8String& uri ) {
+        doc.sources.push_back( basedir + decodeUri( uri ) );
+        auto mapping = Locator::fileSystem().mapFile( Dir_Meshes, doc.sources.back() );
+        doc.mappings.push_back( mapping );
+        return mapping->view();
+      };
+
+      vector<bool> embedded;
+      if ( json.contains( "buffers" ) )
+        for ( auto& buffer : json["buffers"] )
         {
-          if ( out_buf.componentType_ == GLenum::GL_FAILURE_NV )
-            out_buf.componentType_ = (GLenum)accessor.componentType;
-          else if ( out_buf.componentType_ != (GLenum)accessor.componentType )
-            NEKO_EXCEPT( "GLTF accessors for bufferview have multiple component types" );
-          if ( accessor.sparse.isSparse )
+          const auto length = buffer.value( "byteLength", size_t( 0 ) );
+          const auto uri = buffer.value( "uri", utf8String() );
+          if ( uri.starts_with( "data:" ) )
+          {
+            embedded.push_back( true );
+            doc.buffers.emplace_back();
+            continue;
+          }
+          span<const uint8_t> data;
+          if ( uri.empty() )
           {
-            // "WARN: this bufferView has at least one sparse accessor to it. We are going to load the data as patched by this sparse accessor, not the original data"
-            sparse_accessor = (int)a_i;
-            break;
+            // The binary chunk, which only the first buffer of a .glb may refer to
+            if ( !doc.buffers.empty() || binary.empty() )
+              NEKO_EXCEPT( "GLTF buffer has no source: " + path );
+            data = binary;
           }
+          else
+            data = mapSource( uri );
+          if ( data.size() < length )
+            NEKO_EXCEPT( "GLTF buffer is shorter than its byteLength: " + path );
+          embedded.push_back( false );
+          doc.buffers.push_back( data.first( length ) );
+          buffer["uri"] = c_stubBufferUri;
+          buffer["byteLength"] = 1;
         }
-      }
 
-      const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
+      // Images in buffer views are resolved once the views have been parsed
+      vector<int> imageViews;
+      if ( json.contains( "images" ) )
+        for ( auto& image : json["images"] )
+        {
+          const auto uri = image.value( "uri", utf8String() );
+          imageViews.push_back( image.value( "bufferView", -1 ) );
+          doc.images.emplace_back();
+          if ( uri.starts_with( "data:" ) )
+            continue;
+          if ( imageViews.back() < 0 )
+            doc.images.back() = mapSource( uri );
+          image.erase( "bufferView" );
+          image.erase( "mimeType" );
+          image["uri"] = c_stubImageUri;
+        }
+
+      tinygltf::TinyGLTF context;
+      context.SetImageLoader( keepEncodedImage, nullptr );
+      utf8String error;
+      utf8String warning;
+      const auto stubbed = json.dump();
+      if ( !context.LoadASCIIFromString( &doc.model, &error, &warning, stubbed.c_str(),
+        static_cast<unsigned int>( stubbed.size() ), utf8String() ) )
+        NEKO_EXCEPT( "GLTF parse failed: " + path + "\n" + error );
+      if ( !warning.empty() )
+        Locator::console().printf( srcLoader, "Warning: %s: %s", path.c_str(), warning.c_str() );
+
+      for ( size_t i = 0; i < doc.buffers.size(); ++i )
+        if ( embedded[i] )
+          doc.buffers[i] = doc.model.buffers[i].data;
+
+      for ( size_t i = 0; i < doc.images.size(); ++i )
+        if ( imageViews[i] >= 0 )
+        {
+          const auto& view = doc.model.bufferViews.at( imageViews[i] );
+          const auto& buffer = doc.buffers.at( view.buffer );
+          if ( view.byteOffset + view.byteLength > buffer.size() )
+            NEKO_EXCEPT( "GLTF image runs past its buffer: " + path );
+          doc.images[i] = buffer.subspan( view.byteOffset, view.byteLength );
+        }
+        else if ( doc.images[i].empty() )
+          doc.images[i] = doc.model.images[i].image;
+    }
+
+    span<const uint8_t> viewBytes( const Document& doc, int index )
+    {
+      const auto& view = doc.model.bufferViews.at( index );
+      const auto& buffer = doc.buffers.at( view.buffer );
+      if ( view.byteOffset + view.byteLength > buffer.size() )
+        NEKO_EXCEPT( "GLTF buffer view runs past its buffer" );
+      return buffer.subspan( view.byteOffset, view.byteLength );
+    }
+
+    //! Element 0 of an accessor and the distance between elements, checked against the buffer view.
+    //! Null for accessors without a view, which are all zeros apart from their sparse values.
+    pair<const uint8_t*, size_t> accessorData( const Document& doc, const tinygltf::Accessor& accessor )
+    {
+      if ( accessor.bufferView < 0 )
+        return { nullptr, 0 };
+      const auto stride = accessor.ByteStride( doc.model.bufferViews.at( accessor.bufferView ) );
+      if ( stride <= 0 )
+        NEKO_EXCEPT( "GLTF accessor has an invalid stride" );
+      const size_t element = tinygltf::GetComponentSizeInBytes( accessor.componentType ) *
+        tinygltf::GetNumComponentsInType( accessor.type );
+      const auto bytes = viewBytes( doc, accessor.bufferView );
+      if ( accessor.count > 0 && accessor.byteOffset + ( accessor.count - 1 ) * stride + element > bytes.size() )
+        NEKO_EXCEPT( "GLTF accessor runs past its buffer view" );
+      return { bytes.data() + accessor.byteOffset, static_cast<size_t>( stride ) };
+    }
+
+    template <typename T>
+    inline float componentValue( const uint8_t* data, bool normalized )
+    {
+      T value;
+      memcpy( &value, data, sizeof( T ) );
+      if constexpr ( std::is_floating_point_v<T> )
+        return static_cast<float>( value );
+      else if ( !normalized )
+        return static_cast<float>( value );
+      else if constexpr ( std::is_signed_v<T> )
+        return math::max( static_cast<float>( value ) / std::numeric_limits<T>::max(), -1.0f );
+      else
+        return static_cast<float>( value ) / std::numeric_limits<T>::max();
+    }
 
-      out_buf.data_.resize( bufferView.byteLength );
+    template <typename T>
+    void decodeFloatsAs( const uint8_t* data, size_t stride, const DecodeTask& task, bool normalized )
+    {
+      for ( size_t i = task.first; i < task.last; ++i )
+      {
+        const auto element = data + i * stride;
+        auto out = reinterpret_cast<float*>( task.out + i * task.stride );
+        for ( int c = 0; c < task.components; ++c )
+          out[c] = componentValue<T>( element + c * sizeof( T ), normalized );
+      }
+    }
 
-      if ( sparse_accessor < 0 )
+    void decodeFloats( int componentType, const uint8_t* data, size_t stride, const DecodeTask& task, bool normalized )
+    {
+      switch ( componentType )
       {
-        memcpy( out_buf.data_.data(), &buffer.data.at( 0 ) + bufferView.byteOffset, bufferView.byteLength );
+        case TINYGLTF_COMPONENT_TYPE_BYTE: decodeFloatsAs<int8_t>( data, stride, task, normalized ); break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: decodeFloatsAs<uint8_t>( data, stride, task, normalized ); break;
+        case TINYGLTF_COMPONENT_TYPE_SHORT: decodeFloatsAs<int16_t>( data, stride, task, normalized ); break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: decodeFloatsAs<uint16_t>( data, stride, task, normalized ); break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: decodeFloatsAs<uint32_t>( data, stride, task, normalized ); break;
+        case TINYGLTF_COMPONENT_TYPE_FLOAT: decodeFloatsAs<float>( data, stride, task, normalized ); break;
+        default:
+          NEKO_EXCEPT( "GLTF accessor has an unsupported component type" );
       }
-      else
+    }
+
+    template <typename T>
+    void decodeIndicesAs( const uint8_t* data, size_t stride, const DecodeTask& task )
+    {
+      for ( size_t i = task.first; i < task.last; ++i )
       {
-        const auto& accessor = model.accessors[sparse_accessor];
+        T value;
+        memcpy( &value, data + i * stride, sizeof( T ) );
+        *reinterpret_cast<GLuint*>( task.out + i * task.stride ) = static_cast<GLuint>( value );
+      }
+    }
 
-        memcpy( out_buf.data_.data(), buffer.data.data() + bufferView.byteOffset, bufferView.byteLength );
+    void decodeIndices( int componentType, const uint8_t* data, size_t stride, const DecodeTask& task )
+    {
+      switch ( componentType )
+      {
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: decodeIndicesAs<uint8_t>( data, stride, task ); break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: decodeIndicesAs<uint16_t>( data, stride, task ); break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: decodeIndicesAs<uint32_t>( data, stride, task ); break;
+        default:
+          NEKO_EXCEPT( "GLTF index accessor has an unsupported component type" );
+      }
+    }
 
-        const size_t size_of_object_in_buffer = ComponentTypeByteSize( accessor.componentType );
-        const size_t size_of_sparse_indices = ComponentTypeByteSize( accessor.sparse.indices.componentType );
+    void decode( const Document& doc, const DecodeTask& task )
+    {
+      const auto& accessor = *task.accessor;
+      const auto [data, stride] = accessorData( doc, accessor );
+      if ( !data )
+        return;
+      if ( task.components )
+        decodeFloats( accessor.componentType, data, stride, task, accessor.normalized );
+      else
+        decodeIndices( accessor.componentType, data, stride, task );
+    }
 
-        const auto& indices_buffer_view = model.bufferViews[accessor.sparse.indices.bufferView];
-        const auto& indices_buffer = model.buffers[indices_buffer_view.buffer];
+    //! Overwrite the elements an accessor lists in its sparse section, after the rest has been decoded.
+    void patchSparse( const Document& doc, const DecodeTask& task )
+    {
+      const auto& sparse = task.accessor->sparse;
+      const auto count = static_cast<size_t>( sparse.count );
+      const size_t indexSize = tinygltf::GetComponentSizeInBytes( sparse.indices.componentType );
+      const size_t valueSize = tinygltf::GetComponentSizeInBytes( task.accessor->componentType ) *
+        tinygltf::GetNumComponentsInType( task.accessor->type );
+      const auto indexBytes = viewBytes( doc, sparse.indices.bufferView );
+      const auto valueBytes = viewBytes( doc, sparse.values.bufferView );
+      if ( sparse.indices.byteOffset + count * indexSize > indexBytes.size() ||
+           sparse.values.byteOffset + count * valueSize > valueBytes.size() )
+        NEKO_EXCEPT( "GLTF sparse accessor runs past its buffer view" );
 
-        const auto& values_buffer_view = model.bufferViews[accessor.sparse.values.bufferView];
-        const auto& values_buffer = model.buffers[values_buffer_view.buffer];
+      vector<GLuint> targets( count );
+      decodeIndices( sparse.indices.componentType, indexBytes.data() + sparse.indices.byteOffset, indexSize,
+        { nullptr, 0, reinterpret_cast<uint8_t*>( targets.data() ), sizeof( GLuint ), 0, count } );
 
-        for ( size_t sparse_index = 0; sparse_index < accessor.sparse.count; ++sparse_index )
-        {
-          int index = 0;
-          // std::cout << "accessor.sparse.indices.componentType = " <<
-          // accessor.sparse.indices.componentType << std::endl;
-          switch ( accessor.sparse.indices.componentType )
-          {
-            case TINYGLTF_COMPONENT_TYPE_BYTE:
-            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-              index = (int)*(unsigned char*)( indices_buffer.data.data() + indices_buffer_view.byteOffset + accessor.sparse.indices.byteOffset + ( sparse_index * size_of_sparse_indices ) );
-              break;
-            case TINYGLTF_COMPONENT_TYPE_SHORT:
-            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-              index = (int)*(unsigned short*)( indices_buffer.data.data() + indices_buffer_view.byteOffset + accessor.sparse.indices.byteOffset + ( sparse_index * size_of_sparse_indices ) );
-              break;
-            case TINYGLTF_COMPONENT_TYPE_INT:
-            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-              index = (int)*(unsigned int*)( indices_buffer.data.data() + indices_buffer_view.byteOffset + accessor.sparse.indices.byteOffset + ( sparse_index * size_of_sparse_indices ) );
-              break;
-          }
+      const auto values = valueBytes.data() + sparse.values.byteOffset;
+      for ( size_t i = 0; i < count; ++i )
+      {
+        if ( targets[i] >= task.accessor->count )
+          NEKO_EXCEPT( "GLTF sparse index is out of range" );
+        DecodeTask single = task;
+        single.out = task.out + targets[i] * task.stride;
+        single.first = 0;
+        single.last = 1;
+        if ( task.components )
+          decodeFloats( task.accessor->componentType, values + i * valueSize, valueSize, single,
+            task.accessor->normalized );
+        else
+          decodeIndices( task.accessor->componentType, values + i * valueSize, valueSize, single );
+      }
+    }
 
-          const unsigned char* read_from = values_buffer.data.data() + ( values_buffer_view.byteOffset + accessor.sparse.values.byteOffset ) + ( sparse_index * ( size_of_object_in_buffer * accessor.type ) );
+    //! Split the decode of an accessor into blocks, so that large ones spread over the workers too.
+    void queueDecode( vector<DecodeTask>& tasks, PendingPart& pending, const tinygltf::Accessor& accessor,
+      int components, uint8_t* out, size_t stride )
+    {
+      DecodeTask whole { &accessor, components, out, stride, 0, accessor.count };
+      for ( size_t first = 0; first < accessor.count; first += c_decodeBlock )
+      {
+        whole.first = first;
+        whole.last = math::min( first + c_decodeBlock, accessor.count );
+        tasks.push_back( whole );
+      }
+      if ( accessor.sparse.isSparse )
+      {
+        whole.first = 0;
+        whole.last = accessor.count;
+        pending.sparse.push_back( whole );
+      }
+    }
 
-          unsigned char* write_to = out_buf.data_.data() + index * ( size_of_object_in_buffer * accessor.type );
+    const tinygltf::Accessor* findAttribute( const tinygltf::Model& model, const tinygltf::Primitive& primitive,
+      const char* name, int minComponents, int maxComponents )
+    {
+      auto it = primitive.attributes.find( name );
+      if ( it == primitive.attributes.end() )
+        return nullptr;
+      const auto& accessor = model.accessors.at( it->second );
+      const auto components = tinygltf::GetNumComponentsInType( accessor.type );
+      if ( components < minComponents || components > maxComponents )
+        NEKO_EXCEPT( utf8String( "GLTF attribute has the wrong number of components: " ) + name );
+      return &accessor;
+    }
 
-          memcpy( write_to, read_from, size_of_object_in_buffer * accessor.type );
+    //! Give every triangle vertices of its own with the face normal, then weld the corners that still match.
+    //! This is what glTF asks for when a primitive has no normals.
+    void generateFlatNormals( vector<Vertex3D>& verts, vector<GLuint>& indices )
+    {
+      vector<Vertex3D> corners( indices.size() );
+      for ( size_t i = 0; i < indices.size(); i += 3 )
+      {
+        const auto& a = verts[indices[i]].position;
+        const auto edges = math::cross( verts[indices[i + 1]].position - a, verts[indices[i + 2]].position - a );
+        const auto length = math::length( edges );
+        const auto normal = ( length > 0.0f ? edges / length : vec3( 0.0f, 0.0f, 1.0f ) );
+        for ( size_t k = 0; k < 3; ++k )
+        {
+          corners[i + k] = verts[indices[i + k]];
+          corners[i + k].normal = normal;
         }
       }
-
-      out.push_back( move( out_buf ) );
+      verts.swap( corners );
+      for ( size_t i = 0; i < indices.size(); ++i )
+        indices[i] = static_cast<GLuint>( i );
+      util::weldVertices( verts, indices );
     }
-  };
 
-  constexpr vec3 gltf_toVec3( const vector<double>& v, const vec3 def = vec3( 0.0f ) )
-  {
-    if ( v.empty() )
-      return def;
-    return { static_cast<Real>( v[0] ), static_cast<Real>( v[1] ), static_cast<Real>( v[2] ) };
-  }
+    //! Turn strips and fans into lists, make up indices for unindexed primitives and finish the vertices.
+    void finishPart( const Document& doc, PendingPart& pending )
+    {
+      for ( const auto& task : pending.sparse )
+        patchSparse( doc, task );
 
-  constexpr quaternion gltf_toQuat( const vector<double>& v, const quaternion def = glm::quat_identity<Real, glm::defaultp>() )
-  {
-    if ( v.empty() )
-      return def;
-    return { static_cast<Real>( v[0] ), static_cast<Real>( v[1] ), static_cast<Real>( v[2] ), static_cast<Real>( v[3] ) };
-  }
+      auto& part = *pending.part;
+      const auto count = ( pending.indexed ? part.indices.size() : part.vertices.size() );
+      const auto index = [&part, &pending]( size_t i ) {
+        return ( pending.indexed ? part.indices[i] : static_cast<GLuint>( i ) );
+      };
+      vector<GLuint> triangles;
+      const auto mode = pending.primitive->mode;
+      if ( mode == TINYGLTF_MODE_TRIANGLE_STRIP )
+      {
+        for ( size_t i = 0; i + 2 < count; ++i )
+          triangles.insert( triangles.end(), { index( i + ( i & 1 ) ), index( i + 1 - ( i & 1 ) ), index( i + 2 ) } );
+      }
+      else if ( mode == TINYGLTF_MODE_TRIANGLE_FAN )
+      {
+        for ( size_t i = 1; i + 1 < count; ++i )
+          triangles.insert( triangles.end(), { index( 0 ), index( i ), index( i + 1 ) } );
+      }
+      else
+      {
+        triangles.resize( count - count % 3 );
+        for ( size_t i = 0; i < triangles.size(); ++i )
+          triangles[i] = index( i );
+      }
+      part.indices.swap( triangles );
 
-  constexpr vec2 gltf_mesh_vec2( vec2 a )
-  {
-    return { a.x, a.y };
-  }
+      for ( auto i : part.indices )
+        if ( i >= part.vertices.size() )
+          NEKO_EXCEPT( "GLTF primitive index is out of range" );
 
-  constexpr vec3 gltf_mesh_vec3( vec3 a )
-  {
-    return { a.x, a.y, a.z };
-  }
+      // Loose triangles repeat their shared corners
+      if ( !pending.indexed )
+        util::weldVertices( part.vertices, part.indices );
 
-  constexpr vec4 gltf_mesh_vec4( vec4 a )
-  {
-    return { a.x, a.y, a.z, a.w };
-  }
+      if ( !pending.normals )
+        generateFlatNormals( part.vertices, part.indices );
 
-  void gltf_traverseTree( MeshNodePtr out, const tinygltf::Node& node, const vector<DumbBufferStructure>& buffers,
-    const tinygltf::Model& model, int depth = 0 )
-  {
-    out->name = node.name;
+      if ( !pending.tangents )
+        util::generateTangentsAndBitangents( part.vertices, part.indices );
+      else
+        for ( auto& vert : part.vertices )
+          vert.bitangent = math::cross( vert.normal, vec3( vert.tangent ) ) * vert.tangent.w;
+
+      if ( pending.baseColor != vec4( 1.0f ) )
+        for ( auto& vert : part.vertices )
+          vert.color *= pending.baseColor;
+
+      for ( size_t i = 0; i < part.vertices.size(); ++i )
+      {
+        part.boundsMin = ( i ? glm::min( part.boundsMin, part.vertices[i].position ) : part.vertices[i].position );
+        part.boundsMax = ( i ? glm::max( part.boundsMax, part.vertices[i].position ) : part.vertices[i].position );
+      }
+    }
 
-    out->scale = gltf_toVec3( node.scale, vec3( 1.0f ) );
-    out->rotate = gltf_toQuat( node.rotation );
-    out->translate = gltf_toVec3( node.translation, vec3( 0.0f ) );
+    //! Flatten a node and its descendants, parents first.
+    void addNode( const tinygltf::Model& model, int index, int parent, vector<ModelNode>& out, vector<bool>& visited )
+    {
+      if ( index < 0 || index >= static_cast<int>( model.nodes.size() ) || visited[index] )
+        NEKO_EXCEPT( "GLTF node hierarchy is not a tree" );
+      visited[index] = true;
+      const auto& node = model.nodes[index];
 
-    Locator::console().printf( srcLoader, "gltf: node %s depth %i trans %f,%f,%f scl %f,%f,%f mesh %i",
-      node.name.c_str(), depth, out->translate.x, out->translate.x, out->translate.y, out->scale.x, out->scale.y,
-      out->scale.z, node.mesh );
+      ModelNode flat;
+      flat.name = node.name;
+      flat.parent = parent;
+      flat.mesh = node.mesh;
+      if ( node.matrix.size() == 16 )
+      {
+        mat4 matrix;
+        for ( int i = 0; i < 16; ++i )
+          glm::value_ptr( matrix )[i] = static_cast<Real>( node.matrix[i] );
+        vec3 skew;
+        vec4 perspective;
+        glm::decompose( matrix, flat.scale, flat.rotate, flat.translate, skew, perspective );
+      }
+      else
+      {
+        if ( node.translation.size() == 3 )
+          flat.translate = vec3( node.translation[0], node.translation[1], node.translation[2] );
+        if ( node.rotation.size() == 4 )
+          flat.rotate = quaternion( static_cast<Real>( node.rotation[3] ), static_cast<Real>( node.rotation[0] ),
+            static_cast<Real>( node.rotation[1] ), static_cast<Real>( node.rotation[2] ) );
+        if ( node.scale.size() == 3 )
+          flat.scale = vec3( node.scale[0], node.scale[1], node.scale[2] );
+      }
+      const auto self = static_cast<int>( out.size() );
+      out.push_back( move( flat ) );
+      for ( auto child : node.children )
+        addNode( model, child, self, out, visited );
+    }
 
-    if ( node.mesh >= 0 )
+    //! Run fn over items on worker threads. Parallel algorithms terminate when an element throws, so the first
+    //! exception is caught and rethrown on the calling thread once all are done.
+    template <typename Range, typename Fn>
+    void parallelEach( Range& items, Fn&& fn )
     {
-      auto& mesh = model.meshes[node.mesh];
-      for ( auto& primitive : mesh.primitives )
+      std::exception_ptr failure;
+      platform::RWLock failureLock;
+      std::for_each( std::execution::par, items.begin(), items.end(), [&]( auto& item ) {
+        try
+        {
+          fn( item );
+        }
+        catch ( ... )
+        {
+          ScopedRWLock lock( &failureLock );
+          if ( !failure )
+            failure = std::current_exception();
+        }
+      } );
+      if ( failure )
+        std::rethrow_exception( failure );
+    }
+
+    Texture::Wrapping samplerWrapping( const tinygltf::Model& model, int sampler )
+    {
+      if ( sampler < 0 )
+        return Texture::Repeat;
+      switch ( model.samplers.at( sampler ).wrapS )
+      {
+        case TINYGLTF_TEXTURE_WRAP_CLAMP_TO_EDGE: return Texture::ClampEdge;
+        case TINYGLTF_TEXTURE_WRAP_MIRRORED_REPEAT: return Texture::MirroredRepeat;
+        default: return Texture::Repeat;
+      }
+    }
+
+    //! Import the nodes and meshes of a .gltf or .glb, and list the base color textures its materials use.
+    //! The textures stay encoded in doc.
+    void importModel( const utf8String& path, Document& doc, vector<ModelNode>& nodes, vector<ModelMesh>& meshes,
+      MeshCache::Images& images )
+    {
+      NEKO_PROFILE_FUNCTION();
+      parseDocument( path, doc );
+      const auto& gltf = doc.model;
+
+      // One texture per image, however many materials use it
+      images.images.clear();
+      images.materials.assign( gltf.materials.size(), -1 );
+      map<int, int> imageIndices;
+      for ( size_t i = 0; i < gltf.materials.size(); ++i )
       {
-        if ( primitive.indices < 0 )
+        const auto texture = gltf.materials[i].pbrMetallicRoughness.baseColorTexture.index;
+        if ( texture < 0 )
           continue;
-        const auto& indices = model.accessors[primitive.indices];
-        Locator::console().printf( srcLoader, "gltf: mesh primitive indices %i count %i mode %i", primitive.indices, indices.count, primitive.mode );
-        int pos_acc = -1;
-        int pos_count = -1;
-        int norm_acc = -1;
-        int tang_acc = -1;
-        int tc_acc = -1;
-        for ( auto& attribute : primitive.attributes )
+        const auto& source = gltf.textures.at( texture );
+        if ( source.source < 0 || source.source >= static_cast<int>( doc.images.size() ) )
+          continue;
+        auto found = imageIndices.find( source.source );
+        if ( found == imageIndices.end() )
         {
-          const auto& accessor = model.accessors[attribute.second];
-          if ( attribute.first == "POSITION" )
-          {
-            if ( accessor.type != TINYGLTF_TYPE_VEC3 )
-              NEKO_EXCEPT( "GLTF position accessor is not a vec3" );
-            pos_acc = accessor.bufferView;
-            pos_count = (int)accessor.count;
-          }
-          else if ( attribute.first == "NORMAL" )
+          const auto& image = gltf.images[source.source];
+          MeshCache::Image entry;
+          entry.name = ( image.name.empty() ? "image" + std::to_string( source.source ) : image.name );
+          entry.wrapping = samplerWrapping( gltf, source.sampler );
+          entry.encoded = doc.images[source.source];
+          found = imageIndices.emplace( source.source, static_cast<int>( images.images.size() ) ).first;
+          images.images.push_back( move( entry ) );
+        }
+        images.materials[i] = found->second;
+      }
+
+      // Set up every part's storage before decoding anything, since the tasks point into it
+      meshes.clear();
+      meshes.resize( gltf.meshes.size() );
+      for ( size_t m = 0; m < gltf.meshes.size(); ++m )
+      {
+        auto& mesh = meshes[m];
+        mesh.name = gltf.meshes[m].name;
+        for ( const auto& primitive : gltf.meshes[m].primitives )
+        {
+          if ( primitive.mode != TINYGLTF_MODE_TRIANGLES && primitive.mode != TINYGLTF_MODE_TRIANGLE_STRIP &&
+               primitive.mode != TINYGLTF_MODE_TRIANGLE_FAN && primitive.mode != -1 )
           {
-            if ( accessor.type != TINYGLTF_TYPE_VEC3 )
-              NEKO_EXCEPT( "GLTF normal accessor is not a vec3" );
-            norm_acc = accessor.bufferView;
+            Locator::console().printf( srcLoader, "Warning: %s: skipping mesh %s primitive of mode %i",
+              path.c_str(), mesh.name.c_str(), primitive.mode );
+            continue;
           }
-          else if ( attribute.first == "TANGENT" )
+          mesh.parts.emplace_back();
+        }
+      }
+
+      vector<DecodeTask> tasks;
+      vector<PendingPart> pending;
+      for ( size_t m = 0; m < gltf.meshes.size(); ++m )
+      {
+        auto part = meshes[m].parts.begin();
+        for ( const auto& primitive : gltf.meshes[m].primitives )
+        {
+          if ( primitive.mode != TINYGLTF_MODE_TRIANGLES && primitive.mode != TINYGLTF_MODE_TRIANGLE_STRIP &&
+               primitive.mode != TINYGLTF_MODE_TRIANGLE_FAN && primitive.mode != -1 )
+            continue;
+          PendingPart entry;
+          entry.part = &*part++;
+          entry.primitive = &primitive;
+          entry.part->material = primitive.material;
+
+          int texcoord = 0;
+          if ( primitive.material >= 0 )
           {
-            if ( accessor.type != TINYGLTF_TYPE_VEC4 )
-              NEKO_EXCEPT( "GLTF tangent accessor is not a vec4" );
-            tang_acc = accessor.bufferView;
+            const auto& pbr = gltf.materials.at( primitive.material ).pbrMetallicRoughness;
+            texcoord = math::max( pbr.baseColorTexture.texCoord, 0 );
+            if ( pbr.baseColorFactor.size() == 4 )
+              entry.baseColor = vec4( pbr.baseColorFactor[0], pbr.baseColorFactor[1], pbr.baseColorFactor[2],
+                pbr.baseColorFactor[3] );
           }
-          else if ( attribute.first == "TEXCOORD_0" )
+
+          const auto position = findAttribute( gltf, primitive, "POSITION", 3, 3 );
+          if ( !position )
+            NEKO_EXCEPT( "GLTF primitive has no positions: " + path );
+          const auto normal = findAttribute( gltf, primitive, "NORMAL", 3, 3 );
+          const auto tangent = findAttribute( gltf, primitive, "TANGENT", 4, 4 );
+          const auto uv = findAttribute( gltf, primitive, ( "TEXCOORD_" + std::to_string( texcoord ) ).c_str(), 2, 2 );
+          const auto color = findAttribute( gltf, primitive, "COLOR_0", 3, 4 );
+
+          auto& verts = entry.part->vertices;
+          verts.resize( position->count );
+          for ( auto& vert : verts )
+            vert.color = vec4( 1.0f );
+          const auto decodeAttribute = [&]( const tinygltf::Accessor* accessor, size_t offset, int components ) {
+            if ( !accessor )
+              return false;
+            if ( accessor->count != position->count )
+              NEKO_EXCEPT( "GLTF primitive attributes differ in length: " + path );
+            queueDecode( tasks, entry, *accessor, components, reinterpret_cast<uint8_t*>( verts.data() ) + offset,
+              sizeof( Vertex3D ) );
+            return true;
+          };
+          decodeAttribute( position, offsetof( Vertex3D, position ), 3 );
+          entry.normals = decodeAttribute( normal, offsetof( Vertex3D, normal ), 3 );
+          entry.tangents = decodeAttribute( tangent, offsetof( Vertex3D, tangent ), 4 );
+          decodeAttribute( uv, offsetof( Vertex3D, texcoord ), 2 );
+          if ( color )
+            decodeAttribute( color, offsetof( Vertex3D, color ), tinygltf::GetNumComponentsInType( color->type ) );
+
+          if ( primitive.indices >= 0 )
           {
-            if ( accessor.type != TINYGLTF_TYPE_VEC2 )
-              NEKO_EXCEPT( "GLTF texcoord accessor is not a vec2" );
-            tc_acc = accessor.bufferView;
+            const auto& indices = gltf.accessors.at( primitive.indices );
+            if ( tinygltf::GetNumComponentsInType( indices.type ) != 1 )
+              NEKO_EXCEPT( "GLTF index accessor is not scalar: " + path );
+            entry.indexed = true;
+            entry.part->indices.resize( indices.count );
+            queueDecode( tasks, entry, indices, 0, reinterpret_cast<uint8_t*>( entry.part->indices.data() ), sizeof( GLuint ) );
           }
-          Locator::console().printf( srcLoader, "gltf: mesh primitive attribute %s buffer %i name %s viewname %s componenttype %i size %i", attribute.first.c_str(), accessor.bufferView, buffers[accessor.bufferView].bufferName_.c_str(), buffers[accessor.bufferView].viewName_.c_str(), buffers[accessor.bufferView].componentType_, buffers[accessor.bufferView].data_.size() );
-        }
-        if ( pos_acc < 0 || norm_acc < 0 || tang_acc < 0 || tc_acc < 0 )
-          NEKO_EXCEPT( "GLTF mesh is missing pos, norm, tang or texcoord array" );
-        auto index_data = buffers[indices.bufferView].data_.data();
-        auto pos_data = reinterpret_cast<const vec3*>( buffers[pos_acc].data_.data() );
-        auto norm_data = reinterpret_cast<const vec3*>( buffers[norm_acc].data_.data() );
-        auto tang_data = reinterpret_cast<const vec4*>( buffers[tang_acc].data_.data() );
-        auto tc_data = reinterpret_cast<const vec2*>( buffers[tc_acc].data_.data() );
-        for ( int i = 0; i < pos_count; i++ )
-        {
-          Vertex3D v;
-          v.position = gltf_mesh_vec3( *( pos_data + i ) );
-          v.normal = gltf_mesh_vec3( *( norm_data + i ) );
-          v.tangent = gltf_mesh_vec4( *( tang_data + i ) );
-          v.texcoord = gltf_mesh_vec2( * ( tc_data + i ) );
-          v.color = vec4( 1.0f, 1.0f, 1.0f, 1.0f );
-          v.bitangent = vec3( 0.0f );
-          out->vertices.push_back( v );
+          pending.push_back( move( entry ) );
         }
-        out->indices.resize( indices.count );
-        for ( int i = 0; i < indices.count; i++ )
+      }
+
+      parallelEach( tasks, [&doc]( const DecodeTask& task ) { decode( doc, task ); } );
+      parallelEach( pending, [&doc]( PendingPart& entry ) { finishPart( doc, entry ); } );
+
+      for ( auto& mesh : meshes )
+        for ( size_t i = 0; i < mesh.parts.size(); ++i )
         {
-          switch ( indices.componentType )
-          {
-            case TINYGLTF_COMPONENT_TYPE_BYTE:
-            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-              out->indices[i] = static_cast<GLuint>( *( (unsigned char*)( index_data ) + i ) );
-              break;
-            case TINYGLTF_COMPONENT_TYPE_SHORT:
-            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-              out->indices[i] = static_cast<GLuint>( *( (unsigned short*)( index_data ) + i ) );
-              break;
-            case TINYGLTF_COMPONENT_TYPE_INT:
-            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-              out->indices[i] = static_cast<GLuint>( *( (unsigned int*)( index_data ) + i ) );
-              break;
-          }
+          mesh.boundsMin = ( i ? glm::min( mesh.boundsMin, mesh.parts[i].boundsMin ) : mesh.parts[i].boundsMin );
+          mesh.boundsMax = ( i ? glm::max( mesh.boundsMax, mesh.parts[i].boundsMax ) : mesh.parts[i].boundsMax );
         }
+
+      nodes.clear();
+      vector<bool> visited( gltf.nodes.size(), false );
+      if ( !gltf.scenes.empty() )
+      {
+        for ( auto root : gltf.scenes.at( math::max( gltf.defaultScene, 0 ) ).nodes )
+          addNode( gltf, root, -1, nodes, visited );
       }
-      //mesh.primitives[0].
-    }
-    for ( auto childindex : node.children )
-    {
-      auto child = make_shared<MeshNode>();
-      auto& childnode = model.nodes[childindex];
-      gltf_traverseTree( child, childnode, buffers, model, depth + 1 );
-      out->children.insert( child );
+      else
+      {
+        // Without scenes, every node that isn't a child is a root
+        vector<bool> children( gltf.nodes.size(), false );
+        for ( const auto& node : gltf.nodes )
+          for ( auto child : node.children )
+            if ( child >= 0 && child < static_cast<int>( children.size() ) )
+              children[child] = true;
+        for ( size_t i = 0; i < gltf.nodes.size(); ++i )
+          if ( !children[i] )
+            addNode( gltf, static_cast<int>( i ), -1, nodes, visited );
+      }
+      for ( const auto& node : nodes )
+        if ( node.mesh >= static_cast<int>( meshes.size() ) )
+          NEKO_EXCEPT( "GLTF node refers to a missing mesh: " + path );
     }
+
   }
 
-  void loadGLTFModel( const vector<uint8_t>& input, const utf8String& filename, const utf8String& basedir, MeshNodePtr out )
+  bool MeshCache::fetch( Model& model, Images& images )
   {
-    tinygltf::TinyGLTF context;
-    tinygltf::Model model;
-    utf8String error;
-    utf8String warning;
-    auto buf = reinterpret_cast<char*>( Locator::memory().allocZeroed( Memory::Sector::Graphics, input.size() + 1 ) );
-    memcpy( buf, input.data(), input.size() + 1 );
-    if ( !context.LoadASCIIFromString( &model, &error, &warning, buf, static_cast<unsigned int>( input.size() ), basedir ) )
-      NEKO_EXCEPT( "GLTF load failed\n" + error );
-    auto nodecount = model.nodes.size();
-    auto meshcount = model.meshes.size();
-    auto matcount = model.materials.size();
-    auto skincount = model.skins.size();
-    Locator::console().printf( srcLoader,
-      "gltf: tinygltf loaded %s, %i nodes %i meshes %i materials %i skins",
-      filename.c_str(), nodecount, meshcount, matcount, skincount );
-    if ( !model.nodes.empty() )
+    // Mappings are shared, so the importer doesn't map the source a second time
+    const auto source = Locator::fileSystem().mapFile( Dir_Meshes, model.path_ );
+    const auto cacheKey = key( source->view() );
+    if ( load( model, cacheKey, images ) )
+      return true;
+
+    auto doc = make_shared<Document>();
+    importModel( model.path_, *doc, model.nodes_, model.meshes_, images );
+    images.owner = doc;
+    save( model, cacheKey, doc->sources, images );
+    return false;
+  }
+
+  void ThreadedLoader::loadModel( LoadTask::ModelLoad& task )
+  {
+    NEKO_PROFILE_FUNCTION();
+    auto& model = *task.model_;
+    MeshCache::Images images;
+    const auto cached = MeshCache::fetch( model, images );
+
+    // Base color textures become materials of their own
+    vector<MaterialPtr> materials( images.images.size() );
+    for ( size_t i = 0; i < materials.size(); ++i )
     {
-      vector<DumbBufferStructure> buffers;
-      gltf_extractBuffers( model, buffers );
-      gltf_traverseTree( out, model.nodes[0], buffers, model );
+      materials[i] = make_shared<Material>( model.name() + "/" + images.images[i].name );
+      materials[i]->wantWrapping_ = images.images[i].wrapping;
+      materials[i]->wantFiltering_ = Texture::Mipmapped;
     }
+    model.materials_.resize( images.materials.size() );
+    for ( size_t i = 0; i < images.materials.size(); ++i )
+      model.materials_[i] = ( images.materials[i] >= 0 ? materials[images.materials[i]] : MaterialPtr() );
+
+    vector<size_t> order( materials.size() );
+    for ( size_t i = 0; i < order.size(); ++i )
+      order[i] = i;
+    parallelEach( order, [this, &images, &materials, &model]( size_t i ) {
+      const auto& encoded = images.images[i].encoded;
+      int width, height, channels;
+      auto pixels = stbi_load_from_memory( encoded.data(), static_cast<int>( encoded.size() ), &width, &height, &channels, 4 );
+      if ( !pixels )
+        NEKO_EXCEPT( "GLTF image decode failed: " + model.path_ + ": " + stbi_failure_reason() );
+      MaterialLayer layer( Pixmap( width, height, PixFmtColorRGBA8, pixels ) );
+      stbi_image_free( pixels );
+      auto& material = *materials[i];
+      material.width_ = width;
+      material.height_ = height;
+      prepareLayer( material, layer );
+      material.layers_.push_back( move( layer ) );
+      material.loaded_ = true;
+    } );
+
+    model.loaded_ = true;
+
+    size_t vertices = 0;
+    for ( const auto& mesh : model.meshes_ )
+      for ( const auto& part : mesh.parts )
+        vertices += part.vertexData().size();
+    Locator::console().printf( srcLoader, "Loaded model %s (%s%s), %zu nodes, %zu meshes, %zu vertices, %zu textures",
+      model.name().c_str(), model.path_.c_str(), cached ? ", cached" : "", model.nodes_.size(), model.meshes_.size(),
+      vertices, materials.size() );
+
+    finishedTasksLock_.lock();
+    for ( const auto& material : materials )
+      finishedMaterials_.push_back( material );
+    finishedModels_.push_back( task.model_ );
+    finishedTasksLock_.unlock();
   }
 
 }
-
-#endif
\ No newline at end of file
@@ -24,6 +24,25 @@ namespace neko {
     { "mipmapped", Texture::Filtering::Mipmapped }
   };
 
+  static const map<utf8String, PixelFormat> c_compressionMap = {
+    { "bc1", PixFmtBC1 },
+    { "bc3", PixFmtBC3 },
+    { "bc4", PixFmtBC4 },
+    { "bc5", PixFmtBC5 },
+    { "bc7", PixFmtBC7 }
+  };
+
+  void MaterialLayer::buildMipChain()
+  {
+    mips_.clear();
+    const Pixmap* previous = &image_;
+    while ( previous->width() > 1 || previous->height() > 1 )
+    {
+      mips_.push_back( previous->downsample() );
+      previous = &mips_.back();
+    }
+  }
+
   MaterialManager::MaterialManager( Renderer* renderer, ThreadedLoaderPtr loader ):
   LoadedResourceManagerBase<Material>( loader ), renderer_( renderer )
   {
@@ -108,6 +127,15 @@ namespace neko {
           Locator::console().printf(
             srcGfx, R"(Warning: Unknown material filtering "%s" for material "%s")", flt.c_str(), name.c_str() );
       }
+      if ( obj.contains( "compression" ) )
+      {
+        const auto& cmp = obj["compression"].get<utf8String>();
+        if ( c_compressionMap.contains( cmp ) )
+          material->wantCompression_ = c_compressionMap.at( cmp );
+        else
+          Locator::console().printf(
+            srcGfx, R"(Warning: Unknown material compression "%s" for material "%s")", cmp.c_str(), name.c_str() );
+      }
       const auto& layers = obj["layers"];
       if ( !layers.is_array() )
         NEKO_EXCEPT( "Material layers is not an array" );
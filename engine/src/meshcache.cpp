@@ -0,0 +1,420 @@
+#include "pch.h"
+#include "meshcache.h"
+#include "model.h"
+#include "mesh_primitives.h"
+#include "utilities.h"
+#include "locator.h"
+#include "console.h"
+#include "filesystem.h"
+#include "profiler.h"
+
+namespace neko {
+
+  static void concmdMeshConvert( Console* console, ConCmd* command, StringVector& arguments );
+
+  NEKO_DECLARE_CONCMD( mesh_convert,
+    "Import a glTF model from the meshes directory into the mesh cache, if it isn't there yet. Format: mesh_convert <path>",
+    concmdMeshConvert );
+
+  namespace {
+
+    constexpr uint32_t c_maxWriteChunk = 0x4000000; //!< Bytes per writeBlob call
+
+    inline size_t alignUp( size_t offset )
+    {
+      return ( offset + MeshCache::c_alignment - 1 ) & ~( MeshCache::c_alignment - 1 );
+    }
+
+    utf8String cacheFilename( uint64_t key )
+    {
+      char filename[64];
+      sprintf_s( filename, 64, "mesh_%016llx.bin", static_cast<unsigned long long>( key ) );
+      return filename;
+    }
+
+    //! Builds the header in memory, since the data offsets are only known once all of it has been laid out.
+    class HeaderWriter {
+    protected:
+      vector<uint8_t> out_;
+    public:
+      template <typename T>
+      void write( T value )
+      {
+        const auto bytes = reinterpret_cast<const uint8_t*>( &value );
+        out_.insert( out_.end(), bytes, bytes + sizeof( T ) );
+      }
+      void writeString( const utf8String& str )
+      {
+        write( static_cast<uint32_t>( str.size() ) );
+        out_.insert( out_.end(), str.begin(), str.end() );
+      }
+      void writeVec3( const vec3& v )
+      {
+        write( static_cast<float>( v.x ) );
+        write( static_cast<float>( v.y ) );
+        write( static_cast<float>( v.z ) );
+      }
+      inline const vector<uint8_t>& data() const noexcept { return out_; }
+    };
+
+    //! Bounds checked reads from a mapped cache file.
+    class HeaderReader {
+    protected:
+      span<const uint8_t> data_;
+      size_t offset_ = 0;
+    public:
+      explicit HeaderReader( span<const uint8_t> data ): data_( data ) {}
+      const uint8_t* bytes( size_t length )
+      {
+        if ( length > data_.size() - offset_ )
+          NEKO_EXCEPT( "Unexpected end of file" );
+        const auto ptr = data_.data() + offset_;
+        offset_ += length;
+        return ptr;
+      }
+      template <typename T>
+      T read()
+      {
+        T value;
+        memcpy( &value, bytes( sizeof( T ) ), sizeof( T ) );
+        return value;
+      }
+      utf8String readString()
+      {
+        const auto length = read<uint32_t>();
+        return utf8String( reinterpret_cast<const char*>( bytes( length ) ), length );
+      }
+      vec3 readVec3()
+      {
+        const auto x = read<float>();
+        const auto y = read<float>();
+        return vec3( x, y, read<float>() );
+      }
+      inline size_t offset() const noexcept { return offset_; }
+    };
+
+    template <typename T>
+    inline span<const uint8_t> byteSpan( span<const T> items )
+    {
+      return span<const uint8_t>( reinterpret_cast<const uint8_t*>( items.data() ), items.size_bytes() );
+    }
+
+    //! A block of the data section, at offset from its start.
+    struct DataBlock
+    {
+      size_t offset;
+      span<const uint8_t> bytes;
+    };
+
+    //! The spot in the data section of count elements of T at offset, checked against its size and T's alignment.
+    template <typename T>
+    span<const T> dataSpan( span<const uint8_t> data, uint64_t offset, uint64_t count )
+    {
+      if ( offset > data.size() || count > ( data.size() - offset ) / sizeof( T ) )
+        NEKO_EXCEPT( "Data block runs past the end of the file" );
+      const auto ptr = data.data() + offset;
+      if ( reinterpret_cast<uintptr_t>( ptr ) % alignof( T ) )
+        NEKO_EXCEPT( "Data block is misaligned" );
+      return span<const T>( reinterpret_cast<const T*>( ptr ), static_cast<size_t>( count ) );
+    }
+
+  }
+
+  uint64_t MeshCache::key( span<const uint8_t> source )
+  {
+    const auto seed = utils::hash64( &c_cacheVersion, sizeof( c_cacheVersion ) );
+    return utils::hash64( source.data(), source.size(), seed );
+  }
+
+  uint64_t MeshCache::hashDependencies( const vector<utf8String>& paths )
+  {
+    uint64_t hash = utils::hash64( &c_cacheVersion, sizeof( c_cacheVersion ) );
+    for ( const auto& path : paths )
+    {
+      hash = utils::hash64( path.data(), path.size(), hash );
+      const auto mapping = Locator::fileSystem().mapFile( Dir_Meshes, path );
+      hash = utils::hash64( mapping->data(), static_cast<size_t>( mapping->size() ), hash );
+    }
+    return hash;
+  }
+
+  bool MeshCache::load( Model& model, uint64_t key, Images& images )
+  {
+    NEKO_PROFILE_FUNCTION();
+    const auto filename = cacheFilename( key );
+    if ( !Locator::fileSystem().fileStat( Dir_Cache, platform::utf8ToWide( filename ) ) )
+      return false;
+
+    try
+    {
+      auto mapping = Locator::fileSystem().mapFile( Dir_Cache, filename );
+      HeaderReader in( mapping->view() );
+      if ( in.read<uint32_t>() != c_cacheMagic || in.read<uint32_t>() != c_cacheVersion || in.read<uint64_t>() != key )
+        return false;
+
+      const auto dependencyHash = in.read<uint64_t>();
+      vector<utf8String> dependencies( in.read<uint32_t>() );
+      for ( auto& path : dependencies )
+        path = in.readString();
+      if ( hashDependencies( dependencies ) != dependencyHash )
+        return false;
+
+      // A build with a different vertex layout needs its own import
+      KnownVertexAttributes<Vertex3D> attribs;
+      if ( in.read<uint32_t>() != static_cast<uint32_t>( sizeof( Vertex3D ) ) ||
+        in.read<uint32_t>() != static_cast<uint32_t>( attribs.stride() ) ||
+        in.read<uint32_t>() != static_cast<uint32_t>( attribs.records().size() ) )
+        return false;
+      size_t attribOffset = 0;
+      for ( const auto& rec : attribs.records() )
+      {
+        if ( in.read<uint32_t>() != static_cast<uint32_t>( rec.type_ ) ||
+          in.read<uint32_t>() != static_cast<uint32_t>( rec.stype_ ) ||
+          in.read<uint32_t>() != static_cast<uint32_t>( rec.count_ ) ||
+          in.read<uint32_t>() != ( rec.normalize_ ? 1u : 0u ) ||
+          in.read<uint32_t>() != static_cast<uint32_t>( attribOffset ) )
+          return false;
+        attribOffset += rec.size_;
+      }
+
+      vector<ModelNode> nodes( in.read<uint32_t>() );
+      for ( auto& node : nodes )
+      {
+        node.name = in.readString();
+        node.translate = in.readVec3();
+        const auto w = in.read<float>();
+        const auto x = in.read<float>();
+        const auto y = in.read<float>();
+        node.rotate = quaternion( w, x, y, in.read<float>() );
+        node.scale = in.readVec3();
+        node.parent = in.read<int32_t>();
+        node.mesh = in.read<int32_t>();
+      }
+
+      struct ImageEntry
+      {
+        uint64_t offset;
+        uint64_t size;
+      };
+      vector<Image> cachedImages( in.read<uint32_t>() );
+      vector<ImageEntry> imageEntries( cachedImages.size() );
+      for ( size_t i = 0; i < cachedImages.size(); ++i )
+      {
+        cachedImages[i].name = in.readString();
+        cachedImages[i].wrapping = static_cast<Texture::Wrapping>( in.read<uint32_t>() );
+        imageEntries[i].offset = in.read<uint64_t>();
+        imageEntries[i].size = in.read<uint64_t>();
+      }
+
+      vector<int> materials( in.read<uint32_t>() );
+      for ( auto& image : materials )
+      {
+        image = in.read<int32_t>();
+        if ( image < -1 || image >= static_cast<int>( cachedImages.size() ) )
+          NEKO_EXCEPT( "Material refers to a missing image" );
+      }
+
+      struct PartEntry
+      {
+        uint64_t vertexOffset;
+        uint64_t vertexCount;
+        uint64_t indexOffset;
+        uint64_t indexCount;
+      };
+      vector<ModelMesh> meshes( in.read<uint32_t>() );
+      vector<PartEntry> partEntries;
+      for ( auto& mesh : meshes )
+      {
+        mesh.name = in.readString();
+        mesh.boundsMin = in.readVec3();
+        mesh.boundsMax = in.readVec3();
+        mesh.parts.resize( in.read<uint32_t>() );
+        for ( auto& part : mesh.parts )
+        {
+          part.material = in.read<int32_t>();
+          if ( part.material < -1 || part.material >= static_cast<int>( materials.size() ) )
+            NEKO_EXCEPT( "Mesh part refers to a missing material" );
+          part.boundsMin = in.readVec3();
+          part.boundsMax = in.readVec3();
+          PartEntry entry;
+          entry.vertexOffset = in.read<uint64_t>();
+          entry.vertexCount = in.read<uint64_t>();
+          entry.indexOffset = in.read<uint64_t>();
+          entry.indexCount = in.read<uint64_t>();
+          partEntries.push_back( entry );
+        }
+      }
+
+      for ( size_t i = 0; i < nodes.size(); ++i )
+        if ( nodes[i].parent >= static_cast<int>( i ) || nodes[i].mesh >= static_cast<int>( meshes.size() ) )
+          NEKO_EXCEPT( "Node refers to a missing parent or mesh" );
+
+      // Nothing is copied out of the data section; parts and images point straight into the mapping
+      const auto data = mapping->view().subspan( math::min( alignUp( in.offset() ), mapping->view().size() ) );
+      for ( size_t i = 0; i < cachedImages.size(); ++i )
+        cachedImages[i].encoded = dataSpan<uint8_t>( data, imageEntries[i].offset, imageEntries[i].size );
+      auto entry = partEntries.begin();
+      for ( auto& mesh : meshes )
+        for ( auto& part : mesh.parts )
+        {
+          part.mappedVertices = dataSpan<Vertex3D>( data, entry->vertexOffset, entry->vertexCount );
+          part.mappedIndices = dataSpan<GLuint>( data, entry->indexOffset, entry->indexCount );
+          ++entry;
+        }
+
+      model.nodes_.swap( nodes );
+      model.meshes_.swap( meshes );
+      model.cache_ = move( mapping );
+      images.images.swap( cachedImages );
+      images.materials.swap( materials );
+      images.owner.reset();
+    }
+    catch ( std::exception& e )
+    {
+      Locator::console().printf( srcLoader, "Discarding mesh cache %s: %s", filename.c_str(), e.what() );
+      return false;
+    }
+
+    return true;
+  }
+
+  void MeshCache::save( const Model& model, uint64_t key, const vector<utf8String>& dependencies, const Images& images )
+  {
+    NEKO_PROFILE_FUNCTION();
+    const auto filename = cacheFilename( key );
+    try
+    {
+      vector<DataBlock> blocks;
+      size_t dataSize = 0;
+      const auto place = [&blocks, &dataSize]( span<const uint8_t> bytes ) {
+        dataSize = alignUp( dataSize );
+        blocks.push_back( { dataSize, bytes } );
+        dataSize += bytes.size();
+        return static_cast<uint64_t>( blocks.back().offset );
+      };
+
+      HeaderWriter out;
+      out.write( c_cacheMagic );
+      out.write( c_cacheVersion );
+      out.write( key );
+      out.write( hashDependencies( dependencies ) );
+      out.write( static_cast<uint32_t>( dependencies.size() ) );
+      for ( const auto& path : dependencies )
+        out.writeString( path );
+
+      KnownVertexAttributes<Vertex3D> attribs;
+      out.write( static_cast<uint32_t>( sizeof( Vertex3D ) ) );
+      out.write( static_cast<uint32_t>( attribs.stride() ) );
+      out.write( static_cast<uint32_t>( attribs.records().size() ) );
+      size_t attribOffset = 0;
+      for ( const auto& rec : attribs.records() )
+      {
+        out.write( static_cast<uint32_t>( rec.type_ ) );
+        out.write( static_cast<uint32_t>( rec.stype_ ) );
+        out.write( static_cast<uint32_t>( rec.count_ ) );
+        out.write( rec.normalize_ ? 1u : 0u );
+        out.write( static_cast<uint32_t>( attribOffset ) );
+        attribOffset += rec.size_;
+      }
+
+      out.write( static_cast<uint32_t>( model.nodes_.size() ) );
+      for ( const auto& node : model.nodes_ )
+      {
+        out.writeString( node.name );
+        out.writeVec3( node.translate );
+        out.write( static_cast<float>( node.rotate.w ) );
+        out.write( static_cast<float>( node.rotate.x ) );
+        out.write( static_cast<float>( node.rotate.y ) );
+        out.write( static_cast<float>( node.rotate.z ) );
+        out.writeVec3( node.scale );
+        out.write( static_cast<int32_t>( node.parent ) );
+        out.write( static_cast<int32_t>( node.mesh ) );
+      }
+
+      out.write( static_cast<uint32_t>( images.images.size() ) );
+      for ( const auto& image : images.images )
+      {
+        out.writeString( image.name );
+        out.write( static_cast<uint32_t>( image.wrapping ) );
+        out.write( place( image.encoded ) );
+        out.write( static_cast<uint64_t>( image.encoded.size() ) );
+      }
+
+      out.write( static_cast<uint32_t>( images.materials.size() ) );
+      for ( auto image : images.materials )
+        out.write( static_cast<int32_t>( image ) );
+
+      out.write( static_cast<uint32_t>( model.meshes_.size() ) );
+      for ( const auto& mesh : model.meshes_ )
+      {
+        out.writeString( mesh.name );
+        out.writeVec3( mesh.boundsMin );
+        out.writeVec3( mesh.boundsMax );
+        out.write( static_cast<uint32_t>( mesh.parts.size() ) );
+        for ( const auto& part : mesh.parts )
+        {
+          out.write( static_cast<int32_t>( part.material ) );
+          out.writeVec3( part.boundsMin );
+          out.writeVec3( part.boundsMax );
+          const auto vertices = part.vertexData();
+          const auto indices = part.indexData();
+          out.write( place( byteSpan( vertices ) ) );
+          out.write( static_cast<uint64_t>( vertices.size() ) );
+          out.write( place( byteSpan( indices ) ) );
+          out.write( static_cast<uint64_t>( indices.size() ) );
+        }
+      }
+
+      // Everything goes out in order, with zeros up to each aligned offset
+      const uint8_t padding[c_alignment] = {};
+      auto writer = Locator::fileSystem().createFile( Dir_Cache, filename );
+      size_t written = 0;
+      const auto writeBytes = [&writer, &written]( span<const uint8_t> bytes ) {
+        for ( size_t offset = 0; offset < bytes.size(); offset += c_maxWriteChunk )
+        {
+          const auto length = math::min( bytes.size() - offset, static_cast<size_t>( c_maxWriteChunk ) );
+          writer->writeBlob( bytes.data() + offset, static_cast<uint32_t>( length ) );
+        }
+        written += bytes.size();
+      };
+      const auto pad = [&]( size_t to ) {
+        writeBytes( span<const uint8_t>( padding, to - written ) );
+      };
+      writeBytes( out.data() );
+      const auto dataOffset = alignUp( written );
+      for ( const auto& block : blocks )
+      {
+        pad( dataOffset + block.offset );
+        writeBytes( block.bytes );
+      }
+    }
+    catch ( std::exception& e )
+    {
+      Locator::console().printf( srcLoader, "Failed to write mesh cache %s: %s", filename.c_str(), e.what() );
+    }
+  }
+
+  static void concmdMeshConvert( Console* console, ConCmd* command, StringVector& arguments )
+  {
+    if ( arguments.size() < 2 )
+    {
+      console->print( srcLoader, "Format: mesh_convert <path>" );
+      return;
+    }
+    try
+    {
+      Model model( arguments[1], arguments[1] );
+      MeshCache::Images images;
+      if ( MeshCache::fetch( model, images ) )
+        console->printf( srcLoader, "Mesh cache of %s is up to date", arguments[1].c_str() );
+      else
+        console->printf( srcLoader, "Cached %s, %zu meshes and %zu textures", arguments[1].c_str(),
+          model.meshes().size(), images.images.size() );
+    }
+    catch ( std::exception& e )
+    {
+      console->printf( srcLoader, "Mesh conversion failed: %s", e.what() );
+    }
+  }
+
+}
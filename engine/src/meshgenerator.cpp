@@ -3,6 +3,7 @@
 #include "mesh_primitives.h"
 #include "neko_exception.h"
 #include "console.h"
+#include "radixsort.h"
 
 namespace neko {
 
@@ -23,51 +24,239 @@ namespace neko {
       v = vec4( 0.0f );
   }
 
+  namespace {
+
+    constexpr size_t c_tangentChunk = 4096; //!< Triangles or vertices per worker task, a multiple of four
+
+    //! Angle weighted tangent & bitangent directions one triangle contributes to one of its vertices.
+    struct TangentContribution
+    {
+      vec3 tangent;
+      vec3 bitangent;
+    };
+
+    inline __m128 dot3( const __m128* a, const __m128* b )
+    {
+      return _mm_fmadd_ps( a[0], b[0], _mm_fmadd_ps( a[1], b[1], _mm_mul_ps( a[2], b[2] ) ) );
+    }
+
+    //! Remove the component along n and normalize, leaving zero where nothing remains.
+    inline void projectAndNormalize( __m128* v, const __m128* n )
+    {
+      const auto along = dot3( v, n );
+      for ( int j = 0; j < 3; ++j )
+        v[j] = _mm_fnmadd_ps( along, n[j], v[j] );
+      const auto length = _mm_sqrt_ps( dot3( v, v ) );
+      const auto scale = _mm_and_ps( _mm_div_ps( _mm_set1_ps( 1.0f ), length ),
+        _mm_cmpgt_ps( length, _mm_set1_ps( 1e-12f ) ) );
+      for ( int j = 0; j < 3; ++j )
+        v[j] = _mm_mul_ps( v[j], scale );
+    }
+
+    //! The contributions of four triangles starting at first to each of their corners, in index order.
+    //! Like MikkTSpace, the face tangent and bitangent are projected onto each corner's tangent plane,
+    //! normalized and weighted by the corner's angle, so that tessellation doesn't skew the vertex's result.
+    void contributeTriangles( const vector<Vertex3D>& verts, const GLuint* indices, size_t first, size_t triangles,
+      TangentContribution* out )
+    {
+      __m128 position[3][3], normal[3][3], texcoord[3][2];
+      for ( int c = 0; c < 3; ++c )
+      {
+        // Lanes past the last triangle repeat it, their results land in padding nobody reads
+        const Vertex3D* v[4];
+        for ( size_t k = 0; k < 4; ++k )
+          v[k] = &verts[indices[math::min( first + k, triangles - 1 ) * 3 + c]];
+        for ( int j = 0; j < 3; ++j )
+        {
+          position[c][j] = _mm_setr_ps( v[0]->position[j], v[1]->position[j], v[2]->position[j], v[3]->position[j] );
+          normal[c][j] = _mm_setr_ps( v[0]->normal[j], v[1]->normal[j], v[2]->normal[j], v[3]->normal[j] );
+        }
+        for ( int j = 0; j < 2; ++j )
+          texcoord[c][j] = _mm_setr_ps( v[0]->texcoord[j], v[1]->texcoord[j], v[2]->texcoord[j], v[3]->texcoord[j] );
+      }
+
+      __m128 e1[3], e2[3];
+      for ( int j = 0; j < 3; ++j )
+      {
+        e1[j] = _mm_sub_ps( position[1][j], position[0][j] );
+        e2[j] = _mm_sub_ps( position[2][j], position[0][j] );
+      }
+      const auto s1 = _mm_sub_ps( texcoord[1][0], texcoord[0][0] );
+      const auto s2 = _mm_sub_ps( texcoord[2][0], texcoord[0][0] );
+      const auto t1 = _mm_sub_ps( texcoord[1][1], texcoord[0][1] );
+      const auto t2 = _mm_sub_ps( texcoord[2][1], texcoord[0][1] );
+      // Degenerate texture mapping contributes nothing
+      const auto det = _mm_fmsub_ps( s1, t2, _mm_mul_ps( s2, t1 ) );
+      const auto r = _mm_and_ps( _mm_div_ps( _mm_set1_ps( 1.0f ), det ),
+        _mm_cmpneq_ps( det, _mm_setzero_ps() ) );
+
+      __m128 faceTangent[3], faceBitangent[3];
+      for ( int j = 0; j < 3; ++j )
+      {
+        faceTangent[j] = _mm_mul_ps( _mm_fmsub_ps( e1[j], t2, _mm_mul_ps( e2[j], t1 ) ), r );
+        faceBitangent[j] = _mm_mul_ps( _mm_fmsub_ps( e2[j], s1, _mm_mul_ps( e1[j], s2 ) ), r );
+      }
+
+      for ( int c = 0; c < 3; ++c )
+      {
+        __m128 tangent[3], bitangent[3], toNext[3], toPrev[3];
+        for ( int j = 0; j < 3; ++j )
+        {
+          tangent[j] = faceTangent[j];
+          bitangent[j] = faceBitangent[j];
+          toNext[j] = _mm_sub_ps( position[( c + 1 ) % 3][j], position[c][j] );
+          toPrev[j] = _mm_sub_ps( position[( c + 2 ) % 3][j], position[c][j] );
+        }
+        projectAndNormalize( tangent, normal[c] );
+        projectAndNormalize( bitangent, normal[c] );
+        projectAndNormalize( toNext, normal[c] );
+        projectAndNormalize( toPrev, normal[c] );
+        const auto cosine = _mm_min_ps( _mm_max_ps( dot3( toNext, toPrev ), _mm_set1_ps( -1.0f ) ), _mm_set1_ps( 1.0f ) );
+        const auto angle = _mm_acos_ps( cosine );
+
+        alignas( 16 ) float lanes[6][4];
+        for ( int j = 0; j < 3; ++j )
+        {
+          _mm_store_ps( lanes[j], _mm_mul_ps( tangent[j], angle ) );
+          _mm_store_ps( lanes[3 + j], _mm_mul_ps( bitangent[j], angle ) );
+        }
+        for ( size_t k = 0; k < 4; ++k )
+        {
+          out[k * 3 + c].tangent = vec3( lanes[0][k], lanes[1][k], lanes[2][k] );
+          out[k * 3 + c].bitangent = vec3( lanes[3][k], lanes[4][k], lanes[5][k] );
+        }
+      }
+    }
+
+  }
+
   void generateTangentsAndBitangents( vector<Vertex3D>& verts, const vector<GLuint>& indices )
   {
-    for ( auto& vert : verts )
+    const auto triangles = indices.size() / 3;
+    if ( verts.empty() )
+      return;
+
+    // Every corner's contribution first, four triangles at a time, so that no two tasks write the same vertex
+    vector<TangentContribution> contributions( ( ( triangles + 3 ) & ~size_t( 3 ) ) * 3 );
+    vector<size_t> chunks( ( triangles + c_tangentChunk - 1 ) / c_tangentChunk );
+    for ( size_t i = 0; i < chunks.size(); ++i )
+      chunks[i] = i;
+    std::for_each( std::execution::par, chunks.begin(), chunks.end(), [&]( size_t chunk ) {
+      const auto last = math::min( ( chunk + 1 ) * c_tangentChunk, triangles );
+      for ( auto i = chunk * c_tangentChunk; i < last; i += 4 )
+        contributeTriangles( verts, indices.data(), i, triangles, contributions.data() + i * 3 );
+    } );
+
+    // Then the corners of each vertex, as offsets into a single list
+    vector<uint32_t> offsets( verts.size() + 1, 0 );
+    for ( size_t i = 0; i < triangles * 3; ++i )
     {
-      vert.tangent = vec4( 0.0f );
-      vert.bitangent = vec3( 0.0f );
+      assert( indices[i] < verts.size() );
+      ++offsets[indices[i] + 1];
     }
-
-    size_t i = 0;
-    while ( i < indices.size() )
+    for ( size_t i = 1; i < offsets.size(); ++i )
+      offsets[i] += offsets[i - 1];
+    vector<uint32_t> corners( triangles * 3 );
     {
-      auto& v0 = verts[indices[i]];
-      auto& v1 = verts[indices[i + 1]];
-      auto& v2 = verts[indices[i + 2]];
-
-      vec3 e1 = v1.position - v0.position, e2 = v2.position - v0.position;
-      float x1 = v1.texcoord.x - v0.texcoord.x, x2 = v2.texcoord.x - v0.texcoord.x;
-      float y1 = v1.texcoord.y - v0.texcoord.y, y2 = v2.texcoord.y - v0.texcoord.y;
-      float r = 1.0f / ( x1 * y2 - x2 * y1 );
-      vec3 t = ( e1 * y2 - e2 * y1 ) * r;
-      vec3 b = ( e2 * x1 - e1 * x2 ) * r;
-
-      for ( size_t j = 0; j < 3; j++ )
+      auto next = offsets;
+      for ( size_t i = 0; i < triangles * 3; ++i )
+        corners[next[indices[i]]++] = static_cast<uint32_t>( i );
+    }
+
+    // Each vertex sums its own corners, in index order, so the result doesn't depend on scheduling
+    chunks.resize( ( verts.size() + c_tangentChunk - 1 ) / c_tangentChunk );
+    for ( size_t i = 0; i < chunks.size(); ++i )
+      chunks[i] = i;
+    std::for_each( std::execution::par, chunks.begin(), chunks.end(), [&]( size_t chunk ) {
+      const auto last = math::min( ( chunk + 1 ) * c_tangentChunk, verts.size() );
+      for ( auto i = chunk * c_tangentChunk; i < last; ++i )
       {
-        if ( i + j >= verts.size() )
-          break;
-        verts[i + j].tangent += vec4( t, 0.0f );
-        verts[i + j].bitangent += b;
+        auto& vert = verts[i];
+        vec3 tangent( 0.0f );
+        vec3 bitangent( 0.0f );
+        for ( auto c = offsets[i]; c < offsets[i + 1]; ++c )
+        {
+          tangent += contributions[corners[c]].tangent;
+          bitangent += contributions[corners[c]].bitangent;
+        }
+        const auto n = vert.normal;
+        auto xyz = math::rejection( tangent, n );
+        const auto length = math::length( xyz );
+        // Unused or degenerately mapped vertices still get a frame, if an arbitrary one
+        xyz = ( length > 1e-12f ? xyz / length : math::normalize( math::perpendicular( n ) ) );
+        const auto w = ( math::dot( math::cross( n, xyz ), bitangent ) < 0.0f ) ? -1.0f : 1.0f;
+        vert.tangent = vec4( xyz, w );
+        zeroNans( vert.tangent );
+        vert.bitangent = math::cross( n, xyz ) * w;
+        zeroNans( vert.bitangent );
       }
+    } );
+  }
 
-      i += 3;
+  size_t weldVertices( vector<Vertex3D>& verts, vector<GLuint>& indices )
+  {
+    const auto count = verts.size();
+    if ( count < 2 )
+      return 0;
+
+    // Identical vertices hash alike, so after sorting by hash they sit in the same run,
+    // the lowest index first as the sort is stable. Collisions are sorted out below, so half the hash will do.
+    vector<radix::Entry<uint32_t>> order( count );
+    vector<radix::Entry<uint32_t>> scratch;
+    vector<size_t> chunks( ( count + c_tangentChunk - 1 ) / c_tangentChunk );
+    for ( size_t i = 0; i < chunks.size(); ++i )
+      chunks[i] = i;
+    std::for_each( std::execution::par, chunks.begin(), chunks.end(), [&]( size_t chunk ) {
+      const auto last = math::min( ( chunk + 1 ) * c_tangentChunk, count );
+      for ( auto i = chunk * c_tangentChunk; i < last; ++i )
+      {
+        const auto hash = utils::hash64( &verts[i], sizeof( Vertex3D ) );
+        order[i] = { static_cast<uint32_t>( hash ^ ( hash >> 32 ) ), static_cast<uint32_t>( i ) };
+      }
+    } );
+    radix::sort( order, scratch );
+
+    vector<GLuint> remap( count );
+    for ( size_t run = 0; run < count; )
+    {
+      auto end = run + 1;
+      while ( end < count && order[end].key == order[run].key )
+        ++end;
+      for ( auto i = run; i < end; ++i )
+      {
+        const auto index = order[i].index;
+        remap[index] = index;
+        // Runs are short, and any hash collisions within them are told apart here
+        for ( auto j = run; j < i; ++j )
+          if ( remap[order[j].index] == order[j].index &&
+            !memcmp( &verts[order[j].index], &verts[index], sizeof( Vertex3D ) ) )
+          {
+            remap[index] = order[j].index;
+            break;
+          }
+      }
+      run = end;
     }
 
-    for ( auto& vert : verts )
+    // Keep the first of each kind in their original order
+    GLuint unique = 0;
+    for ( size_t i = 0; i < count; ++i )
     {
-      auto n = vec3( vert.normal );
-      auto t = vec3( vert.tangent );
-      auto b = vec3( vert.bitangent );
-      auto xyz = math::normalize( math::rejection( t, n ) );
-      auto w = ( math::dot( math::cross( t, b ), n ) > 0.0f ) ? 1.0f : -1.0f;
-      vert.tangent = vec4( xyz, w );
-      zeroNans( vert.tangent );
-      vert.bitangent = math::cross( n, xyz ) * w;
-      zeroNans( vert.bitangent );
+      if ( remap[i] == i )
+      {
+        verts[unique] = verts[i];
+        remap[i] = unique++;
+      }
+      else
+        remap[i] = remap[remap[i]];
     }
+    verts.resize( unique );
+
+    std::for_each( std::execution::par, indices.begin(), indices.end(), [&remap]( GLuint& index ) {
+      index = remap[index];
+    } );
+
+    return count - unique;
   }
 
   }
@@ -133,6 +322,7 @@ namespace neko {
     GLuint offset = 0;
 
     implAddPlane( verts, indices, dimensions, segments, normal, color );
+    util::generateTangentsAndBitangents( verts, indices );
 
     return make_pair( verts, indices );
   }
@@ -148,6 +338,7 @@ namespace neko {
     implAddPlane( verts, indices, vec2( dimensions.z, dimensions.x ), segments, vec3( 0.0f, -1.0f, 0.0f ), color, vec3( 0.0f, ( inverted ? dimensions.y : -dimensions.y ) * 0.5f, 0.0f ) );
     implAddPlane( verts, indices, vec2( dimensions.y, dimensions.x ), segments, vec3( 0.0f, 0.0f, 1.0f ), color, vec3( 0.0f, 0.0f, ( inverted ? -dimensions.z : dimensions.z ) * 0.5f ) );
     implAddPlane( verts, indices, vec2( dimensions.y, dimensions.x ), segments, vec3( 0.0f, 0.0f, -1.0f ), color, vec3( 0.0f, 0.0f, ( inverted ? dimensions.z : -dimensions.z ) * 0.5f ) );
+    util::generateTangentsAndBitangents( verts, indices );
 
     return make_pair( verts, indices );
   }
@@ -210,43 +401,19 @@ namespace neko {
       }
     }
 
-    // normals & tangents step 1
+    // normals
     for ( uint64_t i = 0; i < indices.size(); i += 3 )
     {
-      Vertex3D triangle[3];
-      for ( uint64_t j = 0; j < 3; ++j )
-        triangle[j] = verts[indices[i + j]];
-
-      auto e1 = ( triangle[1].position - triangle[0].position );
-      auto e2 = ( triangle[2].position - triangle[0].position );
-      auto n = math::normalize( math::cross( e1, e2 ) ); // normal
-
-      auto xy1 = ( triangle[1].texcoord - triangle[0].texcoord );
-      auto xy2 = ( triangle[2].texcoord - triangle[0].texcoord );
-
-      auto r = ( numbers::one / ( xy1.x * xy2.y - xy2.x * xy1.y ) );
-      auto t = ( ( e1 * xy2.y - e2 * xy1.y ) * r ); // tangent
-      auto b = ( ( e2 * xy1.x - e1 * xy2.x ) * r ); // bitangent
-
+      const auto& p0 = verts[indices[i]].position;
+      auto n = math::normalize( math::cross( verts[indices[i + 1]].position - p0, verts[indices[i + 2]].position - p0 ) );
       for ( uint64_t j = 0; j < 3; ++j )
-      {
         verts[indices[i + j]].normal += n;
-        verts[indices[i + j]].tangent += vec4( t, numbers::zero );
-        verts[indices[i + j]].bitangent += b;
-      }
     }
-
-    // normals & tangents step 2
     for ( auto& vert : verts )
-    {
       vert.normal = math::normalize( vert.normal );
-      auto t = math::normalize( vec3( vert.tangent ) );
-      auto b = math::normalize( vert.bitangent );
-      auto xyz = math::normalize( math::rejection( t, vert.normal ) );
-      auto w = ( math::dot( math::cross( t, b ), vert.normal ) > numbers::zero ) ? numbers::one : -( numbers::one );
-      vert.tangent = vec4( xyz, w );
-      vert.bitangent = math::cross( vert.normal, xyz ) * w;
-    }
+
+    // tangents
+    util::generateTangentsAndBitangents( verts, indices );
 
     return make_pair( verts, indices );
   }
@@ -0,0 +1,42 @@
+#include "pch.h"
+#include "model.h"
+#include "loader.h"
+#include "console.h"
+#include "locator.h"
+#include "neko_exception.h"
+
+namespace neko {
+
+  ModelManager::ModelManager( ThreadedLoaderPtr loader ): LoadedResourceManagerBase<Model>( move( loader ) )
+  {
+  }
+
+  ModelPtr ModelManager::loadModel( const utf8String& name, const utf8String& path )
+  {
+    if ( map_.contains( name ) )
+      NEKO_EXCEPT( "Model already exists: " + name );
+    auto model = make_shared<Model>( name, path );
+    map_[name] = model;
+    loader_->addLoadTask( { LoadTask( model ) } );
+    return model;
+  }
+
+  void ModelManager::update()
+  {
+    ModelVector models;
+    loader_->getFinishedModels( models );
+    for ( const auto& model : models )
+    {
+      size_t parts = 0;
+      for ( const auto& mesh : model->meshes_ )
+        parts += mesh.parts.size();
+      Locator::console().printf( srcGfx, "ModelManager::update got model %s, %zu nodes, %zu meshes in %zu parts",
+        model->name().c_str(), model->nodes_.size(), model->meshes_.size(), parts );
+    }
+  }
+
+  ModelManager::~ModelManager()
+  {
+  }
+
+}
@@ -59,8 +59,7 @@ namespace neko {
 
     if ( pmp.format() != format )
     {
-      auto pmc = Pixmap::from( pmp );
-      pmc.convert( format );
+      const auto pmc = pmp.converted( format );
       texture_->writeData( pmc.data().data() );
     }
     else
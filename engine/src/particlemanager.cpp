@@ -13,23 +13,58 @@
 #include "math_aabb.h"
 #include "filesystem.h"
 #include "particles.h"
+#include "profiler.h"
 
 namespace neko {
 
   ParticleSystemManager::ParticleSystemManager()
   {
+    points_ = make_unique<PointRenderBuffer>();
   }
 
-  void ParticleSystemManager::update( GameTime delta, GameTime time )
+  ParticleSystemPtr ParticleSystemManager::createSystem( const utf8String& material, size_t maxParticles )
   {
+    auto system = make_shared<ParticleSystem>( material, maxParticles );
+    systems_.push_back( system );
+    return system;
   }
 
-  void ParticleSystemManager::draw( Shaders& shaders, MaterialManager& materials )
+  void ParticleSystemManager::destroySystem( const ParticleSystemPtr& system )
   {
+    systems_.erase( std::remove( systems_.begin(), systems_.end(), system ), systems_.end() );
+  }
+
+  void ParticleSystemManager::update( GameTime delta, GameTime time, Real interpolation )
+  {
+    NEKO_PROFILE_FUNCTION();
+    interpolation_ = interpolation;
+    // No tick since the last frame; updating now would lose the positions being blended from
+    if ( delta <= 0.0 )
+      return;
+    for ( auto& system : systems_ )
+      system->update( static_cast<Real>( delta ) );
+  }
+
+  void ParticleSystemManager::draw( Renderer& renderer, const Camera& camera )
+  {
+    for ( auto& system : systems_ )
+    {
+      if ( !system->alive() )
+        continue;
+      auto material = renderer.materials().getPtr( system->material() );
+      if ( !material || !material->uploaded() || material->type_ != Material::WorldParticle )
+        continue;
+      auto& pipeline = renderer.useMaterial( system->material() );
+      const auto count = system->alive();
+      system->write( points_->lock( renderer.stream(), count ), camera.view(), interpolation_ );
+      points_->draw( renderer.state(), pipeline, static_cast<GLsizei>( count ) );
+    }
   }
 
   ParticleSystemManager::~ParticleSystemManager()
   {
+    systems_.clear();
+    points_.reset();
   }
 
-}
\ No newline at end of file
+}
@@ -9,9 +9,387 @@
 #include "gfx.h"
 #include "nekosimd.h"
 #include "particles.h"
+#include "console.h"
+#include "radixsort.h"
 
 namespace neko {
 
+  static void concmdBenchmarkParticles( Console* console, ConCmd* command, StringVector& arguments );
 
+  NEKO_DECLARE_CONCMD( bench_particles,
+    "Benchmark particle simulation without rendering. Format: bench_particles [count] [frames]",
+    concmdBenchmarkParticles );
 
-}
\ No newline at end of file
+  ParticleAffector ParticleAffector::gravity( const vec3& acceleration )
+  {
+    return { Gravity, vec4( acceleration, 0.0f ), vec4( 0.0f ) };
+  }
+
+  ParticleAffector ParticleAffector::drag( Real coefficient )
+  {
+    return { Drag, vec4( coefficient, 0.0f, 0.0f, 0.0f ), vec4( 0.0f ) };
+  }
+
+  ParticleAffector ParticleAffector::colorOverLife( const vec4& from, const vec4& to )
+  {
+    return { ColorOverLife, from, to };
+  }
+
+  ParticleAffector ParticleAffector::sizeOverLife( const vec2& from, const vec2& to )
+  {
+    return { SizeOverLife, vec4( from, 0.0f, 0.0f ), vec4( to, 0.0f, 0.0f ) };
+  }
+
+  namespace {
+
+    //! An affector's values for one update, broadcast for the SIMD loop.
+    struct PreparedAffector
+    {
+      ParticleAffector::Type type;
+      simd::vec4f from[4];
+      simd::vec4f range[4]; //!< Or the per-update amounts for gravity and drag
+    };
+
+    vector<PreparedAffector> prepareAffectors( const vector<ParticleAffector>& affectors, float delta )
+    {
+      vector<PreparedAffector> out( affectors.size() );
+      for ( size_t i = 0; i < affectors.size(); ++i )
+      {
+        const auto& affector = affectors[i];
+        auto& prepared = out[i];
+        prepared.type = affector.type;
+        if ( affector.type == ParticleAffector::Gravity )
+        {
+          for ( int j = 0; j < 3; ++j )
+            prepared.range[j] = simd::vec4f( affector.a[j] * delta );
+        }
+        else if ( affector.type == ParticleAffector::Drag )
+          prepared.range[0] = simd::vec4f( math::max( 0.0f, 1.0f - affector.a.x * delta ) );
+        else
+        {
+          for ( int j = 0; j < 4; ++j )
+          {
+            prepared.from[j] = simd::vec4f( affector.a[j] );
+            prepared.range[j] = simd::vec4f( affector.b[j] - affector.a[j] );
+          }
+        }
+      }
+      return out;
+    }
+
+    //! Advance count particles four at a time. Lanes past count in the last group hold nothing anyone reads.
+    void simulate( float* const* streams, size_t count, float delta, const vector<PreparedAffector>& affectors )
+    {
+      const simd::vec4f dt( delta );
+      const simd::vec4f one( 1.0f );
+      for ( size_t i = 0; i < count; i += 4 )
+      {
+        auto age = simd::vec4f( streams[ParticleSystem::Stream_Age] + i ) + dt;
+        age.storeTemporal( streams[ParticleSystem::Stream_Age] + i );
+        const auto life = simd::vec4f( _mm_min_ps(
+          ( age * simd::vec4f( streams[ParticleSystem::Stream_InverseLifetime] + i ) ).packed, one.packed ) );
+
+        simd::vec4f velocity[3] = {
+          simd::vec4f( streams[ParticleSystem::Stream_VelocityX] + i ),
+          simd::vec4f( streams[ParticleSystem::Stream_VelocityY] + i ),
+          simd::vec4f( streams[ParticleSystem::Stream_VelocityZ] + i ) };
+
+        for ( const auto& affector : affectors )
+        {
+          if ( affector.type == ParticleAffector::Gravity )
+          {
+            for ( int j = 0; j < 3; ++j )
+              velocity[j] = velocity[j] + affector.range[j];
+          }
+          else if ( affector.type == ParticleAffector::Drag )
+          {
+            for ( int j = 0; j < 3; ++j )
+              velocity[j] = velocity[j] * affector.range[0];
+          }
+          else if ( affector.type == ParticleAffector::ColorOverLife )
+          {
+            for ( int j = 0; j < 4; ++j )
+              _mm_store_ps( streams[ParticleSystem::Stream_ColorR + j] + i,
+                _mm_fmadd_ps( affector.range[j].packed, life.packed, affector.from[j].packed ) );
+          }
+          else if ( affector.type == ParticleAffector::SizeOverLife )
+          {
+            for ( int j = 0; j < 2; ++j )
+              _mm_store_ps( streams[ParticleSystem::Stream_SizeX + j] + i,
+                _mm_fmadd_ps( affector.range[j].packed, life.packed, affector.from[j].packed ) );
+          }
+        }
+
+        for ( int j = 0; j < 3; ++j )
+        {
+          velocity[j].storeTemporal( streams[ParticleSystem::Stream_VelocityX + j] + i );
+          simd::vec4f previous( streams[ParticleSystem::Stream_PositionX + j] + i );
+          previous.storeTemporal( streams[ParticleSystem::Stream_PreviousX + j] + i );
+          _mm_store_ps( streams[ParticleSystem::Stream_PositionX + j] + i,
+            _mm_fmadd_ps( velocity[j].packed, dt.packed, previous.packed ) );
+        }
+      }
+    }
+
+    //! Swap the last live particle into each expired one's place. Groups of four without deaths are skipped whole.
+    size_t retire( float* const* streams, size_t count )
+    {
+      const auto age = streams[ParticleSystem::Stream_Age];
+      const auto inverse = streams[ParticleSystem::Stream_InverseLifetime];
+      const auto one = _mm_set1_ps( 1.0f );
+      size_t i = 0;
+      while ( i < count )
+      {
+        if ( ( i & 3 ) == 0 && i + 4 <= count )
+        {
+          const auto life = _mm_mul_ps( _mm_load_ps( age + i ), _mm_load_ps( inverse + i ) );
+          if ( !_mm_movemask_ps( _mm_cmpge_ps( life, one ) ) )
+          {
+            i += 4;
+            continue;
+          }
+        }
+        if ( age[i] * inverse[i] >= 1.0f )
+        {
+          --count;
+          for ( int s = 0; s < ParticleSystem::MAX_Stream; ++s )
+            streams[s][i] = streams[s][count];
+        }
+        else
+          ++i;
+      }
+      return count;
+    }
+
+    inline vec3 interpolatePosition( const float* const* streams, size_t i, Real interpolation )
+    {
+      const vec3 previous( streams[ParticleSystem::Stream_PreviousX][i], streams[ParticleSystem::Stream_PreviousY][i],
+        streams[ParticleSystem::Stream_PreviousZ][i] );
+      const vec3 current( streams[ParticleSystem::Stream_PositionX][i], streams[ParticleSystem::Stream_PositionY][i],
+        streams[ParticleSystem::Stream_PositionZ][i] );
+      return previous + ( current - previous ) * interpolation;
+    }
+
+    inline void writeVertex( VertexPointParticle& out, const float* const* streams, size_t i, Real interpolation )
+    {
+      out.pos = interpolatePosition( streams, i, interpolation );
+      out.orient = glm::f32quat( 1.0f, 0.0f, 0.0f, 0.0f );
+      out.size = vec3( streams[ParticleSystem::Stream_SizeX][i], streams[ParticleSystem::Stream_SizeY][i], 1.0f );
+      out.color = vec4( streams[ParticleSystem::Stream_ColorR][i], streams[ParticleSystem::Stream_ColorG][i],
+        streams[ParticleSystem::Stream_ColorB][i], streams[ParticleSystem::Stream_ColorA][i] );
+    }
+
+  }
+
+  ParticleSystem::ParticleSystem( const utf8String& material, size_t maxParticles ):
+    material_( material ), maxParticles_( maxParticles ), random_( std::random_device()() )
+  {
+  }
+
+  void ParticleSystem::spawn( ParticleEmitter& emitter, size_t count )
+  {
+    std::uniform_real_distribution<float> unit( -1.0f, 1.0f );
+    for ( size_t chunk = 0; count > 0; ++chunk )
+    {
+      if ( chunk == counts_.size() )
+      {
+        if ( counts_.size() * c_chunkSize >= maxParticles_ )
+          break;
+        counts_.push_back( 0 );
+        for ( auto& stream : streams_ )
+          stream.resize( counts_.size() * c_chunkSize, 0.0f );
+      }
+      const auto limit = math::min( c_chunkSize, maxParticles_ - chunk * c_chunkSize );
+      while ( counts_[chunk] < limit && count > 0 )
+      {
+        const auto i = chunk * c_chunkSize + counts_[chunk];
+        for ( int j = 0; j < 3; ++j )
+        {
+          streams_[Stream_PositionX + j][i] = emitter.position[j] + unit( random_ ) * emitter.extents[j];
+          streams_[Stream_PreviousX + j][i] = streams_[Stream_PositionX + j][i];
+          streams_[Stream_VelocityX + j][i] = emitter.velocity[j] + unit( random_ ) * emitter.velocitySpread[j];
+        }
+        const auto lifetime = emitter.lifetime + unit( random_ ) * emitter.lifetimeSpread;
+        streams_[Stream_Age][i] = 0.0f;
+        streams_[Stream_InverseLifetime][i] = 1.0f / math::max( lifetime, 0.0001f );
+        for ( int j = 0; j < 4; ++j )
+          streams_[Stream_ColorR + j][i] = emitter.color[j];
+        streams_[Stream_SizeX][i] = emitter.size.x;
+        streams_[Stream_SizeY][i] = emitter.size.y;
+        counts_[chunk]++;
+        alive_++;
+        count--;
+      }
+    }
+  }
+
+  void ParticleSystem::update( Real delta )
+  {
+    const auto affectors = prepareAffectors( affectors_, delta );
+
+    vector<size_t> chunks( counts_.size() );
+    for ( size_t i = 0; i < chunks.size(); ++i )
+      chunks[i] = i;
+    std::for_each( std::execution::par, chunks.begin(), chunks.end(), [&]( size_t chunk ) {
+      float* streams[MAX_Stream];
+      for ( int s = 0; s < MAX_Stream; ++s )
+        streams[s] = streams_[s].data() + chunk * c_chunkSize;
+      simulate( streams, counts_[chunk], delta, affectors );
+      counts_[chunk] = static_cast<uint32_t>( retire( streams, counts_[chunk] ) );
+    } );
+
+    alive_ = 0;
+    for ( auto count : counts_ )
+      alive_ += count;
+
+    for ( auto& emitter : emitters_ )
+    {
+      if ( !emitter.enabled )
+        continue;
+      emitter.pending += static_cast<double>( emitter.rate ) * delta;
+      const auto count = static_cast<size_t>( emitter.pending );
+      emitter.pending -= static_cast<double>( count );
+      spawn( emitter, count );
+    }
+  }
+
+  void ParticleSystem::write( span<VertexPointParticle> out, Real interpolation ) const
+  {
+    assert( out.size() >= alive_ );
+
+    vector<size_t> chunks( counts_.size() );
+    vector<size_t> offsets( counts_.size() );
+    size_t offset = 0;
+    for ( size_t i = 0; i < chunks.size(); ++i )
+    {
+      chunks[i] = i;
+      offsets[i] = offset;
+      offset += counts_[i];
+    }
+
+    std::for_each( std::execution::par, chunks.begin(), chunks.end(), [&]( size_t chunk ) {
+      const float* s[MAX_Stream];
+      for ( int j = 0; j < MAX_Stream; ++j )
+        s[j] = streams_[j].data() + chunk * c_chunkSize;
+      auto dst = out.data() + offsets[chunk];
+      for ( size_t i = 0; i < counts_[chunk]; ++i )
+        writeVertex( dst[i], s, i, interpolation );
+    } );
+  }
+
+  void ParticleSystem::write( span<VertexPointParticle> out, const mat4& view, Real interpolation )
+  {
+    if ( !sorted_ )
+    {
+      write( out, interpolation );
+      return;
+    }
+
+    assert( out.size() >= alive_ );
+
+    vector<size_t> chunks( counts_.size() );
+    vector<size_t> offsets( counts_.size() );
+    size_t offset = 0;
+    for ( size_t i = 0; i < chunks.size(); ++i )
+    {
+      chunks[i] = i;
+      offsets[i] = offset;
+      offset += counts_[i];
+    }
+
+    // The vertices are built in chunk order first, so that reordering them reads one vertex per particle
+    // instead of gathering each from every stream.
+    // View depth is the negated z of the view space position, so only the view matrix' third row is needed.
+    const auto row = -vec4( view[0].z, view[1].z, view[2].z, view[3].z );
+    order_.resize( alive_ );
+    vertices_.resize( alive_ );
+    std::for_each( std::execution::par, chunks.begin(), chunks.end(), [&]( size_t chunk ) {
+      const float* s[MAX_Stream];
+      for ( int j = 0; j < MAX_Stream; ++j )
+        s[j] = streams_[j].data() + chunk * c_chunkSize;
+      const auto first = offsets[chunk];
+      for ( size_t i = 0; i < counts_[chunk]; ++i )
+      {
+        auto& vertex = vertices_[first + i];
+        writeVertex( vertex, s, i, interpolation );
+        // Back to front: the furthest particles get the smallest keys
+        const auto depth = row.x * vertex.pos.x + row.y * vertex.pos.y + row.z * vertex.pos.z + row.w;
+        order_[first + i] = { ~radix::floatBits( depth ), static_cast<uint32_t>( first + i ) };
+      }
+    } );
+
+    radix::sort( order_, scratch_ );
+
+    chunks.resize( ( alive_ + c_chunkSize - 1 ) / c_chunkSize );
+    for ( size_t i = 0; i < chunks.size(); ++i )
+      chunks[i] = i;
+    std::for_each( std::execution::par, chunks.begin(), chunks.end(), [&]( size_t chunk ) {
+      const auto last = math::min( ( chunk + 1 ) * c_chunkSize, alive_ );
+      for ( size_t i = chunk * c_chunkSize; i < last; ++i )
+        out[i] = vertices_[order_[i].index];
+    } );
+  }
+
+  void ParticleSystem::clear()
+  {
+    for ( auto& stream : streams_ )
+      stream.clear();
+    counts_.clear();
+    alive_ = 0;
+  }
+
+  static void concmdBenchmarkParticles( Console* console, ConCmd* command, StringVector& arguments )
+  {
+    const auto count = static_cast<size_t>( arguments.size() > 1 ? math::max( 1, atoi( arguments[1].c_str() ) ) : 1000000 );
+    const auto frames = ( arguments.size() > 2 ? math::max( 1, atoi( arguments[2].c_str() ) ) : 240 );
+    constexpr Real delta = 1.0f / 60.0f;
+    constexpr Real lifetime = 2.0f;
+
+    // Spawning matches dying once the first particles expire, so the timed second half runs at a steady count
+    ParticleSystem system( "", count );
+    ParticleEmitter emitter;
+    emitter.extents = vec3( 8.0f, 0.0f, 8.0f );
+    emitter.velocity = vec3( 0.0f, 4.0f, 0.0f );
+    emitter.velocitySpread = vec3( 1.0f );
+    emitter.rate = static_cast<Real>( count ) / lifetime;
+    emitter.lifetime = lifetime;
+    system.emitters().push_back( emitter );
+    system.affectors().push_back( ParticleAffector::gravity( vec3( 0.0f, -9.81f, 0.0f ) ) );
+    system.affectors().push_back( ParticleAffector::drag( 0.5f ) );
+    system.affectors().push_back( ParticleAffector::colorOverLife( vec4( 1.0f ), vec4( 1.0f, 0.5f, 0.0f, 0.0f ) ) );
+    system.affectors().push_back( ParticleAffector::sizeOverLife( vec2( 0.1f ), vec2( 0.5f ) ) );
+
+    vector<VertexPointParticle> vertices( count );
+    vector<double> updates, writes;
+    platform::PerformanceTimer timer;
+    const auto warmup = static_cast<int>( lifetime / delta );
+    for ( int frame = 0; frame < warmup + frames; ++frame )
+    {
+      timer.start();
+      system.update( delta );
+      const auto updateTime = timer.stop();
+      timer.start();
+      system.write( span<VertexPointParticle>( vertices.data(), system.alive() ) );
+      const auto writeTime = timer.stop();
+      if ( frame >= warmup )
+      {
+        updates.push_back( updateTime );
+        writes.push_back( writeTime );
+      }
+    }
+
+    std::sort( updates.begin(), updates.end() );
+    std::sort( writes.begin(), writes.end() );
+    double updateSum = 0.0, writeSum = 0.0;
+    for ( size_t i = 0; i < updates.size(); ++i )
+    {
+      updateSum += updates[i];
+      writeSum += writes[i];
+    }
+    console->printf( srcGfx,
+      "Particles x%zu alive, %zu frames: update avg %.3fms, p50 %.3fms, max %.3fms; write avg %.3fms, p50 %.3fms, max %.3fms",
+      system.alive(), updates.size(), updateSum / updates.size(), updates[updates.size() / 2], updates.back(),
+      writeSum / writes.size(), writes[writes.size() / 2], writes.back() );
+  }
+
+}
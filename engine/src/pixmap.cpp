@@ -4,13 +4,22 @@
 #include "filesystem.h"
 #include "locator.h"
 #include "neko_platform.h"
+#include "console.h"
 
 #include "lodepng.h"
 #include "tinytiffreader.hxx"
+#include "tiff_definitions_internal.h"
 #include "tinyexr.h"
+#include "miniz.h"
 
 namespace neko {
 
+  static void concmdCheckConvert( Console* console, ConCmd* command, StringVector& arguments );
+
+  NEKO_DECLARE_CONCMD( dbg_pixconvert,
+    "Check Pixmap::convert between every format pair against a scalar reference. Format: dbg_pixconvert",
+    concmdCheckConvert );
+
   // PixelFormat mapping to <components, bytes per component>
   static const map<PixelFormat, pair<int, int>> g_fmtInfo = {
     { PixFmtColorRGB8, { 3, 1 } },
@@ -22,6 +31,191 @@ namespace neko {
     { PixFmtColorR16f, { 1, 2 } }
   };
 
+  namespace {
+
+    constexpr int c_convertChunk = 256; //!< Pixels per pass through the float scratch row
+    constexpr size_t c_convertParallelPixels = 256 * 256; //!< Below this, converting on one thread is faster
+
+    //! sRGB transfer tables. Decoding is a lookup per 8-bit value; encoding searches for the first code whose
+    //! midpoint to the next one lies above the linear value, which rounds correctly in the encoded space.
+    struct SRGBTables
+    {
+      float decode[256];
+      alignas( 32 ) float midpoints[256]; //!< Linear value halfway between codes i and i+1, padded with infinity
+      SRGBTables()
+      {
+        const auto toLinear = []( double c ) {
+          return ( c <= 0.04045 ? c / 12.92 : std::pow( ( c + 0.055 ) / 1.055, 2.4 ) );
+        };
+        for ( int i = 0; i < 256; ++i )
+          decode[i] = static_cast<float>( toLinear( i / 255.0 ) );
+        for ( int i = 0; i < 255; ++i )
+          midpoints[i] = static_cast<float>( toLinear( ( i + 0.5 ) / 255.0 ) );
+        midpoints[255] = std::numeric_limits<float>::infinity();
+      }
+    };
+
+    const SRGBTables& srgbTables()
+    {
+      static const SRGBTables tables;
+      return tables;
+    }
+
+    //! Eight linear values to sRGB codes, by a branchless binary search over the midpoints.
+    inline __m256i encodeSRGB( __m256 values, const SRGBTables& tables )
+    {
+      auto index = _mm256_setzero_si256();
+      for ( int step = 128; step > 0; step >>= 1 )
+      {
+        const auto candidate = _mm256_add_epi32( index, _mm256_set1_epi32( step ) );
+        const auto threshold = _mm256_i32gather_ps(
+          tables.midpoints, _mm256_sub_epi32( candidate, _mm256_set1_epi32( 1 ) ), 4 );
+        const auto above = _mm256_castps_si256( _mm256_cmp_ps( values, threshold, _CMP_GE_OQ ) );
+        index = _mm256_blendv_epi8( index, candidate, above );
+      }
+      return index;
+    }
+
+    //! Eight floats to bytes, clamped to [0, 1] and rounded to nearest. NaN becomes zero.
+    inline __m256i encodeUnorm( __m256 values )
+    {
+      const auto clamped = _mm256_min_ps( _mm256_max_ps( values, _mm256_setzero_ps() ), _mm256_set1_ps( 1.0f ) );
+      return _mm256_cvtps_epi32( _mm256_mul_ps( clamped, _mm256_set1_ps( 255.0f ) ) );
+    }
+
+    inline uint8_t encodeUnorm( float value )
+    {
+      const auto clamped = ( value > 0.0f ? ( value < 1.0f ? value : 1.0f ) : 0.0f );
+      return static_cast<uint8_t>( _mm_cvtss_si32( _mm_set_ss( clamped * 255.0f ) ) );
+    }
+
+    inline uint8_t encodeSRGB( float value, const SRGBTables& tables )
+    {
+      int index = 0;
+      for ( int step = 128; step > 0; step >>= 1 )
+        if ( value >= tables.midpoints[index + step - 1] )
+          index += step;
+      return static_cast<uint8_t>( index );
+    }
+
+    //! Pixels in any supported format to RGBA floats. Missing channels become zero, missing alpha one.
+    void loadRow( const uint8_t* src, PixelFormat format, int count, bool srgb, float* out )
+    {
+      const auto components = g_fmtInfo.at( format ).first;
+      const auto bytes = g_fmtInfo.at( format ).second;
+      int i = 0;
+      if ( bytes == 1 )
+      {
+        if ( components == 4 && !srgb )
+        {
+          const auto scale = _mm256_set1_ps( 1.0f / 255.0f );
+          for ( ; i + 2 <= count; i += 2 )
+          {
+            const auto bytes8 = _mm_loadl_epi64( reinterpret_cast<const __m128i*>( src + i * 4 ) );
+            _mm256_storeu_ps( out + i * 4, _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( bytes8 ) ), scale ) );
+          }
+        }
+        const auto& tables = srgbTables();
+        for ( ; i < count; ++i )
+        {
+          const auto pixel = src + i * components;
+          for ( int c = 0; c < 4; ++c )
+          {
+            if ( c >= components )
+              out[i * 4 + c] = ( c == 3 ? 1.0f : 0.0f );
+            else if ( srgb && c < 3 )
+              out[i * 4 + c] = tables.decode[pixel[c]];
+            else
+              out[i * 4 + c] = static_cast<float>( pixel[c] ) * ( 1.0f / 255.0f );
+          }
+        }
+      }
+      else if ( bytes == 2 )
+      {
+        const auto halves = reinterpret_cast<const uint16_t*>( src );
+        if ( components == 4 )
+        {
+          for ( ; i + 2 <= count; i += 2 )
+            _mm256_storeu_ps( out + i * 4, _mm256_cvtph_ps( _mm_loadu_si128( reinterpret_cast<const __m128i*>( halves + i * 4 ) ) ) );
+        }
+        else
+        {
+          alignas( 32 ) float values[8];
+          for ( ; i + 8 <= count; i += 8 )
+          {
+            _mm256_store_ps( values, _mm256_cvtph_ps( _mm_loadu_si128( reinterpret_cast<const __m128i*>( halves + i ) ) ) );
+            for ( int j = 0; j < 8; ++j )
+              _mm_storeu_ps( out + ( i + j ) * 4, _mm_setr_ps( values[j], 0.0f, 0.0f, 1.0f ) );
+          }
+        }
+        for ( ; i < count; ++i )
+          for ( int c = 0; c < 4; ++c )
+            out[i * 4 + c] = ( c < components ? _cvtsh_ss( halves[i * components + c] ) : ( c == 3 ? 1.0f : 0.0f ) );
+      }
+      else
+        memcpy( out, src, static_cast<size_t>( count ) * 4 * sizeof( float ) );
+    }
+
+    //! RGBA floats to pixels in any supported format. Channels the format lacks are dropped.
+    void storeRow( const float* in, PixelFormat format, int count, bool srgb, uint8_t* dst )
+    {
+      const auto components = g_fmtInfo.at( format ).first;
+      const auto bytes = g_fmtInfo.at( format ).second;
+      int i = 0;
+      if ( bytes == 1 )
+      {
+        const auto& tables = srgbTables();
+        alignas( 32 ) int32_t codes[8];
+        const auto alphaLanes = _mm256_setr_epi32( 0, 0, 0, -1, 0, 0, 0, -1 );
+        for ( ; i + 2 <= count; i += 2 )
+        {
+          const auto values = _mm256_loadu_ps( in + i * 4 );
+          auto encoded = encodeUnorm( values );
+          if ( srgb )
+            encoded = _mm256_blendv_epi8( encodeSRGB( values, tables ), encoded, alphaLanes );
+          _mm256_store_si256( reinterpret_cast<__m256i*>( codes ), encoded );
+          for ( int j = 0; j < 2; ++j )
+            for ( int c = 0; c < components; ++c )
+              dst[( i + j ) * components + c] = static_cast<uint8_t>( codes[j * 4 + c] );
+        }
+        for ( ; i < count; ++i )
+          for ( int c = 0; c < components; ++c )
+            dst[i * components + c] = ( srgb && c < 3 ? encodeSRGB( in[i * 4 + c], tables ) : encodeUnorm( in[i * 4 + c] ) );
+      }
+      else if ( bytes == 2 )
+      {
+        auto halves = reinterpret_cast<uint16_t*>( dst );
+        if ( components == 4 )
+        {
+          for ( ; i + 2 <= count; i += 2 )
+            _mm_storeu_si128( reinterpret_cast<__m128i*>( halves + i * 4 ),
+              _mm256_cvtps_ph( _mm256_loadu_ps( in + i * 4 ), _MM_FROUND_TO_NEAREST_INT ) );
+        }
+        else
+        {
+          const auto reds = _mm256_setr_epi32( 0, 4, 8, 12, 16, 20, 24, 28 );
+          for ( ; i + 8 <= count; i += 8 )
+            _mm_storeu_si128( reinterpret_cast<__m128i*>( halves + i ),
+              _mm256_cvtps_ph( _mm256_i32gather_ps( in + i * 4, reds, 4 ), _MM_FROUND_TO_NEAREST_INT ) );
+        }
+        for ( ; i < count; ++i )
+          for ( int c = 0; c < components; ++c )
+            halves[i * components + c] = _cvtss_sh( in[i * 4 + c], _MM_FROUND_TO_NEAREST_INT );
+      }
+      else
+        memcpy( dst, in, static_cast<size_t>( count ) * 4 * sizeof( float ) );
+    }
+
+    //! Between two 8-bit formats nothing needs rounding, so channels are copied as they are.
+    void swizzleRow( const uint8_t* src, int srcComponents, int count, int dstComponents, uint8_t* dst )
+    {
+      for ( int i = 0; i < count; ++i )
+        for ( int c = 0; c < dstComponents; ++c )
+          dst[i * dstComponents + c] = ( c < srcComponents ? src[i * srcComponents + c] : ( c == 3 ? 0xFF : 0x00 ) );
+    }
+
+  }
+
   Pixmap::Pixmap( PixelFormat fmt ): format_( fmt )
   {
     if ( !g_fmtInfo.contains( format_ ) )
@@ -37,13 +231,24 @@ namespace neko {
       NEKO_EXCEPT( "Unsupported pixel format passed to Pixmap" );
 
     const auto& p = g_fmtInfo.at( format_ );
-    auto datasize = ( width_ * height_ * p.first * p.second );
-    data_.resize( static_cast<size_t>( datasize ) );
+    const auto datasize = static_cast<size_t>( width_ ) * height_ * p.first * p.second;
+    data_.resize( datasize );
 
     if ( data )
       memcpy( data_.data(), data, datasize );
   }
 
+  Pixmap::Pixmap( int width, int height, PixelFormat fmt, vector<uint8_t>&& data ):
+    width_( width ), height_( height ), format_( fmt ), data_( move( data ) )
+  {
+    if ( !g_fmtInfo.contains( format_ ) )
+      NEKO_EXCEPT( "Unsupported pixel format passed to Pixmap" );
+
+    const auto& p = g_fmtInfo.at( format_ );
+    if ( data_.size() != static_cast<size_t>( width_ ) * height_ * p.first * p.second )
+      NEKO_EXCEPT( "Pixel data size doesn't match the Pixmap dimensions" );
+  }
+
   Pixmap::Pixmap( const Pixmap& from, int x, int y, int width, int height ):
     width_( width ), height_( height ), format_( from.format() )
   {
@@ -70,54 +275,331 @@ namespace neko {
     return out;
   }
 
-  Pixmap Pixmap::fromPNG( const vector<uint8_t>& input )
+  size_t ImageInfo::bytes() const
   {
-    Pixmap out( PixFmtColorRGBA8 );
+    const auto& info = g_fmtInfo.at( format );
+    return static_cast<size_t>( width ) * height * info.first * info.second;
+  }
+
+  namespace {
+
+    //! Destination row for source row y, bottom up when flipping.
+    inline uint8_t* targetRow( uint8_t* out, const ImageInfo& info, size_t stride, int y, bool flip )
+    {
+      return out + static_cast<size_t>( flip ? info.height - 1 - y : y ) * stride;
+    }
 
-    vector<uint8_t> pngdata;
-    unsigned int width, height;
+    inline uint8_t paeth( int a, int b, int c )
+    {
+      const auto p = a + b - c;
+      const auto pa = math::abs( p - a );
+      const auto pb = math::abs( p - b );
+      const auto pc = math::abs( p - c );
+      return static_cast<uint8_t>( pa <= pb && pa <= pc ? a : pb <= pc ? b : c );
+    }
 
-    if ( lodepng::decode( pngdata, width, height, input.data(), input.size(), LCT_RGBA, 8 ) == 0 )
+    //! Undo a PNG scanline filter in place. prev is the unfiltered row above, null for the first.
+    bool unfilterRow( uint8_t filter, uint8_t* row, const uint8_t* prev, size_t length, size_t bpp )
     {
-      out.width_ = width;
-      out.height_ = height;
-      out.data_.resize( pngdata.size() );
-      for ( size_t i = 0; i < height; ++i ) // flip rows
+      switch ( filter )
       {
-        auto srcrow = pngdata.data() + ( i * (size_t)width * 4 );
-        auto dstrow = out.data_.data() + ( ( (size_t)height - 1 - i ) * width * 4 );
-        memcpy( dstrow, srcrow, (size_t)width * 4 );
+        case 0:
+          break;
+        case 1:
+          for ( size_t i = bpp; i < length; ++i )
+            row[i] += row[i - bpp];
+          break;
+        case 2:
+          if ( prev )
+            for ( size_t i = 0; i < length; ++i )
+              row[i] += prev[i];
+          break;
+        case 3:
+          for ( size_t i = 0; i < length; ++i )
+            row[i] += static_cast<uint8_t>( ( ( i >= bpp ? row[i - bpp] : 0 ) + ( prev ? prev[i] : 0 ) ) >> 1 );
+          break;
+        case 4:
+          for ( size_t i = 0; i < length; ++i )
+            row[i] += paeth( i >= bpp ? row[i - bpp] : 0, prev ? prev[i] : 0, i >= bpp && prev ? prev[i - bpp] : 0 );
+          break;
+        default:
+          return false;
       }
+      return true;
     }
-    else
+
+    //! Inflates the concatenated IDAT payloads a row at a time, so no whole image intermediate is ever held.
+    class PNGRowReader {
+      vector<pair<const uint8_t*, size_t>> chunks_;
+      size_t next_ = 0;
+      mz_stream stream_ {};
+    public:
+      explicit PNGRowReader( vector<pair<const uint8_t*, size_t>>&& chunks ): chunks_( move( chunks ) )
+      {
+        if ( mz_inflateInit( &stream_ ) != MZ_OK )
+          NEKO_EXCEPT( "PNG inflate init failed" );
+      }
+      bool read( uint8_t* out, size_t length )
+      {
+        stream_.next_out = out;
+        stream_.avail_out = static_cast<unsigned int>( length );
+        while ( stream_.avail_out > 0 )
+        {
+          if ( stream_.avail_in == 0 && next_ < chunks_.size() )
+          {
+            stream_.next_in = chunks_[next_].first;
+            stream_.avail_in = static_cast<unsigned int>( chunks_[next_].second );
+            next_++;
+          }
+          // Input can run out with output still pending inside the inflater, so only a stall is the end
+          const auto pending = stream_.avail_out;
+          const auto status = mz_inflate( &stream_, MZ_NO_FLUSH );
+          if ( status == MZ_STREAM_END )
+            return ( stream_.avail_out == 0 );
+          if ( status != MZ_OK && status != MZ_BUF_ERROR )
+            return false;
+          if ( stream_.avail_out == pending && stream_.avail_in == 0 && next_ == chunks_.size() )
+            return false;
+        }
+        return true;
+      }
+      ~PNGRowReader() { mz_inflateEnd( &stream_ ); }
+    };
+
+    //! The common PNGs: non-interlaced 8-bit grey, grey+alpha, RGB or RGBA without a transparency key.
+    //! Rows are inflated, unfiltered and expanded to RGBA straight into the output. False for anything else.
+    bool decodePNGStreaming( const vector<uint8_t>& input, const ImageInfo& info, uint8_t* out, bool flip )
+    {
+      lodepng::State state;
+      unsigned int width = 0, height = 0;
+      if ( lodepng_inspect( &width, &height, &state, input.data(), input.size() ) != 0 ||
+        static_cast<int>( width ) != info.width || static_cast<int>( height ) != info.height )
+        return false;
+      const auto& color = state.info_png.color;
+      if ( state.info_png.interlace_method != 0 || color.bitdepth != 8 )
+        return false;
+      size_t channels = 0;
+      switch ( color.colortype )
+      {
+        case LCT_GREY: channels = 1; break;
+        case LCT_GREY_ALPHA: channels = 2; break;
+        case LCT_RGB: channels = 3; break;
+        case LCT_RGBA: channels = 4; break;
+        default: return false;
+      }
+
+      vector<pair<const uint8_t*, size_t>> idat;
+      const auto end = input.data() + input.size();
+      for ( auto chunk = input.data() + 8; chunk + 12 <= end; chunk = lodepng_chunk_next_const( chunk ) )
+      {
+        const auto length = static_cast<size_t>( lodepng_chunk_length( chunk ) );
+        if ( length > static_cast<size_t>( end - chunk ) - 12 )
+          return false;
+        if ( lodepng_chunk_type_equals( chunk, "tRNS" ) )
+          return false;
+        if ( lodepng_chunk_type_equals( chunk, "IDAT" ) )
+          idat.emplace_back( lodepng_chunk_data_const( chunk ), length );
+        else if ( lodepng_chunk_type_equals( chunk, "IEND" ) )
+          break;
+      }
+
+      PNGRowReader reader( move( idat ) );
+      const auto stride = static_cast<size_t>( info.width ) * 4;
+      const auto length = static_cast<size_t>( info.width ) * channels;
+      vector<uint8_t> rows( channels == 4 ? 0 : length * 2 ); // RGBA unfilters in place in the output
+      uint8_t* prev = nullptr;
+      for ( int y = 0; y < info.height; ++y )
+      {
+        const auto dst = targetRow( out, info, stride, y, flip );
+        const auto row = ( channels == 4 ? dst : rows.data() + ( y & 1 ) * length );
+        uint8_t filter = 0;
+        if ( !reader.read( &filter, 1 ) || !reader.read( row, length ) || !unfilterRow( filter, row, prev, length, channels ) )
+          NEKO_EXCEPT( "PNG decode failed" );
+        prev = row;
+        if ( channels == 4 )
+          continue;
+        for ( int x = 0; x < info.width; ++x )
+        {
+          const auto src = row + x * channels;
+          const auto pixel = dst + x * 4;
+          pixel[0] = src[0];
+          pixel[1] = ( channels >= 3 ? src[1] : src[0] );
+          pixel[2] = ( channels >= 3 ? src[2] : src[0] );
+          pixel[3] = ( channels == 2 ? src[1] : 0xFF );
+        }
+      }
+
+      return true;
+    }
+
+  }
+
+  ImageInfo Pixmap::inspectPNG( const vector<uint8_t>& input )
+  {
+    lodepng::State state;
+    unsigned int width = 0, height = 0;
+    if ( lodepng_inspect( &width, &height, &state, input.data(), input.size() ) != 0 )
+      NEKO_EXCEPT( "PNG header decode failed" );
+    return { .width = static_cast<int>( width ), .height = static_cast<int>( height ), .format = PixFmtColorRGBA8 };
+  }
+
+  void Pixmap::decodePNG( const vector<uint8_t>& input, const ImageInfo& info, uint8_t* out, bool flip )
+  {
+    assert( out && info.format == PixFmtColorRGBA8 );
+    if ( decodePNGStreaming( input, info, out, flip ) )
+      return;
+
+    // Interlaced, paletted, keyed and other bit depths are left to lodepng, at the cost of one intermediate copy
+    lodepng::State state;
+    unsigned char* decoded = nullptr;
+    unsigned int width = 0, height = 0;
+    const auto error = lodepng_decode( &decoded, &width, &height, &state, input.data(), input.size() );
+    if ( !error && static_cast<int>( width ) == info.width && static_cast<int>( height ) == info.height )
+    {
+      const auto stride = static_cast<size_t>( width ) * 4;
+      for ( int y = 0; y < info.height; ++y )
+        memcpy( targetRow( out, info, stride, y, flip ), decoded + y * stride, stride );
+    }
+    // Our lodepng allocates from the graphics sector
+    if ( decoded )
+      Locator::memory().free( Memory::Sector::Graphics, decoded );
+    if ( error || static_cast<int>( width ) != info.width || static_cast<int>( height ) != info.height )
       NEKO_EXCEPT( "PNG decode failed" );
+  }
 
+  Pixmap Pixmap::fromPNG( const vector<uint8_t>& input, bool flip )
+  {
+    const auto info = inspectPNG( input );
+    Pixmap out( info.width, info.height, info.format, nullptr );
+    decodePNG( input, info, out.data_.data(), flip );
     return out;
   }
 
-  Pixmap Pixmap::fromEXR( const vector<uint8_t>& input )
+  namespace {
+
+    //! Owns a parsed EXR header for the length of a decode.
+    struct EXRHeaderScope
+    {
+      EXRHeader header;
+      EXRHeaderScope( const vector<uint8_t>& input )
+      {
+        InitEXRHeader( &header );
+        EXRVersion version;
+        const char* err = nullptr;
+        if ( ParseEXRVersionFromMemory( &version, input.data(), input.size() ) != TINYEXR_SUCCESS ||
+          ParseEXRHeaderFromMemory( &header, &version, input.data(), input.size(), &err ) != TINYEXR_SUCCESS )
+        {
+          utf8String message = "EXR header decode failed";
+          if ( err )
+          {
+            message.append( ": " ).append( err );
+            FreeEXRErrorMessage( err );
+          }
+          FreeEXRHeader( &header );
+          NEKO_EXCEPT( message );
+        }
+      }
+      ~EXRHeaderScope() { FreeEXRHeader( &header ); }
+    };
+
+    inline float exrSample( const unsigned char* channel, int type, size_t index )
+    {
+      if ( type == TINYEXR_PIXELTYPE_HALF )
+        return _cvtsh_ss( reinterpret_cast<const uint16_t*>( channel )[index] );
+      if ( type == TINYEXR_PIXELTYPE_FLOAT )
+        return reinterpret_cast<const float*>( channel )[index];
+      return static_cast<float>( reinterpret_cast<const uint32_t*>( channel )[index] );
+    }
+
+  }
+
+  ImageInfo Pixmap::inspectEXR( const vector<uint8_t>& input )
   {
-    Pixmap out( PixFmtColorRGBA32f );
+    EXRHeaderScope scope( input );
+    const auto& window = scope.header.data_window;
+    return { .width = window.max_x - window.min_x + 1, .height = window.max_y - window.min_y + 1, .format = PixFmtColorRGBA32f };
+  }
 
-    int width, height;
-    float* values = nullptr;
-    const char* err = nullptr;
+  void Pixmap::decodeEXR( const vector<uint8_t>& input, const ImageInfo& info, uint8_t* out, bool flip )
+  {
+    assert( out && info.format == PixFmtColorRGBA32f );
+    EXRHeaderScope scope( input );
+    auto& header = scope.header;
 
-    auto ret = LoadEXRFromMemory( &values, &width, &height, input.data(), input.size(), &err );
+    // Half channels stay half until they're interleaved, which keeps tinyexr's planar copy at its smallest
+    EXRImage image;
+    InitEXRImage( &image );
+    const char* err = nullptr;
+    if ( LoadEXRImageFromMemory( &image, &header, input.data(), input.size(), &err ) != TINYEXR_SUCCESS )
+    {
+      utf8String message = "EXR decode failed";
+      if ( err )
+      {
+        message.append( ": " ).append( err );
+        FreeEXRErrorMessage( err );
+      }
+      NEKO_EXCEPT( message );
+    }
+    if ( image.width != info.width || image.height != info.height )
+    {
+      FreeEXRImage( &image );
+      NEKO_EXCEPT( "EXR dimensions don't match its header" );
+    }
 
-    if ( ret != TINYEXR_SUCCESS )
-      NEKO_EXCEPT( "LoadEXRFromMemory failed" );
+    // Grey images fill every channel like tinyexr's own loader does, otherwise R, G and B are required
+    int sources[4] = { 0, 0, 0, 0 };
+    if ( header.num_channels > 1 )
+    {
+      const char* names[4] = { "R", "G", "B", "A" };
+      for ( int c = 0; c < 4; ++c )
+      {
+        sources[c] = -1;
+        for ( int i = 0; i < header.num_channels; ++i )
+          if ( strcmp( header.channels[i].name, names[c] ) == 0 )
+            sources[c] = i;
+        if ( sources[c] < 0 && c < 3 )
+        {
+          FreeEXRImage( &image );
+          NEKO_EXCEPT( "EXR image has no R, G and B channels" );
+        }
+      }
+    }
 
-    if ( !values )
-      NEKO_EXCEPT( "No read from EXR" );
+    // Scanline images are a single block at the origin, tiled ones one block per tile
+    const auto stride = static_cast<size_t>( info.width ) * 4 * sizeof( float );
+    const auto copyBlock = [&]( unsigned char** planes, int x0, int y0, int blockWidth, int blockHeight, int pitch ) {
+      for ( int y = 0; y < blockHeight && y0 + y < info.height; ++y )
+      {
+        auto dst = reinterpret_cast<float*>( targetRow( out, info, stride, y0 + y, flip ) ) + x0 * 4;
+        for ( int x = 0; x < blockWidth && x0 + x < info.width; ++x, dst += 4 )
+        {
+          const auto index = static_cast<size_t>( y ) * pitch + x;
+          for ( int c = 0; c < 4; ++c )
+            dst[c] = ( sources[c] < 0 ? 1.0f
+              : exrSample( planes[sources[c]], header.pixel_types[sources[c]], index ) );
+        }
+      }
+    };
+    if ( header.tiled )
+    {
+      for ( int i = 0; i < image.num_tiles; ++i )
+      {
+        const auto& tile = image.tiles[i];
+        copyBlock( tile.images, tile.offset_x * header.tile_size_x, tile.offset_y * header.tile_size_y,
+          header.tile_size_x, header.tile_size_y, header.tile_size_x );
+      }
+    }
+    else
+      copyBlock( image.images, 0, 0, info.width, info.height, info.width );
 
-    out.width_ = width;
-    out.height_ = height;
-    out.data_.resize( static_cast<uint64_t>( width ) * height * 4 * sizeof( float ) );
-    out.format_ = PixFmtColorRGBA32f;
-    memcpy( out.data_.data(), values, out.data_.size() );
-    free( values );
+    FreeEXRImage( &image );
+  }
 
+  Pixmap Pixmap::fromEXR( const vector<uint8_t>& input, bool flip )
+  {
+    const auto info = inspectEXR( input );
+    Pixmap out( info.width, info.height, info.format, nullptr );
+    decodeEXR( input, info, out.data_.data(), flip );
     return out;
   }
 
@@ -199,78 +681,173 @@ namespace neko {
     tiff_TinyTiffSetPosCallback
   };
 
-  Pixmap Pixmap::fromTIFF( const utf8String& filename )
-  {
-    Pixmap out( PixFmtColorRGBA8 );
+  namespace {
 
-    auto tiff = TinyTIFFReader_open( platform::utf8ToWide( filename ).c_str(), &g_tiffCallbacks );
-    if ( tiff )
-    {
-      out.width_ = TinyTIFFReader_getWidth( tiff );
-      out.height_ = TinyTIFFReader_getHeight( tiff );
-      auto bps = static_cast<int>( TinyTIFFReader_getBitsPerSample( tiff, 0 ) );
-      auto sf = TinyTIFFReader_getSampleFormat( tiff );
-      auto spp = TinyTIFFReader_getSamplesPerPixel( tiff );
-
-      if ( spp == 3 )
-        out.format_ = PixFmtColorRGB8;
-      else if ( spp == 4 )
-        out.format_ = PixFmtColorRGBA8;
-      else
-        NEKO_EXCEPT( "Unsupported channel count in TIFF image" );
+    //! 16-bit samples to 8-bit, exactly round( v * 255 / 65535 ). Computed as ( x - ( x >> 8 ) ) >> 8 with
+    //! x = v + 128 saturated, which stays within 16 bits. Swap converts from the other byte order first.
+    void narrow16( const uint8_t* src, uint8_t* dst, size_t count, bool swap )
+    {
+      const auto bias = _mm_set1_epi16( 128 );
+      const auto scale = [&]( __m128i v ) {
+        if ( swap )
+          v = _mm_or_si128( _mm_slli_epi16( v, 8 ), _mm_srli_epi16( v, 8 ) );
+        v = _mm_adds_epu16( v, bias );
+        return _mm_srli_epi16( _mm_sub_epi16( v, _mm_srli_epi16( v, 8 ) ), 8 );
+      };
+      size_t i = 0;
+      for ( ; i + 16 <= count; i += 16 )
+      {
+        const auto lo = scale( _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + i * 2 ) ) );
+        const auto hi = scale( _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + i * 2 + 16 ) ) );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( dst + i ), _mm_packus_epi16( lo, hi ) );
+      }
+      for ( ; i < count; ++i )
+      {
+        uint16_t v;
+        memcpy( &v, src + i * 2, 2 );
+        if ( swap )
+          v = static_cast<uint16_t>( ( v << 8 ) | ( v >> 8 ) );
+        const auto x = math::min( v + 128, 0xFFFF );
+        dst[i] = static_cast<uint8_t>( ( x - ( x >> 8 ) ) >> 8 );
+      }
+    }
 
-      vector<uint8_t> tiffSource;
-      tiffSource.resize( static_cast<size_t>( out.width_ ) * out.height_ * ( bps / 8 ) );
-      out.data_.resize( static_cast<size_t>( out.width_ ) * out.height_ * spp * sizeof( uint8_t ) );
-      if ( bps == 16 && sf == TINYTIFF_SAMPLEFORMAT_UINT )
+    //! One row of separate 8-bit planes to interleaved pixels.
+    void interleave( const uint8_t* const* planes, int count, int width, uint8_t* dst )
+    {
+      int x = 0;
+      if ( count == 4 )
       {
-        auto data = reinterpret_cast<uint8_t*>( out.data_.data() );
-        auto source = reinterpret_cast<uint16_t*>( tiffSource.data() );
-        for ( auto s = 0; s < spp; ++s )
+        for ( ; x + 16 <= width; x += 16 )
         {
-          TinyTIFFReader_getSampleData( tiff, tiffSource.data(), s );
-          if ( TinyTIFFReader_wasError( tiff ) )
-            NEKO_EXCEPT( "TIFF reader error" );
-          for ( auto y = 0; y < out.height_; ++y )
-          {
-            for ( auto x = 0; x < out.width_; ++x )
-            {
-              auto p = ( y * out.width_ ) + x;
-              auto d = ( ( ( y * out.width_ ) + x ) * spp ) + s;
-              // I'm practically entirely sure that this is wrong - whatever,
-              // fix when we actually need one of these textures
-              data[d] = math::iround( static_cast<Real>( source[p] ) / 256.0f );
-            }
-          }
+          const auto r = _mm_loadu_si128( reinterpret_cast<const __m128i*>( planes[0] + x ) );
+          const auto g = _mm_loadu_si128( reinterpret_cast<const __m128i*>( planes[1] + x ) );
+          const auto b = _mm_loadu_si128( reinterpret_cast<const __m128i*>( planes[2] + x ) );
+          const auto a = _mm_loadu_si128( reinterpret_cast<const __m128i*>( planes[3] + x ) );
+          const auto rg0 = _mm_unpacklo_epi8( r, g );
+          const auto rg1 = _mm_unpackhi_epi8( r, g );
+          const auto ba0 = _mm_unpacklo_epi8( b, a );
+          const auto ba1 = _mm_unpackhi_epi8( b, a );
+          const auto out = reinterpret_cast<__m128i*>( dst + x * 4 );
+          _mm_storeu_si128( out, _mm_unpacklo_epi16( rg0, ba0 ) );
+          _mm_storeu_si128( out + 1, _mm_unpackhi_epi16( rg0, ba0 ) );
+          _mm_storeu_si128( out + 2, _mm_unpacklo_epi16( rg1, ba1 ) );
+          _mm_storeu_si128( out + 3, _mm_unpackhi_epi16( rg1, ba1 ) );
         }
       }
-      else if ( bps == 8 && sf == TINYTIFF_SAMPLEFORMAT_UINT )
+      else if ( count == 2 )
       {
-        auto data = reinterpret_cast<uint8_t*>( out.data_.data() );
-        auto source = reinterpret_cast<uint8_t*>( tiffSource.data() );
-        for ( auto s = 0; s < spp; ++s )
+        for ( ; x + 16 <= width; x += 16 )
         {
-          TinyTIFFReader_getSampleData( tiff, tiffSource.data(), s );
-          if ( TinyTIFFReader_wasError( tiff ) )
-            NEKO_EXCEPT( "TIFF reader error" );
-          for ( auto y = 0; y < out.height_; ++y )
-          {
-            for ( auto x = 0; x < out.width_; ++x )
-            {
-              auto p = ( y * out.width_ ) + x;
-              auto d = ( ( ( y * out.width_ ) + x ) * spp ) + s;
-              data[d] = static_cast<uint8_t>( source[p] );
-            }
-          }
+          const auto r = _mm_loadu_si128( reinterpret_cast<const __m128i*>( planes[0] + x ) );
+          const auto g = _mm_loadu_si128( reinterpret_cast<const __m128i*>( planes[1] + x ) );
+          const auto out = reinterpret_cast<__m128i*>( dst + x * 2 );
+          _mm_storeu_si128( out, _mm_unpacklo_epi8( r, g ) );
+          _mm_storeu_si128( out + 1, _mm_unpackhi_epi8( r, g ) );
         }
       }
-      else
-        NEKO_EXCEPT( "Unsupported bit/channel/sample format combination in TIFF image" );
-
-      free( tiff );
+      for ( ; x < width; ++x )
+        for ( int c = 0; c < count; ++c )
+          dst[x * count + c] = planes[c][x];
     }
-    else
+
+  }
+
+  Pixmap Pixmap::fromTIFF( const utf8String& filename, bool flip )
+  {
+    auto tiff = TinyTIFFReader_open( platform::utf8ToWide( filename ).c_str(), &g_tiffCallbacks );
+    if ( !tiff )
       NEKO_EXCEPT( "TIFF reader creation failed" );
+    unique_ptr<TinyTIFFReaderFile, decltype( &TinyTIFFReader_close )> scope( tiff, TinyTIFFReader_close );
+
+    const auto& frame = tiff->currentFrame;
+    if ( frame.compression != TIFF_COMPRESSION_NONE || frame.isTiled || frame.orientation != TIFF_ORIENTATION_STANDARD ||
+      frame.photometric_interpretation == TIFF_PHOTOMETRICINTERPRETATION_PALETTE )
+      NEKO_EXCEPT( "Unsupported TIFF layout, only uncompressed and untiled non-palette images are supported" );
+    if ( ( frame.bitspersample != 8 && frame.bitspersample != 16 ) || frame.sampleformat != TINYTIFF_SAMPLEFORMAT_UINT )
+      NEKO_EXCEPT( "Unsupported bit/channel/sample format combination in TIFF image" );
+    if ( frame.samplesperpixel < 1 || frame.samplesperpixel > 4 )
+      NEKO_EXCEPT( "Unsupported channel count in TIFF image" );
+    if ( !frame.width || !frame.height || !frame.stripcount || !frame.stripoffsets || !frame.stripbytecounts )
+      NEKO_EXCEPT( "TIFF image has no strips" );
+
+    constexpr PixelFormat c_formats[4] = { PixFmtColorR8, PixFmtColorRG8, PixFmtColorRGB8, PixFmtColorRGBA8 };
+    const ImageInfo info = { .width = static_cast<int>( frame.width ), .height = static_cast<int>( frame.height ),
+      .format = c_formats[frame.samplesperpixel - 1] };
+    const auto samples = static_cast<int>( frame.samplesperpixel );
+    const auto bytes = static_cast<size_t>( frame.bitspersample / 8 );
+    const auto planar = ( samples > 1 && frame.planarconfiguration == TIFF_PLANARCONFIG_PLANAR );
+    const auto swap = ( tiff->filebyteorder != tiff->systembyteorder );
+    const auto rowBytes = static_cast<size_t>( info.width ) * bytes * ( planar ? 1 : samples );
+    const auto stride = static_cast<size_t>( info.width ) * samples;
+
+    Pixmap out( info.width, info.height, info.format, nullptr );
+
+    // Interleaved 8-bit rows are final as they are, so they're read straight into place.
+    // Everything else is read as is and converted below.
+    const auto direct = ( bytes == 1 && !planar );
+    vector<uint8_t> raw( direct ? 0 : rowBytes * info.height * ( planar ? samples : 1 ) );
+
+    // Strips are whole rows, of every sample in turn when planar
+    auto& reader = *reinterpret_cast<TiffReaderInstance*>( tiff->hFile )->reader;
+    const auto rowsPerStrip = ( frame.rowsperstrip ? frame.rowsperstrip : frame.height );
+    int plane = 0;
+    int y = 0;
+    for ( uint32_t strip = 0; strip < frame.stripcount && plane < ( planar ? samples : 1 ); ++strip )
+    {
+      const auto rows = static_cast<int>( math::min( rowsPerStrip, static_cast<uint32_t>( info.height - y ) ) );
+      if ( frame.stripbytecounts[strip] < rows * rowBytes )
+        NEKO_EXCEPT( "TIFF strip is shorter than its rows" );
+      reader.seek( FileSeek_Beginning, static_cast<int32_t>( frame.stripoffsets[strip] ) );
+      for ( int row = y; row < y + rows; ++row )
+      {
+        const auto dst = ( direct ? targetRow( out.data_.data(), info, stride, row, flip )
+                                  : raw.data() + ( static_cast<size_t>( plane ) * info.height + row ) * rowBytes );
+        reader.read( dst, static_cast<uint32_t>( rowBytes ) );
+      }
+      y += rows;
+      if ( y == info.height )
+      {
+        y = 0;
+        plane++;
+      }
+    }
+    if ( plane < ( planar ? samples : 1 ) )
+      NEKO_EXCEPT( "TIFF image is missing strips" );
+
+    if ( direct )
+      return out;
+
+    // Narrowing and interleaving rows are independent, so bands of them go in parallel
+    constexpr int c_bandRows = 64;
+    vector<int> bands( ( info.height + c_bandRows - 1 ) / c_bandRows );
+    for ( size_t i = 0; i < bands.size(); ++i )
+      bands[i] = static_cast<int>( i ) * c_bandRows;
+    std::for_each( std::execution::par, bands.begin(), bands.end(), [&]( int first ) {
+      vector<uint8_t> narrowed( planar && bytes == 2 ? stride : 0 );
+      const uint8_t* planes[4] = {};
+      for ( int row = first; row < math::min( first + c_bandRows, info.height ); ++row )
+      {
+        const auto dst = targetRow( out.data_.data(), info, stride, row, flip );
+        if ( !planar )
+        {
+          narrow16( raw.data() + row * rowBytes, dst, stride, swap );
+          continue;
+        }
+        for ( int s = 0; s < samples; ++s )
+        {
+          const auto src = raw.data() + ( static_cast<size_t>( s ) * info.height + row ) * rowBytes;
+          if ( bytes == 2 )
+          {
+            narrow16( src, narrowed.data() + s * info.width, info.width, swap );
+            planes[s] = narrowed.data() + s * info.width;
+          }
+          else
+            planes[s] = src;
+        }
+        interleave( planes, samples, info.width, dst );
+      }
+    } );
 
     return out;
   }
@@ -282,61 +859,92 @@ namespace neko {
     data_.clear();
   }
 
-  void Pixmap::convert( PixelFormat newfmt )
+  void Pixmap::convert( PixelFormat newfmt, bool srgb )
   {
     if ( newfmt == format_ )
       return;
 
+    auto out = converted( newfmt, srgb );
+    format_ = newfmt;
+    data_.swap( out.data_ );
+  }
+
+  Pixmap Pixmap::converted( PixelFormat newfmt, bool srgb ) const
+  {
     if ( !g_fmtInfo.contains( newfmt ) )
       NEKO_EXCEPT( "Unsupported pixel format passed to Pixmap::convert" );
 
     if ( data_.empty() )
     {
-      format_ = newfmt;
-      return;
+      Pixmap out( newfmt );
+      out.width_ = width_;
+      out.height_ = height_;
+      return out;
     }
 
-    vector<uint8_t> rbd;
-    const auto pixelCount = ( width_ * height_ );
-    const auto components = g_fmtInfo.at( newfmt ).first;
-    const auto bytespercomponent = g_fmtInfo.at( newfmt ).second;
-    const auto stride = ( components * bytespercomponent );
-    rbd.resize( static_cast<size_t>( pixelCount ) * stride );
+    if ( newfmt == format_ )
+      return from( *this );
 
-    if ( newfmt == PixFmtColorRGBA8 && format_ == PixFmtColorRGBA32f )
-    {
-      auto srcdata = reinterpret_cast<float*>( data_.data() );
-      auto dstdata = reinterpret_cast<uint8_t*>( rbd.data() );
-      for ( auto i = 0; i < ( pixelCount * components ); ++i )
-        dstdata[i] = static_cast<uint8_t>( srcdata[i] * 255.0f );
-    }
-    else if ( newfmt == PixFmtColorRGBA32f && format_ == PixFmtColorRGBA8 )
+    const auto& srcInfo = g_fmtInfo.at( format_ );
+    const auto& dstInfo = g_fmtInfo.at( newfmt );
+    const auto srcStride = static_cast<size_t>( srcInfo.first * srcInfo.second );
+    const auto dstStride = static_cast<size_t>( dstInfo.first * dstInfo.second );
+    const auto pixelCount = static_cast<size_t>( width_ ) * height_;
+    vector<uint8_t> rbd( pixelCount * dstStride );
+
+    // Each chunk goes through a float RGBA scratch row that fits in L1
+    const auto convertRange = [&]( size_t first, size_t last ) {
+      alignas( 32 ) float scratch[c_convertChunk * 4];
+      for ( auto i = first; i < last; i += c_convertChunk )
+      {
+        const auto count = static_cast<int>( math::min( last - i, static_cast<size_t>( c_convertChunk ) ) );
+        const auto src = data_.data() + i * srcStride;
+        const auto dst = rbd.data() + i * dstStride;
+        if ( srcInfo.second == 1 && dstInfo.second == 1 )
+          swizzleRow( src, srcInfo.first, count, dstInfo.first, dst );
+        else
+        {
+          loadRow( src, format_, count, srgb, scratch );
+          storeRow( scratch, newfmt, count, srgb, dst );
+        }
+      }
+    };
+
+    if ( pixelCount < c_convertParallelPixels )
+      convertRange( 0, pixelCount );
+    else
     {
-      constexpr auto scaler = ( 1.0f / 255.0f );
-      auto srcdata = reinterpret_cast<uint8_t*>( data_.data() );
-      auto dstdata = reinterpret_cast<float*>( rbd.data() );
-      for ( auto i = 0; i < ( pixelCount * components ); ++i )
-        dstdata[i] = static_cast<float>( srcdata[i] ) * scaler;
+      vector<size_t> bands( ( pixelCount + c_convertParallelPixels - 1 ) / c_convertParallelPixels );
+      for ( size_t i = 0; i < bands.size(); ++i )
+        bands[i] = i * c_convertParallelPixels;
+      std::for_each( std::execution::par, bands.begin(), bands.end(), [&]( size_t first ) {
+        convertRange( first, math::min( first + c_convertParallelPixels, pixelCount ) );
+      } );
     }
-    else
-      NEKO_EXCEPT( "Unsupported pixel format passed to Pixmap::convert" );
 
-    format_ = newfmt;
-    data_.swap( rbd );
+    return Pixmap( width_, height_, newfmt, move( rbd ) );
   }
 
-  void Pixmap::writePNG( const utf8String& filename ) const
+  bool Pixmap::encodePNG( vector<uint8_t>& out ) const
   {
-    platform::FileWriter writer( filename );
-    vector<uint8_t> buffer;
+    out.clear();
     if ( format_ == PixFmtColorRGBA8 )
-      lodepng::encode( buffer, data_.data(), width_, height_, LCT_RGBA, 8 );
+      lodepng::encode( out, data_.data(), width_, height_, LCT_RGBA, 8 );
     else if ( format_ == PixFmtColorRGB8 )
-      lodepng::encode( buffer, data_.data(), width_, height_, LCT_RGB, 8 );
+      lodepng::encode( out, data_.data(), width_, height_, LCT_RGB, 8 );
     else if ( format_ == PixFmtColorR8 )
-      lodepng::encode( buffer, data_.data(), width_, height_, LCT_GREY, 8 );
+      lodepng::encode( out, data_.data(), width_, height_, LCT_GREY, 8 );
     else
+      return false;
+    return true;
+  }
+
+  void Pixmap::writePNG( const utf8String& filename ) const
+  {
+    vector<uint8_t> buffer;
+    if ( !encodePNG( buffer ) )
       return;
+    platform::FileWriter writer( filename );
     writer.writeBlob( buffer.data(), static_cast<uint32_t>( buffer.size() ) );
   }
 
@@ -411,4 +1019,210 @@ namespace neko {
       NEKO_EXCEPT( "Unsupported stride" );
   }
 
+  Pixmap Pixmap::downsample() const
+  {
+    const auto& info = g_fmtInfo.at( format_ );
+    if ( info.second != 1 )
+      NEKO_EXCEPT( "Unsupported pixel format passed to Pixmap::downsample" );
+
+    const auto components = info.first;
+    const auto w = math::max( width_ / 2, 1 );
+    const auto h = math::max( height_ / 2, 1 );
+    Pixmap out( w, h, format_, nullptr );
+
+    auto dst = out.data_.data();
+    for ( int y = 0; y < h; ++y )
+    {
+      const auto y0 = math::min( y * 2, height_ - 1 );
+      const auto y1 = math::min( y * 2 + 1, height_ - 1 );
+      const auto row0 = data_.data() + static_cast<size_t>( y0 ) * width_ * components;
+      const auto row1 = data_.data() + static_cast<size_t>( y1 ) * width_ * components;
+      for ( int x = 0; x < w; ++x )
+      {
+        const auto x0 = math::min( x * 2, width_ - 1 ) * components;
+        const auto x1 = math::min( x * 2 + 1, width_ - 1 ) * components;
+        for ( int c = 0; c < components; ++c )
+          *dst++ = static_cast<uint8_t>(
+            ( row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2 ) >> 2 );
+      }
+    }
+
+    return out;
+  }
+
+  namespace {
+
+    // Scalar reference for the conversion kernels, written from the format definitions without intrinsics
+
+    float referenceFromHalf( uint16_t half )
+    {
+      const auto exponent = ( half >> 10 ) & 0x1F;
+      const auto mantissa = half & 0x3FF;
+      double value;
+      if ( exponent == 0 )
+        value = std::ldexp( static_cast<double>( mantissa ), -24 );
+      else if ( exponent == 0x1F )
+        value = ( mantissa ? std::numeric_limits<double>::quiet_NaN() : std::numeric_limits<double>::infinity() );
+      else
+        value = std::ldexp( static_cast<double>( 0x400 | mantissa ), exponent - 25 );
+      return static_cast<float>( ( half & 0x8000 ) ? -value : value );
+    }
+
+    uint16_t referenceToHalf( float value )
+    {
+      uint32_t bits;
+      memcpy( &bits, &value, sizeof( bits ) );
+      const auto sign = static_cast<uint16_t>( ( bits >> 16 ) & 0x8000 );
+      const auto magnitude = bits & 0x7FFFFFFF;
+      if ( magnitude > 0x7F800000 )
+        return sign | 0x7E00;
+      if ( magnitude >= 0x477FF000 ) // 65520 and up round to infinity
+        return sign | 0x7C00;
+      if ( magnitude < 0x38800000 ) // Below the smallest normal half, count in subnormal steps
+      {
+        float absolute;
+        memcpy( &absolute, &magnitude, sizeof( absolute ) );
+        return sign | static_cast<uint16_t>( std::nearbyint( static_cast<double>( absolute ) * 16777216.0 ) );
+      }
+      auto half = ( magnitude >> 13 ) - ( 112u << 10 );
+      const auto remainder = magnitude & 0x1FFF;
+      if ( remainder > 0x1000 || ( remainder == 0x1000 && ( half & 1 ) ) )
+        ++half;
+      return sign | static_cast<uint16_t>( half );
+    }
+
+    float referenceLoad( const uint8_t* pixel, PixelFormat format, int channel, bool srgb )
+    {
+      const auto& info = g_fmtInfo.at( format );
+      if ( channel >= info.first )
+        return ( channel == 3 ? 1.0f : 0.0f );
+      if ( info.second == 2 )
+        return referenceFromHalf( reinterpret_cast<const uint16_t*>( pixel )[channel] );
+      if ( info.second == 4 )
+        return reinterpret_cast<const float*>( pixel )[channel];
+      const auto code = pixel[channel];
+      if ( !srgb || channel == 3 )
+        return static_cast<float>( code ) * ( 1.0f / 255.0f );
+      const auto c = code / 255.0;
+      return static_cast<float>( c <= 0.04045 ? c / 12.92 : std::pow( ( c + 0.055 ) / 1.055, 2.4 ) );
+    }
+
+    void referenceStore( float value, PixelFormat format, int channel, bool srgb, uint8_t* pixel )
+    {
+      const auto bytes = g_fmtInfo.at( format ).second;
+      if ( bytes == 2 )
+        reinterpret_cast<uint16_t*>( pixel )[channel] = referenceToHalf( value );
+      else if ( bytes == 4 )
+        reinterpret_cast<float*>( pixel )[channel] = value;
+      else if ( !srgb || channel == 3 )
+      {
+        const auto clamped = ( value > 0.0f ? ( value < 1.0f ? value : 1.0f ) : 0.0f );
+        pixel[channel] = static_cast<uint8_t>( std::nearbyint( clamped * 255.0f ) );
+      }
+      else
+      {
+        const auto c = ( value > 0.0f ? ( value < 1.0f ? static_cast<double>( value ) : 1.0 ) : 0.0 );
+        const auto encoded = ( c <= 0.0031308 ? c * 12.92 : 1.055 * std::pow( c, 1.0 / 2.4 ) - 0.055 );
+        pixel[channel] = static_cast<uint8_t>( std::nearbyint( encoded * 255.0 ) );
+      }
+    }
+
+    //! Random pixels with awkward values mixed in: out of range, signed zero, half subnormals and overflow.
+    vector<uint8_t> referenceSource( PixelFormat format, size_t pixels, std::mt19937& rng )
+    {
+      const auto& info = g_fmtInfo.at( format );
+      const auto values = pixels * info.first;
+      vector<uint8_t> data( values * info.second );
+      std::uniform_int_distribution<int> codes( 0, 255 );
+      std::uniform_int_distribution<int> pick( 0, 31 );
+      std::uniform_real_distribution<float> floats( -0.5f, 1.5f );
+      const float specials[] = { 0.0f, -0.0f, 1.0f, 0.5f, -2.0f, 1e-6f, 65504.0f, 70000.0f };
+      for ( size_t i = 0; i < values; ++i )
+      {
+        if ( info.second == 1 )
+        {
+          data[i] = static_cast<uint8_t>( codes( rng ) );
+          continue;
+        }
+        const auto p = pick( rng );
+        const auto value = ( p < 8 ? specials[p] : floats( rng ) );
+        if ( info.second == 2 )
+          reinterpret_cast<uint16_t*>( data.data() )[i] = referenceToHalf( value );
+        else
+          reinterpret_cast<float*>( data.data() )[i] = value;
+      }
+      return data;
+    }
+
+  }
+
+  static void concmdCheckConvert( Console* console, ConCmd* command, StringVector& arguments )
+  {
+    const pair<PixelFormat, const char*> formats[] = {
+      { PixFmtColorRGB8, "RGB8" }, { PixFmtColorRGBA8, "RGBA8" }, { PixFmtColorRG8, "RG8" }, { PixFmtColorR8, "R8" },
+      { PixFmtColorR16f, "R16f" }, { PixFmtColorRGBA16f, "RGBA16f" }, { PixFmtColorRGBA32f, "RGBA32f" } };
+
+    // Odd sizes leave a scalar tail after the SIMD chunks, and the larger one also splits into parallel bands
+    const pair<int, int> sizes[] = { { 7, 3 }, { 331, 199 } };
+
+    std::mt19937 rng( 1 );
+    size_t checked = 0;
+    size_t failed = 0;
+    for ( const auto& size : sizes )
+    {
+      const auto pixels = static_cast<size_t>( size.first ) * size.second;
+      for ( const auto& from : formats )
+      {
+        const auto& srcInfo = g_fmtInfo.at( from.first );
+        const auto srcStride = static_cast<size_t>( srcInfo.first * srcInfo.second );
+        const Pixmap source( size.first, size.second, from.first, referenceSource( from.first, pixels, rng ).data() );
+        for ( const auto& to : formats )
+        {
+          if ( to.first == from.first )
+            continue;
+          const auto& dstInfo = g_fmtInfo.at( to.first );
+          const auto dstStride = static_cast<size_t>( dstInfo.first * dstInfo.second );
+          // Between 8-bit formats codes are copied as they are, whatever the transfer function
+          const auto copy = ( srcInfo.second == 1 && dstInfo.second == 1 );
+          for ( const auto srgb : { false, true } )
+          {
+            const auto result = source.converted( to.first, srgb );
+            vector<uint8_t> expected( pixels * dstStride );
+            for ( size_t i = 0; i < pixels; ++i )
+              for ( int c = 0; c < dstInfo.first; ++c )
+                referenceStore( referenceLoad( source.data().data() + i * srcStride, from.first, c, srgb && !copy ),
+                  to.first, c, srgb && !copy, expected.data() + i * dstStride );
+
+            // The reference encodes sRGB with pow, which can land a code off where the midpoint search
+            // rounds in linear space; everything else has to match bit for bit
+            size_t mismatches = 0;
+            for ( size_t i = 0; i < pixels; ++i )
+              for ( int c = 0; c < dstInfo.first; ++c )
+              {
+                const auto offset = i * dstStride + static_cast<size_t>( c ) * dstInfo.second;
+                if ( dstInfo.second == 1 )
+                {
+                  const auto tolerance = ( srgb && !copy && c < 3 ? 1 : 0 );
+                  if ( abs( static_cast<int>( result.data()[offset] ) - static_cast<int>( expected[offset] ) ) > tolerance )
+                    ++mismatches;
+                }
+                else if ( memcmp( result.data().data() + offset, expected.data() + offset, dstInfo.second ) != 0 )
+                  ++mismatches;
+              }
+
+            checked += pixels * dstInfo.first;
+            if ( mismatches )
+            {
+              ++failed;
+              console->printf( srcGfx, "Pixmap convert %s -> %s%s at %dx%d: %zu of %zu channels differ from reference",
+                from.second, to.second, srgb ? " (sRGB)" : "", size.first, size.second, mismatches, pixels * dstInfo.first );
+            }
+          }
+        }
+      }
+    }
+
+    console->printf( srcGfx, "Pixmap convert check: %zu channels compared, %zu conversions failed", checked, failed );
+  }
+
 }
\ No newline at end of file
@@ -0,0 +1,306 @@
+#include "pch.h"
+#include "profiler.h"
+#include "utilities.h"
+#include "locator.h"
+#include "console.h"
+#include "filesystem.h"
+
+namespace neko {
+
+  using namespace gl;
+
+  static void concmdProfilerCapture( Console* console, ConCmd* command, StringVector& arguments );
+
+  NEKO_DECLARE_CONCMD( prof_capture,
+    "Write the profiler's recent markers as a Chrome trace. Format: prof_capture [filename]",
+    concmdProfilerCapture );
+
+  namespace {
+
+    platform::RWLock g_threadsLock;
+    vector<unique_ptr<ProfileThreadBuffer>> g_threads;
+    thread_local ProfileThreadBuffer* t_thread = nullptr;
+
+    //! GPU timestamp queries, touched by the render thread only.
+    struct GpuFrame
+    {
+      GLuint queries[Profiler::c_gpuScopesPerFrame * 2] = {};
+      const char* names[Profiler::c_gpuScopesPerFrame] = {};
+      int used = 0;
+    };
+
+    struct GpuState
+    {
+      GpuFrame frames[Profiler::c_gpuFrames];
+      size_t frame = 0;
+      bool created = false;
+      ProfileThreadBuffer* timeline = nullptr; //!< Pseudo thread the GPU scopes are recorded on
+      uint64_t dropped = 0; //!< Frames whose results weren't ready in time
+    } g_gpu;
+
+    ProfileThreadBuffer& registerThread( const char* name )
+    {
+      ScopedRWLock lock( &g_threadsLock );
+      auto buffer = make_unique<ProfileThreadBuffer>( static_cast<uint32_t>( g_threads.size() + 1 ) );
+      buffer->name_ = name ? name : "Thread " + std::to_string( g_threads.size() + 1 );
+      g_threads.push_back( move( buffer ) );
+      return *g_threads.back();
+    }
+
+    //! Copy every ring under the registry lock, so threads registering meanwhile don't invalidate the list.
+    void snapshotAll( vector<pair<ProfileThreadBuffer*, vector<ProfileEvent>>>& out )
+    {
+      ScopedRWLock lock( &g_threadsLock, false );
+      out.resize( g_threads.size() );
+      for ( size_t i = 0; i < g_threads.size(); ++i )
+      {
+        out[i].first = g_threads[i].get();
+        out[i].second.clear();
+        g_threads[i]->snapshot( out[i].second );
+      }
+    }
+
+    void appendEscaped( utf8String& out, const char* str )
+    {
+      for ( ; *str; ++str )
+      {
+        if ( *str == '"' || *str == '\\' )
+          out.push_back( '\\' );
+        out.push_back( *str );
+      }
+    }
+
+  }
+
+  // ProfileThreadBuffer
+
+  void ProfileThreadBuffer::snapshot( vector<ProfileEvent>& out ) const
+  {
+    const auto end = written_.load( std::memory_order_acquire );
+    const auto begin = ( end > c_capacity ? end - c_capacity : 0 );
+    const auto first = out.size();
+    for ( auto i = begin; i < end; ++i )
+      out.push_back( events_[i & ( c_capacity - 1 )] );
+
+    // Anything the producer lapped while we were copying may be torn, and so may the slot it's writing
+    // event after into right now, which still holds event after - c_capacity
+    std::atomic_thread_fence( std::memory_order_acquire );
+    const auto after = written_.load( std::memory_order_relaxed );
+    const auto valid = ( after + 1 > c_capacity ? after + 1 - c_capacity : 0 );
+    if ( valid > begin )
+    {
+      const auto torn = static_cast<size_t>( math::min( valid - begin, end - begin ) );
+      out.erase( out.begin() + first, out.begin() + first + torn );
+    }
+  }
+
+  // Profiler
+
+  ProfileThreadBuffer& Profiler::thread()
+  {
+    if ( !t_thread )
+      t_thread = &registerThread( nullptr );
+    return *t_thread;
+  }
+
+  void Profiler::nameThread( const char* name )
+  {
+    auto& buffer = thread();
+    ScopedRWLock lock( &g_threadsLock );
+    buffer.name_ = name;
+  }
+
+  int Profiler::gpuBegin( const char* name )
+  {
+    auto& frame = g_gpu.frames[g_gpu.frame % c_gpuFrames];
+    if ( !g_gpu.created )
+    {
+      for ( auto& f : g_gpu.frames )
+        glGenQueries( static_cast<GLsizei>( c_gpuScopesPerFrame * 2 ), f.queries );
+      g_gpu.timeline = &registerThread( "GPU" );
+      g_gpu.created = true;
+    }
+    if ( frame.used >= static_cast<int>( c_gpuScopesPerFrame ) )
+      return -1;
+    const auto index = frame.used++;
+    frame.names[index] = name;
+    glQueryCounter( frame.queries[index * 2], GL_TIMESTAMP );
+    return index;
+  }
+
+  void Profiler::gpuEnd( int index )
+  {
+    if ( index < 0 )
+      return;
+    auto& frame = g_gpu.frames[g_gpu.frame % c_gpuFrames];
+    glQueryCounter( frame.queries[index * 2 + 1], GL_TIMESTAMP );
+  }
+
+  void Profiler::gpuFrame()
+  {
+    if ( !g_gpu.created )
+      return;
+
+    g_gpu.frame++;
+    auto& frame = g_gpu.frames[g_gpu.frame % c_gpuFrames];
+    if ( !frame.used )
+      return;
+
+    // The oldest frame is c_gpuFrames behind, so its results should be in; if not, drop them rather than stall
+    GLint available = 0;
+    glGetQueryObjectiv( frame.queries[frame.used * 2 - 1], GL_QUERY_RESULT_AVAILABLE, &available );
+    if ( !available )
+    {
+      g_gpu.dropped++;
+      frame.used = 0;
+      return;
+    }
+
+    // Map the GPU clock onto ours. Both count nanoseconds, so only the offset differs
+    GLint64 gpuNow = 0;
+    glGetInteger64v( GL_TIMESTAMP, &gpuNow );
+    const auto offset = static_cast<int64_t>( now() ) - gpuNow;
+
+    for ( int i = 0; i < frame.used; ++i )
+    {
+      GLuint64 start = 0, end = 0;
+      glGetQueryObjectui64v( frame.queries[i * 2], GL_QUERY_RESULT, &start );
+      glGetQueryObjectui64v( frame.queries[i * 2 + 1], GL_QUERY_RESULT, &end );
+      g_gpu.timeline->push( { frame.names[i], static_cast<uint64_t>( static_cast<int64_t>( start ) + offset ),
+        static_cast<uint64_t>( static_cast<int64_t>( end ) + offset ) } );
+    }
+    frame.used = 0;
+  }
+
+  void Profiler::gpuShutdown()
+  {
+    if ( !g_gpu.created )
+      return;
+    for ( auto& f : g_gpu.frames )
+    {
+      glDeleteQueries( static_cast<GLsizei>( c_gpuScopesPerFrame * 2 ), f.queries );
+      f.used = 0;
+    }
+    // The timeline buffer stays registered, so a restart keeps appending to it
+    g_gpu.created = false;
+  }
+
+  void Profiler::exportTrace( const utf8String& filename )
+  {
+    vector<pair<ProfileThreadBuffer*, vector<ProfileEvent>>> threads;
+    snapshotAll( threads );
+
+    uint64_t origin = std::numeric_limits<uint64_t>::max();
+    for ( const auto& thread : threads )
+      for ( const auto& event : thread.second )
+        origin = math::min( origin, event.start );
+
+    utf8String out = "{\"traceEvents\":[\n";
+    char line[256];
+    bool first = true;
+    for ( const auto& thread : threads )
+    {
+      sprintf_s( line, 256, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"",
+        first ? "" : ",\n", thread.first->id_ );
+      out.append( line );
+      {
+        ScopedRWLock lock( &g_threadsLock, false );
+        appendEscaped( out, thread.first->name_.c_str() );
+      }
+      out.append( "\"}}" );
+      first = false;
+      for ( const auto& event : thread.second )
+      {
+        out.append( ",\n{\"name\":\"" );
+        appendEscaped( out, event.name );
+        sprintf_s( line, 256, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", thread.first->id_,
+          static_cast<double>( event.start - origin ) / 1000.0,
+          static_cast<double>( event.end - event.start ) / 1000.0 );
+        out.append( line );
+      }
+    }
+    out.append( "\n],\"displayTimeUnit\":\"ms\"}\n" );
+
+    auto writer = Locator::fileSystem().createFile( Dir_User, filename );
+    writer->writeBlob( out.data(), static_cast<uint32_t>( out.size() ) );
+  }
+
+  void Profiler::imguiWindow()
+  {
+    struct Summary
+    {
+      string_view name;
+      size_t calls = 0;
+      uint64_t total = 0;
+      uint64_t longest = 0;
+    };
+
+    static vector<pair<ProfileThreadBuffer*, vector<ProfileEvent>>> threads;
+    snapshotAll( threads );
+    const auto since = now() - 1000000000ull;
+
+    ImGui::Begin( "Profiler" );
+    if ( ImGui::Button( "Capture trace" ) )
+      Locator::console().queueCommand( "prof_capture" );
+    ImGui::SameLine();
+    ImGui::Text( "GPU frames dropped: %llu", g_gpu.dropped );
+
+    for ( const auto& thread : threads )
+    {
+      vector<Summary> summaries;
+      for ( const auto& event : thread.second )
+      {
+        if ( event.end < since )
+          continue;
+        const string_view name( event.name );
+        auto it = std::find_if( summaries.begin(), summaries.end(), [&name]( const Summary& s ) { return s.name == name; } );
+        if ( it == summaries.end() )
+        {
+          summaries.push_back( { name } );
+          it = summaries.end() - 1;
+        }
+        it->calls++;
+        it->total += event.end - event.start;
+        it->longest = math::max( it->longest, event.end - event.start );
+      }
+      std::sort( summaries.begin(), summaries.end(),
+        []( const Summary& a, const Summary& b ) { return a.total > b.total; } );
+
+      ImGui::PushID( thread.first );
+      if ( ImGui::CollapsingHeader( thread.first->name_.c_str(), ImGuiTreeNodeFlags_DefaultOpen ) &&
+        ImGui::BeginTable( "markers", 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp ) )
+      {
+        ImGui::TableSetupColumn( "marker" );
+        ImGui::TableSetupColumn( "calls/s" );
+        ImGui::TableSetupColumn( "avg ms" );
+        ImGui::TableSetupColumn( "max ms" );
+        ImGui::TableHeadersRow();
+        for ( const auto& summary : summaries )
+        {
+          ImGui::TableNextRow();
+          ImGui::TableNextColumn();
+          ImGui::TextUnformatted( summary.name.data(), summary.name.data() + summary.name.size() );
+          ImGui::TableNextColumn();
+          ImGui::Text( "%zu", summary.calls );
+          ImGui::TableNextColumn();
+          ImGui::Text( "%.3f", static_cast<double>( summary.total ) / summary.calls / 1000000.0 );
+          ImGui::TableNextColumn();
+          ImGui::Text( "%.3f", static_cast<double>( summary.longest ) / 1000000.0 );
+        }
+        ImGui::EndTable();
+      }
+      ImGui::PopID();
+    }
+    ImGui::End();
+  }
+
+  static void concmdProfilerCapture( Console* console, ConCmd* command, StringVector& arguments )
+  {
+    utf8String filename = "profile.json";
+    if ( arguments.size() > 1 )
+      filename = arguments[1];
+    Profiler::exportTrace( filename );
+    console->printf( srcEngine, "Profiler trace written to %s", filename.c_str() );
+  }
+
+}
@@ -0,0 +1,255 @@
+#include "pch.h"
+#include "radixsort.h"
+#include "locator.h"
+#include "console.h"
+
+namespace neko {
+
+  static void concmdBenchmarkSort( Console* console, ConCmd* command, StringVector& arguments );
+
+  NEKO_DECLARE_CONCMD( bench_sort,
+    "Benchmark sorting random float depths against std::sort. Format: bench_sort [count] [runs]",
+    concmdBenchmarkSort );
+
+  namespace radix {
+
+    namespace {
+
+      constexpr size_t c_insertionThreshold = 48; //!< Buckets this small finish with an insertion sort
+
+      template <typename Key>
+      inline uint32_t digit( Key key, int shift )
+      {
+        return static_cast<uint32_t>( key >> shift ) & 0xFF;
+      }
+
+      template <typename Key>
+      void lsdSort( vector<Entry<Key>>& entries, vector<Entry<Key>>& scratch )
+      {
+        constexpr int digits = sizeof( Key );
+        const auto count = entries.size();
+        if ( count < 2 )
+          return;
+        assert( count <= std::numeric_limits<uint32_t>::max() );
+
+        scratch.resize( count );
+
+        const auto blocks = ( count < c_parallelThreshold ? 1 : ( count + c_blockSize - 1 ) / c_blockSize );
+        const auto blockSize = ( count + blocks - 1 ) / blocks;
+        vector<size_t> indices( blocks );
+        for ( size_t i = 0; i < blocks; ++i )
+          indices[i] = i;
+        const auto forEachBlock = [&indices]( auto&& fn ) {
+          if ( indices.size() == 1 )
+            fn( indices[0] );
+          else
+            std::for_each( std::execution::par, indices.begin(), indices.end(), fn );
+        };
+        const auto blockRange = [blockSize, count]( size_t block ) {
+          return pair<size_t, size_t>( block * blockSize, math::min( ( block + 1 ) * blockSize, count ) );
+        };
+
+        // Counts of every digit per block, from a single pass over the keys
+        vector<uint32_t> counts( blocks * digits * 256, 0 );
+        const auto blockCounts = [&counts]( size_t block, int d ) {
+          return counts.data() + ( block * digits + d ) * 256;
+        };
+        forEachBlock( [&]( size_t block ) {
+          const auto [first, last] = blockRange( block );
+          for ( size_t i = first; i < last; ++i )
+            for ( int d = 0; d < digits; ++d )
+              ++blockCounts( block, d )[digit( entries[i].key, d * 8 )];
+        } );
+
+        auto src = &entries;
+        auto dst = &scratch;
+        bool moved = false;
+        for ( int d = 0; d < digits; ++d )
+        {
+          const auto shift = d * 8;
+          // Every entry shares this digit, nothing would move
+          size_t total = 0;
+          const auto first = digit( src->front().key, shift );
+          for ( size_t block = 0; block < blocks; ++block )
+            total += blockCounts( block, d )[first];
+          if ( total == count )
+            continue;
+
+          // Entries have moved between blocks since the counts were taken, so count this digit again
+          if ( moved )
+            forEachBlock( [&]( size_t block ) {
+              const auto [begin, end] = blockRange( block );
+              auto histogram = blockCounts( block, d );
+              memset( histogram, 0, 256 * sizeof( uint32_t ) );
+              for ( size_t i = begin; i < end; ++i )
+                ++histogram[digit( ( *src )[i].key, shift )];
+            } );
+
+          // Each block writes its share of a bucket after the blocks before it, which keeps the sort stable
+          uint32_t sum = 0;
+          for ( int value = 0; value < 256; ++value )
+            for ( size_t block = 0; block < blocks; ++block )
+            {
+              auto& offset = blockCounts( block, d )[value];
+              const auto n = offset;
+              offset = sum;
+              sum += n;
+            }
+
+          forEachBlock( [&]( size_t block ) {
+            const auto [begin, end] = blockRange( block );
+            auto offsets = blockCounts( block, d );
+            const auto in = src->data();
+            auto out = dst->data();
+            for ( size_t i = begin; i < end; ++i )
+              out[offsets[digit( in[i].key, shift )]++] = in[i];
+          } );
+
+          std::swap( src, dst );
+          moved = true;
+        }
+
+        if ( src != &entries )
+          entries.swap( *src );
+      }
+
+      template <typename Key>
+      void msdSort( Entry<Key>* entries, size_t count, int shift )
+      {
+        if ( count <= c_insertionThreshold )
+        {
+          for ( size_t i = 1; i < count; ++i )
+          {
+            const auto entry = entries[i];
+            auto j = i;
+            for ( ; j > 0 && entries[j - 1].key > entry.key; --j )
+              entries[j] = entries[j - 1];
+            entries[j] = entry;
+          }
+          return;
+        }
+
+        size_t histogram[256] = {};
+        for ( size_t i = 0; i < count; ++i )
+          ++histogram[digit( entries[i].key, shift )];
+
+        if ( histogram[digit( entries[0].key, shift )] == count )
+        {
+          if ( shift > 0 )
+            msdSort( entries, count, shift - 8 );
+          return;
+        }
+
+        size_t heads[256];
+        size_t tails[256];
+        size_t sum = 0;
+        for ( int value = 0; value < 256; ++value )
+        {
+          heads[value] = sum;
+          sum += histogram[value];
+          tails[value] = sum;
+        }
+
+        // Carry each misplaced entry to the next free slot of its bucket, taking whatever was there along next,
+        // until one belonging to the current bucket turns up
+        for ( uint32_t value = 0; value < 256; ++value )
+          while ( heads[value] < tails[value] )
+          {
+            auto entry = entries[heads[value]];
+            auto d = digit( entry.key, shift );
+            while ( d != value )
+            {
+              std::swap( entry, entries[heads[d]++] );
+              d = digit( entry.key, shift );
+            }
+            entries[heads[value]++] = entry;
+          }
+
+        if ( shift == 0 )
+          return;
+
+        // The buckets are independent from here on
+        vector<int> buckets;
+        for ( int value = 0; value < 256; ++value )
+          if ( histogram[value] > 1 )
+            buckets.push_back( value );
+        const auto recurse = [&]( int value ) {
+          msdSort( entries + tails[value] - histogram[value], histogram[value], shift - 8 );
+        };
+        if ( count >= c_parallelThreshold )
+          std::for_each( std::execution::par, buckets.begin(), buckets.end(), recurse );
+        else
+          std::for_each( buckets.begin(), buckets.end(), recurse );
+      }
+
+    }
+
+    void sort( vector<Entry<uint32_t>>& entries, vector<Entry<uint32_t>>& scratch )
+    {
+      lsdSort( entries, scratch );
+    }
+
+    void sort( vector<Entry<uint64_t>>& entries, vector<Entry<uint64_t>>& scratch )
+    {
+      lsdSort( entries, scratch );
+    }
+
+    void sortInPlace( vector<Entry<uint32_t>>& entries )
+    {
+      if ( entries.size() > 1 )
+        msdSort( entries.data(), entries.size(), 24 );
+    }
+
+    void sortInPlace( vector<Entry<uint64_t>>& entries )
+    {
+      if ( entries.size() > 1 )
+        msdSort( entries.data(), entries.size(), 56 );
+    }
+
+  }
+
+  static void concmdBenchmarkSort( Console* console, ConCmd* command, StringVector& arguments )
+  {
+    const auto count = static_cast<size_t>( arguments.size() > 1 ? math::max( 1, atoi( arguments[1].c_str() ) ) : 1000000 );
+    const auto runs = ( arguments.size() > 2 ? math::max( 1, atoi( arguments[2].c_str() ) ) : 20 );
+
+    // View depths of a scene spread out in front of the camera, keyed back to front like transparent draws are
+    std::mt19937 rng( 1 );
+    std::uniform_real_distribution<Real> depths( 0.1f, 1000.0f );
+    vector<radix::DepthEntry> input( count );
+    for ( size_t i = 0; i < count; ++i )
+      input[i] = { ~radix::floatBits( depths( rng ) ), static_cast<uint32_t>( i ) };
+
+    const auto byKey = []( const radix::DepthEntry& a, const radix::DepthEntry& b ) { return a.key < b.key; };
+    vector<radix::DepthEntry> entries;
+    vector<radix::DepthEntry> scratch;
+    double times[3] = {};
+    bool valid = true;
+    platform::PerformanceTimer timer;
+    for ( int run = 0; run < runs; ++run )
+    {
+      entries = input;
+      timer.start();
+      radix::sort( entries, scratch );
+      times[0] += timer.stop();
+      for ( size_t i = 1; i < count && valid; ++i )
+        valid = ( entries[i - 1].key < entries[i].key ||
+          ( entries[i - 1].key == entries[i].key && entries[i - 1].index < entries[i].index ) );
+
+      entries = input;
+      timer.start();
+      radix::sortInPlace( entries );
+      times[1] += timer.stop();
+      valid = valid && std::is_sorted( entries.begin(), entries.end(), byKey );
+
+      entries = input;
+      timer.start();
+      std::sort( std::execution::par, entries.begin(), entries.end(), byKey );
+      times[2] += timer.stop();
+    }
+
+    console->printf( srcGfx, "Sort x%zu, %d runs: radix %.3fms, radix in place %.3fms, std::sort %.3fms%s", count, runs,
+      times[0] / runs, times[1] / runs, times[2] / runs, valid ? "" : " (RESULTS OUT OF ORDER)" );
+  }
+
+}
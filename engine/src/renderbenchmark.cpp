@@ -0,0 +1,230 @@
+#include "pch.h"
+#include "renderbenchmark.h"
+#include "gfx.h"
+#include "renderer.h"
+#include "console.h"
+#include "locator.h"
+#include "filesystem.h"
+#include "utilities.h"
+#include "profiler.h"
+
+namespace neko {
+
+  using namespace gl;
+
+  static void concmdBenchmarkRender( Console* console, ConCmd* command, StringVector& arguments );
+
+  NEKO_DECLARE_CONCMD( bench_render,
+    "Benchmark drawing a grid of renderables. Format: bench_render sprites|texts|primitives|paintables [count] [frames] [dump]",
+    concmdBenchmarkRender );
+
+  const char* RenderBenchmark::c_sceneNames[MAX_Scene] = {
+    "sprites",
+    "texts",
+    "primitives",
+    "paintables"
+  };
+
+  namespace {
+
+    constexpr vec2 c_benchmarkArea = { 16.0f, 9.0f }; //!< World units the grid is spread over, facing the game camera
+    constexpr GameTime c_benchmarkTime = 1.0;
+
+    platform::RWLock g_requestLock;
+    optional<RenderBenchmark::Settings> g_request;
+
+    double percentile( const vector<double>& sorted, double fraction )
+    {
+      const auto index = static_cast<size_t>( fraction * static_cast<double>( sorted.size() - 1 ) + 0.5 );
+      return sorted[math::min( index, sorted.size() - 1 )];
+    }
+
+  }
+
+  void RenderBenchmark::request( const Settings& settings )
+  {
+    ScopedRWLock lock( &g_requestLock );
+    g_request = settings;
+  }
+
+  bool RenderBenchmark::takeRequest( Settings& out )
+  {
+    ScopedRWLock lock( &g_requestLock );
+    if ( !g_request )
+      return false;
+    out = *g_request;
+    g_request.reset();
+    return true;
+  }
+
+  void RenderBenchmark::populate( SManager& scene )
+  {
+    const auto count = static_cast<size_t>( math::max( 1, settings_.count ) );
+    const auto columns = static_cast<size_t>(
+      std::ceil( std::sqrt( static_cast<double>( count ) * c_benchmarkArea.x / c_benchmarkArea.y ) ) );
+    const auto rows = ( count + columns - 1 ) / columns;
+    const auto spacing = math::min( c_benchmarkArea.x / static_cast<Real>( columns ),
+      c_benchmarkArea.y / static_cast<Real>( rows ) );
+    const auto origin = vec2( -0.5f * spacing * static_cast<Real>( columns - 1 ),
+      0.5f * spacing * static_cast<Real>( rows - 1 ) );
+
+    entities_.reserve( count );
+    char name[32];
+    for ( size_t i = 0; i < count; ++i )
+    {
+      sprintf_s( name, 32, "bench_%zu", i );
+      c::entity e = c::null;
+      if ( settings_.scene == Scene_Sprites )
+      {
+        e = scene.createSprite( name );
+      }
+      else if ( settings_.scene == Scene_Texts )
+      {
+        e = scene.createText( name );
+        scene.tt( e ).content = name;
+        scene.tt( e ).alignHorizontal = 1;
+      }
+      else if ( settings_.scene == Scene_Primitives )
+      {
+        e = scene.createPlane( name );
+        scene.pt( e ).values.plane.dimensions = vec2( spacing * 0.8f );
+      }
+      else if ( settings_.scene == Scene_Paintables )
+      {
+        e = scene.createPaintable( name );
+      }
+      auto& tn = scene.tn( e );
+      tn.translate = vec3( origin.x + spacing * static_cast<Real>( i % columns ),
+        origin.y - spacing * static_cast<Real>( i / columns ), 0.0f );
+      // Sprites, texts and paintables keep their natural pixel scaled size, so dense grids overlap like real scenes do
+      scene.markDirty( e );
+      entities_.push_back( e );
+    }
+  }
+
+  void RenderBenchmark::clear( SManager& scene )
+  {
+    for ( auto e : entities_ )
+      scene.destroyNode( e );
+    entities_.clear();
+  }
+
+  void RenderBenchmark::dumpFrame( Renderer& renderer, const utf8String& filename )
+  {
+    auto texture = renderer.getMergedMainFramebuffer();
+    if ( !texture )
+      return;
+    vector<uint8_t> pixels( static_cast<size_t>( texture->width() ) * texture->height() * 4 );
+    glGetTextureImage( texture->handle(), 0, GL_RGBA, GL_UNSIGNED_BYTE, static_cast<GLsizei>( pixels.size() ),
+      pixels.data() );
+    Pixmap pixmap( texture->width(), texture->height(), PixFmtColorRGBA8, move( pixels ) );
+    pixmap.flipVertical();
+    pixmap.writePNG( filename );
+  }
+
+  RenderBenchmark::Results RenderBenchmark::run( Renderer& renderer, SManager& scene,
+    const ViewportDrawParameters& params )
+  {
+    NEKO_PROFILE_FUNCTION();
+
+    Results results;
+    auto camera = scene.cams().getActive();
+    if ( !camera )
+    {
+      Locator::console().printf( srcGfx, "Benchmark: no active camera" );
+      return results;
+    }
+
+    populate( scene );
+
+    const RenderVisualizations novis = { .bounds = false, .frustums = false, .nodes = false };
+    vector<double> times;
+    times.reserve( settings_.frames );
+    platform::PerformanceTimer timer;
+    for ( int frame = 0; frame < settings_.warmup + settings_.frames; ++frame )
+    {
+      scene.update();
+      renderer.update( scene, 0.0, c_benchmarkTime );
+      timer.start();
+      renderer.drawGame( c_benchmarkTime, scene, *camera, nullptr, params, novis, false );
+      glFinish();
+      const auto ms = timer.stop();
+      if ( frame >= settings_.warmup )
+        times.push_back( ms );
+      renderer.state().endFrame();
+      renderer.stream().endFrame();
+      NEKO_PROFILE_GPU_FRAME();
+    }
+
+    if ( settings_.dump )
+    {
+      char dumpname[64];
+      sprintf_s( dumpname, 64, "bench_%s_%d.png", c_sceneNames[settings_.scene], settings_.count );
+      dumpFrame( renderer, dumpname );
+    }
+
+    clear( scene );
+
+    if ( times.empty() )
+      return results;
+
+    for ( auto ms : times )
+      results.average += ms;
+    results.average /= static_cast<double>( times.size() );
+    std::sort( times.begin(), times.end() );
+    results.p50 = percentile( times, 0.5 );
+    results.p90 = percentile( times, 0.9 );
+    results.p99 = percentile( times, 0.99 );
+    results.worst = times.back();
+
+    Locator::console().printf( srcGfx,
+      "Benchmark %s x%d, %zu frames: avg %.3fms, p50 %.3fms, p90 %.3fms, p99 %.3fms, max %.3fms",
+      c_sceneNames[settings_.scene], settings_.count, times.size(), results.average, results.p50, results.p90,
+      results.p99, results.worst );
+
+    // Machine readable copy for tracking results across builds
+    nlohmann::json report = {
+      { "scene", c_sceneNames[settings_.scene] },
+      { "count", settings_.count },
+      { "frames", times.size() },
+      { "average", results.average },
+      { "p50", results.p50 },
+      { "p90", results.p90 },
+      { "p99", results.p99 },
+      { "max", results.worst }
+    };
+    char filename[64];
+    sprintf_s( filename, 64, "bench_%s_%d.json", c_sceneNames[settings_.scene], settings_.count );
+    const auto text = report.dump( 2 );
+    Locator::fileSystem().createFile( Dir_User, filename )->writeBlob( text.data(), static_cast<uint32_t>( text.size() ) );
+
+    return results;
+  }
+
+  static void concmdBenchmarkRender( Console* console, ConCmd* command, StringVector& arguments )
+  {
+    RenderBenchmark::Settings settings;
+    if ( arguments.size() < 2 )
+    {
+      console->print( srcGfx, "Format: bench_render sprites|texts|primitives|paintables [count] [frames] [dump]" );
+      return;
+    }
+    int scene = 0;
+    while ( scene < RenderBenchmark::MAX_Scene && arguments[1] != RenderBenchmark::c_sceneNames[scene] )
+      ++scene;
+    if ( scene == RenderBenchmark::MAX_Scene )
+    {
+      console->printf( srcGfx, "Unknown benchmark scene %s", arguments[1].c_str() );
+      return;
+    }
+    settings.scene = static_cast<RenderBenchmark::Scene>( scene );
+    if ( arguments.size() > 2 )
+      settings.count = math::max( 1, atoi( arguments[2].c_str() ) );
+    if ( arguments.size() > 3 )
+      settings.frames = math::max( 1, atoi( arguments[3].c_str() ) );
+    if ( arguments.size() > 4 )
+      settings.dump = ( atoi( arguments[4].c_str() ) != 0 );
+    RenderBenchmark::request( settings );
+  }
+
+}
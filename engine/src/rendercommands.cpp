@@ -0,0 +1,312 @@
+#include "pch.h"
+#include "locator.h"
+#include "rendercommands.h"
+#include "shaders.h"
+#include "neko_exception.h"
+#include "console.h"
+
+namespace neko {
+
+  using namespace gl;
+
+  static void concmdBenchmarkCommands( Console* console, ConCmd* command, StringVector& arguments );
+
+  NEKO_DECLARE_CONCMD( dbg_cmdbench,
+    "Record, sort & validate a synthetic render command list without touching the GPU. Format: dbg_cmdbench [count]",
+    concmdBenchmarkCommands );
+
+  // RenderCommandList
+
+  uint64_t RenderCommandList::makeKey( RenderPass pass, uint16_t pipeline, uint16_t material, Real depth )
+  {
+    constexpr uint64_t pipelineMask = ( 1ull << c_pipelineBits ) - 1;
+    auto key = static_cast<uint64_t>( pass ) << ( 64 - c_passBits );
+    if ( pass == RenderPass_Transparent )
+    {
+      // Back to front: the furthest draws get the smallest keys
+      key |= static_cast<uint64_t>( ~depthBits( depth ) ) << ( c_pipelineBits + c_materialBits );
+      key |= ( pipeline & pipelineMask ) << c_materialBits;
+      key |= material;
+    }
+    else
+    {
+      key |= ( pipeline & pipelineMask ) << ( c_materialBits + c_depthBits );
+      key |= static_cast<uint64_t>( material ) << c_depthBits;
+      key |= depthBits( depth );
+    }
+    return key;
+  }
+
+  uint16_t RenderCommandList::pipeline( const utf8String& name )
+  {
+    for ( size_t i = 0; i < pipelines_.size(); ++i )
+      if ( pipelines_[i] == name )
+        return static_cast<uint16_t>( i );
+
+    if ( pipelines_.size() >= c_maxPipelines )
+      NEKO_EXCEPT( "Render command list pipeline table is full" );
+
+    pipelines_.push_back( name );
+    return static_cast<uint16_t>( pipelines_.size() - 1 );
+  }
+
+  DrawParams& RenderCommandList::draw( RenderPass pass, uint16_t pipeline, GLuint vao, GLuint texture,
+    GLsizei count, Real depth, bool shortIndices, GLint baseVertex )
+  {
+    assert( pipeline < pipelines_.size() );
+
+    DrawCommand cmd;
+    // Texture names are small sequential integers, so the low bits suffice to group by material
+    cmd.key = makeKey( pass, pipeline, static_cast<uint16_t>( texture ), depth );
+    cmd.vao = vao;
+    cmd.texture = texture;
+    cmd.pipeline = pipeline;
+    cmd.shortIndices = shortIndices ? 1 : 0;
+    cmd.count = count;
+    cmd.baseVertex = baseVertex;
+    cmd.params = static_cast<uint32_t>( params_.size() );
+    commands_.push_back( cmd );
+
+    sorted_ = false;
+    return params_.emplace_back();
+  }
+
+  void RenderCommandList::sort()
+  {
+    order_.resize( commands_.size() );
+    for ( size_t i = 0; i < commands_.size(); ++i )
+    {
+      order_[i].key = commands_[i].key;
+      order_[i].index = static_cast<uint32_t>( i );
+    }
+    radix::sort( order_, scratch_ );
+    sorted_ = true;
+  }
+
+  void RenderCommandList::clear()
+  {
+    commands_.clear();
+    params_.clear();
+    order_.clear();
+    sorted_ = true;
+  }
+
+  pair<size_t, size_t> RenderCommandList::passRange( RenderPass pass ) const
+  {
+    assert( sorted_ );
+    const auto lower = static_cast<uint64_t>( pass ) << ( 64 - c_passBits );
+    const auto upper = static_cast<uint64_t>( pass + 1 ) << ( 64 - c_passBits );
+    auto first = std::lower_bound( order_.begin(), order_.end(), lower,
+      []( const SortEntry& entry, uint64_t key ) { return entry.key < key; } );
+    auto last = std::lower_bound( first, order_.end(), upper,
+      []( const SortEntry& entry, uint64_t key ) { return entry.key < key; } );
+    return { static_cast<size_t>( first - order_.begin() ), static_cast<size_t>( last - order_.begin() ) };
+  }
+
+  // RenderBackend
+
+  void RenderBackend::execute( const RenderCommandList& list, RenderPass pass )
+  {
+    assert( list.sorted() );
+    const auto [first, last] = list.passRange( pass );
+    if ( first == last )
+      return;
+
+    beginPass( pass );
+
+    const DrawCommand* previous = nullptr;
+    for ( size_t i = first; i < last; ++i )
+    {
+      const auto& cmd = list.sortedCommand( i );
+      bool batch = !previous;
+      if ( !previous || cmd.pipeline != previous->pipeline )
+      {
+        bindPipeline( list, cmd.pipeline );
+        stats_.pipelineChanges++;
+        batch = true;
+      }
+      if ( !previous || cmd.vao != previous->vao )
+      {
+        bindVao( cmd.vao );
+        stats_.vaoChanges++;
+        batch = true;
+      }
+      if ( !previous || cmd.texture != previous->texture )
+      {
+        bindTexture( cmd.texture );
+        stats_.textureChanges++;
+        batch = true;
+      }
+      if ( batch )
+        stats_.batches++;
+      submit( list, cmd, list.params( cmd ) );
+      stats_.draws++;
+      previous = &cmd;
+    }
+
+    endPass( pass );
+  }
+
+  // GLRenderBackend
+
+  static_assert( sizeof( uniforms::DrawData ) == 80, "DrawData must match its std430 layout" );
+
+  GLRenderBackend::GLRenderBackend( Shaders& shaders, PassStateCallback passState ):
+  shaders_( shaders ), passState_( move( passState ) )
+  {
+  }
+
+  void GLRenderBackend::upload( const RenderCommandList& list )
+  {
+    const auto count = list.paramsCount();
+    if ( !count )
+    {
+      draws_ = {};
+      return;
+    }
+
+    auto data = shaders_.stream().allocate<uniforms::DrawData>( count, draws_ );
+    for ( size_t i = 0; i < count; ++i )
+    {
+      const auto& params = list.params( i );
+      data[i].model = params.model;
+      data[i].texDimensions = params.textureDimensions;
+      data[i].posScale = params.positionScale;
+      data[i].texLayer = params.textureLayer;
+    }
+  }
+
+  void GLRenderBackend::beginPass( RenderPass pass )
+  {
+    if ( passState_ )
+      passState_( pass );
+    if ( draws_.size )
+      shaders_.state().bindBufferRange( GL_SHADER_STORAGE_BUFFER, c_drawBufferBinding, draws_.buffer, draws_.offset,
+        draws_.size );
+    pipeline_ = nullptr;
+  }
+
+  void GLRenderBackend::bindPipeline( const RenderCommandList& list, uint16_t pipeline )
+  {
+    pipeline_ = &shaders_.usePipeline( list.pipelineName( pipeline ) );
+    pipeline_->setUniform( Uniform_Tex, 0 );
+  }
+
+  void GLRenderBackend::bindVao( GLuint vao )
+  {
+    shaders_.state().bindVertexArray( vao );
+  }
+
+  void GLRenderBackend::bindTexture( GLuint texture )
+  {
+    shaders_.state().bindTextureUnit( 0, texture );
+  }
+
+  void GLRenderBackend::submit( const RenderCommandList& list, const DrawCommand& cmd, const DrawParams& params )
+  {
+    assert( pipeline_ );
+    const auto type = ( cmd.shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT );
+    if ( pipeline_->drawBuffer() )
+    {
+      assert( ( cmd.params + 1 ) * sizeof( uniforms::DrawData ) <= static_cast<size_t>( draws_.size ) );
+      // A single instance, whose base instance the shader uses to index the draw buffer
+      glDrawElementsInstancedBaseVertexBaseInstance( GL_TRIANGLES, cmd.count, type, nullptr, 1, cmd.baseVertex,
+        cmd.params );
+      return;
+    }
+    pipeline_->setUniform( Uniform_Model, params.model );
+    if ( params.flags & DrawParam_TextureLayer )
+      pipeline_->setUniform( Uniform_TexLayer, params.textureLayer );
+    if ( params.flags & DrawParam_TextureDimensions )
+      pipeline_->setUniform( Uniform_TexDimensions, params.textureDimensions );
+    if ( params.flags & DrawParam_PositionScale )
+      pipeline_->setUniform( Uniform_PositionScale, params.positionScale );
+    glDrawElementsBaseVertex( GL_TRIANGLES, cmd.count, type, nullptr, cmd.baseVertex );
+  }
+
+  void GLRenderBackend::endPass( RenderPass pass )
+  {
+    pipeline_ = nullptr;
+  }
+
+  // NullRenderBackend
+
+  void NullRenderBackend::error( const char* what, const DrawCommand& cmd )
+  {
+    // Don't flood the console when a whole list is broken
+    if ( stats_.errors++ < 8 )
+      Locator::console().printf( srcGfx, "Render command validation: %s (key 0x%016llx)", what, cmd.key );
+  }
+
+  void NullRenderBackend::beginPass( RenderPass pass )
+  {
+    lastKey_ = 0;
+  }
+
+  void NullRenderBackend::bindPipeline( const RenderCommandList& list, uint16_t pipeline )
+  {
+  }
+
+  void NullRenderBackend::bindVao( GLuint vao )
+  {
+  }
+
+  void NullRenderBackend::bindTexture( GLuint texture )
+  {
+  }
+
+  void NullRenderBackend::submit( const RenderCommandList& list, const DrawCommand& cmd, const DrawParams& params )
+  {
+    if ( !validate_ )
+      return;
+    if ( cmd.key < lastKey_ )
+      error( "command out of order", cmd );
+    if ( cmd.pipeline >= list.pipelineCount() )
+      error( "unknown pipeline", cmd );
+    if ( !cmd.vao )
+      error( "no vertex array", cmd );
+    if ( cmd.count <= 0 )
+      error( "empty draw", cmd );
+    if ( cmd.params >= list.paramsCount() )
+      error( "parameters out of range", cmd );
+    lastKey_ = cmd.key;
+  }
+
+  // Benchmark
+
+  static void concmdBenchmarkCommands( Console* console, ConCmd* command, StringVector& arguments )
+  {
+    size_t count = 100000;
+    if ( arguments.size() > 1 )
+      count = static_cast<size_t>( math::max( 1, atoi( arguments[1].c_str() ) ) );
+
+    // A plausible scene: a few pipelines, more materials, most draws opaque
+    RenderCommandList list;
+    const uint16_t pipelines[3] = { list.pipeline( "mat_unlit" ), list.pipeline( "sprite" ), list.pipeline( "text3d" ) };
+    std::mt19937 rng( 1 );
+    std::uniform_real_distribution<Real> depths( 0.1f, 100.0f );
+
+    const auto started = chrono::steady_clock::now();
+    for ( size_t i = 0; i < count; ++i )
+    {
+      const auto pass = ( i % 4 == 0 ) ? RenderPass_Transparent : RenderPass_Opaque;
+      auto& params = list.draw( pass, pipelines[rng() % 3], 1 + rng() % 64, 1 + rng() % 32, 6, depths( rng ) );
+      params.flags = DrawParam_TextureLayer;
+    }
+    const auto recorded = chrono::steady_clock::now();
+    list.sort();
+    const auto sorted = chrono::steady_clock::now();
+    NullRenderBackend backend;
+    for ( int pass = 0; pass < MAX_RenderPass; ++pass )
+      backend.execute( list, static_cast<RenderPass>( pass ) );
+    const auto executed = chrono::steady_clock::now();
+
+    using ms = chrono::duration<double, std::milli>;
+    const auto& stats = backend.stats();
+    console->printf( srcGfx, "Render commands: %zu draws, record %.3fms, sort %.3fms, execute %.3fms", stats.draws,
+      ms( recorded - started ).count(), ms( sorted - recorded ).count(), ms( executed - sorted ).count() );
+    console->printf( srcGfx, "Render commands: %zu batches, %zu pipeline, %zu vao & %zu texture changes, %zu errors",
+      stats.batches, stats.pipelineChanges, stats.vaoChanges, stats.textureChanges, stats.errors );
+  }
+
+}
@@ -13,7 +13,9 @@
 #include "math_aabb.h"
 #include "filesystem.h"
 #include "spriteanim.h"
+#include "model.h"
 #include "frustum.h"
+#include "profiler.h"
 
 namespace neko {
 
@@ -277,10 +279,14 @@ namespace neko {
   {
     clearErrors();
 
-    shaders_ = make_shared<Shaders>( console_ );
+    stream_ = make_unique<StreamBuffer>();
+    shaders_ = make_shared<Shaders>( console_, state_, *stream_ );
     shaders_->initialize();
+    backend_ = make_unique<GLRenderBackend>( *shaders_ );
+    frustumViz_ = make_unique<LineRenderBuffer<24>>();
 
     materials_ = make_shared<MaterialManager>( this, loader_ );
+    streamer_ = make_unique<TextureStreamer>( this );
 
     // texts_ = make_shared<TextManager>( fonts_, console_ );
 
@@ -301,6 +307,7 @@ namespace neko {
 
     particles_ = make_shared<ParticleSystemManager>();
     sprites_ = make_shared<SpriteManager>( this );
+    models_ = make_shared<ModelManager>( loader_ );
   }
 
   TexturePtr Renderer::loadPNGTexture( const utf8String& filepath, Texture::Wrapping wrapping, Texture::Filtering filtering )
@@ -324,7 +331,9 @@ namespace neko {
 
     sprites_->initialize();
     sprites_->loadAnimdefFile( R"(spriteanimdefs.json)" );
-    sprites_->loadAnimsetFile( R"(spriteanimsets.json)" );
+    if ( !sprites_->loadAtlasFile( R"(spriteatlas.bin)",
+      SpriteManager::hashSources( { R"(spriteanimdefs.json)", R"(spriteanimsets.json)" } ) ) )
+      sprites_->loadAnimsetFile( R"(spriteanimsets.json)" );
 
     if ( g_CVar_vid_msaa.as_i() > 1 )
       ctx_.fboMainMultisampled_ = make_unique<Framebuffer>( this, 2, c_bufferFormat, true, g_CVar_vid_msaa.as_i() );
@@ -349,44 +358,13 @@ namespace neko {
     loader_->getFinishedMaterials( mats );
     if ( !mats.empty() )
       console_->printf( srcGfx, "Renderer::uploadTextures got %d new materials", mats.size() );
-    for ( auto& mat : mats )
-    {
-      if ( !mat->loaded() )
-        continue;
-      for ( auto& layer : mat->layers_ )
-      {
-        assert( layer.hasHostCopy() );
-        if ( mat->arrayDepth_ == 1 )
-        {
-          layer.texture_ = make_shared<Texture>(
-            this,
-            layer.image_.width(),
-            layer.image_.height(),
-            layer.image_.format(),
-            layer.image_.data().data(),
-            mat->wantWrapping_,
-            mat->wantFiltering_ );
-        }
-        else
-        {
-          layer.texture_ = make_shared<Texture>(
-            this,
-            mat->width_,
-            mat->height_,
-            mat->arrayDepth_,
-            layer.image_.format(),
-            layer.image_.data().data(),
-            mat->wantWrapping_,
-            mat->wantFiltering_ );
-        }
-        layer.deleteHostCopy();
-      }
-    }
+    streamer_->add( mats );
+    streamer_->update();
   }
 
-  void Renderer::update( SManager& scene, GameTime delta, GameTime time )
+  void Renderer::update( SManager& scene, GameTime delta, GameTime time, Real interpolation )
   {
-    // Upload any new textures. Could this be parallellized?
+    // Upload new textures and stream the rest by last frame's usage
     uploadTextures();
 
     scene.primitives().update();
@@ -395,15 +373,16 @@ namespace neko {
     fonts_->update();
     fonts_->prepareRender();
     sprites_->prepareRender( *loader_ );
+    models_->update();
 
-    scene.sprites().update( *materials_ );
+    scene.sprites().update( *materials_, *sprites_ );
     scene.paintables().update( *this );
 
 #ifndef NEKO_NO_SCRIPTING
     //texts_->jsUpdate( director_->renderSync() );
 #endif
 
-    particles_->update( delta, time );
+    particles_->update( delta, time, interpolation );
   }
 
   void Renderer::jsRestart()
@@ -445,9 +424,10 @@ namespace neko {
     auto material = materials_->get( name );
     if ( !material || !material->uploaded() )
     {
-      glBindTextures( 0, 4, empties );
+      state_.bindTextures( 0, 4, empties );
       return shaders_->usePipeline( "mat_unlit" );
     }
+    streamer_->noteUsage( *material, 0.0f );
     if ( material->type_ == Material::UnlitSimple )
     {
       GLuint units[4] = {
@@ -455,13 +435,17 @@ namespace neko {
         material->layers_[0].texture_->handle(),
         material->layers_[0].texture_->handle(),
         material->layers_[0].texture_->handle() };
-      glBindTextures( 0, 4, units );
+      state_.bindTextures( 0, 4, units );
       auto& pipeline = shaders_->usePipeline( "mat_unlit" );
-      pipeline.setUniform( "tex", 0 );
+      pipeline.setUniform( Uniform_Tex, 0 );
       return pipeline;
     }
     if ( material->type_ == Material::WorldParticle )
     {
+      state_.bindTextureUnit( 0, material->layers_[0].texture_->handle() );
+      auto& pipeline = shaders_->usePipeline( "particle_billboard" );
+      pipeline.setUniform( Uniform_Tex, 0 );
+      return pipeline;
     }
     return shaders_->usePipeline( "mat_unlit" );
   }
@@ -477,36 +461,31 @@ namespace neko {
     uniform.exposure = camera.exposure();
   }
 
-  void setGLDrawState( bool depthtest, bool depthwrite, bool facecull, bool wireframe )
+  void setGLDrawState( GLStateCache& state, bool depthtest, bool depthwrite, bool facecull, bool wireframe )
   {
-    glDisable( GL_SCISSOR_TEST );
-    glDisable( GL_STENCIL_TEST );
+    state.enable( GLStateCache::Cap_ScissorTest, false );
+    state.enable( GLStateCache::Cap_StencilTest, false );
 
-    glDepthFunc( GL_LESS );
+    state.depthFunc( GL_LESS );
 
-    if ( depthtest )
-      glEnable( GL_DEPTH_TEST );
-    else
-      glDisable( GL_DEPTH_TEST );
-    glDepthMask( depthwrite ? GL_TRUE : GL_FALSE );
+    state.enable( GLStateCache::Cap_DepthTest, depthtest );
+    state.depthMask( depthwrite );
 
-    glPolygonMode( GL_FRONT_AND_BACK, wireframe ? GL_LINE : GL_FILL );
+    state.polygonMode( wireframe ? GL_LINE : GL_FILL );
 
-    glEnable( GL_BLEND );
+    state.enable( GLStateCache::Cap_Blend, true );
     // glBlendFuncSeparate( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE_MINUS_DST_ALPHA, GL_ONE );
-    glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+    state.blendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
 
-    glDisable( GL_LINE_SMOOTH );
-    glDisable( GL_POLYGON_SMOOTH );
+    state.enable( GLStateCache::Cap_LineSmooth, false );
+    state.enable( GLStateCache::Cap_PolygonSmooth, false );
 
+    state.enable( GLStateCache::Cap_CullFace, facecull );
     if ( facecull )
     {
-      glEnable( GL_CULL_FACE );
-      glCullFace( GL_BACK );
-      glFrontFace( GL_CCW );
+      state.cullFace( GL_BACK );
+      state.frontFace( GL_CCW );
     }
-    else
-      glDisable( GL_CULL_FACE );
   }
 
   void Renderer::prepareSceneDraw( GameTime time, Camera& camera, const ViewportDrawParameters& drawparams )
@@ -514,15 +493,12 @@ namespace neko {
     camera.exposure( drawparams.drawopExposure() );
 
     {
-      auto world = shaders_->world()->lock().data();
-      world->time = (float)time;
-      setCameraUniforms( camera, world->camera );
-      for ( auto& pointLight : world->pointLights )
-        pointLight.dummy = vec4( 0.0f );
-      shaders_->world()->unlock();
+      auto& world = shaders_->writeWorld();
+      world.time = (float)time;
+      setCameraUniforms( camera, world.camera );
     }
 
-    setGLDrawState( true, true, true, drawparams.drawopShouldDrawWireframe() );
+    setGLDrawState( state_, true, true, true, drawparams.drawopShouldDrawWireframe() );
   }
 
   void Renderer::prepareSceneDraw( GameTime time, const ViewportDrawParameters& drawparams )
@@ -531,15 +507,12 @@ namespace neko {
     camera->exposure( drawparams.drawopExposure() );
 
     {
-      auto world = shaders_->world()->lock().data();
-      world->time = (float)time;
-      setCameraUniforms( *camera, world->camera );
-      for ( auto& pointLight : world->pointLights )
-        pointLight.dummy = vec4( 0.0f );
-      shaders_->world()->unlock();
+      auto& world = shaders_->writeWorld();
+      world.time = (float)time;
+      setCameraUniforms( *camera, world.camera );
     }
 
-    setGLDrawState( true, true, true, drawparams.drawopShouldDrawWireframe() );
+    setGLDrawState( state_, true, true, true, drawparams.drawopShouldDrawWireframe() );
   }
 
   inline vec2 toScreen( const vec3& pt, const mat4& model, const ViewportDrawParameters& dp )
@@ -590,10 +563,9 @@ namespace neko {
     }
   }
 
-  inline void visualizeFrustum( const Camera& cam, Shaders& shdr )
+  inline void visualizeFrustum( const Camera& cam, Shaders& shdr, LineRenderBuffer<24>& vizbuf )
   {
-    LineRenderBuffer<24> vizbuf;
-    auto verts = vizbuf.buffer().lock();
+    auto verts = vizbuf.lock( shdr.stream() );
     const auto color = vec4( 1.0f, 0.0f, 0.0f, 1.0f );
 
     for ( size_t i = 0; i < 24; ++i )
@@ -602,17 +574,19 @@ namespace neko {
     size_t i = 0;
     cam.frustum().feedVertsTo( verts, i );
 
-    vizbuf.buffer().unlock();
     auto ppl = &shdr.usePipeline( "dbg_line" );
-    vizbuf.draw( *ppl, cam.model(), 24, 0, gl::GL_LINES );
+    vizbuf.draw( shdr.state(), *ppl, cam.model(), 24, 0, gl::GL_LINES );
   }
 
   void Renderer::sceneDraw( GameTime time, SManager& scene, Camera& camera, const ViewportDrawParameters& drawparams,
     const RenderVisualizations& vis, bool showVis )
   {
+    NEKO_PROFILE_FUNCTION();
+    NEKO_PROFILE_GPU( "Scene" );
+
     auto wire = ( drawparams.drawopShouldDrawWireframe() );
 
-    setGLDrawState( true, true, true, wire );
+    setGLDrawState( state_, true, true, true, wire );
 
     drawSceneRecurse( scene, camera, drawparams, vis, showVis, scene.root() );
 
@@ -622,10 +596,10 @@ namespace neko {
         continue;
 
       if ( vis.frustums && showVis )
-        visualizeFrustum( *cm.second.instance, *shaders_ );
+        visualizeFrustum( *cm.second.instance, *shaders_, *frustumViz_ );
     }
 
-    glEnable( GL_LINE_SMOOTH );
+    state_.enable( GLStateCache::Cap_LineSmooth, true );
 
     #if 0
     if ( g_CVar_dbg_shownormals.as_b() )
@@ -645,18 +619,37 @@ namespace neko {
     }
     #endif
 
-    glDisable( GL_LINE_SMOOTH );
+    state_.enable( GLStateCache::Cap_LineSmooth, false );
+
+    // Solids first (with depth writes), transparents back to front afterwards (without depth writes)
+    {
+      NEKO_PROFILE_SCOPE( "Record commands" );
+      commands_.clear();
+      scene.primitives().record( commands_, camera, *builtin_.placeholderTexture_ );
+      scene.sprites().record( commands_, camera );
+      scene.texts().record( commands_, camera );
+      commands_.sort();
+    }
+
+    backend_->passState( [this, wire]( RenderPass pass ) {
+      setGLDrawState( state_, true, pass == RenderPass_Opaque, false, wire );
+    } );
+    backend_->upload( commands_ );
 
-    // TODO at some point this primitive stuff has to be replaced with proper
-    // scene graph traversal, and sorting to solids first (with depth writes),
-    // transparents afterwards (without depth writes)
-    setGLDrawState( true, true, false, wire );
-    scene.primitives().draw( *shaders_, *builtin_.placeholderTexture_ );
-    setGLDrawState( true, false, false, wire );
-    particles_->draw( *shaders_, *materials_ );
-    scene.paintables().draw( *this, camera );
-    scene.sprites().draw( *this, camera );
-    scene.texts().draw( *this );
+    {
+      NEKO_PROFILE_GPU( "Opaque pass" );
+      backend_->execute( commands_, RenderPass_Opaque );
+    }
+    setGLDrawState( state_, true, false, false, wire );
+    {
+      NEKO_PROFILE_GPU( "Particles & paintables" );
+      particles_->draw( *this, camera );
+      scene.paintables().draw( *this, camera );
+    }
+    {
+      NEKO_PROFILE_GPU( "Transparent pass" );
+      backend_->execute( commands_, RenderPass_Transparent );
+    }
   }
 
   void Renderer::implClearAndPrepare( const vec3& color )
@@ -664,26 +657,26 @@ namespace neko {
     // set the clear color
     glClearColor( color.x, color.y, color.z, 1.0f );
     // enable depth writes or there is no depth clearing
-    glDepthMask( TRUE );
+    state_.depthMask( true );
     // reset depth func
-    glDepthFunc( GL_LESS );
+    state_.depthFunc( GL_LESS );
     // finally, clear buffers
     glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
   }
 
   void Renderer::bindVao( GLuint id )
   {
-    glBindVertexArray( id );
+    state_.bindVertexArray( id );
   }
 
   void Renderer::bindTexture( GLuint unit, TexturePtr texture )
   {
-    glBindTextureUnit( unit, texture->handle() );
+    state_.bindTextureUnit( unit, texture->handle() );
   }
 
   void Renderer::bindTextures( const vector<GLuint>& textures, GLuint firstUnit )
   {
-    glBindTextures( firstUnit, static_cast<GLsizei>( textures.size() ), textures.data() );
+    state_.bindTextures( firstUnit, static_cast<GLsizei>( textures.size() ), textures.data() );
   }
 
   void Renderer::bindTextures( const vector<TexturePtr>& textures, GLuint firstUnit )
@@ -691,41 +684,44 @@ namespace neko {
     vector<GLuint> handles( textures.size(), 0 );
     for ( size_t i = 0; i < textures.size(); ++i )
       handles[i] = textures[i]->handle();
-    glBindTextures( firstUnit, static_cast<GLsizei>( handles.size() ), handles.data() );
+    state_.bindTextures( firstUnit, static_cast<GLsizei>( handles.size() ), handles.data() );
   }
 
   void Renderer::bindTextureUnits( const vector<GLuint>& textures )
   {
     for ( GLuint i = 0; i < textures.size(); ++i )
-      glBindTextureUnit( i, textures[i] );
+      state_.bindTextureUnit( i, textures[i] );
   }
 
   void Renderer::bindImageTexture( GLuint unit, TexturePtr texture, int level, GLenum access )
   {
-    glBindImageTexture( unit, texture->handle(), level, GL_FALSE, 0, access, texture->internalFormat() );
+    state_.bindImageTexture( unit, texture->handle(), level, GL_FALSE, 0, access, texture->internalFormat() );
   }
 
   void Renderer::resetFbo()
   {
-    glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+    state_.bindFramebuffer( 0 );
   }
 
   void Renderer::drawGame( GameTime time, SManager& scene, Camera& camera, const Viewport* viewport,
     const ViewportDrawParameters& params, const RenderVisualizations& vis, bool showVis )
   {
+    NEKO_PROFILE_FUNCTION();
     if ( !ctx_.ready() )
       return;
 
+    // Resources may have been destroyed and their names reused since the last draw
+    state_.invalidate();
+
     if ( viewport )
       viewport->begin();
 
     {
-      auto processing = shaders_->processing()->lock().data();
-      processing->ambient = vec4( 0.04f, 0.04f, 0.04f, 1.0f );
-      processing->gamma = g_CVar_vid_gamma.as_f();
-      processing->resolution = resolution_;
-      processing->textproj = glm::ortho( 0.0f, resolution_.x, resolution_.y, 0.0f );
-      shaders_->processing()->unlock();
+      auto& processing = shaders_->writeProcessing();
+      processing.ambient = vec4( 0.04f, 0.04f, 0.04f, 1.0f );
+      processing.gamma = g_CVar_vid_gamma.as_f();
+      processing.resolution = resolution_;
+      processing.textproj = glm::ortho( 0.0f, resolution_.x, resolution_.y, 0.0f );
     }
 
     bindVao( builtin_.emptyVAO_ );
@@ -745,17 +741,17 @@ namespace neko {
       main->end();
     }
 
-    glDisable( GL_DEPTH_TEST );
-    glDisable( GL_CULL_FACE );
-    glDisable( GL_MULTISAMPLE );
-    glDisable( GL_STENCIL_TEST );
+    state_.enable( GLStateCache::Cap_DepthTest, false );
+    state_.enable( GLStateCache::Cap_CullFace, false );
+    state_.enable( GLStateCache::Cap_Multisample, false );
+    state_.enable( GLStateCache::Cap_StencilTest, false );
 
     // Smoothing can generate sub-fragments and cause visible ridges between triangles.
     // Use a framebuffer for AA instead.
-    glDisable( GL_LINE_SMOOTH );
-    glDisable( GL_POLYGON_SMOOTH );
+    state_.enable( GLStateCache::Cap_LineSmooth, false );
+    state_.enable( GLStateCache::Cap_PolygonSmooth, false );
 
-    glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );
+    state_.polygonMode( GL_FILL );
 
     if ( main != ctx_.fboMain_ )
     {
@@ -767,11 +763,11 @@ namespace neko {
     {
       ctx_.mergedMain_->prepare( 0, { 0 } );
       ctx_.mergedMain_->begin();
-      setGLDrawState( false, false, false, false );
+      setGLDrawState( state_, false, false, false, false );
       auto& pipeline = shaders_->usePipeline( "mainframebuf2d" );
-      pipeline.setUniform( "tex", 0 );
+      pipeline.setUniform( Uniform_Tex, 0 );
       bindTextures( main->textures() );
-      builtin_.screenQuad_->begin();
+      builtin_.screenQuad_->begin( state_ );
       builtin_.screenQuad_->draw();
       ctx_.mergedMain_->end();
     }
@@ -781,12 +777,12 @@ namespace neko {
     // Draw the merged buffer in full quad
     if ( viewport )
     {
-      setGLDrawState( false, false, false, false );
+      setGLDrawState( state_, false, false, false, false );
       auto& pipeline = shaders_->usePipeline( "passthrough2d" );
-      pipeline.setUniform( "tex", 0 );
+      pipeline.setUniform( Uniform_Tex, 0 );
       const GLuint hndl = ctx_.mergedMain_->texture( 0 )->handle();
-      glBindTextures( 0, 1, &hndl );
-      builtin_.screenQuad_->begin();
+      state_.bindTextures( 0, 1, &hndl );
+      builtin_.screenQuad_->begin( state_ );
       builtin_.screenQuad_->draw();
     }
 
@@ -800,25 +796,29 @@ namespace neko {
   void Renderer::draw( GameTime time, SManager& scene, Camera& camera, const ViewportDrawParameters& drawparams,
     const RenderVisualizations& vis, bool showVis, Indexed2DVertexBuffer* viewportQuad )
   {
+    NEKO_PROFILE_FUNCTION();
     // check that the drawcontext is ready (fbo's available etc)
     if ( !ctx_.ready() )
       return;
 
+    // Resources may have been destroyed and their names reused since the last draw
+    state_.invalidate();
+
     GLint previousViewport[4];
     glGetIntegerv( GL_VIEWPORT, previousViewport );
     glViewport( 0, 0, static_cast<GLsizei>( drawparams.drawopFullResolution().x ),
       static_cast<GLsizei>( drawparams.drawopFullResolution().y ) );
-    glDisable( GL_SCISSOR_TEST );
+    state_.enable( GLStateCache::Cap_ScissorTest, false );
 
     // Default to empty VAO, since not having a bound VAO is illegal as per 4.5 spec
-    glBindVertexArray( builtin_.emptyVAO_ );
+    state_.bindVertexArray( builtin_.emptyVAO_ );
 
     {
-      auto processing = shaders_->processing()->lock().data();
-      processing->ambient = vec4( 0.0f, 0.0f, 0.0f, 1.0f );
-      processing->gamma = g_CVar_vid_gamma.as_f();
-      processing->resolution = resolution_;
-      shaders_->processing()->unlock();
+      auto& processing = shaders_->writeProcessing();
+      processing.ambient = vec4( 0.0f, 0.0f, 0.0f, 1.0f );
+      processing.gamma = g_CVar_vid_gamma.as_f();
+      processing.resolution = resolution_;
+      processing.textproj = glm::ortho( 0.0f, resolution_.x, resolution_.y, 0.0f );
     }
 
     {
@@ -847,28 +847,28 @@ namespace neko {
 
     // implClearAndPrepare(); // 2 - clear the window
 
-    glDisable( GL_DEPTH_TEST );
-    glDisable( GL_CULL_FACE );
-    glDisable( GL_MULTISAMPLE );
-    glDisable( GL_STENCIL_TEST );
+    state_.enable( GLStateCache::Cap_DepthTest, false );
+    state_.enable( GLStateCache::Cap_CullFace, false );
+    state_.enable( GLStateCache::Cap_Multisample, false );
+    state_.enable( GLStateCache::Cap_StencilTest, false );
 
     // Smoothing can generate sub-fragments and cause visible ridges between triangles.
     // Use a framebuffer for AA instead.
-    glDisable( GL_LINE_SMOOTH );
-    glDisable( GL_POLYGON_SMOOTH );
+    state_.enable( GLStateCache::Cap_LineSmooth, false );
+    state_.enable( GLStateCache::Cap_PolygonSmooth, false );
 
-    glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );
+    state_.polygonMode( GL_FILL );
 
     // Early out - if dbg_showdepth is enabled, just show the main depth buffer
     if ( g_CVar_dbg_showdepth.as_b() && drawparams.drawopShouldDoBufferVisualizations() )
     {
-      setGLDrawState( false, false, false, false );
+      setGLDrawState( state_, false, false, false, false );
       auto& pipeline = shaders_->usePipeline( "dbg_depthvis2d" );
-      pipeline.setUniform( "tex", 0 );
+      pipeline.setUniform( Uniform_Tex, 0 );
       GLuint handle =
         ( ctx_.fboMainMultisampled_ ? ctx_.fboMainMultisampled_->depth()->handle() : ctx_.fboMain_->depth()->handle() );
-      viewportQuad->begin();
-      glBindTextures( 0, 1, &handle );
+      viewportQuad->begin( state_ );
+      state_.bindTextures( 0, 1, &handle );
       viewportQuad->draw();
       return;
     }
@@ -883,27 +883,27 @@ namespace neko {
     {
       ctx_.mergedMain_->prepare( 0, { 0 } );
       ctx_.mergedMain_->begin();
-      setGLDrawState( false, false, false, false );
+      setGLDrawState( state_, false, false, false, false );
       auto& pipeline = shaders_->usePipeline( "mainframebuf2d" );
-      pipeline.setUniform( "tex", 0 );
-      builtin_.screenQuad_->begin();
+      pipeline.setUniform( Uniform_Tex, 0 );
+      builtin_.screenQuad_->begin( state_ );
       const GLuint hndl = ctx_.fboMain_->texture( 0 )->handle();
-      glBindTextures( 0, 1, &hndl );
+      state_.bindTextures( 0, 1, &hndl );
       builtin_.screenQuad_->draw();
       ctx_.mergedMain_->end();
     }
 
-    glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+    state_.bindFramebuffer( 0 );
 
     // Draw the merged buffer in full quad
     if ( true )
     {
-      setGLDrawState( false, false, false, false );
+      setGLDrawState( state_, false, false, false, false );
       auto& pipeline = shaders_->usePipeline( "passthrough2d" );
-      pipeline.setUniform( "tex", 0 );
-      viewportQuad->begin();
+      pipeline.setUniform( Uniform_Tex, 0 );
+      viewportQuad->begin( state_ );
       const GLuint hndl = ctx_.mergedMain_->texture( 0 )->handle();
-      glBindTextures( 0, 1, &hndl );
+      state_.bindTextures( 0, 1, &hndl );
       viewportQuad->draw();
     }
 
@@ -911,12 +911,15 @@ namespace neko {
 
 #ifndef NEKO_NO_GUI
     if ( gui )
+    {
       gui->getRenderManagerPtr()->drawOneFrame( shaders_.get() );
+      state_.invalidate();
+    }
 #endif
 
-    glBindTextureUnit( 0, 0 );
-    glBindTextureUnit( 1, 0 );
-    glBindVertexArray( builtin_.emptyVAO_ );
+    state_.bindTextureUnit( 0, 0 );
+    state_.bindTextureUnit( 1, 0 );
+    state_.bindVertexArray( builtin_.emptyVAO_ );
   }
 
   void Renderer::shutdown()
@@ -940,6 +943,8 @@ namespace neko {
 
     sprites_.reset();
 
+    models_.reset();
+
     ctx_.mergedMain_.reset();
     ctx_.fboMain_.reset();
     ctx_.fboMainMultisampled_.reset();
@@ -948,10 +953,15 @@ namespace neko {
     //texts_->teardown();
 #endif
 
+    streamer_.reset();
     materials_.reset();
 
+    frustumViz_.reset();
+    backend_.reset();
+    Profiler::gpuShutdown();
     shaders_->shutdown();
     shaders_.reset();
+    stream_.reset();
 
     if ( builtin_.emptyVAO_ )
       glDeleteVertexArrays( 1, &builtin_.emptyVAO_ );
@@ -9,6 +9,7 @@
 # include "console.h"
 # include "locator.h"
 # include "memory.h"
+# include "components.h"
 
 # include "js_console.h"
 # include "js_util.h"
@@ -78,8 +79,10 @@ namespace neko {
   void Scripting::tick( GameTime tick, GameTime time )
   {
     auto scene = global_->renderSync().lockSceneWrite();
+    scene->snapshotTransforms();
     global_->tick( tick, time, *scene );
     global_->process( *scene );
+    engine_->publishTick( time + tick );
     global_->renderSync().unlockSceneWrite();
   }
 
@@ -6,11 +6,35 @@
 #include "memory.h"
 #include "neko_exception.h"
 #include "filesystem.h"
+#include "utilities.h"
 
 namespace neko {
 
   using namespace gl;
 
+  NEKO_DECLARE_CONVAR( gl_programcache, "Whether to cache linked shader program binaries on disk and reuse them on startup.", true );
+
+  static void concmdBenchmarkUniforms( Console* console, ConCmd* command, StringVector& arguments );
+
+  NEKO_DECLARE_CONCMD( dbg_uniformbench,
+    "Compare the CPU cost of per-draw uniform lookup paths, excluding the driver. Format: dbg_uniformbench [draws]",
+    concmdBenchmarkUniforms );
+
+  const char* c_uniformNames[MAX_Uniform] = {
+    "model",
+    "tex",
+    "tex_layer",
+    "tex_dimensions",
+    "posscale"
+  };
+
+  namespace {
+
+    constexpr uint32_t c_programCacheMagic = 0x5043474E; // 'NGCP'
+    constexpr uint32_t c_programCacheVersion = 1;
+
+  }
+
   struct ShaderMapper
   {
     ShaderType type;
@@ -31,7 +55,8 @@ namespace neko {
     { Shader_Task, GL_TASK_SHADER_NV, GL_TASK_SHADER_BIT_NV, "task" }
   };
 
-  Shaders::Shaders( ConsolePtr console ): console_( move( console ) )
+  Shaders::Shaders( ConsolePtr console, GLStateCache& state, StreamBuffer& stream ):
+  console_( move( console ) ), state_( state ), stream_( stream )
   {
   }
 
@@ -43,8 +68,27 @@ namespace neko {
     if ( hasCompiler != GL_TRUE )
       NEKO_EXCEPT( "Shader compiler is not present on this platform" );
 
-    world_ = make_unique<MappedGLBuffer<neko::uniforms::World>>();
-    processing_ = make_unique<MappedGLBuffer<neko::uniforms::Processing>>();
+    // Binaries are only valid for the exact driver that produced them
+    driverKey_ = 0;
+    GLint formats = 0;
+    glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &formats );
+    if ( formats > 0 )
+    {
+      utf8String driver;
+      for ( auto name : { GL_VENDOR, GL_RENDERER, GL_VERSION } )
+      {
+        auto str = glGetString( name );
+        if ( str )
+          driver.append( reinterpret_cast<const char*>( str ) );
+        driver.push_back( '\n' );
+      }
+      driverKey_ = utils::hash64( driver.data(), driver.size() );
+    }
+    else
+      console_->printf( srcGfx, "Driver supports no program binary formats, program cache disabled" );
+
+    writeWorld();
+    writeProcessing();
 
     loadIncludeFile( R"(includes.json)" );
     loadPipelineFile( R"(pipelines.json)" );
@@ -68,6 +112,8 @@ namespace neko {
 
   Program::Program(): id_( 0 ), linked_( false )
   {
+    for ( auto& location : locations_ )
+      location = -1;
     id_ = glCreateProgram();
     if ( id_ == 0 )
       NEKO_EXCEPT( "Program creation failed" );
@@ -112,6 +158,10 @@ namespace neko {
     pipelines_.clear();
     programs_.clear();
     shaders_.clear();
+    includes_.clear();
+    sources_.clear();
+    // Deleted pipeline names may be reused
+    state_.invalidate();
   }
 
   void Shaders::dumpLog( const GLuint& target, const bool isProgram )
@@ -160,6 +210,8 @@ namespace neko {
       NEKO_EXCEPT( "Passed shader is not ready" );
 
     glAttachShader( program.id(), shader.id() );
+    if ( driverKey_ )
+      glProgramParameteri( program.id(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
     glLinkProgram( program.id() );
     glDetachShader( program.id(), shader.id() );
 
@@ -172,62 +224,223 @@ namespace neko {
       NEKO_EXCEPT( "GL program linking failed" );
     }
 
+    resolveUniforms( program, uniforms );
+  }
+
+  void Shaders::resolveUniforms( Program& program, const vector<utf8String>& uniforms )
+  {
     for ( const auto& uni : uniforms )
       program.uniforms_[uni.c_str()] = glGetUniformLocation( program.id(), uni.c_str() );
+
+    for ( int i = 0; i < MAX_Uniform; ++i )
+      program.locations_[i] = glGetUniformLocation( program.id(), c_uniformNames[i] );
   }
 
-  utf8String Shaders::readSource( const utf8String& filename, int includeDepth )
+  // ShaderSource
+
+  namespace {
+
+    inline bool isBlank( char c )
+    {
+      return ( c == ' ' || c == '\t' || c == '\r' );
+    }
+
+    //! Split a line into its preprocessor directive and the rest, or return false if it isn't one.
+    bool readDirective( string_view line, string_view& directive, string_view& rest )
+    {
+      size_t i = 0;
+      while ( i < line.size() && isBlank( line[i] ) )
+        ++i;
+      if ( i == line.size() || line[i] != '#' )
+        return false;
+      ++i;
+      while ( i < line.size() && isBlank( line[i] ) )
+        ++i;
+      const auto start = i;
+      while ( i < line.size() && line[i] >= 'a' && line[i] <= 'z' )
+        ++i;
+      directive = line.substr( start, i - start );
+      while ( i < line.size() && isBlank( line[i] ) )
+        ++i;
+      rest = line.substr( i );
+      return true;
+    }
+
+  }
+
+  void ShaderSource::parse( utf8String contents )
+  {
+    text = move( contents );
+    if ( !text.empty() && text.back() != '\n' )
+      text.push_back( '\n' );
+    hash = utils::hash64( text.data(), text.size() );
+    includes.clear();
+    chunks.clear();
+
+    size_t runStart = 0;
+    auto endRun = [this, &runStart]( size_t end ) {
+      if ( end > runStart )
+        chunks.push_back( { runStart, end - runStart, c_text } );
+    };
+
+    // Depth of conditionals inside an #ifdef __cplusplus section, counting the section itself
+    int cppDepth = 0;
+    bool skip = false;
+    const string_view view( text );
+    size_t pos = 0;
+    while ( pos < view.size() )
+    {
+      const auto eol = view.find( '\n', pos );
+      const auto next = ( eol == view.npos ? view.size() : eol + 1 );
+      string_view directive, rest;
+      bool consumed = false;
+      if ( readDirective( view.substr( pos, next - pos ), directive, rest ) )
+      {
+        if ( cppDepth == 0 && directive == "ifdef" && rest.starts_with( "__cplusplus" ) )
+        {
+          cppDepth = 1;
+          skip = true;
+          consumed = true;
+        }
+        else if ( cppDepth > 0 && ( directive == "if" || directive == "ifdef" || directive == "ifndef" ) )
+          cppDepth++;
+        else if ( cppDepth == 1 && directive == "else" )
+        {
+          skip = false;
+          consumed = true;
+        }
+        else if ( cppDepth > 0 && directive == "endif" )
+        {
+          if ( --cppDepth == 0 )
+          {
+            skip = false;
+            consumed = true;
+          }
+        }
+        else if ( !skip && directive == "include" && !rest.empty() )
+        {
+          const char close = ( rest[0] == '<' ? '>' : '"' );
+          const auto end = rest.find( close, 1 );
+          if ( ( rest[0] != '<' && rest[0] != '"' ) || end == rest.npos )
+            NEKO_EXCEPT( "Malformed include directive" );
+          endRun( pos );
+          runStart = pos;
+          chunks.push_back( { pos, next - pos, includes.size() } );
+          includes.emplace_back( rest.substr( 1, end - 1 ) );
+          consumed = true;
+        }
+      }
+      if ( consumed || skip )
+      {
+        endRun( pos );
+        runStart = next;
+      }
+      pos = next;
+    }
+    endRun( view.size() );
+  }
+
+  // Shaders
+
+  uint64_t Shaders::sourceKey( const utf8String& filename, int includeDepth ) const
   {
     if ( includeDepth > 3 )
       NEKO_EXCEPT( "Maximum include depth exceeded; circular dependency?" );
 
-    utf8String source = Locator::fileSystem().openFile( Dir_Shaders, filename )->readFullString();
-    stringstream ss( source );
-    utf8String line;
-    utf8String out;
-    int ifdefDepth = 0;
-    bool skip = false;
-    const std::regex rgx( "^[ ]*#[ ]*include[ ]+[\"<](.*)[\">].*" );
-    while ( std::getline( ss, line ) )
+    const auto& source = sources_.at( filename );
+    auto key = source.hash;
+    for ( const auto& include : source.includes )
     {
-      if ( line.find( "#ifdef __cplusplus" ) != line.npos )
+      if ( includes_.find( include ) == includes_.end() )
+        NEKO_EXCEPT( "Include not found: " + include );
+      const auto dependency = sourceKey( include, includeDepth + 1 );
+      key = utils::hash64( &dependency, sizeof( dependency ), key );
+    }
+    return key;
+  }
+
+  void Shaders::expandSource( const utf8String& filename, utf8String& out ) const
+  {
+    const auto& source = sources_.at( filename );
+    for ( const auto& chunk : source.chunks )
+    {
+      if ( chunk.include == ShaderSource::c_text )
+        out.append( source.text, chunk.offset, chunk.length );
+      else
       {
-        ifdefDepth++;
-        skip = true;
+        expandSource( source.includes[chunk.include], out );
+        out.push_back( '\n' );
       }
-      else if ( line.find( "#else" ) != line.npos && ifdefDepth > 0 )
+    }
+  }
+
+  void Shaders::preprocess( const vector<PipelineDefinition>& definitions )
+  {
+    platform::PerformanceTimer timer;
+    timer.start();
+
+    set<utf8String> unique( includes_.begin(), includes_.end() );
+    for ( const auto& definition : definitions )
+      for ( const auto& file : definition.files )
+        unique.insert( file.second );
+    const vector<utf8String> files( unique.begin(), unique.end() );
+
+    // File reads and tokenizing are independent per file. Exceptions can't cross the parallel algorithm,
+    // so they're carried out and rethrown here
+    vector<ShaderSource> parsed( files.size() );
+    vector<std::exception_ptr> errors( files.size() );
+    std::for_each( std::execution::par, files.begin(), files.end(), [&]( const utf8String& file ) {
+      const auto i = static_cast<size_t>( &file - files.data() );
+      try
       {
-        skip = false;
+        parsed[i].parse( Locator::fileSystem().openFile( Dir_Shaders, file )->readFullString() );
       }
-      else if ( line.find( "#endif" ) != line.npos && ifdefDepth > 0 )
+      catch ( ... )
       {
-        ifdefDepth--;
-        skip = false;
+        errors[i] = std::current_exception();
       }
-      else if ( !skip )
+    } );
+    for ( const auto& error : errors )
+      if ( error )
+        std::rethrow_exception( error );
+
+    sources_.clear();
+    for ( size_t i = 0; i < files.size(); ++i )
+      sources_[files[i]] = move( parsed[i] );
+
+    // Only stage files are compiled; expand those whose include tree isn't cached yet.
+    // Entries nothing refers to anymore are dropped, so edits don't pile up stale sources
+    map<uint64_t, utf8String> current;
+    map<uint64_t, const utf8String*> missing;
+    size_t cached = 0;
+    for ( const auto& definition : definitions )
+      for ( const auto& file : definition.files )
       {
-        std::smatch matches;
-        if ( std::regex_search( line, matches, rgx ) )
+        const auto key = sourceKey( file.second );
+        if ( current.find( key ) != current.end() || missing.find( key ) != missing.end() )
+          continue;
+        auto it = expanded_.find( key );
+        if ( it != expanded_.end() )
         {
-          if ( includes_.find( matches[1].str() ) == includes_.end() )
-            NEKO_EXCEPT( "Include not found: " + matches[1].str() )
-          out.append( includes_.at( matches[1].str() ) + "\n" );
+          current[key] = move( it->second );
+          cached++;
         }
         else
-        {
-          out.append( line + "\n" );
-        }
+          missing[key] = &file.second;
       }
-    }
-
-    return move( out );
-  }
-
-  void Shaders::readIncludeFile( utf8String filename )
-  {
-    auto source = readSource( filename );
-    source[source.length() - 1] = '\n';
-    includes_[filename] = source;
+    vector<pair<uint64_t, const utf8String*>> work( missing.begin(), missing.end() );
+    vector<utf8String> results( work.size() );
+    std::for_each( std::execution::par, work.begin(), work.end(), [&]( const pair<uint64_t, const utf8String*>& item ) {
+      auto& out = results[&item - work.data()];
+      out.reserve( sources_.at( *item.second ).text.size() * 2 );
+      expandSource( *item.second, out );
+    } );
+    for ( size_t i = 0; i < work.size(); ++i )
+      current[work[i].first] = move( results[i] );
+    expanded_.swap( current );
+
+    console_->printf( srcGfx, "Preprocessed %zu shader files in %.2fms, %zu of %zu unique sources cached", files.size(),
+      timer.stop(), cached, cached + work.size() );
   }
 
   void Shaders::loadIncludeJSONRaw( const nlohmann::json& obj )
@@ -243,7 +456,7 @@ namespace neko {
     }
     else if ( obj.is_string() )
     {
-      readIncludeFile( obj.get<utf8String>() );
+      includes_.insert( obj.get<utf8String>() );
     }
     else
       NEKO_EXCEPT( "Include JSON is not an array or a string" );
@@ -261,20 +474,149 @@ namespace neko {
     loadIncludeJSON( input );
   }
 
-  void Shaders::buildSeparableProgram( const utf8String& name,
-  const utf8String& filename, ShaderType type, ShaderPtr& shader, ProgramPtr& program, const vector<utf8String>& uniforms )
+  void Shaders::buildSeparableProgram( const utf8String& name, ShaderType type, const utf8String& expanded,
+  ShaderPtr& shader, ProgramPtr& program, const vector<utf8String>& uniforms, const vector<utf8String>& defines )
   {
-    auto source = readSource( filename );
+    auto source = expanded;
+
+    // Defines have to follow the #version line, which must come first
+    if ( !defines.empty() )
+    {
+      utf8String injected;
+      for ( const auto& define : defines )
+        injected.append( "#define " + define + "\n" );
+      const auto eol = source.find( '\n' );
+      source.insert( eol == source.npos ? 0 : eol + 1, injected );
+    }
+
+    // The same text could in theory build several stage types, so the stage is part of the key
+    auto key = ( driverKey_ ? utils::hash64( source.data(), source.size(), driverKey_ ) : 0 );
+    if ( key )
+      key = utils::hash64( &type, sizeof( type ), key );
+    const bool cache = ( key && g_CVar_gl_programcache.as_b() );
+
+    program = make_shared<Program>();
+    if ( cache )
+    {
+      if ( loadProgramBinary( *program, key ) )
+      {
+        resolveUniforms( *program, uniforms );
+        cacheStats_.hits++;
+        return;
+      }
+      // Don't link from source into a program that may have been handed a rejected binary
+      program = make_shared<Program>();
+    }
 
     console_->printf( srcGfx, "Compiling %s shader: %s", c_shaderTypes[type].name.c_str(), name.c_str() );
 
     shader = make_unique<Shader>( type );
     compileShader( *shader, source );
-    program = make_shared<Program>();
     linkSingleProgram( *program, *shader, uniforms );
+    if ( cache )
+    {
+      cacheStats_.misses++;
+      saveProgramBinary( *program, key );
+    }
+  }
+
+  bool Shaders::loadProgramBinary( Program& program, uint64_t key )
+  {
+    char filename[64];
+    sprintf_s( filename, 64, "program_%016llx.bin", static_cast<unsigned long long>( key ) );
+    if ( !Locator::fileSystem().fileStat( Dir_Cache, platform::utf8ToWide( filename ) ) )
+      return false;
+
+    try
+    {
+      auto reader = Locator::fileSystem().openFile( Dir_Cache, filename );
+      if ( reader->readUint32() != c_programCacheMagic || reader->readUint32() != c_programCacheVersion ||
+        reader->readUint64() != key )
+        return false;
+      const auto format = static_cast<GLenum>( reader->readUint32() );
+      vector<uint8_t> binary( reader->readUint32() );
+      if ( binary.empty() )
+        return false;
+      reader->read( binary.data(), static_cast<uint32_t>( binary.size() ) );
+
+      glProgramBinary( program.id(), format, binary.data(), static_cast<GLsizei>( binary.size() ) );
+      GLint linked = 0;
+      glGetProgramiv( program.id(), GL_LINK_STATUS, &linked );
+      if ( !linked )
+      {
+        cacheStats_.rejected++;
+        return false;
+      }
+      program.linked_ = true;
+    }
+    catch ( std::exception& e )
+    {
+      console_->printf( srcGfx, "Discarding program cache %s: %s", filename, e.what() );
+      return false;
+    }
+
+    return true;
+  }
+
+  void Shaders::saveProgramBinary( const Program& program, uint64_t key )
+  {
+    GLint length = 0;
+    glGetProgramiv( program.id(), GL_PROGRAM_BINARY_LENGTH, &length );
+    if ( length <= 0 )
+      return;
+    vector<uint8_t> binary( static_cast<size_t>( length ) );
+    GLenum format = GL_NONE;
+    GLsizei written = 0;
+    glGetProgramBinary( program.id(), length, &written, &format, binary.data() );
+    if ( written <= 0 )
+      return;
+
+    char filename[64];
+    sprintf_s( filename, 64, "program_%016llx.bin", static_cast<unsigned long long>( key ) );
+    try
+    {
+      auto writer = Locator::fileSystem().createFile( Dir_Cache, filename );
+      writer->writeUint32( c_programCacheMagic );
+      writer->writeUint32( c_programCacheVersion );
+      writer->writeUint64( key );
+      writer->writeUint32( static_cast<uint32_t>( format ) );
+      writer->writeUint32( static_cast<uint32_t>( written ) );
+      writer->writeBlob( binary.data(), static_cast<uint32_t>( written ) );
+    }
+    catch ( std::exception& e )
+    {
+      console_->printf( srcGfx, "Failed to write program cache %s: %s", filename, e.what() );
+    }
+  }
+
+  void Shaders::buildPipeline( const PipelineDefinition& definition )
+  {
+    if ( pipelines_.find( definition.name ) != pipelines_.end() )
+      NEKO_EXCEPT( "Pipeline " + definition.name + " already exists" );
+
+    auto pipeline = make_unique<Pipeline>( definition.name );
+    for ( const auto& file : definition.files )
+    {
+      ShaderPtr shader;
+      ProgramPtr program;
+      buildSeparableProgram( definition.name, file.first, expanded_.at( sourceKey( file.second ) ), shader, program,
+        definition.uniforms, definition.defines );
+      glUseProgramStages( pipeline->id(), c_shaderTypes[file.first].maskBit, program->id() );
+      pipeline->stages_[file.first] = program;
+      if ( shader )
+        shaders_.push_back( move( shader ) );
+      programs_.push_back( move( program ) );
+    }
+
+    for ( const auto& stage : pipeline->stages_ )
+      pipeline->programs_.push_back( stage.second.get() );
+    pipeline->drawBuffer_ = ( std::find( definition.defines.begin(), definition.defines.end(), c_drawBufferDefine ) !=
+      definition.defines.end() );
+
+    pipelines_[definition.name] = move( pipeline );
   }
 
-  void Shaders::loadPipelineJSONRaw( const nlohmann::json& obj )
+  void Shaders::loadPipelineJSONRaw( const nlohmann::json& obj, vector<PipelineDefinition>& out )
   {
     if ( obj.is_array() )
     {
@@ -282,80 +624,42 @@ namespace neko {
       {
         if ( !entry.is_object() )
           NEKO_EXCEPT( "Pipeline array entry is not an object" );
-        loadPipelineJSONRaw( entry );
+        loadPipelineJSONRaw( entry, out );
       }
     }
     else if ( obj.is_object() )
     {
-      auto name = obj["name"].get<utf8String>();
-      if ( pipelines_.find( name ) != pipelines_.end() )
-        NEKO_EXCEPT( "Pipeline " + name + " already exists" );
+      PipelineDefinition definition;
+      definition.name = obj["name"].get<utf8String>();
+
+      if ( obj.contains( "vert" ) )
+        definition.files[Shader_Vertex] = obj["vert"].get<utf8String>();
+      if ( obj.contains( "geom" ) )
+        definition.files[Shader_Geometry] = obj["geom"].get<utf8String>();
+      if ( obj.contains( "frag" ) )
+        definition.files[Shader_Fragment] = obj["frag"].get<utf8String>();
+      if ( obj.contains( "comp" ) )
+        definition.files[Shader_Compute] = obj["comp"].get<utf8String>();
 
-      utf8String vp_filename = obj.contains( "vert" ) ? obj["vert"].get<utf8String>() : "";
-      utf8String gp_filename = obj.contains( "geom" ) ? obj["geom"].get<utf8String>() : "";
-      utf8String fp_filename = obj.contains( "frag" ) ? obj["frag"].get<utf8String>() : "";
-      utf8String cp_filename = obj.contains( "comp" ) ? obj["comp"].get<utf8String>() : "";
-
-      vector<utf8String> uniforms;
       if ( obj.contains( "uniforms" ) )
       {
         const auto& funf = obj["uniforms"];
         if ( !funf.is_array() )
           NEKO_EXCEPT( "Pipeline uniforms is not an array" );
         for ( auto& u : funf )
-          uniforms.push_back( u.get<utf8String>() );
+          definition.uniforms.push_back( u.get<utf8String>() );
+      }
+
+      if ( obj.contains( "defines" ) )
+      {
+        const auto& fdef = obj["defines"];
+        if ( !fdef.is_array() )
+          NEKO_EXCEPT( "Pipeline defines is not an array" );
+        for ( auto& d : fdef )
+          definition.defines.push_back( d.get<utf8String>() );
       }
 
-      ShaderPtr vs, gs, fs, cs;
-      ProgramPtr vp, gp, fp, cp;
-
-      if ( !vp_filename.empty() )
-        buildSeparableProgram( name, vp_filename, ShaderType::Shader_Vertex, vs, vp, uniforms );
-      if ( !gp_filename.empty() )
-        buildSeparableProgram( name, gp_filename, ShaderType::Shader_Geometry, gs, gp, uniforms );
-      if ( !fp_filename.empty() )
-        buildSeparableProgram( name, fp_filename, ShaderType::Shader_Fragment, fs, fp, uniforms );
-      if ( !cp_filename.empty() )
-        buildSeparableProgram( name, cp_filename, ShaderType::Shader_Compute, cs, cp, uniforms );
-
-      auto pipeline = make_unique<Pipeline>( name );
-      if ( vp )
-        glUseProgramStages( pipeline->id(), c_shaderTypes[vs->type()].maskBit, vp->id() );
-      if ( gp )
-        glUseProgramStages( pipeline->id(), c_shaderTypes[gs->type()].maskBit, gp->id() );
-      if ( fp )
-        glUseProgramStages( pipeline->id(), c_shaderTypes[fs->type()].maskBit, fp->id() );
-      if ( cp )
-        glUseProgramStages( pipeline->id(), c_shaderTypes[cs->type()].maskBit, cp->id() );
-
-      if ( vp )
-        pipeline->stages_[ShaderType::Shader_Vertex] = vp;
-      if ( gp )
-        pipeline->stages_[ShaderType::Shader_Geometry] = gp;
-      if ( fp )
-        pipeline->stages_[ShaderType::Shader_Fragment] = fp;
-      if ( cp )
-        pipeline->stages_[ShaderType::Shader_Compute] = cp;
-
-      if ( vs )
-        shaders_.push_back( move( vs ) );
-      if ( gs )
-        shaders_.push_back( move( gs ) );
-      if ( fs )
-        shaders_.push_back( move( fs ) );
-      if ( cs )
-        shaders_.push_back( move( cs ) );
-
-      if ( vp )
-        programs_.push_back( move( vp ) );
-      if ( gp )
-        programs_.push_back( move( gp ) );
-      if ( fp )
-        programs_.push_back( move( fp ) );
-      if ( cp )
-        programs_.push_back( move( cp ) );
-
-      pipelines_[name] = move( pipeline );
+      out.push_back( move( definition ) );
     }
     else
       NEKO_EXCEPT( "Pipeline JSON is not an array or an object" );
@@ -364,7 +668,17 @@ namespace neko {
   void Shaders::loadPipelineJSON( const utf8String& input )
   {
     auto parsed = nlohmann::json::parse( input );
-    loadPipelineJSONRaw( parsed );
+    vector<PipelineDefinition> definitions;
+    loadPipelineJSONRaw( parsed, definitions );
+
+    // Sources are prepared for all pipelines up front; compiling has to stay on this thread with the context
+    preprocess( definitions );
+    cacheStats_ = ProgramCacheStats();
+    for ( const auto& definition : definitions )
+      buildPipeline( definition );
+    if ( driverKey_ && g_CVar_gl_programcache.as_b() )
+      console_->printf( srcGfx, "Program cache: %zu hits, %zu misses, %zu rejected", cacheStats_.hits,
+        cacheStats_.misses, cacheStats_.rejected );
   }
 
   void Shaders::loadPipelineFile( const utf8String& filename )
@@ -377,15 +691,118 @@ namespace neko {
   {
     assert( pipelines_.find( name ) != pipelines_.end() );
     auto& pipeline = ( *pipelines_[name] );
-    glBindProgramPipeline( pipeline.id_ );
-    glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 0, world_->id() );
-    glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 1, processing_->id() );
+    state_.bindProgramPipeline( pipeline.id_ );
+
+    // A range from an earlier frame may since have been rewritten by the ring wrapping around, or belong to
+    // a buffer the stream has retired, so a frame that hasn't written its own gets a fresh zeroed one
+    if ( worldFrame_ != stream_.frame() )
+      writeWorld();
+    else
+      state_.bindBufferRange( GL_SHADER_STORAGE_BUFFER, 0, world_.buffer, world_.offset, world_.size );
+    if ( processingFrame_ != stream_.frame() )
+      writeProcessing();
+    else
+      state_.bindBufferRange( GL_SHADER_STORAGE_BUFFER, 1, processing_.buffer, processing_.offset, processing_.size );
 
     return pipeline;
   }
 
+  uniforms::World& Shaders::writeWorld()
+  {
+    world_ = stream_.allocate( sizeof( uniforms::World ) );
+    worldFrame_ = stream_.frame();
+    memset( world_.data, 0, world_.size );
+    state_.bindBufferRange( GL_SHADER_STORAGE_BUFFER, 0, world_.buffer, world_.offset, world_.size );
+    return *reinterpret_cast<uniforms::World*>( world_.data );
+  }
+
+  uniforms::Processing& Shaders::writeProcessing()
+  {
+    processing_ = stream_.allocate( sizeof( uniforms::Processing ) );
+    processingFrame_ = stream_.frame();
+    memset( processing_.data, 0, processing_.size );
+    state_.bindBufferRange( GL_SHADER_STORAGE_BUFFER, 1, processing_.buffer, processing_.offset, processing_.size );
+    return *reinterpret_cast<uniforms::Processing*>( processing_.data );
+  }
+
   Shaders::~Shaders()
   {
   }
 
+  // Benchmark
+
+  static void concmdBenchmarkUniforms( Console* console, ConCmd* command, StringVector& arguments )
+  {
+    size_t draws = 1000000;
+    if ( arguments.size() > 1 )
+      draws = static_cast<size_t>( math::max( 1, atoi( arguments[1].c_str() ) ) );
+
+    // Two stages, as in a vertex/fragment pipeline, each knowing the usual uniforms by name
+    const Uniform perDraw[] = { Uniform_Model, Uniform_TexLayer, Uniform_TexDimensions };
+    map<string, GLint> keyed[2];
+    map<string, GLint, std::less<>> transparent[2];
+    GLint locations[2][MAX_Uniform];
+    for ( int stage = 0; stage < 2; ++stage )
+      for ( int i = 0; i < MAX_Uniform; ++i )
+      {
+        keyed[stage][c_uniformNames[i]] = i;
+        transparent[stage][c_uniformNames[i]] = i;
+        locations[stage][i] = i;
+      }
+
+    // The sink keeps the lookups from being optimized away
+    volatile GLint sink = 0;
+    using ns = chrono::duration<double, std::nano>;
+
+    // What Program::setUniform( const char* ) used to do: find, then operator[], both building a string
+    auto started = chrono::steady_clock::now();
+    for ( size_t d = 0; d < draws; ++d )
+      for ( auto& stage : keyed )
+        for ( auto uniform : perDraw )
+        {
+          const char* name = c_uniformNames[uniform];
+          if ( stage.find( name ) != stage.end() )
+            sink = sink + stage[name];
+        }
+    const auto keyedTime = ns( chrono::steady_clock::now() - started ).count() / draws;
+
+    started = chrono::steady_clock::now();
+    for ( size_t d = 0; d < draws; ++d )
+      for ( auto& stage : transparent )
+        for ( auto uniform : perDraw )
+        {
+          auto it = stage.find( string_view( c_uniformNames[uniform] ) );
+          if ( it != stage.end() )
+            sink = sink + it->second;
+        }
+    const auto transparentTime = ns( chrono::steady_clock::now() - started ).count() / draws;
+
+    started = chrono::steady_clock::now();
+    for ( size_t d = 0; d < draws; ++d )
+      for ( auto& stage : locations )
+        for ( auto uniform : perDraw )
+          sink = sink + stage[uniform];
+    const auto handleTime = ns( chrono::steady_clock::now() - started ).count() / draws;
+
+    // The draw buffer path replaces all of the above with one record written per draw
+    vector<uniforms::DrawData> drawData( math::min( draws, (size_t)65536 ) );
+    started = chrono::steady_clock::now();
+    for ( size_t d = 0; d < draws; ++d )
+    {
+      auto& data = drawData[d % drawData.size()];
+      data.model = mat4( static_cast<Real>( d ) );
+      data.texDimensions = vec2( 1.0f, 1.0f );
+      data.posScale = 1.0f;
+      data.texLayer = static_cast<int>( d );
+    }
+    sink = sink + drawData[0].texLayer;
+    const auto bufferTime = ns( chrono::steady_clock::now() - started ).count() / draws;
+
+    console->printf( srcGfx, "Uniform lookups over %zu draws, 2 stages x 3 uniforms, per draw:", draws );
+    console->printf( srcGfx, "  string keyed: %.1fns (6 glProgramUniform calls)", keyedTime );
+    console->printf( srcGfx, "  transparent:  %.1fns (6 glProgramUniform calls)", transparentTime );
+    console->printf( srcGfx, "  handles:      %.1fns (6 glProgramUniform calls)", handleTime );
+    console->printf( srcGfx, "  draw buffer:  %.1fns (0 glProgramUniform calls)", bufferTime );
+  }
+
 }
\ No newline at end of file
@@ -38,6 +38,7 @@ namespace neko {
 
   void SpriteManager::shutdown()
   {
+    atlasEntries_.clear();
     sets_.clear();
   }
 
@@ -86,7 +87,7 @@ namespace neko {
   {
   }
 
-  void SpriteManager::loadAnimsetJSONRaw( const json& obj ) 
+  void SpriteManager::parseAnimsetJSON( const json& obj, SpriteAnimationSetDefinitionVector& out ) const
   {
     if ( obj.is_array() )
     {
@@ -94,7 +95,7 @@ namespace neko {
       {
         if ( !entry.is_object() )
           NEKO_EXCEPT( "Sprite animation set array entry is not an object" );
-        loadAnimsetJSONRaw( entry );
+        parseAnimsetJSON( entry, out );
       }
     }
     else if ( obj.is_object() )
@@ -117,17 +118,29 @@ namespace neko {
             flipx = njson::readVector<int>( value["flip-frames-x"] );
           auto def = make_shared<SpriteAnimationSetDefinitionEntry>( key, sheetname, defname, sheetpos, flipx );
           def->definition_ = animdefs_.at( def->defName_ );
-          auto matname = set->name_ + "_" + def->name_;
-          def->material_ = renderer_->materials().createMaterial( matname );
           set->entries_[def->name_] = def;
         }
-        renderer_->loader()->addLoadTask( { LoadTask( set ) } );
+        out.push_back( set );
       }
     }
     else
       NEKO_EXCEPT( "Sprite animation set JSON is not an array or an object" );
   }
 
+  void SpriteManager::loadAnimsetJSONRaw( const json& obj )
+  {
+    assert( renderer_ );
+
+    SpriteAnimationSetDefinitionVector sets;
+    parseAnimsetJSON( obj, sets );
+    for ( auto& set : sets )
+    {
+      for ( auto& [key, def] : set->entries_ )
+        def->material_ = renderer_->materials().createMaterial( set->name_ + "_" + def->name_ );
+      renderer_->loader()->addLoadTask( { LoadTask( set ) } );
+    }
+  }
+
   void SpriteManager::loadAnimsetJSON( const utf8String& input )
   {
     auto parsed = nlohmann::json::parse( input );
@@ -140,6 +153,103 @@ namespace neko {
     loadAnimsetJSON( input );
   }
 
+  uint64_t SpriteManager::hashSources( const vector<utf8String>& filenames )
+  {
+    uint64_t hash = utils::hash64( &c_atlasVersion, sizeof( c_atlasVersion ) );
+    for ( const auto& filename : filenames )
+    {
+      auto input = Locator::fileSystem().openFile( Dir_Data, filename )->readFullString();
+      hash = utils::hash64( input.data(), input.size(), hash );
+    }
+    return hash;
+  }
+
+  namespace {
+
+    utf8String readString( FileReader& reader )
+    {
+      utf8String str( reader.readUint32(), '\0' );
+      reader.read( str.data(), static_cast<uint32_t>( str.size() ) );
+      return str;
+    }
+
+    vec2i readVec2i( FileReader& reader )
+    {
+      const auto x = reader.readInt();
+      return { x, reader.readInt() };
+    }
+
+  }
+
+  bool SpriteManager::loadAtlasFile( const utf8String& filename, uint64_t sources )
+  {
+    assert( renderer_ );
+
+    if ( !Locator::fileSystem().fileStat( Dir_Data, platform::utf8ToWide( filename ) ) )
+      return false;
+
+    auto reader = Locator::fileSystem().openFile( Dir_Data, filename );
+    if ( reader->readUint32() != c_atlasMagic || reader->readUint32() != c_atlasVersion ||
+         reader->readUint64() != sources )
+    {
+      Locator::console().printf( srcGfx, "Sprite atlas %s is out of date, using sheets. Run sprite_pack to update it.",
+        filename.c_str() );
+      return false;
+    }
+
+    auto atlas = make_shared<SpriteAtlas>();
+    atlas->name_ = readString( *reader );
+    atlas->pageSize_ = readVec2i( *reader );
+    atlas->pages_.resize( reader->readUint32() );
+    for ( auto& page : atlas->pages_ )
+      page = readString( *reader );
+    atlas->material_ = renderer_->materials().createMaterial( atlas->name_ );
+
+    const auto setCount = reader->readUint32();
+    for ( uint32_t i = 0; i < setCount; ++i )
+    {
+      auto set = make_shared<SpriteAnimationSetDefinition>();
+      set->name_ = readString( *reader );
+      const auto entryCount = reader->readUint32();
+      for ( uint32_t j = 0; j < entryCount; ++j )
+      {
+        auto name = readString( *reader );
+        auto defname = readString( *reader );
+        auto entry = make_shared<SpriteAnimationSetDefinitionEntry>( name, atlas->name_, defname, vec2i( 0, 0 ),
+          vector<int>() );
+        if ( !animdefs_.contains( defname ) )
+          NEKO_EXCEPT( "Sprite atlas refers to an unknown animation definition: " + defname );
+        entry->definition_ = animdefs_.at( defname );
+        entry->material_ = atlas->material_;
+        entry->atlasFrames_.resize( reader->readUint32() );
+        for ( auto& frame : entry->atlasFrames_ )
+        {
+          frame.page = reader->readInt();
+          frame.position = readVec2i( *reader );
+          frame.size = readVec2i( *reader );
+          frame.offset = readVec2i( *reader );
+        }
+        set->entries_[entry->name_] = entry;
+        atlasEntries_[set->name_ + "_" + entry->name_] = entry;
+      }
+      if ( sets_.contains( set->name_ ) )
+        NEKO_EXCEPT( "Sprite animation set already exists: " + set->name_ );
+      sets_[set->name_] = set;
+    }
+
+    Locator::console().printf( srcGfx, "Loaded sprite atlas %s: %zu sets, %zu pages of %ix%i", filename.c_str(),
+      static_cast<size_t>( setCount ), atlas->pages_.size(), atlas->pageSize_.x, atlas->pageSize_.y );
+
+    renderer_->loader()->addLoadTask( { LoadTask( atlas ) } );
+    return true;
+  }
+
+  SpriteAnimationSetDefinitionEntryPtr SpriteManager::atlasEntry( const utf8String& name ) const
+  {
+    auto it = atlasEntries_.find( name );
+    return ( it != atlasEntries_.end() ? it->second : SpriteAnimationSetDefinitionEntryPtr() );
+  }
+
   SpriteManager::~SpriteManager() {}
 
 }
\ No newline at end of file
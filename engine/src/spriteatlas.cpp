@@ -0,0 +1,282 @@
+#include "pch.h"
+#include "spriteatlas.h"
+#include "locator.h"
+#include "console.h"
+#include "filesystem.h"
+#include "utilities.h"
+#include "neko_exception.h"
+
+namespace neko {
+
+  static void concmdSpritePack( Console* console, ConCmd* command, StringVector& arguments );
+
+  NEKO_DECLARE_CONCMD( sprite_pack,
+    "Pack the sprite animation sets into an atlas, used instead of the sheets from the next start. Format: sprite_pack [maxpagesize]",
+    concmdSpritePack );
+
+  namespace {
+
+    void writeString( platform::FileWriter& writer, const utf8String& str )
+    {
+      writer.writeUint32( static_cast<uint32_t>( str.size() ) );
+      writer.writeBlob( str.data(), static_cast<uint32_t>( str.size() ) );
+    }
+
+    //! Bounding rectangle of the texels with any alpha, as x, y, width, height. Zero size if there are none.
+    vec4i opaqueBounds( const Pixmap& image )
+    {
+      vec2i lo( image.width(), image.height() );
+      vec2i hi( -1, -1 );
+      const auto pixels = image.data().data();
+      for ( int y = 0; y < image.height(); ++y )
+      {
+        const auto row = pixels + static_cast<size_t>( y ) * image.width() * 4;
+        for ( int x = 0; x < image.width(); ++x )
+          if ( row[x * 4 + 3] )
+          {
+            lo = glm::min( lo, vec2i( x, y ) );
+            hi = glm::max( hi, vec2i( x, y ) );
+          }
+      }
+      if ( hi.x < 0 )
+        return { 0, 0, 0, 0 };
+      return { lo.x, lo.y, hi.x - lo.x + 1, hi.y - lo.y + 1 };
+    }
+
+  }
+
+  SpriteAtlasPacker::Frame SpriteAtlasPacker::addFrame( const Pixmap& frame )
+  {
+    Frame out;
+    const auto bounds = opaqueBounds( frame );
+    out.offset = { bounds.x, bounds.y };
+    frames_++;
+
+    Image image { bounds.z > 0 ? Pixmap( frame, bounds.x, bounds.y, bounds.z, bounds.w ) : Pixmap( PixFmtColorRGBA8 ) };
+
+    // Identical frames, such as holds in an animation or the same pose in two sets, share their texels
+    const auto& data = image.pixels.data();
+    const auto key = utils::hash64( data.data(), data.size(), utils::hash64( &bounds.z, sizeof( int ) * 2 ) );
+    for ( auto index : known_[key] )
+    {
+      const auto& other = images_[index].pixels;
+      if ( other.width() == image.pixels.width() && other.height() == image.pixels.height() && other.data() == data )
+      {
+        out.image = index;
+        return out;
+      }
+    }
+
+    out.image = images_.size();
+    known_[key].push_back( out.image );
+    images_.push_back( move( image ) );
+    return out;
+  }
+
+  void SpriteAtlasPacker::load( const utf8String& defsFile, const utf8String& setsFile )
+  {
+    SpriteManager definitions( nullptr );
+    definitions.loadAnimdefFile( defsFile );
+    SpriteAnimationSetDefinitionVector sets;
+    definitions.parseAnimsetJSON(
+      nlohmann::json::parse( Locator::fileSystem().openFile( Dir_Data, setsFile )->readFullString() ), sets );
+    sources_ = SpriteManager::hashSources( { defsFile, setsFile } );
+
+    map<utf8String, Pixmap> sheets;
+    for ( const auto& set : sets )
+    {
+      Set packed;
+      packed.name = set->name();
+      for ( const auto& [key, entry] : set->entries_ )
+      {
+        if ( !sheets.contains( entry->sheetName_ ) )
+        {
+          vector<uint8_t> input;
+          Locator::fileSystem().openFile( Dir_Textures, entry->sheetName_ )->readFullVector( input );
+          auto sheet = Pixmap::fromPNG( input );
+          if ( sheet.format() != PixFmtColorRGBA8 )
+            sheet.convert( PixFmtColorRGBA8 );
+          sheets.emplace( entry->sheetName_, move( sheet ) );
+        }
+        const auto& sheet = sheets.at( entry->sheetName_ );
+        const auto& def = *entry->definition_;
+
+        Entry out;
+        out.name = entry->name_;
+        out.definition = def.name();
+        for ( int i = 0; i < def.frameCount(); ++i )
+        {
+          const auto pos = entry->sheetPos_ + ( def.direction() == SpriteAnimationDefinition::Vertical ?
+            vec2i( 0, i * def.height() ) : vec2i( i * def.width(), 0 ) );
+          if ( pos.x < 0 || pos.y < 0 || pos.x + def.width() > sheet.width() || pos.y + def.height() > sheet.height() )
+            NEKO_EXCEPT( "Sprite frame is outside its sheet: " + set->name() + "_" + entry->name_ );
+          Pixmap frame( sheet, pos.x, pos.y, def.width(), def.height() );
+          if ( utils::contains( entry->flipFramesX_, i ) )
+            frame.flipRectHorizontal( 0, 0, def.width(), def.height() );
+          out.frames.push_back( addFrame( frame ) );
+        }
+        packed.entries.push_back( move( out ) );
+      }
+      sets_.push_back( move( packed ) );
+    }
+  }
+
+  bool SpriteAtlasPacker::pack( int pageSize, const vector<size_t>& order, vector<TextureAtlasPtr>& pages )
+  {
+    pages.clear();
+    for ( auto index : order )
+    {
+      auto& image = images_[index];
+      if ( image.pixels.empty() )
+        continue;
+      const auto width = image.pixels.width() + c_padding;
+      const auto height = image.pixels.height() + c_padding;
+
+      // First fit over the open pages, a new page if none has room
+      vec4i region( -1, -1, 0, 0 );
+      for ( size_t i = 0; i < pages.size() && region.x < 0; ++i )
+      {
+        region = pages[i]->getRegion( width, height );
+        image.page = static_cast<int>( i );
+      }
+      if ( region.x < 0 )
+      {
+        pages.push_back( make_shared<TextureAtlas>( vec2i( pageSize, pageSize ), 4 ) );
+        region = pages.back()->getRegion( width, height );
+        image.page = static_cast<int>( pages.size() - 1 );
+        if ( region.x < 0 )
+          return false;
+      }
+      image.position = { region.x, region.y };
+    }
+    return true;
+  }
+
+  SpriteAtlasPacker::Result SpriteAtlasPacker::write( const utf8String& filename, int maxPageSize )
+  {
+    maxPageSize = math::max( maxPageSize, c_minPageSize );
+
+    vector<size_t> order( images_.size() );
+    for ( size_t i = 0; i < order.size(); ++i )
+      order[i] = i;
+    std::sort( order.begin(), order.end(), [this]( size_t a, size_t b ) {
+      const auto& pa = images_[a].pixels;
+      const auto& pb = images_[b].pixels;
+      return ( pa.height() != pb.height() ? pa.height() > pb.height() : pa.width() > pb.width() );
+    } );
+
+    size_t area = 0;
+    int largest = 0;
+    for ( const auto& image : images_ )
+    {
+      if ( image.pixels.empty() )
+        continue;
+      area += static_cast<size_t>( image.pixels.width() + c_padding ) * ( image.pixels.height() + c_padding );
+      largest = math::max( largest, math::max( image.pixels.width(), image.pixels.height() ) + c_padding );
+    }
+
+    // The page border is reserved, see TextureAtlas
+    int pageSize = c_minPageSize;
+    while ( pageSize < maxPageSize &&
+      ( static_cast<size_t>( pageSize - 2 ) * ( pageSize - 2 ) < area || pageSize - 2 < largest ) )
+      pageSize *= 2;
+    pageSize = math::min( pageSize, maxPageSize );
+
+    vector<TextureAtlasPtr> pages;
+    for ( ;; )
+    {
+      const bool packed = pack( pageSize, order, pages );
+      if ( packed && ( pages.size() <= 1 || pageSize >= maxPageSize ) )
+        break;
+      if ( !packed && pageSize >= maxPageSize )
+        NEKO_EXCEPT( "Sprite frame doesn't fit on an atlas page" );
+      pageSize = math::min( pageSize * 2, maxPageSize );
+    }
+    if ( pages.empty() )
+      pages.push_back( make_shared<TextureAtlas>( vec2i( pageSize, pageSize ), 4 ) );
+
+    Result result;
+    result.frames = frames_;
+    result.unique = images_.size();
+    result.pages = pages.size();
+    result.pageSize = pageSize;
+    size_t used = 0;
+    for ( const auto& image : images_ )
+    {
+      if ( image.pixels.empty() )
+        continue;
+      pages[image.page]->setRegion( image.position.x, image.position.y, image.pixels.width(), image.pixels.height(),
+        image.pixels.data().data(), static_cast<size_t>( image.pixels.width() ) * 4 );
+      used += static_cast<size_t>( image.pixels.width() ) * image.pixels.height();
+    }
+    result.coverage = static_cast<Real>( static_cast<double>( used ) /
+      ( static_cast<double>( pageSize ) * pageSize * static_cast<double>( pages.size() ) ) );
+
+    const auto name = filename.substr( 0, filename.find_last_of( '.' ) );
+    vector<utf8String> pageNames;
+    vector<uint8_t> encoded;
+    for ( size_t i = 0; i < pages.size(); ++i )
+    {
+      char pagename[32];
+      sprintf_s( pagename, 32, "_%zu.png", i );
+      pageNames.push_back( name + pagename );
+      Pixmap( pageSize, pageSize, PixFmtColorRGBA8, pages[i]->data() ).encodePNG( encoded );
+      Locator::fileSystem().createFile( Dir_Textures, pageNames.back() )->writeBlob(
+        encoded.data(), static_cast<uint32_t>( encoded.size() ) );
+    }
+
+    auto writer = Locator::fileSystem().createFile( Dir_Data, filename );
+    writer->writeUint32( SpriteManager::c_atlasMagic );
+    writer->writeUint32( SpriteManager::c_atlasVersion );
+    writer->writeUint64( sources_ );
+    writeString( *writer, name );
+    writer->writeInt( pageSize );
+    writer->writeInt( pageSize );
+    writer->writeUint32( static_cast<uint32_t>( pageNames.size() ) );
+    for ( const auto& page : pageNames )
+      writeString( *writer, page );
+    writer->writeUint32( static_cast<uint32_t>( sets_.size() ) );
+    for ( const auto& set : sets_ )
+    {
+      writeString( *writer, set.name );
+      writer->writeUint32( static_cast<uint32_t>( set.entries.size() ) );
+      for ( const auto& entry : set.entries )
+      {
+        writeString( *writer, entry.name );
+        writeString( *writer, entry.definition );
+        writer->writeUint32( static_cast<uint32_t>( entry.frames.size() ) );
+        for ( const auto& frame : entry.frames )
+        {
+          const auto& image = images_[frame.image];
+          writer->writeInt( image.page );
+          writer->writeInt( image.position.x );
+          writer->writeInt( image.position.y );
+          writer->writeInt( image.pixels.width() );
+          writer->writeInt( image.pixels.height() );
+          writer->writeInt( frame.offset.x );
+          writer->writeInt( frame.offset.y );
+        }
+      }
+    }
+
+    return result;
+  }
+
+  static void concmdSpritePack( Console* console, ConCmd* command, StringVector& arguments )
+  {
+    const auto maxPageSize = ( arguments.size() > 1 ? atoi( arguments[1].c_str() ) : 2048 );
+    try
+    {
+      SpriteAtlasPacker packer;
+      packer.load( R"(spriteanimdefs.json)", R"(spriteanimsets.json)" );
+      const auto result = packer.write( R"(spriteatlas.bin)", maxPageSize );
+      console->printf( srcGfx, "Packed %zu sprite frames (%zu unique) into %zu pages of %ix%i, %.1f%% covered",
+        result.frames, result.unique, result.pages, result.pageSize, result.pageSize, result.coverage * 100.0f );
+    }
+    catch ( std::exception& e )
+    {
+      console->printf( srcGfx, "Sprite packing failed: %s", e.what() );
+    }
+  }
+
+}
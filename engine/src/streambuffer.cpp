@@ -0,0 +1,128 @@
+#include "pch.h"
+#include "streambuffer.h"
+#include "neko_exception.h"
+
+namespace neko {
+
+  using namespace gl;
+
+  namespace {
+
+    constexpr glbinding::SharedBitfield<BufferStorageMask, MapBufferAccessMask> c_glStreamFlags =
+      ( GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT );
+
+  }
+
+  StreamBuffer::StreamBuffer( size_t frameSize )
+  {
+    GLint alignment = 0;
+    glGetIntegerv( GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment );
+    alignment_ = math::max( alignment_, static_cast<size_t>( alignment ) );
+    create( frameSize );
+  }
+
+  void StreamBuffer::create( size_t frameSize )
+  {
+    frameSize_ = ( ( frameSize + alignment_ - 1 ) / alignment_ ) * alignment_;
+    const auto bytes = static_cast<GLsizeiptr>( frameSize_ * c_frames );
+    glCreateBuffers( 1, &id_ );
+    glNamedBufferStorage( id_, bytes, nullptr, c_glStreamFlags );
+    base_ = reinterpret_cast<uint8_t*>( glMapNamedBufferRange( id_, 0, bytes, c_glStreamFlags ) );
+    if ( !base_ )
+      NEKO_EXCEPT( "Stream buffer mapping failed" );
+    stats_.capacity = frameSize_;
+  }
+
+  void StreamBuffer::grow( size_t required )
+  {
+    // The current frame's earlier allocations stay where they are; the old buffer is only released
+    // once no frame in flight can still reference it
+    retired_.emplace_back( frame_, id_ );
+    glUnmapNamedBuffer( id_ );
+    for ( auto& fence : fences_ )
+      if ( fence )
+      {
+        glDeleteSync( fence );
+        fence = nullptr;
+      }
+
+    auto size = frameSize_ * 2;
+    while ( size < required )
+      size *= 2;
+    create( size );
+    offset_ = 0;
+    stats_.grows++;
+  }
+
+  StreamBuffer::Allocation StreamBuffer::allocate( size_t bytes )
+  {
+    const auto size = ( ( bytes + alignment_ - 1 ) / alignment_ ) * alignment_;
+    if ( offset_ + size > frameSize_ )
+      grow( math::max( offset_ + size, stats_.peak ) );
+
+    Allocation ret;
+    ret.buffer = id_;
+    ret.offset = static_cast<GLintptr>( ( frame_ % c_frames ) * frameSize_ + offset_ );
+    ret.data = base_ + ret.offset;
+    ret.size = static_cast<GLsizeiptr>( bytes );
+    offset_ += size;
+    return ret;
+  }
+
+  void StreamBuffer::waitFence( size_t region )
+  {
+    auto& fence = fences_[region];
+    if ( !fence )
+      return;
+    auto result = glClientWaitSync( fence, GL_NONE_BIT, 0 );
+    if ( result == GL_TIMEOUT_EXPIRED )
+    {
+      stats_.waits++;
+      do
+        result = glClientWaitSync( fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000 );
+      while ( result == GL_TIMEOUT_EXPIRED );
+    }
+    if ( result == GL_WAIT_FAILED )
+      NEKO_EXCEPT( "Stream buffer fence wait failed" );
+    glDeleteSync( fence );
+    fence = nullptr;
+  }
+
+  void StreamBuffer::endFrame()
+  {
+    stats_.used = offset_;
+    stats_.peak = math::max( stats_.peak, offset_ );
+
+    const auto region = frame_ % c_frames;
+    if ( fences_[region] )
+      glDeleteSync( fences_[region] );
+    fences_[region] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, GL_NONE_BIT );
+
+    frame_++;
+    offset_ = 0;
+    waitFence( frame_ % c_frames );
+
+    for ( auto it = retired_.begin(); it != retired_.end(); )
+    {
+      if ( it->first + c_frames <= frame_ )
+      {
+        glDeleteBuffers( 1, &it->second );
+        it = retired_.erase( it );
+      }
+      else
+        ++it;
+    }
+  }
+
+  StreamBuffer::~StreamBuffer()
+  {
+    for ( auto& fence : fences_ )
+      if ( fence )
+        glDeleteSync( fence );
+    for ( auto& retired : retired_ )
+      glDeleteBuffers( 1, &retired.second );
+    glUnmapNamedBuffer( id_ );
+    glDeleteBuffers( 1, &id_ );
+  }
+
+}
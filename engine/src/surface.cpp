@@ -108,6 +108,51 @@ namespace neko {
         .internalformat = GL_R16F,
         .gltype = GL_HALF_FLOAT
       }
+    },
+    { PixFmtBC1,
+      {
+        .components = 3,
+        .bytes = 0, // Block compressed, see TextureCompressor::blockBytes
+        .glformat = GL_RGB,
+        .internalformat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+        .gltype = GL_UNSIGNED_BYTE
+      }
+    },
+    { PixFmtBC3,
+      {
+        .components = 4,
+        .bytes = 0, // Block compressed, see TextureCompressor::blockBytes
+        .glformat = GL_RGBA,
+        .internalformat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+        .gltype = GL_UNSIGNED_BYTE
+      }
+    },
+    { PixFmtBC4,
+      {
+        .components = 1,
+        .bytes = 0, // Block compressed, see TextureCompressor::blockBytes
+        .glformat = GL_RED,
+        .internalformat = GL_COMPRESSED_RED_RGTC1,
+        .gltype = GL_UNSIGNED_BYTE
+      }
+    },
+    { PixFmtBC5,
+      {
+        .components = 2,
+        .bytes = 0, // Block compressed, see TextureCompressor::blockBytes
+        .glformat = GL_RG,
+        .internalformat = GL_COMPRESSED_RG_RGTC2,
+        .gltype = GL_UNSIGNED_BYTE
+      }
+    },
+    { PixFmtBC7,
+      {
+        .components = 4,
+        .bytes = 0, // Block compressed, see TextureCompressor::blockBytes
+        .glformat = GL_RGBA,
+        .internalformat = GL_COMPRESSED_RGBA_BPTC_UNORM,
+        .gltype = GL_UNSIGNED_BYTE
+      }
     }
   };
 
@@ -29,16 +29,68 @@ namespace neko {
   {
     hbbuf_ = make_unique<HBBuffer>( "en" );
 
+    UErrorCode status = U_ZERO_ERROR;
+    breaker_.reset( icu::BreakIterator::createLineInstance( icu::Locale::getDefault(), status ) );
+    if ( U_FAILURE( status ) || !breaker_ )
+      NEKO_EXCEPT( "Line break iterator creation failed" );
+
     features_.push_back( features.kerning ? features::KerningOn : features::KerningOff );
     features_.push_back( features.ligatures ? features::LigatureOn : features::LigatureOff );
     features_.push_back( features.ligatures ? features::CligOn : features::CligOff );
   }
 
+  namespace {
+
+    inline bool isHardBreak( UChar c )
+    {
+      return ( c == 0x000A || c == 0x000B || c == 0x000C || c == 0x000D || c == 0x0085 || c == 0x2028 || c == 0x2029 );
+    }
+
+    constexpr size_t c_minimumGlyphCapacity = 64;
+
+    //! Glyph positions are in 1/64 pixel units from HarfBuzz, so this many fractional bits are lossless
+    constexpr int c_maxQuantShift = 6;
+
+    inline int16_t toFixed( Real value, int shift )
+    {
+      auto fixed = static_cast<int>( std::lround( value * static_cast<Real>( 1 << shift ) ) );
+      return static_cast<int16_t>( math::clamp( fixed, -32768, 32767 ) );
+    }
+
+    inline uint16_t toUnorm16( Real value )
+    {
+      return static_cast<uint16_t>( std::lround( math::clamp( value, 0.0f, 1.0f ) * 65535.0f ) );
+    }
+
+    inline uint32_t packColor( const vec4& color )
+    {
+      auto c = [&color]( int i ) { return static_cast<uint32_t>( std::lround( math::clamp( color[i], 0.0f, 1.0f ) * 255.0f ) ); };
+      return ( c( 0 ) | ( c( 1 ) << 8 ) | ( c( 2 ) << 16 ) | ( c( 3 ) << 24 ) );
+    }
+
+    inline TextAlignment resolveAlignment( TextAlignment align, bool rtl )
+    {
+      if ( align == TextAlign_Unspecified || align == TextAlign_Start )
+        return ( rtl ? TextAlign_Right : TextAlign_Left );
+      if ( align == TextAlign_End )
+        return ( rtl ? TextAlign_Left : TextAlign_Right );
+      return align;
+    }
+
+  }
+
   void Text::text( const unicodeString& text )
   {
     if ( text.compare( text_ ) == 0 || text_ == text )
       return;
 
+    // Everything before the first differing unit keeps its layout
+    int32_t common = 0;
+    const auto maxCommon = math::min( text.length(), text_.length() );
+    while ( common < maxCommon && text.charAt( common ) == text_.charAt( common ) )
+      ++common;
+
+    dirtyFrom_ = ( dirty_ ? math::min( dirtyFrom_, common ) : common );
     text_ = text;
     dirty_ = true;
   }
@@ -54,111 +106,349 @@ namespace neko {
       return;
 
     style_ = newStyle;
+    dirtyFrom_ = 0;
     dirty_ = true;
   }
 
-  void Text::regenerate()
+  void Text::markRelayout()
   {
-    if ( !dirty_ || !style_ || !style_->face()->font()->loaded() )
+    if ( !dirty_ )
+      dirtyFrom_ = numeric_limits<int32_t>::max();
+    relayout_ = true;
+    dirty_ = true;
+  }
+
+  void Text::width( Real maxWidth )
+  {
+    maxWidth = math::max( maxWidth, 0.0f );
+    if ( maxWidth == maxWidth_ )
       return;
-    
-    // TODO handle special case where textdata doesn't exist (= generate empty mesh)
 
-    hbbuf_->setFrom( style_->hbfnt_, features_, text_ );
+    maxWidth_ = maxWidth;
+    markRelayout();
+  }
 
-    const auto ascender = style_->ascender();
-    const auto descender = style_->descender();
-    const auto lineheight = ( ascender - descender );
+  void Text::alignment( TextAlignment align )
+  {
+    if ( align == alignment_ )
+      return;
 
-    vertices_.clear();
-    indices_.clear();
+    alignment_ = align;
+    markRelayout();
+  }
 
-    vec2 minpos { std::numeric_limits<Real>::max(), std::numeric_limits<Real>::max() };
-    meshDimensions_ = { 0.0f, 0.0f };
+  void Text::shapeParagraph( Paragraph& paragraph )
+  {
+    paragraph.run.clear();
+    paragraph.breaks.clear();
+    paragraph.rtl = false;
 
-    // TODO figure out the actual properties to use for offsetting, not this * 1.6f hardcoded nonsense
-    vec3 position( 0.0f, lineheight * 1.6f, 0.0f );
+    if ( paragraph.length < 1 )
+      return;
 
+    auto source = text_.getBuffer() + paragraph.start;
+    paragraph.rtl = ( ubidi_getBaseDirection( source, paragraph.length ) == UBIDI_RTL );
+
+    hbbuf_->setFrom( style_->hbfnt_, features_, text_, paragraph.start, paragraph.length );
+
+    paragraph.run.reserve( hbbuf_->count() );
     for ( unsigned int i = 0; i < hbbuf_->count(); ++i )
     {
-      auto codepoint = text_.charAt( i );
-      auto glyphindex = hbbuf_->glyphInfo()[i].codepoint;
+      const auto& ginfo = hbbuf_->glyphInfo()[i];
       const auto& gpos = hbbuf_->glyphPosition()[i];
 
-      const auto chartype = u_charType( codepoint );
-      if ( chartype == U_CONTROL_CHAR && glyphindex == 0 )
+      ShapedGlyph glyph;
+      glyph.index = ginfo.codepoint;
+      glyph.cluster = static_cast<int32_t>( ginfo.cluster );
+      glyph.advance = vec2( gpos.x_advance, gpos.y_advance ) / c_fmagic;
+      glyph.offset = vec2( gpos.x_offset, gpos.y_offset ) / c_fmagic;
+
+      // Hard breaks never reach the shaper, but other control characters (tabs etc.) might
+      auto codepoint = text_.char32At( glyph.cluster );
+      glyph.control = ( u_charType( codepoint ) == U_CONTROL_CHAR && ginfo.codepoint == 0 );
+      glyph.space = ( u_isWhitespace( codepoint ) != 0 );
+
+      paragraph.run.push_back( glyph );
+    }
+
+    // Map the break opportunities to glyph indices. Clusters are monotonic since we shape left-to-right.
+    UErrorCode status = U_ZERO_ERROR;
+    auto ut = utext_openUChars( nullptr, source, paragraph.length, &status );
+    breaker_->setText( ut, status );
+    if ( U_SUCCESS( status ) )
+    {
+      size_t glyph = 0;
+      for ( auto pos = breaker_->next(); pos != icu::BreakIterator::DONE && pos < paragraph.length; pos = breaker_->next() )
       {
-        position.x = 0.0f;
-        position.y += lineheight;
-        continue;
+        while ( glyph < paragraph.run.size() && paragraph.run[glyph].cluster < paragraph.start + pos )
+          ++glyph;
+        if ( glyph > 0 && glyph < paragraph.run.size() && ( paragraph.breaks.empty() || paragraph.breaks.back() != glyph ) )
+          paragraph.breaks.push_back( glyph );
+      }
+    }
+    utext_close( ut );
+  }
+
+  void Text::wrapParagraph( Paragraph& paragraph )
+  {
+    paragraph.rows.clear();
+
+    const auto& run = paragraph.run;
+    auto rowWidth = [&run]( size_t first, size_t last ) -> Real
+    {
+      while ( last > first && run[last - 1].space )
+        --last;
+      Real width = 0.0f;
+      for ( auto i = first; i < last; ++i )
+        width += run[i].advance.x;
+      return width;
+    };
+
+    // Greedy: take the last break opportunity that still fits. A single word wider than
+    // the wrap width overflows its row rather than being broken mid-word.
+    size_t first = 0;
+    size_t candidate = 0;
+    for ( size_t i = 0; i <= paragraph.breaks.size(); ++i )
+    {
+      const auto next = ( i < paragraph.breaks.size() ? paragraph.breaks[i] : run.size() );
+      if ( maxWidth_ > 0.0f && candidate > first && rowWidth( first, next ) > maxWidth_ )
+      {
+        paragraph.rows.push_back( { first, candidate, rowWidth( first, candidate ) } );
+        first = candidate;
+      }
+      candidate = next;
+    }
+    paragraph.rows.push_back( { first, run.size(), rowWidth( first, run.size() ) } );
+  }
+
+  void Text::emitParagraph( Paragraph& paragraph, Real alignWidth )
+  {
+    const auto baseline = ( style_->ascender() - style_->descender() );
+    const auto color = packColor( vec4( 1.0f, 1.0f, 1.0f, 1.0f ) );
+
+    paragraph.firstGlyph = vertices_.size() / 4;
+    paragraph.glyphCount = 0;
+    paragraph.min = vec2( numeric_limits<Real>::max() );
+    paragraph.max = vec2( 0.0f );
+
+    const auto align = resolveAlignment( alignment_, paragraph.rtl );
+
+    for ( size_t r = 0; r < paragraph.rows.size(); ++r )
+    {
+      const auto& row = paragraph.rows[r];
+
+      vec3 position( 0.0f, style_->ascender() + style_->lineHeight() * static_cast<Real>( paragraph.firstRow + r ), 0.0f );
+      if ( align == TextAlign_Right )
+        position.x = ( alignWidth - row.width );
+      else if ( align == TextAlign_Center )
+        position.x = ( alignWidth - row.width ) * 0.5f;
+
+      for ( auto i = row.first; i < row.last; ++i )
+      {
+        const auto& shaped = paragraph.run[i];
+        if ( shaped.control )
+        {
+          position += vec3( shaped.advance, 0.0f );
+          continue;
+        }
+
+        auto glyph = style_->getGlyph( manager_->ft(), style_->face_->face_, shaped.index );
+
+        // bearing = bitmap_left/bitmap_top
+        auto p0 = vec2(
+          ( position.x + shaped.offset.x + glyph->bearing.x ),
+          ( position.y - shaped.offset.y - glyph->bearing.y ) );
+
+        auto p1 = vec2(
+          ( p0.x + glyph->width ),
+          ( p0.y + glyph->height ) );
+
+        paragraph.min = glm::min( p0, paragraph.min );
+        paragraph.max = glm::max( p1, paragraph.max );
+
+        // Indices come from the shared quad index buffer, so only the four corners are stored
+        const int16_t x0 = toFixed( p0.x, quantShift_ ), x1 = toFixed( p1.x, quantShift_ );
+        const int16_t y0 = toFixed( baseline - p0.y, quantShift_ ), y1 = toFixed( baseline - p1.y, quantShift_ );
+        const uint16_t s0 = toUnorm16( glyph->coords[0].x ), s1 = toUnorm16( glyph->coords[1].x );
+        const uint16_t t0 = toUnorm16( glyph->coords[0].y ), t1 = toUnorm16( glyph->coords[1].y );
+        vertices_.emplace_back( x0, y0, s0, t0, color );
+        vertices_.emplace_back( x0, y1, s0, t1, color );
+        vertices_.emplace_back( x1, y1, s1, t1, color );
+        vertices_.emplace_back( x1, y0, s1, t0, color );
+
+        position += vec3( shaped.advance, 0.0f );
+        paragraph.glyphCount++;
       }
+    }
+  }
 
-      auto glyph = style_->getGlyph( manager_->ft(), style_->face_->face_, glyphindex );
-      auto offset = vec2( gpos.x_offset, gpos.y_offset ) / c_fmagic;
-      auto advance = ( vec2( gpos.x_advance, gpos.y_advance ) / c_fmagic );
+  void Text::updateDimensions()
+  {
+    vec2 minpos { numeric_limits<Real>::max() };
+    vec2 maxpos { 0.0f };
+    bool any = false;
 
-      // bearing = bitmap_left/bitmap_top
-      auto p0 = vec2(
-        ( position.x + offset.x + glyph->bearing.x ),
-        ( position.y - offset.y - glyph->bearing.y ) );
+    for ( const auto& paragraph : paragraphs_ )
+    {
+      if ( !paragraph.glyphCount )
+        continue;
+      minpos = glm::min( paragraph.min, minpos );
+      maxpos = glm::max( paragraph.max, maxpos );
+      any = true;
+    }
 
-      auto p1 = vec2(
-        ( p0.x + glyph->width ),
-        ( p0.y + glyph->height ) );
+    meshDimensions_ = ( any ? maxpos - minpos : vec2( 0.0f ) );
+  }
 
-      auto color = vec4( 1.0f, 1.0f, 1.0f, 1.0f );
+  void Text::emitFrom( size_t first, Real alignWidth )
+  {
+    const auto firstGlyph = ( first > 0 ? paragraphs_[first - 1].firstGlyph + paragraphs_[first - 1].glyphCount : 0 );
+    vertices_.resize( firstGlyph * 4 );
+    uploadFrom_ = math::min( uploadFrom_, firstGlyph );
 
-      minpos.x = math::min( p0.x, minpos.x );
-      minpos.y = math::min( p0.y, minpos.y );
-      meshDimensions_.x = math::max( p1.x, meshDimensions_.x );
-      meshDimensions_.y = math::max( p1.y, meshDimensions_.y );
+    for ( auto i = first; i < paragraphs_.size(); ++i )
+      emitParagraph( paragraphs_[i], alignWidth );
+  }
 
-      auto index = static_cast<VertexIndex>( vertices_.size() );
-      vertices_.emplace_back( vec3( p0.x, lineheight - p0.y, position.z ), vec2( glyph->coords[0].x, glyph->coords[0].y ), color );
-      vertices_.emplace_back( vec3( p0.x, lineheight - p1.y, position.z ), vec2( glyph->coords[0].x, glyph->coords[1].y ), color );
-      vertices_.emplace_back( vec3( p1.x, lineheight - p1.y, position.z ), vec2( glyph->coords[1].x, glyph->coords[1].y ), color );
-      vertices_.emplace_back( vec3( p1.x, lineheight - p0.y, position.z ), vec2( glyph->coords[1].x, glyph->coords[0].y ), color );
+  int Text::requiredQuantShift() const
+  {
+    const auto baseline = ( style_->ascender() - style_->descender() );
 
-      Indices idcs = { index + 0, index + 1, index + 2, index + 0, index + 2, index + 3 };
-      indices_.insert( indices_.end(), idcs.begin(), idcs.end() );
+    Real extent = 0.0f;
+    for ( const auto& paragraph : paragraphs_ )
+    {
+      if ( !paragraph.glyphCount )
+        continue;
+      extent = math::max( { extent, math::abs( paragraph.min.x ), math::abs( paragraph.max.x ),
+        math::abs( baseline - paragraph.min.y ), math::abs( baseline - paragraph.max.y ) } );
+    }
+
+    auto shift = c_maxQuantShift;
+    while ( shift > 0 && extent * static_cast<Real>( 1 << shift ) > 32767.0f )
+      --shift;
+    return shift;
+  }
 
-      position += vec3( advance, 0.0f );
+  void Text::regenerate()
+  {
+    if ( !dirty_ || !style_ || !style_->face()->font()->loaded() )
+      return;
+
+    // Paragraphs that end before the first changed unit keep their shaped runs and breaks.
+    // One ending in a lone CR is reshaped if the change begins right after it,
+    // since an appended LF would turn it into a single CRLF break.
+    size_t keep = 0;
+    while ( keep < paragraphs_.size() )
+    {
+      const auto& paragraph = paragraphs_[keep];
+      if ( paragraph.end() > dirtyFrom_ )
+        break;
+      if ( paragraph.end() == dirtyFrom_ && ( paragraph.breakLength == 0 ||
+        ( paragraph.breakLength == 1 && text_.charAt( paragraph.start + paragraph.length ) == 0x000D ) ) )
+        break;
+      ++keep;
+    }
+    paragraphs_.resize( keep );
+
+    // There's always a final paragraph without a break, even if empty
+    if ( paragraphs_.empty() || paragraphs_.back().breakLength > 0 )
+    {
+      int32_t start = ( paragraphs_.empty() ? 0 : paragraphs_.back().end() );
+      while ( true )
+      {
+        Paragraph paragraph;
+        paragraph.start = start;
+        while ( paragraph.start + paragraph.length < text_.length() && !isHardBreak( text_.charAt( paragraph.start + paragraph.length ) ) )
+          paragraph.length++;
+
+        const auto brk = paragraph.start + paragraph.length;
+        if ( brk < text_.length() )
+          paragraph.breakLength = ( text_.charAt( brk ) == 0x000D && brk + 1 < text_.length() && text_.charAt( brk + 1 ) == 0x000A ) ? 2 : 1;
+
+        shapeParagraph( paragraph );
+        paragraphs_.push_back( move( paragraph ) );
+
+        if ( paragraphs_.back().breakLength == 0 )
+          break;
+        start = paragraphs_.back().end();
+      }
+    }
+
+    // Wrapping only depends on the cached runs, so a width change never reshapes
+    size_t from = ( relayout_ ? 0 : keep );
+    for ( auto i = from; i < paragraphs_.size(); ++i )
+    {
+      auto& paragraph = paragraphs_[i];
+      paragraph.firstRow = ( i > 0 ? paragraphs_[i - 1].firstRow + paragraphs_[i - 1].rows.size() : 0 );
+      wrapParagraph( paragraph );
     }
 
-    meshDimensions_ -= minpos;
+    // Without a wrap width, align against the widest row. If that changed, any paragraph
+    // that isn't left aligned moves too, so everything gets emitted again.
+    auto alignWidth = maxWidth_;
+    bool leftOnly = true;
+    for ( const auto& paragraph : paragraphs_ )
+    {
+      leftOnly = leftOnly && ( resolveAlignment( alignment_, paragraph.rtl ) == TextAlign_Left );
+      if ( maxWidth_ <= 0.0f )
+        for ( const auto& row : paragraph.rows )
+          alignWidth = math::max( alignWidth, row.width );
+    }
+    if ( !leftOnly && alignWidth != layoutWidth_ )
+      from = 0;
+    layoutWidth_ = alignWidth;
 
+    emitFrom( from, alignWidth );
+
+    // Keep as much fixed point precision as the extents allow; requantize everything when that changes
+    const auto shift = requiredQuantShift();
+    if ( shift != quantShift_ )
+    {
+      quantShift_ = shift;
+      emitFrom( 0, alignWidth );
+    }
+
+    updateDimensions();
+
+    relayout_ = false;
     dirty_ = false;
   }
 
   void Text::update( Renderer& renderer )
   {
-    bool wasDirty = dirty_;
     regenerate();
-   
-    if ( wasDirty && mesh_ )
-      mesh_.reset();
-    if ( !mesh_ && !vertices_.empty() && !indices_.empty() )
+
+    const auto glyphCount = vertices_.size() / 4;
+    if ( !mesh_ && !glyphCount )
+      return;
+
+    // Grow geometrically so that typing doesn't reallocate the buffers on every keystroke.
+    // The old mesh may still be drawn by frames in flight, so the manager holds on to it for a while.
+    if ( !mesh_ || mesh_->quadCapacity() < glyphCount )
     {
-      mesh_ = make_unique<TextRenderBuffer>(
-        static_cast<gl::GLuint>( vertices_.size() ),
-        static_cast<gl::GLuint>( indices_.size() ) );
-      const auto& verts = mesh_->buffer().lock();
-      const auto& indcs = mesh_->indices().lock();
-      memcpy( verts.data(), vertices_.data(), vertices_.size() * sizeof( VertexText ) );
-      memcpy( indcs.data(), indices_.data(), indices_.size() * sizeof( GLuint ) );
-      mesh_->buffer().unlock();
-      mesh_->indices().unlock();
+      const auto capacity = math::max( { glyphCount, ( mesh_ ? mesh_->quadCapacity() * 2 : 0 ), c_minimumGlyphCapacity } );
+      if ( mesh_ )
+        manager_->retireMesh( move( mesh_ ) );
+      mesh_ = make_unique<TextRenderBuffer>( static_cast<gl::GLuint>( capacity ), manager_->quadIndices() );
     }
+
+    // Only the glyphs from the first changed line onwards need to be written, into each frame's copy in turn
+    mesh_->invalidate( uploadFrom_ );
+    uploadFrom_ = glyphCount;
+    mesh_->upload( renderer.stream().frame(), vertices_ );
   }
 
-  void Text::draw( Renderer& renderer, const mat4& modelMatrix )
+  void Text::record( RenderCommandList& list, const mat4& modelMatrix, Real depth )
   {
-    if ( !mesh_ || !style_ )
+    if ( !mesh_ || !style_ || vertices_.empty() )
       return;
     if ( style_ && style_->material_ )
     {
-      mesh_->draw( renderer.shaders(), modelMatrix,
-        style_->material_->textureHandle( 0 )
+      mesh_->record( list, modelMatrix,
+        style_->material_->textureHandle( 0 ),
+        static_cast<gl::GLsizei>( vertices_.size() / 4 ),
+        1.0f / static_cast<Real>( 1 << quantShift_ ),
+        depth
       );
     }
   }
@@ -29,6 +29,35 @@ namespace neko {
     assert( handle_ );
   }
 
+  Texture::Texture( Renderer* renderer, int width, int height, PixelFormat format, int levels,
+    const Wrapping wrapping, const Filtering filtering ):
+    Surface( renderer, width, height, format ),
+    type_( Tex2D ), multisamples_( 1 ), levels_( levels )
+  {
+    assert( levels_ > 0 );
+    handle_ = renderer_->implCreateTexture2D(
+      width_, height_, glFormat_, internalFormat_, internalType_,
+      nullptr, glWrappingFromType( wrapping ), filtering, 1, levels_ );
+    assert( handle_ );
+  }
+
+  Texture::Texture( Renderer* renderer, const CompressedImage& image, const Wrapping wrapping,
+    const Filtering filtering ):
+    Surface( renderer, image.levels.front().width, image.levels.front().height, image.format ),
+    type_( Tex2D ), multisamples_( 1 ), levels_( static_cast<int>( image.levels.size() ) )
+  {
+    handle_ = renderer_->implCreateTexture2D(
+      width_, height_, glFormat_, internalFormat_, internalType_,
+      nullptr, glWrappingFromType( wrapping ), filtering, 1, levels_ );
+    assert( handle_ );
+    for ( int i = 0; i < levels_; ++i )
+    {
+      const auto& level = image.levels[i];
+      glCompressedTextureSubImage2D( handle_, i, 0, 0, level.width, level.height, internalFormat_,
+        static_cast<GLsizei>( level.data.size() ), level.data.data() );
+    }
+  }
+
   Texture::Texture( Renderer* renderer, int width, int height, int depth,
     PixelFormat format, const void* data, const Wrapping wrapping,
     const Filtering filtering, int multisamples ):
@@ -78,7 +107,7 @@ namespace neko {
   //! Called by Texture::Texture()
   GLuint Renderer::implCreateTexture2D( int width, int height,
   GLGraphicsFormat format, GLGraphicsFormat internalFormat, GLGraphicsFormat internalType,
-  const void* data, GLWrapMode wrap, Texture::Filtering filtering, int samples )
+  const void* data, GLWrapMode wrap, Texture::Filtering filtering, int samples, int levels )
   {
     assert( width <= info_.maxTextureSize && height <= info_.maxTextureSize );
 
@@ -96,12 +125,12 @@ namespace neko {
     if ( samples > 1 )
       glTextureStorage2DMultisample( handle, samples, internalFormat, width, height, true );
     else
-      glTextureStorage2D( handle, 1, internalFormat, width, height );
+      glTextureStorage2D( handle, levels, internalFormat, width, height );
 
     if ( data )
       glTextureSubImage2D( handle, 0, 0, 0, width, height, format, internalType, data );
 
-    if ( filtering == Texture::Mipmapped )
+    if ( filtering == Texture::Mipmapped && data )
       glGenerateTextureMipmap( handle );
 
     return handle;
@@ -170,6 +199,13 @@ namespace neko {
     glTextureSubImage2D( handle_, 0, offset.x, offset.y, width, height, glFormat_, internalType_, data );
   }
 
+  void Texture::writeLevel( int level, const void* data )
+  {
+    assert( data && level >= 0 && level < levels_ );
+    glTextureSubImage2D( handle_, level, 0, 0, math::max( width_ >> level, 1 ), math::max( height_ >> level, 1 ),
+      glFormat_, internalType_, data );
+  }
+
   Texture::~Texture()
   {
     if ( handle_ )
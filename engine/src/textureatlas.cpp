@@ -3,6 +3,7 @@
 #include "texture.h"
 #include "renderer.h"
 #include "textureatlas.h"
+#include "neko_exception.h"
 
 namespace neko {
 
@@ -186,4 +187,14 @@ namespace neko {
     dirty_ = true;
   }
 
+  void TextureAtlas::restore( const vector<vec3i>& nodes, size_t used, const uint8_t* data, size_t length )
+  {
+    if ( nodes.empty() || length != data_.size() )
+      NEKO_EXCEPT( "Texture atlas restore data mismatch" );
+    nodes_ = nodes;
+    used_ = used;
+    memcpy( data_.data(), data, length );
+    dirty_ = true;
+  }
+
 }
\ No newline at end of file
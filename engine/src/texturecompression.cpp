@@ -0,0 +1,593 @@
+#include "pch.h"
+#include "texturecompression.h"
+#include "materials.h"
+#include "utilities.h"
+#include "locator.h"
+#include "console.h"
+#include "filesystem.h"
+#include "profiler.h"
+
+namespace neko {
+
+  namespace {
+
+    //! A 4x4 block as channel planes, for four pixels per SSE op.
+    struct Block
+    {
+      alignas( 16 ) float ch[4][16];
+    };
+
+    constexpr int c_bc7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    void fetchBlock( const Pixmap& image, int components, int bx, int by, Block& out )
+    {
+      const auto data = image.data().data();
+      for ( int y = 0; y < 4; ++y )
+      {
+        const auto sy = math::min( by * 4 + y, image.height() - 1 );
+        for ( int x = 0; x < 4; ++x )
+        {
+          const auto sx = math::min( bx * 4 + x, image.width() - 1 );
+          const auto pixel = data + ( static_cast<size_t>( sy ) * image.width() + sx ) * components;
+          for ( int c = 0; c < 4; ++c )
+            out.ch[c][y * 4 + x] = ( c < components ? pixel[c] : ( c == 3 ? 255.0f : 0.0f ) );
+        }
+      }
+    }
+
+    //! Mean and dominant direction of the block's pixels. False for a flat block.
+    bool principalAxis( const Block& b, int channels, float* mean, float* axis )
+    {
+      float lo[4], hi[4];
+      for ( int c = 0; c < channels; ++c )
+      {
+        mean[c] = 0.0f;
+        lo[c] = hi[c] = b.ch[c][0];
+        for ( int i = 0; i < 16; ++i )
+        {
+          mean[c] += b.ch[c][i];
+          lo[c] = math::min( lo[c], b.ch[c][i] );
+          hi[c] = math::max( hi[c], b.ch[c][i] );
+        }
+        mean[c] *= ( 1.0f / 16.0f );
+      }
+
+      float cov[4][4] = {};
+      for ( int i = 0; i < 16; ++i )
+        for ( int c = 0; c < channels; ++c )
+          for ( int d = c; d < channels; ++d )
+            cov[c][d] += ( b.ch[c][i] - mean[c] ) * ( b.ch[d][i] - mean[d] );
+      for ( int c = 0; c < channels; ++c )
+        for ( int d = 0; d < c; ++d )
+          cov[c][d] = cov[d][c];
+
+      // Power iteration, seeded with the bounding box diagonal
+      float length = 0.0f;
+      for ( int c = 0; c < channels; ++c )
+      {
+        axis[c] = hi[c] - lo[c];
+        length += axis[c] * axis[c];
+      }
+      if ( length < 1.0f )
+        return false;
+      for ( int iteration = 0; iteration < 8; ++iteration )
+      {
+        float next[4] = {};
+        for ( int c = 0; c < channels; ++c )
+          for ( int d = 0; d < channels; ++d )
+            next[c] += cov[c][d] * axis[d];
+        length = 0.0f;
+        for ( int c = 0; c < channels; ++c )
+          length += next[c] * next[c];
+        if ( length < 1e-12f )
+          return true; // Degenerate covariance, keep the diagonal
+        const auto scale = 1.0f / std::sqrt( length );
+        for ( int c = 0; c < channels; ++c )
+          axis[c] = next[c] * scale;
+      }
+      return true;
+    }
+
+    void lineEndpoints( const Block& b, int channels, const float* mean, const float* axis, float* e0, float* e1 )
+    {
+      float lo = std::numeric_limits<float>::max();
+      float hi = -lo;
+      for ( int i = 0; i < 16; ++i )
+      {
+        float t = 0.0f;
+        for ( int c = 0; c < channels; ++c )
+          t += ( b.ch[c][i] - mean[c] ) * axis[c];
+        lo = math::min( lo, t );
+        hi = math::max( hi, t );
+      }
+      for ( int c = 0; c < channels; ++c )
+      {
+        e0[c] = math::clamp( mean[c] + axis[c] * lo, 0.0f, 255.0f );
+        e1[c] = math::clamp( mean[c] + axis[c] * hi, 0.0f, 255.0f );
+      }
+    }
+
+    //! Nearest of steps evenly spaced points from e0 to e1, by projection onto the line.
+    void fitIndices( const Block& b, int channels, const float* e0, const float* e1, int steps, int* indices )
+    {
+      float d[4];
+      float dd = 0.0f;
+      for ( int c = 0; c < channels; ++c )
+      {
+        d[c] = e1[c] - e0[c];
+        dd += d[c] * d[c];
+      }
+      if ( dd < 1e-6f )
+      {
+        for ( int i = 0; i < 16; ++i )
+          indices[i] = 0;
+        return;
+      }
+
+      const auto scale = _mm_set1_ps( static_cast<float>( steps - 1 ) / dd );
+      const auto top = _mm_set1_ps( static_cast<float>( steps - 1 ) );
+      const auto zero = _mm_setzero_ps();
+      for ( int i = 0; i < 16; i += 4 )
+      {
+        auto t = _mm_setzero_ps();
+        for ( int c = 0; c < channels; ++c )
+        {
+          const auto delta = _mm_sub_ps( _mm_load_ps( &b.ch[c][i] ), _mm_set1_ps( e0[c] ) );
+          t = _mm_add_ps( t, _mm_mul_ps( delta, _mm_set1_ps( d[c] ) ) );
+        }
+        t = _mm_min_ps( _mm_max_ps( _mm_mul_ps( t, scale ), zero ), top );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( &indices[i] ), _mm_cvtps_epi32( t ) );
+      }
+    }
+
+    //! Least squares endpoints for fixed interpolation weights. False if the weights don't pin down a line.
+    bool refineEndpoints( const Block& b, int channels, const float* weights, float* e0, float* e1 )
+    {
+      float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+      float x[4] = {}, y[4] = {};
+      for ( int i = 0; i < 16; ++i )
+      {
+        const auto w = weights[i];
+        const auto iw = 1.0f - w;
+        aa += iw * iw;
+        ab += iw * w;
+        bb += w * w;
+        for ( int c = 0; c < channels; ++c )
+        {
+          x[c] += iw * b.ch[c][i];
+          y[c] += w * b.ch[c][i];
+        }
+      }
+      const auto det = aa * bb - ab * ab;
+      if ( math::abs( det ) < 1e-6f )
+        return false;
+      const auto inv = 1.0f / det;
+      for ( int c = 0; c < channels; ++c )
+      {
+        e0[c] = math::clamp( ( bb * x[c] - ab * y[c] ) * inv, 0.0f, 255.0f );
+        e1[c] = math::clamp( ( aa * y[c] - ab * x[c] ) * inv, 0.0f, 255.0f );
+      }
+      return true;
+    }
+
+    //! Little endian bit packer for 128 bit blocks.
+    struct BitWriter
+    {
+      uint8_t* out;
+      int position = 0;
+      void write( uint32_t value, int bits )
+      {
+        for ( int i = 0; i < bits; ++i, ++position )
+          if ( value & ( 1u << i ) )
+            out[position >> 3] |= static_cast<uint8_t>( 1u << ( position & 7 ) );
+      }
+    };
+
+    // BC1
+
+    inline uint16_t pack565( const float* color )
+    {
+      const auto r = static_cast<uint16_t>( color[0] * ( 31.0f / 255.0f ) + 0.5f );
+      const auto g = static_cast<uint16_t>( color[1] * ( 63.0f / 255.0f ) + 0.5f );
+      const auto b = static_cast<uint16_t>( color[2] * ( 31.0f / 255.0f ) + 0.5f );
+      return static_cast<uint16_t>( ( r << 11 ) | ( g << 5 ) | b );
+    }
+
+    inline void unpack565( uint16_t value, float* color )
+    {
+      const auto r = ( value >> 11 ) & 31;
+      const auto g = ( value >> 5 ) & 63;
+      const auto b = value & 31;
+      color[0] = static_cast<float>( ( r << 3 ) | ( r >> 2 ) );
+      color[1] = static_cast<float>( ( g << 2 ) | ( g >> 4 ) );
+      color[2] = static_cast<float>( ( b << 3 ) | ( b >> 2 ) );
+    }
+
+    float lineError( const Block& b, int channels, const float* e0, const float* e1, const int* indices, int steps )
+    {
+      float error = 0.0f;
+      for ( int i = 0; i < 16; ++i )
+      {
+        const auto w = static_cast<float>( indices[i] ) / static_cast<float>( steps - 1 );
+        for ( int c = 0; c < channels; ++c )
+        {
+          const auto delta = e0[c] + ( e1[c] - e0[c] ) * w - b.ch[c][i];
+          error += delta * delta;
+        }
+      }
+      return error;
+    }
+
+    void encodeBC1( const Block& b, uint8_t* out )
+    {
+      float mean[4], axis[4], e0[4], e1[4];
+      uint16_t best0 = 0, best1 = 0;
+      int bestIndices[16] = {};
+
+      if ( !principalAxis( b, 3, mean, axis ) )
+      {
+        best0 = best1 = pack565( mean );
+      }
+      else
+      {
+        lineEndpoints( b, 3, mean, axis, e0, e1 );
+        auto bestError = std::numeric_limits<float>::max();
+        for ( int iteration = 0; iteration < 2; ++iteration )
+        {
+          const auto q0 = pack565( e0 );
+          const auto q1 = pack565( e1 );
+          float d0[3], d1[3];
+          unpack565( q0, d0 );
+          unpack565( q1, d1 );
+          int indices[16];
+          fitIndices( b, 3, d0, d1, 4, indices );
+          const auto error = lineError( b, 3, d0, d1, indices, 4 );
+          if ( error < bestError )
+          {
+            bestError = error;
+            best0 = q0;
+            best1 = q1;
+            memcpy( bestIndices, indices, sizeof( indices ) );
+          }
+          float weights[16];
+          for ( int i = 0; i < 16; ++i )
+            weights[i] = static_cast<float>( indices[i] ) / 3.0f;
+          if ( !refineEndpoints( b, 3, weights, e0, e1 ) )
+            break;
+        }
+      }
+
+      // Four color mode needs the first endpoint larger; equal endpoints can only use index 0
+      if ( best0 < best1 )
+      {
+        std::swap( best0, best1 );
+        for ( auto& index : bestIndices )
+          index = 3 - index;
+      }
+      else if ( best0 == best1 )
+        memset( bestIndices, 0, sizeof( bestIndices ) );
+
+      constexpr uint32_t c_order[4] = { 0, 2, 3, 1 }; // Line position to BC1 palette index
+      uint32_t bits = 0;
+      for ( int i = 0; i < 16; ++i )
+        bits |= c_order[bestIndices[i]] << ( i * 2 );
+      out[0] = static_cast<uint8_t>( best0 & 0xFF );
+      out[1] = static_cast<uint8_t>( best0 >> 8 );
+      out[2] = static_cast<uint8_t>( best1 & 0xFF );
+      out[3] = static_cast<uint8_t>( best1 >> 8 );
+      memcpy( out + 4, &bits, 4 );
+    }
+
+    // BC4, also the alpha half of BC3 and both halves of BC5
+
+    void encodeBC4( const Block& b, int channel, uint8_t* out )
+    {
+      float lo = b.ch[channel][0];
+      float hi = lo;
+      for ( int i = 1; i < 16; ++i )
+      {
+        lo = math::min( lo, b.ch[channel][i] );
+        hi = math::max( hi, b.ch[channel][i] );
+      }
+      const auto r0 = static_cast<uint8_t>( hi + 0.5f );
+      const auto r1 = static_cast<uint8_t>( lo + 0.5f );
+      out[0] = r0;
+      out[1] = r1;
+      memset( out + 2, 0, 6 );
+      if ( r0 == r1 )
+        return;
+
+      // Eight value mode: 0 is r0, 1 is r1, 2...7 step from r0 towards r1
+      Block plane;
+      memcpy( plane.ch[0], b.ch[channel], sizeof( plane.ch[0] ) );
+      const float e0 = r0;
+      const float e1 = r1;
+      int indices[16];
+      fitIndices( plane, 1, &e0, &e1, 8, indices );
+      uint64_t bits = 0;
+      for ( int i = 0; i < 16; ++i )
+      {
+        const auto t = indices[i];
+        const uint64_t code = ( t == 0 ? 0 : t == 7 ? 1 : t + 1 );
+        bits |= code << ( i * 3 );
+      }
+      for ( int i = 0; i < 6; ++i )
+        out[2 + i] = static_cast<uint8_t>( bits >> ( i * 8 ) );
+    }
+
+    // BC7, mode 6 only: one subset, 7.7.7.7 endpoints with a p-bit each, 4 bit indices
+
+    void quantizeBC7( const float* endpoint, uint32_t* q, uint32_t& pbit, float* dequantized )
+    {
+      auto bestError = std::numeric_limits<float>::max();
+      for ( uint32_t p = 0; p < 2; ++p )
+      {
+        float error = 0.0f;
+        uint32_t candidate[4];
+        float values[4];
+        for ( int c = 0; c < 4; ++c )
+        {
+          const auto v = math::clamp( ( endpoint[c] - static_cast<float>( p ) ) * 0.5f + 0.5f, 0.0f, 127.0f );
+          candidate[c] = static_cast<uint32_t>( v );
+          values[c] = static_cast<float>( ( candidate[c] << 1 ) | p );
+          error += ( values[c] - endpoint[c] ) * ( values[c] - endpoint[c] );
+        }
+        if ( error < bestError )
+        {
+          bestError = error;
+          pbit = p;
+          memcpy( q, candidate, sizeof( candidate ) );
+          memcpy( dequantized, values, sizeof( values ) );
+        }
+      }
+    }
+
+    float bc7Indices( const Block& b, const float* d0, const float* d1, int* indices )
+    {
+      // Projection gets within one step of the nearest palette entry, the neighbours settle it
+      fitIndices( b, 4, d0, d1, 16, indices );
+      float error = 0.0f;
+      for ( int i = 0; i < 16; ++i )
+      {
+        auto best = std::numeric_limits<float>::max();
+        const auto center = indices[i];
+        for ( int k = math::max( center - 1, 0 ); k <= math::min( center + 1, 15 ); ++k )
+        {
+          float e = 0.0f;
+          for ( int c = 0; c < 4; ++c )
+          {
+            const auto a = static_cast<int>( d0[c] );
+            const auto z = static_cast<int>( d1[c] );
+            const auto value = static_cast<float>( ( a * ( 64 - c_bc7Weights[k] ) + z * c_bc7Weights[k] + 32 ) >> 6 );
+            e += ( value - b.ch[c][i] ) * ( value - b.ch[c][i] );
+          }
+          if ( e < best )
+          {
+            best = e;
+            indices[i] = k;
+          }
+        }
+        error += best;
+      }
+      return error;
+    }
+
+    void encodeBC7( const Block& b, uint8_t* out )
+    {
+      float mean[4], axis[4], e0[4], e1[4];
+      if ( principalAxis( b, 4, mean, axis ) )
+        lineEndpoints( b, 4, mean, axis, e0, e1 );
+      else
+      {
+        memcpy( e0, mean, sizeof( e0 ) );
+        memcpy( e1, mean, sizeof( e1 ) );
+      }
+
+      uint32_t best[2][4] = {}, bestP[2] = {};
+      int bestIndices[16] = {};
+      auto bestError = std::numeric_limits<float>::max();
+      for ( int iteration = 0; iteration < 2; ++iteration )
+      {
+        uint32_t q[2][4], p[2];
+        float d0[4], d1[4];
+        quantizeBC7( e0, q[0], p[0], d0 );
+        quantizeBC7( e1, q[1], p[1], d1 );
+        int indices[16];
+        const auto error = bc7Indices( b, d0, d1, indices );
+        if ( error < bestError )
+        {
+          bestError = error;
+          memcpy( best, q, sizeof( q ) );
+          memcpy( bestP, p, sizeof( p ) );
+          memcpy( bestIndices, indices, sizeof( indices ) );
+        }
+        float weights[16];
+        for ( int i = 0; i < 16; ++i )
+          weights[i] = static_cast<float>( c_bc7Weights[indices[i]] ) / 64.0f;
+        if ( !refineEndpoints( b, 4, weights, e0, e1 ) )
+          break;
+      }
+
+      // The anchor index is stored without its top bit, so it must be below 8
+      if ( bestIndices[0] >= 8 )
+      {
+        std::swap( best[0], best[1] );
+        std::swap( bestP[0], bestP[1] );
+        for ( auto& index : bestIndices )
+          index = 15 - index;
+      }
+
+      memset( out, 0, 16 );
+      BitWriter writer { out };
+      writer.write( 1u << 6, 7 );
+      for ( int c = 0; c < 4; ++c )
+      {
+        writer.write( best[0][c], 7 );
+        writer.write( best[1][c], 7 );
+      }
+      writer.write( bestP[0], 1 );
+      writer.write( bestP[1], 1 );
+      writer.write( static_cast<uint32_t>( bestIndices[0] ), 3 );
+      for ( int i = 1; i < 16; ++i )
+        writer.write( static_cast<uint32_t>( bestIndices[i] ), 4 );
+    }
+
+    void encodeBlock( const Block& b, PixelFormat format, uint8_t* out )
+    {
+      switch ( format )
+      {
+        case PixFmtBC1:
+          encodeBC1( b, out );
+          break;
+        case PixFmtBC3:
+          encodeBC4( b, 3, out );
+          encodeBC1( b, out + 8 );
+          break;
+        case PixFmtBC4:
+          encodeBC4( b, 0, out );
+          break;
+        case PixFmtBC5:
+          encodeBC4( b, 0, out );
+          encodeBC4( b, 1, out + 8 );
+          break;
+        case PixFmtBC7:
+          encodeBC7( b, out );
+          break;
+        default:
+          break;
+      }
+    }
+
+    uint64_t cacheKey( const Pixmap& image, PixelFormat format, bool mipmapped )
+    {
+      const uint32_t header[5] = { TextureCompressor::c_cacheVersion, static_cast<uint32_t>( format ),
+        static_cast<uint32_t>( image.width() ), static_cast<uint32_t>( image.height() ), mipmapped ? 1u : 0u };
+      const auto seed = utils::hash64( header, sizeof( header ) );
+      return utils::hash64( image.data().data(), image.data().size(), seed );
+    }
+
+    bool loadCached( uint64_t key, PixelFormat format, CompressedImage& out )
+    {
+      char filename[64];
+      sprintf_s( filename, 64, "texture_%016llx.bin", static_cast<unsigned long long>( key ) );
+      if ( !Locator::fileSystem().fileStat( Dir_Cache, platform::utf8ToWide( filename ) ) )
+        return false;
+
+      try
+      {
+        auto reader = Locator::fileSystem().openFile( Dir_Cache, filename );
+        if ( reader->readUint32() != TextureCompressor::c_cacheMagic ||
+          reader->readUint32() != TextureCompressor::c_cacheVersion || reader->readUint64() != key )
+          return false;
+        out.format = format;
+        out.levels.resize( reader->readUint32() );
+        for ( auto& level : out.levels )
+        {
+          level.width = static_cast<int>( reader->readUint32() );
+          level.height = static_cast<int>( reader->readUint32() );
+          level.data.resize( reader->readUint32() );
+          reader->read( level.data.data(), static_cast<uint32_t>( level.data.size() ) );
+        }
+      }
+      catch ( std::exception& e )
+      {
+        Locator::console().printf( srcLoader, "Discarding texture cache %s: %s", filename, e.what() );
+        out.reset();
+        return false;
+      }
+
+      return true;
+    }
+
+    void saveCached( uint64_t key, const CompressedImage& image )
+    {
+      char filename[64];
+      sprintf_s( filename, 64, "texture_%016llx.bin", static_cast<unsigned long long>( key ) );
+      try
+      {
+        auto writer = Locator::fileSystem().createFile( Dir_Cache, filename );
+        writer->writeUint32( TextureCompressor::c_cacheMagic );
+        writer->writeUint32( TextureCompressor::c_cacheVersion );
+        writer->writeUint64( key );
+        writer->writeUint32( static_cast<uint32_t>( image.levels.size() ) );
+        for ( const auto& level : image.levels )
+        {
+          writer->writeUint32( static_cast<uint32_t>( level.width ) );
+          writer->writeUint32( static_cast<uint32_t>( level.height ) );
+          writer->writeUint32( static_cast<uint32_t>( level.data.size() ) );
+          writer->writeBlob( level.data.data(), static_cast<uint32_t>( level.data.size() ) );
+        }
+      }
+      catch ( std::exception& e )
+      {
+        Locator::console().printf( srcLoader, "Failed to write texture cache %s: %s", filename, e.what() );
+      }
+    }
+
+  }
+
+  bool TextureCompressor::isCompressed( PixelFormat format )
+  {
+    return ( format == PixFmtBC1 || format == PixFmtBC3 || format == PixFmtBC4 || format == PixFmtBC5 ||
+             format == PixFmtBC7 );
+  }
+
+  bool TextureCompressor::compressible( const Material& mat, const Pixmap& image )
+  {
+    const auto& fmt = c_pixelFormatData.at( image.format() );
+    return ( mat.wantCompression_ && mat.arrayDepth_ == 1 && fmt.bytes == fmt.components );
+  }
+
+  size_t TextureCompressor::blockBytes( PixelFormat format )
+  {
+    return ( format == PixFmtBC1 || format == PixFmtBC4 ? 8 : 16 );
+  }
+
+  void TextureCompressor::encode( const Pixmap& image, PixelFormat format, CompressedLevel& out )
+  {
+    NEKO_PROFILE_FUNCTION();
+
+    const auto& fmt = c_pixelFormatData.at( image.format() );
+    if ( !isCompressed( format ) || fmt.bytes != fmt.components )
+      NEKO_EXCEPT( "Unsupported format pair passed to TextureCompressor::encode" );
+
+    const auto blocksX = ( image.width() + 3 ) / 4;
+    const auto blocksY = ( image.height() + 3 ) / 4;
+    const auto stride = blockBytes( format );
+    out.width = image.width();
+    out.height = image.height();
+    out.data.resize( static_cast<size_t>( blocksX ) * blocksY * stride );
+
+    vector<int> rows( blocksY );
+    for ( int y = 0; y < blocksY; ++y )
+      rows[y] = y;
+    std::for_each( std::execution::par, rows.begin(), rows.end(), [&]( int by ) {
+      Block block;
+      auto dst = out.data.data() + static_cast<size_t>( by ) * blocksX * stride;
+      for ( int bx = 0; bx < blocksX; ++bx, dst += stride )
+      {
+        fetchBlock( image, fmt.components, bx, by, block );
+        encodeBlock( block, format, dst );
+      }
+    } );
+  }
+
+  void TextureCompressor::encodeLayer( MaterialLayer& layer, PixelFormat format, bool mipmapped )
+  {
+    auto& out = layer.compressed_;
+    const auto key = cacheKey( layer.image_, format, mipmapped );
+    if ( !loadCached( key, format, out ) )
+    {
+      if ( mipmapped )
+        layer.buildMipChain();
+      out.format = format;
+      out.levels.resize( layer.levels() );
+      for ( int i = 0; i < layer.levels(); ++i )
+        encode( layer.level( i ), format, out.levels[i] );
+      saveCached( key, out );
+    }
+    layer.image_.reset();
+    layer.mips_.clear();
+  }
+
+}
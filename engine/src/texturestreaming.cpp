@@ -0,0 +1,282 @@
+#include "pch.h"
+#include "texturestreaming.h"
+#include "renderer.h"
+#include "camera.h"
+#include "console.h"
+#include "profiler.h"
+
+namespace neko {
+
+  using namespace gl;
+
+  NEKO_DECLARE_CONVAR( tex_streaming, "Whether to stream mipmapped textures by usage. Applies to textures loaded afterwards.", true );
+  NEKO_DECLARE_CONVAR( tex_budget, "Texture streaming memory budget in MiB.", 512 );
+  NEKO_DECLARE_CONVAR( tex_uploadcap, "Texture upload cap per frame in KiB. One upload always goes through.", 4096 );
+
+  TextureStreamer::TextureStreamer( Renderer* renderer ): renderer_( renderer )
+  {
+    assert( renderer_ );
+  }
+
+  bool TextureStreamer::streamable( const Material& mat, const Pixmap& image )
+  {
+    return ( mat.arrayDepth_ == 1 && !mat.arrayTexture_ && mat.wantFiltering_ == Texture::Mipmapped &&
+             c_pixelFormatData.at( image.format() ).bytes == c_pixelFormatData.at( image.format() ).components );
+  }
+
+  Real TextureStreamer::pixelsPerUnit( const Camera& camera, const vec3& position, Real viewportHeight )
+  {
+    // Works for both projections: w is the view depth for perspective, one for orthographic
+    const auto& projection = camera.frustum().projection();
+    const auto clip = projection * camera.view() * vec4( position, 1.0f );
+    return projection[1][1] * 0.5f * viewportHeight / math::max( math::abs( clip.w ), 0.0001f );
+  }
+
+  size_t TextureStreamer::levelBytes( const Pixmap& image )
+  {
+    return static_cast<size_t>( image.width() ) * image.height() * c_pixelFormatData.at( image.format() ).bytes;
+  }
+
+  size_t TextureStreamer::uploadWhole( Material& mat )
+  {
+    size_t bytes = 0;
+    for ( auto& layer : mat.layers_ )
+    {
+      assert( layer.hasHostCopy() );
+      if ( !layer.compressed_.empty() )
+      {
+        layer.texture_ = make_shared<Texture>( renderer_, layer.compressed_, mat.wantWrapping_, mat.wantFiltering_ );
+        bytes += layer.compressed_.size();
+        layer.deleteHostCopy();
+        continue;
+      }
+      if ( mat.arrayDepth_ == 1 && !mat.arrayTexture_ )
+      {
+        layer.texture_ = make_shared<Texture>( renderer_, layer.image_.width(), layer.image_.height(),
+          layer.image_.format(), layer.image_.data().data(), mat.wantWrapping_, mat.wantFiltering_ );
+      }
+      else
+      {
+        layer.texture_ = make_shared<Texture>( renderer_, mat.width_, mat.height_, mat.arrayDepth_,
+          layer.image_.format(), layer.image_.data().data(), mat.wantWrapping_, mat.wantFiltering_ );
+      }
+      bytes += layer.image_.data().size();
+      layer.deleteHostCopy();
+    }
+    return bytes;
+  }
+
+  size_t TextureStreamer::resize( Entry& entry, int level )
+  {
+    auto& mat = *entry.material;
+    auto& layer = mat.layers_[entry.layer];
+    const auto& top = layer.level( level );
+    auto texture = make_shared<Texture>(
+      renderer_, top.width(), top.height(), top.format(), entry.levels - level, mat.wantWrapping_, mat.wantFiltering_ );
+
+    size_t uploaded = 0;
+    entry.bytes = 0;
+    for ( int i = level; i < entry.levels; ++i )
+    {
+      const auto& image = layer.level( i );
+      if ( layer.texture_ && i >= entry.resident )
+      {
+        glCopyImageSubData( layer.texture_->handle(), GL_TEXTURE_2D, i - entry.resident, 0, 0, 0,
+          texture->handle(), GL_TEXTURE_2D, i - level, 0, 0, 0, image.width(), image.height(), 1 );
+      }
+      else
+      {
+        texture->writeLevel( i - level, image.data().data() );
+        uploaded += levelBytes( image );
+      }
+      entry.bytes += levelBytes( image );
+    }
+
+    layer.texture_ = move( texture );
+    entry.resident = level;
+    return uploaded;
+  }
+
+  size_t TextureStreamer::prime( const MaterialPtr& mat, size_t layer )
+  {
+    Entry entry;
+    entry.material = mat;
+    entry.layer = layer;
+    entry.levels = mat->layers_[layer].levels();
+    while ( entry.tail < entry.levels - 1 )
+    {
+      const auto& image = mat->layers_[layer].level( entry.tail );
+      if ( image.width() <= c_tailSize && image.height() <= c_tailSize )
+        break;
+      entry.tail++;
+    }
+    entry.resident = entry.levels;
+    entry.wanted = entry.tail;
+    const auto uploaded = resize( entry, entry.tail );
+    entries_.push_back( move( entry ) );
+    return uploaded;
+  }
+
+  void TextureStreamer::add( const MaterialVector& materials )
+  {
+    for ( const auto& mat : materials )
+    {
+      if ( !mat->loaded() )
+        continue;
+      bool stream = g_CVar_tex_streaming.as_b() && !mat->layers_.empty();
+      for ( const auto& layer : mat->layers_ )
+        stream = ( stream && !layer.mips_.empty() );
+      if ( !stream )
+      {
+        queue_.push_back( mat );
+        continue;
+      }
+      for ( size_t i = 0; i < mat->layers_.size(); ++i )
+        primed_ += prime( mat, i );
+    }
+  }
+
+  void TextureStreamer::noteUsage( const Material& mat, Real density )
+  {
+    if ( mat.lastUseFrame_ != frame_ )
+    {
+      mat.lastUseFrame_ = frame_;
+      mat.finestDensity_ = density;
+    }
+    else
+      mat.finestDensity_ = math::min( mat.finestDensity_, density );
+  }
+
+  void TextureStreamer::update()
+  {
+    NEKO_PROFILE_FUNCTION();
+
+    const auto budget = static_cast<size_t>( math::max( g_CVar_tex_budget.as_i(), 1 ) ) * 1024 * 1024;
+    const auto cap = static_cast<size_t>( math::max( g_CVar_tex_uploadcap.as_i(), 1 ) ) * 1024;
+    auto uploaded = primed_; // Priming since the last update counts against this frame
+    primed_ = 0;
+
+    // Whole uploads first, since nothing of them is drawable before
+    while ( !queue_.empty() && uploaded < cap )
+    {
+      uploaded += uploadWhole( *queue_.front() );
+      queue_.pop_front();
+    }
+
+    // Drop textures nobody else references anymore
+    entries_.erase( std::remove_if( entries_.begin(), entries_.end(),
+      []( const Entry& e ) { return e.material.use_count() == 1; } ), entries_.end() );
+
+    size_t resident = 0;
+    for ( auto& entry : entries_ )
+    {
+      const auto& mat = *entry.material;
+      if ( mat.lastUseFrame_ == frame_ )
+      {
+        const auto level = ( mat.finestDensity_ > 1.0f ? static_cast<int>( std::log2( mat.finestDensity_ ) ) : 0 );
+        entry.wanted = math::min( level, entry.tail );
+      }
+      else if ( frame_ - mat.lastUseFrame_ > c_idleFrames )
+        entry.wanted = entry.tail;
+      resident += entry.bytes;
+    }
+
+    // Over budget: take the finest levels from textures that have more than they want, then the least recently used
+    if ( resident > budget )
+    {
+      vector<Entry*> victims;
+      for ( auto& entry : entries_ )
+        if ( entry.resident < entry.tail )
+          victims.push_back( &entry );
+      std::sort( victims.begin(), victims.end(), []( const Entry* a, const Entry* b ) {
+        const bool aexcess = ( a->resident < a->wanted );
+        const bool bexcess = ( b->resident < b->wanted );
+        if ( aexcess != bexcess )
+          return aexcess;
+        return ( a->material->lastUseFrame_ < b->material->lastUseFrame_ );
+      } );
+      for ( auto victim : victims )
+      {
+        if ( resident <= budget )
+          break;
+        auto level = victim->resident;
+        auto freed = size_t( 0 );
+        while ( level < victim->tail && resident - freed > budget )
+          freed += levelBytes( victim->material->layers_[victim->layer].level( level++ ) );
+        resident -= victim->bytes;
+        resize( *victim, level );
+        resident += victim->bytes;
+        stats_.evictions++;
+      }
+    }
+
+    // Levels beyond what a texture wants only stay while the budget has room for them. When a raise doesn't fit,
+    // they go, least recently used first, so a full budget doesn't keep newly visible textures at their tail.
+    vector<Entry*> excess;
+    for ( auto& entry : entries_ )
+      if ( entry.resident < entry.wanted )
+        excess.push_back( &entry );
+    std::sort( excess.begin(), excess.end(), []( const Entry* a, const Entry* b ) {
+      return ( a->material->lastUseFrame_ < b->material->lastUseFrame_ );
+    } );
+    size_t nextExcess = 0;
+    const auto reclaim = [&]( size_t needed ) {
+      while ( resident + needed > budget && nextExcess < excess.size() )
+      {
+        auto victim = excess[nextExcess++];
+        resident -= victim->bytes;
+        resize( *victim, victim->wanted );
+        resident += victim->bytes;
+        stats_.evictions++;
+      }
+      return ( resident + needed <= budget );
+    };
+
+    // Under budget: add wanted levels, most recently used first, as far as the upload cap allows
+    vector<Entry*> raises;
+    for ( auto& entry : entries_ )
+      if ( entry.wanted < entry.resident )
+        raises.push_back( &entry );
+    std::sort( raises.begin(), raises.end(), []( const Entry* a, const Entry* b ) {
+      if ( a->material->lastUseFrame_ != b->material->lastUseFrame_ )
+        return ( a->material->lastUseFrame_ > b->material->lastUseFrame_ );
+      return ( a->resident - a->wanted > b->resident - b->wanted );
+    } );
+    for ( auto entry : raises )
+    {
+      if ( uploaded >= cap )
+        break;
+      auto level = entry->resident;
+      size_t added = 0;
+      while ( level > entry->wanted )
+      {
+        const auto bytes = levelBytes( entry->material->layers_[entry->layer].level( level - 1 ) );
+        if ( uploaded + added > 0 && uploaded + added + bytes > cap )
+          break;
+        if ( resident + added + bytes > budget && !reclaim( added + bytes ) )
+          break;
+        added += bytes;
+        level--;
+      }
+      if ( level == entry->resident )
+        continue;
+      resident -= entry->bytes;
+      uploaded += resize( *entry, level );
+      resident += entry->bytes;
+    }
+
+    stats_.resident = resident;
+    stats_.budget = budget;
+    stats_.uploaded = uploaded;
+    stats_.streamed = entries_.size();
+    stats_.queued = queue_.size();
+    frame_++;
+  }
+
+  TextureStreamer::~TextureStreamer()
+  {
+    entries_.clear();
+    queue_.clear();
+  }
+
+}
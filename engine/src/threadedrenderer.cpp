@@ -9,6 +9,7 @@
 #include "console.h"
 #include "messaging.h"
 #include "gui.h"
+#include "profiler.h"
 #include "neko_types.h"
 
 namespace neko {
@@ -28,7 +29,6 @@ namespace neko {
   {
     gfx_ = make_shared<Gfx>( loader_, fonts_, messaging_, director_, console_ );
     gfx_->postInitialize( *engine_.get() );
-    lastTime_ = 0.0;
     lastRealTime_ = 0.0;
   }
 
@@ -58,6 +58,8 @@ namespace neko {
         continue;
       }
 
+      NEKO_PROFILE_SCOPE( "Render frame" );
+
       gfx_->logicLock_.lock();
 
       gfx_->preUpdate();
@@ -67,14 +69,10 @@ namespace neko {
 
       gfx_->processEvents( *engine_, discardMouse, discardKeyboard );
 
-      auto time = engine_->sync().gameTime.load();
-      auto delta = ( time - lastTime_ );
-      lastTime_ = time;
-
-      gfx_->update( time, delta, *engine_ );
+      gfx_->update( *engine_ );
 
       auto rt = engine_->sync().realTime.load();
-      delta = ( rt - lastRealTime_ );
+      auto delta = ( rt - lastRealTime_ );
       lastRealTime_ = rt;
 
       gfx_->updateRealTime( rt, delta, *engine_ );
@@ -90,6 +88,7 @@ namespace neko {
   bool ThreadedRenderer::threadProc( platform::Event& running, platform::Event& wantStop, void* argument )
   {
     platform::performanceInitializeRenderThread();
+    NEKO_PROFILE_THREAD( "Render" );
 
     auto myself = ( (ThreadedRenderer*)argument )->shared_from_this();
     myself->initialize();
@@ -29,4 +29,10 @@
 // Define to disable the GUI & drop MyGUI SDK requirement.
 #define NEKO_NO_GUI
 
+// Defined to compile in the profiler's markers (CPU scopes & GPU timers); without it they compile to nothing.
+// On in debug builds only, unless NEKO_PROFILE_RELEASE is defined for capturing from release builds.
+#if defined( _DEBUG ) || defined( NEKO_PROFILE_RELEASE )
+# define NEKO_PROFILER
+#endif
+
 #define NEKO_NO_RAINET
\ No newline at end of file
@@ -119,6 +119,7 @@ namespace neko {
   using std::unordered_map;
   using std::make_shared;
   using std::shared_ptr;
+  using std::weak_ptr;
   using std::make_unique;
   using std::unique_ptr;
 